@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Times db_live_slots() against the memcmp() loop block scans used
+ *  before it, over an in memory array of student records.
+ *
+ *      ./bench_live [records] [percent live] [rounds]
+ *
+ *  Both visit every live record in blocks of SCAN_BLOCK_RECS, the way
+ *  scan_db() hands them out, and must agree on the students they saw.
+ */
+#define DEFAULT_RECS    (1 << 20)
+#define DEFAULT_LIVE    10
+#define DEFAULT_ROUNDS  20
+
+typedef long (*scan_kernel_fn)(const student_t *recs, int n);
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long scan_memcmp(const student_t *recs, int n)
+{
+    long sum = 0;
+
+    for (int first = 0; first < n; first += SCAN_BLOCK_RECS)
+    {
+        int m = n - first < SCAN_BLOCK_RECS ? n - first : SCAN_BLOCK_RECS;
+
+        for (int i = 0; i < m; i++)
+        {
+            if (memcmp(&recs[first + i], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0)
+                continue;
+            sum += 1 + recs[first + i].id;
+        }
+    }
+
+    return sum;
+}
+
+static long scan_live(const student_t *recs, int n)
+{
+    int live[SCAN_BLOCK_RECS];
+    long sum = 0;
+
+    for (int first = 0; first < n; first += SCAN_BLOCK_RECS)
+    {
+        int m = n - first < SCAN_BLOCK_RECS ? n - first : SCAN_BLOCK_RECS;
+        int nlive = db_live_slots(&recs[first], m, live);
+
+        for (int i = 0; i < nlive; i++)
+            sum += 1 + recs[first + live[i]].id;
+    }
+
+    return sum;
+}
+
+static double time_kernel(scan_kernel_fn fn, const student_t *recs, int n, int rounds, long *sum)
+{
+    double best = 0;
+
+    for (int r = 0; r < rounds; r++)
+    {
+        double t0 = now();
+
+        *sum = fn(recs, n);
+        double t = now() - t0;
+        if (r == 0 || t < best)
+            best = t;
+    }
+
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : DEFAULT_RECS;
+    int pct = argc > 2 ? atoi(argv[2]) : DEFAULT_LIVE;
+    int rounds = argc > 3 ? atoi(argv[3]) : DEFAULT_ROUNDS;
+    student_t *recs;
+    long sum_memcmp, sum_live;
+    double t_memcmp, t_live;
+    double mb;
+
+    if (n <= 0 || pct < 0 || pct > 100 || rounds <= 0)
+    {
+        printf("usage: %s [records] [percent live] [rounds]\n", argv[0]);
+        exit(1);
+    }
+
+    recs = calloc(n, sizeof(student_t));
+    if (recs == NULL)
+    {
+        printf("cant allocate %d records\n", n);
+        exit(1);
+    }
+
+    // live students are scattered, a record with only its last byte set
+    // still has to count as live
+    srand(1);
+    for (int i = 0; i < n; i++)
+    {
+        if (rand() % 100 >= pct)
+            continue;
+        if (i % 3 == 0)
+        {
+            recs[i].id = i + 1;
+            recs[i].gpa = 350;
+        }
+        else
+        {
+            recs[i].lname[sizeof(recs[i].lname) - 1] = 'x';
+        }
+    }
+
+    t_memcmp = time_kernel(scan_memcmp, recs, n, rounds, &sum_memcmp);
+    t_live = time_kernel(scan_live, recs, n, rounds, &sum_live);
+    mb = (double)n * sizeof(student_t) / (1 << 20);
+
+#if defined(__AVX2__)
+    const char *kernel = "avx2";
+#elif defined(__SSE2__)
+    const char *kernel = "sse2";
+#else
+    const char *kernel = "scalar";
+#endif
+
+    printf("%d records, %d%% live, best of %d rounds\n", n, pct, rounds);
+    printf("%-16s %9.3f ms %9.1f MB/s\n", "memcmp loop", t_memcmp * 1e3, mb / t_memcmp);
+    printf("%-16s %9.3f ms %9.1f MB/s  %.2fx\n", kernel, t_live * 1e3, mb / t_live,
+           t_memcmp / t_live);
+
+    free(recs);
+    if (sum_memcmp != sum_live)
+    {
+        printf("kernels disagree: %ld vs %ld\n", sum_memcmp, sum_live);
+        exit(1);
+    }
+
+    return 0;
+}
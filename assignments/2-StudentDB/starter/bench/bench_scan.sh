@@ -0,0 +1,76 @@
+#! /bin/bash
+#
+# Times whole-database commands of sdbsc on both engines.
+#
+#   ./bench_scan.sh [percent live] [rounds]
+#
+# bench_live times db_live_slots() on its own, but with the default mmap
+# engine and the occupancy bitmap sdbsc never calls it: -p, -e and -x
+# walk the set bits, and -c is a popcount of the bitmap on either engine.
+# This loads one database and times the commands that go through
+# scan_db() as sdbsc really runs them, once as built and once with
+# SDB_ENGINE=io, where they take the extent walk and the kernel.
+# [percent live] of the MAX_STD_ID slots hold a student.  Each time is
+# the best of [rounds] runs, process start included.
+#
+# Runs in a scratch directory, student.db next to sdbsc is not touched.
+
+pct=${1:-30}
+rounds=${2:-5}
+
+if [ "$pct" -le 0 ] || [ "$pct" -gt 100 ] || [ "$rounds" -le 0 ]; then
+    echo "usage: $0 [percent live] [rounds]"
+    exit 1
+fi
+
+sdbsc=$(cd "$(dirname "$0")/.." && pwd)/sdbsc
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+slots=$(awk '$2 == "MAX_STD_ID" { print $3 }' "$(dirname "$sdbsc")/db.h")
+students=$((slots * pct / 100))
+awk -v n="$students" -v slots="$slots" 'BEGIN {
+    srand(1)
+    while (count < n) {
+        id = int(rand() * slots) + 1
+        if (id in seen)
+            continue
+        seen[id] = 1
+        count++
+        printf "%d f%d l%d %d\n", id, id, id, id % 400 + 100
+    }
+}' > load.txt
+"$sdbsc" -b load.txt > /dev/null || exit 1
+
+# best wall clock of [rounds] runs in ms, output discarded
+best() {
+    local min=
+    for ((r = 0; r < rounds; r++)); do
+        local start end t
+        start=$(date +%s%N)
+        "$@" > /dev/null || exit 1
+        end=$(date +%s%N)
+        t=$(((end - start) / 1000))
+        if [ -z "$min" ] || [ "$t" -lt "$min" ]; then
+            min=$t
+        fi
+    done
+    printf "%d.%03d" $((min / 1000)) $((min % 1000))
+}
+
+printf "%d students, %d%% of %d slots live, best of %d runs in ms\n" \
+    "$students" "$pct" "$slots" "$rounds"
+printf "%-12s %12s %12s\n" "" "mmap+bitmap" "io (kernel)"
+for op in "-p" "-e bin" "-e csv"; do
+    printf "%-12s %12s %12s\n" "sdbsc $op" \
+        "$(best "$sdbsc" $op)" "$(SDB_ENGINE=io best "$sdbsc" $op)"
+done
+
+# both engines have to agree on what is in the database
+for op in "-c" "-p"; do
+    if [ "$("$sdbsc" $op | md5sum)" != "$(SDB_ENGINE=io "$sdbsc" $op | md5sum)" ]; then
+        echo "engines disagree on sdbsc $op"
+        exit 1
+    fi
+done
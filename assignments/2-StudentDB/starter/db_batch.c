@@ -0,0 +1,322 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#endif
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Batched record I/O
+ *
+ *  -F and -D hand a whole list of ids to get_students() and
+ *  remove_students(), which turn it into one array of db_batch_req_t, a
+ *  buffer, a length and a file offset each.  db_batch_io() runs the array:
+ *
+ *    io_uring    every request is a readv/writev SQE, the ring is filled
+ *                and submitted with one io_uring_enter() that also waits
+ *                for all of the completions.  Batches larger than
+ *                DB_BATCH_RING_ENTRIES go in ring sized rounds.
+ *    pool        without io_uring, because the headers or the kernel lack
+ *                it or it is disabled, DB_BATCH_THREADS threads take
+ *                requests off the array and pread()/pwrite() them.
+ *
+ *  io_uring is used through its system calls, there is no liburing to link
+ *  against.  SDB_BATCH_ENV=pool skips the ring.  The mmap engine does not
+ *  get here, its records are memory.
+ */
+
+#ifdef HAVE_IO_URING
+//the mapped rings of one io_uring instance
+typedef struct batch_ring {
+    int fd;
+    unsigned entries;
+    void *sq_ptr;
+    size_t sq_len;
+    void *cq_ptr;
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+} batch_ring_t;
+
+static void ring_close(batch_ring_t *ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+    if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED)
+        munmap(ring->sq_ptr, ring->sq_len);
+    if (ring->fd >= 0)
+        close(ring->fd);
+}
+
+/*
+ *  ring_open
+ *      Sets up a ring of at least entries SQEs and maps it.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE when io_uring is not available
+ */
+static int ring_open(batch_ring_t *ring, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        return ERR_DB_FILE;
+    ring->entries = p.sq_entries;
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_len > ring->sq_len)
+            ring->sq_len = ring->cq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ptr = ring->sq_ptr;
+    else
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED)
+        goto fail;
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail;
+
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+    ring->cq_head = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + p.cq_off.cqes);
+    return NO_ERROR;
+
+fail:
+    ring_close(ring);
+    return ERR_DB_FILE;
+}
+
+/*
+ *  ring_round
+ *      Queues n requests, no more than the ring holds, then submits them
+ *      and waits for all of their completions in the same
+ *      io_uring_enter().
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if io_uring_enter() failed; the
+ *            requests that made it into the kernel are still waited for,
+ *            so none of them is in flight afterwards
+ */
+static int ring_round(batch_ring_t *ring, int fd, bool write, db_batch_req_t *reqs,
+                      struct iovec *iov, int n)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned mask = *ring->sq_mask;
+    int submitted = 0;
+    int reaped = 0;
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < n; i++)
+    {
+        unsigned idx = (tail + i) & mask;
+        struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+        iov[i].iov_base = reqs[i].buf;
+        iov[i].iov_len = reqs[i].len;
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = fd;
+        sqe->off = reqs[i].off;
+        sqe->addr = (unsigned long)&iov[i];
+        sqe->len = 1;
+        sqe->user_data = i;
+        ring->sq_array[idx] = idx;
+        reqs[i].res = -ECANCELED;
+    }
+    __atomic_store_n(ring->sq_tail, tail + n, __ATOMIC_RELEASE);
+
+    while (reaped < submitted || (rc == NO_ERROR && reaped < n))
+    {
+        // after a failure only what is in flight is waited for
+        int to_submit = rc == NO_ERROR ? n - submitted : 0;
+        int ret = syscall(__NR_io_uring_enter, ring->fd, to_submit,
+                          to_submit + submitted - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (rc != NO_ERROR)
+                return rc;
+            rc = ERR_DB_FILE;
+            continue;
+        }
+        if (rc == NO_ERROR)
+            submitted += ret;
+
+        unsigned head = *ring->cq_head;
+        unsigned cq_mask = *ring->cq_mask;
+
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & cq_mask];
+
+            if (cqe->user_data < (unsigned)n)
+                reqs[cqe->user_data].res = cqe->res;
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return rc;
+}
+
+static int ring_io(int fd, bool write, db_batch_req_t *reqs, int n)
+{
+    unsigned entries = n < DB_BATCH_RING_ENTRIES ? n : DB_BATCH_RING_ENTRIES;
+    batch_ring_t ring;
+    struct iovec *iov;
+    int rc = NO_ERROR;
+
+    if (ring_open(&ring, entries) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    iov = malloc(ring.entries * sizeof(*iov));
+    if (iov == NULL)
+    {
+        ring_close(&ring);
+        return ERR_DB_FILE;
+    }
+
+    for (int first = 0; first < n && rc == NO_ERROR; first += ring.entries)
+    {
+        int m = n - first < (int)ring.entries ? n - first : (int)ring.entries;
+
+        rc = ring_round(&ring, fd, write, &reqs[first], iov, m);
+    }
+
+    free(iov);
+    ring_close(&ring);
+    return rc;
+}
+#endif
+
+//the requests the pool threads share, next is the first one not taken
+typedef struct batch_pool {
+    int fd;
+    bool write;
+    db_batch_req_t *reqs;
+    int n;
+    int next;
+} batch_pool_t;
+
+static void *pool_worker(void *arg)
+{
+    batch_pool_t *pool = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->n)
+    {
+        db_batch_req_t *req = &pool->reqs[i];
+        ssize_t res;
+
+        do
+        {
+            if (pool->write)
+                res = pwrite(pool->fd, req->buf, req->len, req->off);
+            else
+                res = pread(pool->fd, req->buf, req->len, req->off);
+        } while (res < 0 && errno == EINTR);
+
+        req->res = res < 0 ? -errno : res;
+    }
+
+    return NULL;
+}
+
+static int pool_io(int fd, bool write, db_batch_req_t *reqs, int n)
+{
+    batch_pool_t pool = {.fd = fd, .write = write, .reqs = reqs, .n = n, .next = 0};
+    pthread_t threads[DB_BATCH_THREADS];
+    int nthreads = 0;
+
+    // the calling thread works too, so a failed pthread_create() only
+    // makes the pool smaller
+    for (int t = 1; t < DB_BATCH_THREADS && t < n; t++)
+    {
+        if (pthread_create(&threads[nthreads], NULL, pool_worker, &pool) != 0)
+            break;
+        nthreads++;
+    }
+    pool_worker(&pool);
+
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(threads[t], NULL);
+
+    return NO_ERROR;
+}
+
+/*
+ *  db_batch_io
+ *      fd:     database file descriptor
+ *      write:  true to write the buffers, false to read into them
+ *      reqs:   n requests, res is set to the bytes transferred or -errno
+ *
+ *  The requests run concurrently and in no particular order, none of them
+ *  may overlap a request that writes.
+ *
+ *  returns:  NO_ERROR once every request has a result, or ERR_DB_FILE
+ */
+int db_batch_io(int fd, bool write, db_batch_req_t *reqs, int n)
+{
+    const char *mode = getenv(SDB_BATCH_ENV);
+
+    if (n <= 0)
+        return NO_ERROR;
+
+#ifdef HAVE_IO_URING
+    if (mode == NULL || strcmp(mode, "pool") != 0)
+    {
+        if (ring_io(fd, write, reqs, n) == NO_ERROR)
+            return NO_ERROR;
+        // a ring that is gone or broke part way, the pool redoes all of it
+    }
+#else
+    (void)mode;
+#endif
+
+    return pool_io(fd, write, reqs, n);
+}
@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Occupancy bitmap
+ *
+ *  One bit per possible student id (MAX_STD_ID+1 bits, about 12.5KB) kept
+ *  in a file next to the database (dbFile + DB_BMP_SUFFIX) and mapped
+ *  MAP_SHARED.  put_record() and bulk_load() keep it in sync, so an
+ *  existence check is a bit test, a count is a popcount and scans can jump
+ *  from one set bit to the next with __builtin_ctzll().
+ *
+ *  It is a sidecar (see db_side.c), so a bitmap that belongs to a
+ *  compacted (renamed) database or was left behind by a crash mid update is
+ *  rebuilt with one scan_db().
+ */
+#define BMP_WORDS       ((MAX_STD_ID + 1 + 63) / 64)
+#define BMP_FILE_LEN    (sizeof(db_side_hdr_t) + BMP_WORDS * sizeof(uint64_t))
+
+static db_bmp_t g_db_bmp = {.fd = -1};
+
+static int rebuild_bit(const student_t *s, void *arg)
+{
+    uint64_t *words = arg;
+
+    if (s->id >= MIN_STD_ID && s->id <= MAX_STD_ID)
+        words[s->id >> 6] |= 1ULL << (s->id & 63);
+    return NO_ERROR;
+}
+
+static int bmp_rebuild(int fd, db_side_hdr_t *hdr, uint64_t *words, struct stat *st)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memset(words, 0, BMP_WORDS * sizeof(uint64_t));
+
+    if (scan_db(fd, rebuild_bit, words) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    db_side_stamp(hdr, DB_BMP_MAGIC, DB_BMP_VERSION, st);
+    return NO_ERROR;
+}
+
+/*
+ *  db_bmp_open
+ *      fd:      database file descriptor
+ *      dbFile:  name of the database, used to find the bitmap
+ *      reset:   the database was just truncated, clear every bit
+ *
+ *  Maps the bitmap of fd, creating or rebuilding it when needed.  The
+ *  database works without a bitmap, so any failure just leaves fd without
+ *  one.
+ *
+ *  returns:  NO_ERROR if fd has a bitmap, ERR_DB_FILE otherwise
+ */
+int db_bmp_open(int fd, const char *dbFile, bool reset)
+{
+    char path[PATH_MAX];
+    struct stat db_st;
+    void *base;
+    size_t len;
+
+    if (g_db_bmp.fd >= 0 || fstat(fd, &db_st) < 0)
+        return ERR_DB_FILE;
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, DB_BMP_SUFFIX);
+    if (db_side_map(path, BMP_FILE_LEN, &base, &len) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    db_side_hdr_t *hdr = base;
+    uint64_t *words = (uint64_t *)(hdr + 1);
+
+    if (len != BMP_FILE_LEN || reset ||
+        !db_side_valid(hdr, DB_BMP_MAGIC, DB_BMP_VERSION, &db_st))
+    {
+        if (len != BMP_FILE_LEN || bmp_rebuild(fd, hdr, words, &db_st) != NO_ERROR)
+        {
+            munmap(base, len);
+            return ERR_DB_FILE;
+        }
+    }
+
+    g_db_bmp.fd = fd;
+    g_db_bmp.hdr = hdr;
+    g_db_bmp.words = words;
+    return NO_ERROR;
+}
+
+void db_bmp_close(int fd)
+{
+    if (fd < 0 || g_db_bmp.fd != fd)
+        return;
+
+    munmap(g_db_bmp.hdr, BMP_FILE_LEN);
+    g_db_bmp.fd = -1;
+    g_db_bmp.hdr = NULL;
+    g_db_bmp.words = NULL;
+}
+
+/*
+ *  db_bmp_find
+ *      returns:  the bitmap of fd, or NULL if fd has none
+ */
+db_bmp_t *db_bmp_find(int fd)
+{
+    if (fd < 0 || g_db_bmp.fd != fd)
+        return NULL;
+
+    return &g_db_bmp;
+}
+
+bool db_bmp_test(db_bmp_t *bmp, int id)
+{
+    if (id < MIN_STD_ID || id > MAX_STD_ID)
+        return false;
+
+    return (__atomic_load_n(&bmp->words[id >> 6], __ATOMIC_RELAXED) >> (id & 63)) & 1;
+}
+
+void db_bmp_set(db_bmp_t *bmp, int id, bool live)
+{
+    uint64_t bit;
+
+    if (id < MIN_STD_ID || id > MAX_STD_ID)
+        return;
+
+    bit = 1ULL << (id & 63);
+    if (live)
+        __atomic_or_fetch(&bmp->words[id >> 6], bit, __ATOMIC_RELAXED);
+    else
+        __atomic_and_fetch(&bmp->words[id >> 6], ~bit, __ATOMIC_RELAXED);
+}
+
+/*
+ *  db_bmp_count
+ *      returns:  the number of students in the database
+ */
+int db_bmp_count(db_bmp_t *bmp)
+{
+    int count = 0;
+
+    for (int i = 0; i < BMP_WORDS; i++)
+        count += __builtin_popcountll(bmp->words[i]);
+
+    return count;
+}
+
+/*
+ *  db_bmp_next
+ *      from:  first id to consider
+ *
+ *  returns:  the smallest id >= from that is in the database, or -1
+ */
+int db_bmp_next(db_bmp_t *bmp, int from)
+{
+    int i;
+    uint64_t word;
+
+    if (from < 0)
+        from = 0;
+    if (from > MAX_STD_ID)
+        return -1;
+
+    i = from >> 6;
+    word = bmp->words[i] & (~0ULL << (from & 63));
+    while (word == 0)
+    {
+        if (++i >= BMP_WORDS)
+            return -1;
+        word = bmp->words[i];
+    }
+
+    return (i << 6) + __builtin_ctzll(word);
+}
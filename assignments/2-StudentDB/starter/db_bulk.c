@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Bulk loading
+ *
+ *  testload.sh starts one sdbsc per student, each paying for process
+ *  startup, open_db() and a duplicate check.  bulk_load() reads every
+ *  student from one input, sorts them by id and writes runs of consecutive
+ *  ids with one pwritev() per run (IOV_MAX records at most).  A packed
+ *  database takes all of them as a single run at its end.  Only pointers
+ *  are sorted, pwritev() gathers the 64 byte records from where they were
+ *  parsed.
+ */
+#define BULK_SEPARATORS " \t,\r\n"
+#define BULK_SKIP       1
+
+typedef struct bulk_set {
+    student_t *recs;
+    student_t **order;
+    int num;
+    int cap;
+} bulk_set_t;
+
+static int cmp_student_id(const void *a, const void *b)
+{
+    const student_t *sa = *(student_t *const *)a;
+    const student_t *sb = *(student_t *const *)b;
+
+    // equal ids keep their input order, the first one is loaded
+    if (sa->id != sb->id)
+        return (sa->id > sb->id) - (sa->id < sb->id);
+    return (sa > sb) - (sa < sb);
+}
+
+/*
+ *  parse_line
+ *      line:  "id first_name last_name gpa", comma or blank separated
+ *      s:     filled in on success
+ *
+ *  returns:  NO_ERROR, BULK_SKIP for blank and # comment lines, or
+ *            EXIT_FAIL_ARGS if the line is malformed or out of range
+ */
+static int parse_line(char *line, student_t *s)
+{
+    char *save;
+    char *fields[4];
+    char *end;
+    long id;
+    int n = 0;
+
+    char *tok = strtok_r(line, BULK_SEPARATORS, &save);
+    if (tok == NULL || *tok == '#')
+        return BULK_SKIP;
+
+    while (tok != NULL && n < 4)
+    {
+        fields[n++] = tok;
+        tok = strtok_r(NULL, BULK_SEPARATORS, &save);
+    }
+    if (n != 4 || tok != NULL)
+        return EXIT_FAIL_ARGS;
+
+    errno = 0;
+    id = strtol(fields[0], &end, 10);
+    if (errno != 0 || *end != '\0' || id > INT_MAX || id < INT_MIN)
+        return EXIT_FAIL_ARGS;
+
+    // same conversion as -a, see main()
+    memset(s, 0, STUDENT_RECORD_SIZE);
+    s->id = (int)id;
+    s->gpa = atoi(fields[3]);
+    if (validate_range(s->id, s->gpa) != NO_ERROR)
+        return EXIT_FAIL_ARGS;
+
+    strncpy(s->fname, fields[1], sizeof(s->fname) - 1);
+    strncpy(s->lname, fields[2], sizeof(s->lname) - 1);
+    return NO_ERROR;
+}
+
+static int read_input(FILE *in, bulk_set_t *set, int *rejected)
+{
+    char *line = NULL;
+    size_t line_cap = 0;
+    int line_no = 0;
+    int rc;
+
+    while (getline(&line, &line_cap, in) != -1)
+    {
+        line_no++;
+
+        if (set->num == set->cap)
+        {
+            int cap = set->cap ? set->cap * 2 : 1024;
+            student_t *recs = realloc(set->recs, (size_t)cap * sizeof(student_t));
+            if (recs == NULL)
+            {
+                free(line);
+                return ERR_DB_OP;
+            }
+            set->recs = recs;
+            set->cap = cap;
+        }
+
+        rc = parse_line(line, &set->recs[set->num]);
+        if (rc == NO_ERROR)
+        {
+            set->num++;
+        }
+        else if (rc != BULK_SKIP)
+        {
+            printf(M_ERR_BULK_LINE, line_no);
+            (*rejected)++;
+        }
+    }
+
+    free(line);
+    return ferror(in) ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  write_run
+ *      Writes order[0..n) into n consecutive slots starting at slot.
+ */
+static int write_run(int fd, student_t **order, int n, int slot)
+{
+    struct iovec iov[IOV_MAX];
+    off_t offset = (off_t)slot * STUDENT_RECORD_SIZE;
+
+    while (n > 0)
+    {
+        int batch = n < IOV_MAX ? n : IOV_MAX;
+        ssize_t want = (ssize_t)batch * STUDENT_RECORD_SIZE;
+
+        for (int i = 0; i < batch; i++)
+        {
+            iov[i].iov_base = order[i];
+            iov[i].iov_len = STUDENT_RECORD_SIZE;
+        }
+
+        ssize_t io_size = pwritev(fd, iov, batch, offset);
+        if (io_size < 0 && errno == EINTR)
+            continue;
+        if (io_size != want)
+            return ERR_DB_FILE;
+
+        order += batch;
+        offset += want;
+        n -= batch;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  bulk_load
+ *      fd:    database file descriptor
+ *      path:  file to load, "-" for stdin
+ *
+ *  Adds one student per input line, "id first_name last_name gpa" with
+ *  the fields separated by blanks or commas.  Blank lines and lines
+ *  starting with # are ignored.  Lines that do not parse, fail
+ *  validate_range(), or whose id is already in the database or earlier
+ *  in the input are reported and skipped, the rest are still loaded.  The
+ *  whole load holds the database lock, other processes wait for it.
+ *
+ *  returns:  <number>     the number of students that were skipped
+ *            ERR_DB_FILE  database or input file I/O issue
+ *            ERR_DB_OP    out of memory
+ *
+ *  console:  M_BULK_DONE on success
+ *            M_ERR_BULK_LINE, M_ERR_DB_ADD_DUP for every skipped student
+ *            M_ERR_DB_OPEN, M_ERR_DB_READ, M_ERR_DB_WRITE on error
+ */
+int bulk_load(int fd, char *path)
+{
+    bulk_set_t set = {0};
+    db_bmp_t *bmp;
+    db_names_t *names;
+    db_col_t *col;
+    db_wal_t *wal = NULL;
+    struct timespec t0, t1;
+    FILE *in = stdin;
+    student_t existing;
+    int rejected = 0;
+    int added = 0;
+    bool locked = false;
+    int rc;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    if (strcmp(path, "-") != 0)
+    {
+        in = fopen(path, "r");
+        if (in == NULL)
+        {
+            printf(M_ERR_DB_OPEN);
+            return ERR_DB_FILE;
+        }
+    }
+
+    rc = read_input(in, &set, &rejected);
+    if (in != stdin)
+        fclose(in);
+    if (rc != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        goto out;
+    }
+
+    set.order = malloc((size_t)(set.num ? set.num : 1) * sizeof(student_t *));
+    if (set.order == NULL)
+    {
+        rc = ERR_DB_OP;
+        goto out;
+    }
+
+    if (db_lock_all(fd, DB_LOCK_EX) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        rc = ERR_DB_FILE;
+        goto out;
+    }
+    locked = true;
+
+    // drop duplicates, order is compacted in place to the students to write
+    int keep = 0;
+    for (int i = 0; i < set.num; i++)
+        set.order[i] = &set.recs[i];
+    qsort(set.order, set.num, sizeof(student_t *), cmp_student_id);
+
+    for (int i = 0; i < set.num; i++)
+    {
+        student_t *s = set.order[i];
+
+        if (keep > 0 && set.order[keep - 1]->id == s->id)
+            rc = NO_ERROR;
+        else
+            rc = get_student(fd, s->id, &existing);
+
+        if (rc == ERR_DB_FILE)
+        {
+            printf(M_ERR_DB_READ);
+            goto out;
+        }
+        if (rc == NO_ERROR)
+        {
+            printf(M_ERR_DB_ADD_DUP, s->id);
+            rejected++;
+            continue;
+        }
+        set.order[keep++] = s;
+    }
+
+    // with a write-ahead log the whole batch is logged and synced up front
+    if (keep > 0)
+        wal = db_wal_find(fd);
+    if (wal != NULL)
+    {
+        if (db_wal_begin(wal) != NO_ERROR)
+        {
+            wal = NULL;
+            rc = ERR_DB_FILE;
+        }
+        else
+        {
+            rc = db_wal_log_batch(wal, NULL, set.order, keep);
+        }
+        if (rc != NO_ERROR)
+        {
+            printf(M_ERR_DB_WRITE);
+            goto out;
+        }
+    }
+
+    // bits are set as runs land.  If a write fails the writer count is
+    // left raised on purpose, the next open then rebuilds the bitmap.
+    bmp = db_bmp_find(fd);
+    if (bmp != NULL)
+        db_side_begin(bmp->hdr);
+
+    // a packed database appends everything as one run
+    db_pack_t *pack = db_pack_find(fd);
+    if (pack != NULL && keep > 0)
+    {
+        int slot = db_pack_next_slot(pack);
+
+        db_side_begin(pack->hdr);
+        if (slot < 0 || write_run(fd, set.order, keep, slot) != NO_ERROR)
+        {
+            printf(M_ERR_DB_WRITE);
+            rc = ERR_DB_FILE;
+            goto out;
+        }
+        for (int i = 0; i < keep; i++)
+        {
+            db_pack_set(pack, set.order[i]->id, slot + i);
+            if (bmp != NULL)
+                db_bmp_set(bmp, set.order[i]->id, true);
+        }
+        db_side_end(pack->hdr);
+        added = keep;
+        keep = 0;
+    }
+
+    // one pwritev() per run of consecutive ids
+    for (int i = 0; i < keep;)
+    {
+        int n = 1;
+
+        while (i + n < keep && set.order[i + n]->id == set.order[i]->id + n)
+            n++;
+
+        rc = write_run(fd, &set.order[i], n, set.order[i]->id);
+        if (rc != NO_ERROR)
+        {
+            printf(M_ERR_DB_WRITE);
+            goto out;
+        }
+        for (int j = 0; bmp != NULL && j < n; j++)
+            db_bmp_set(bmp, set.order[i + j]->id, true);
+        added += n;
+        i += n;
+    }
+
+    if (bmp != NULL)
+        db_side_end(bmp->hdr);
+
+    // all students are in, add their names as one merge and their columns
+    names = db_names_find(fd);
+    if (names != NULL && added > 0)
+    {
+        db_side_begin(names->hdr);
+        if (db_names_merge(names, set.order, added) == NO_ERROR)
+            db_side_end(names->hdr);
+    }
+
+    col = db_col_find(fd);
+    if (col != NULL && added > 0)
+    {
+        bool col_ok = true;
+
+        db_side_begin(col->hdr);
+        for (int i = 0; i < added && col_ok; i++)
+            col_ok = db_col_add(col, set.order[i]->id, set.order[i]->gpa) == NO_ERROR;
+        if (col_ok)
+            db_side_end(col->hdr);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf(M_BULK_DONE, added, rejected, secs, secs > 0 ? added / secs : 0.0);
+    rc = rejected;
+
+out:
+    if (wal != NULL)
+        db_wal_end(wal, rc >= 0);
+    if (locked)
+        db_lock_all(fd, DB_LOCK_UN);
+    free(set.order);
+    free(set.recs);
+    return rc;
+}
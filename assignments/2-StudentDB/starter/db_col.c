@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Columnar shadow
+ *
+ *  A gpa is 4 of the 64 bytes of a student_t, so an average over the row
+ *  store reads 16 times the bytes it needs.  This sidecar
+ *  (dbFile + DB_COL_SUFFIX) keeps the id and gpa of every student in two
+ *  packed int arrays, in no particular order: adds append, deletes move
+ *  the last student into the hole.  A third array, indexed by id, holds
+ *  the position of every student in the other two, so a delete finds its
+ *  row without searching the id column.  The arrays are sized for every
+ *  possible id up front, what is never written stays a file hole.
+ *
+ *  aggregate_db() reduces the gpa column four lanes at a time with SSE2.
+ *  Without the sidecar it collects the column with one scan_db() first.
+ */
+#define COL_CAP         (MAX_STD_ID + 1)
+#define COL_FILE_LEN    (sizeof(db_side_hdr_t) + 3 * (size_t)COL_CAP * sizeof(int))
+
+static db_col_t g_db_col = {.fd = -1};
+
+static int collect_col(const student_t *s, void *arg)
+{
+    db_col_t *col = arg;
+
+    if (col->hdr->count >= COL_CAP || s->id < MIN_STD_ID || s->id > MAX_STD_ID)
+        return ERR_DB_FILE;
+
+    col->ids[col->hdr->count] = s->id;
+    col->gpas[col->hdr->count] = s->gpa;
+    col->hdr->count++;
+    col->rows[s->id] = (int)col->hdr->count;
+    return NO_ERROR;
+}
+
+static int col_rebuild(int fd, db_col_t *col, struct stat *st)
+{
+    memset(col->hdr, 0, sizeof(db_side_hdr_t));
+    memset(col->rows, 0, (size_t)COL_CAP * sizeof(int));
+    col->hdr->cap = COL_CAP;
+
+    if (scan_db(fd, collect_col, col) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    db_side_stamp(col->hdr, DB_COL_MAGIC, DB_COL_VERSION, st);
+    return NO_ERROR;
+}
+
+/*
+ *  db_col_open
+ *      fd:      database file descriptor
+ *      dbFile:  name of the database, used to find the columns
+ *      reset:   the database was just truncated, drop every student
+ *
+ *  returns:  NO_ERROR if fd has columns, ERR_DB_FILE otherwise.  The
+ *            aggregates fall back to a scan without them.
+ */
+int db_col_open(int fd, const char *dbFile, bool reset)
+{
+    char path[PATH_MAX];
+    struct stat db_st;
+    void *base;
+    size_t len;
+
+    if (g_db_col.fd >= 0 || fstat(fd, &db_st) < 0)
+        return ERR_DB_FILE;
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, DB_COL_SUFFIX);
+    if (db_side_map(path, COL_FILE_LEN, &base, &len) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (len != COL_FILE_LEN)
+    {
+        munmap(base, len);
+        return ERR_DB_FILE;
+    }
+
+    g_db_col.hdr = base;
+    g_db_col.ids = (int *)(g_db_col.hdr + 1);
+    g_db_col.gpas = g_db_col.ids + COL_CAP;
+    g_db_col.rows = g_db_col.gpas + COL_CAP;
+
+    if (reset || !db_side_valid(g_db_col.hdr, DB_COL_MAGIC, DB_COL_VERSION, &db_st) ||
+        g_db_col.hdr->count > COL_CAP)
+    {
+        if (col_rebuild(fd, &g_db_col, &db_st) != NO_ERROR)
+        {
+            munmap(base, len);
+            g_db_col.hdr = NULL;
+            return ERR_DB_FILE;
+        }
+    }
+
+    g_db_col.fd = fd;
+    return NO_ERROR;
+}
+
+void db_col_close(int fd)
+{
+    if (fd < 0 || g_db_col.fd != fd)
+        return;
+
+    munmap(g_db_col.hdr, COL_FILE_LEN);
+    g_db_col.fd = -1;
+    g_db_col.hdr = NULL;
+    g_db_col.ids = NULL;
+    g_db_col.gpas = NULL;
+    g_db_col.rows = NULL;
+}
+
+/*
+ *  db_col_find
+ *      returns:  the columns of fd, or NULL if fd has none
+ */
+db_col_t *db_col_find(int fd)
+{
+    if (fd < 0 || g_db_col.fd != fd)
+        return NULL;
+
+    return &g_db_col;
+}
+
+/*
+ *  col_position
+ *      returns:  the position of id in the id column, or -1
+ */
+static long col_position(db_col_t *col, int id)
+{
+    long pos;
+
+    if (id < MIN_STD_ID || id > MAX_STD_ID)
+        return -1;
+
+    pos = (long)col->rows[id] - 1;
+    if (pos < 0 || (size_t)pos >= col->hdr->count || col->ids[pos] != id)
+        return -1;
+
+    return pos;
+}
+
+/*
+ *  db_col_add
+ *      Appends id, or changes its gpa if it is already in the columns.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if id is out of range
+ */
+int db_col_add(db_col_t *col, int id, int gpa)
+{
+    long pos = col_position(col, id);
+    size_t n = col->hdr->count;
+
+    if (pos >= 0)
+    {
+        col->gpas[pos] = gpa;
+        return NO_ERROR;
+    }
+    if (id < MIN_STD_ID || id > MAX_STD_ID || n >= COL_CAP)
+        return ERR_DB_FILE;
+
+    col->ids[n] = id;
+    col->gpas[n] = gpa;
+    col->rows[id] = (int)n + 1;
+    col->hdr->count = n + 1;
+    return NO_ERROR;
+}
+
+void db_col_remove(db_col_t *col, int id)
+{
+    long pos = col_position(col, id);
+    size_t last;
+
+    if (pos < 0)
+        return;
+
+    last = col->hdr->count - 1;
+    col->ids[pos] = col->ids[last];
+    col->gpas[pos] = col->gpas[last];
+    col->rows[col->ids[pos]] = (int)pos + 1;
+    col->rows[id] = 0;
+    col->hdr->count = last;
+}
+
+/*
+ *  db_gpa_stats
+ *      gpas:   n gpas, as stored (350 is 3.50)
+ *      stats:  filled in, min and max are 0 when n is 0
+ *
+ *  gpas are at most MAX_STD_GPA, so four int lanes hold the sum of any
+ *  database without overflowing.
+ */
+void db_gpa_stats(const int *gpas, size_t n, db_gpa_stats_t *stats)
+{
+    int sum = 0;
+    int min = INT_MAX;
+    int max = INT_MIN;
+    size_t i = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->count = (int)n;
+    if (n == 0)
+        return;
+
+#ifdef __SSE2__
+    if (n >= 4)
+    {
+        __m128i v_sum = _mm_setzero_si128();
+        __m128i v_min = _mm_set1_epi32(INT_MAX);
+        __m128i v_max = _mm_set1_epi32(INT_MIN);
+        int lanes[4];
+
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)&gpas[i]);
+            __m128i lt = _mm_cmplt_epi32(v, v_min);
+            __m128i gt = _mm_cmpgt_epi32(v, v_max);
+
+            v_sum = _mm_add_epi32(v_sum, v);
+            v_min = _mm_or_si128(_mm_and_si128(lt, v), _mm_andnot_si128(lt, v_min));
+            v_max = _mm_or_si128(_mm_and_si128(gt, v), _mm_andnot_si128(gt, v_max));
+        }
+
+        _mm_storeu_si128((__m128i *)lanes, v_sum);
+        sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm_storeu_si128((__m128i *)lanes, v_min);
+        for (int k = 0; k < 4; k++)
+            min = lanes[k] < min ? lanes[k] : min;
+        _mm_storeu_si128((__m128i *)lanes, v_max);
+        for (int k = 0; k < 4; k++)
+            max = lanes[k] > max ? lanes[k] : max;
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        sum += gpas[i];
+        min = gpas[i] < min ? gpas[i] : min;
+        max = gpas[i] > max ? gpas[i] : max;
+    }
+
+    // a 5.00 gpa goes into the top bucket
+    for (i = 0; i < n; i++)
+    {
+        int bucket = gpas[i] / DB_GPA_BUCKET_WIDTH;
+
+        if (bucket >= DB_GPA_BUCKETS)
+            bucket = DB_GPA_BUCKETS - 1;
+        if (bucket < 0)
+            bucket = 0;
+        stats->hist[bucket]++;
+    }
+
+    stats->sum = sum;
+    stats->min = min;
+    stats->max = max;
+}
+
+typedef struct gpa_set {
+    int *gpas;
+    size_t num;
+    size_t cap;
+} gpa_set_t;
+
+static int collect_gpa(const student_t *s, void *arg)
+{
+    gpa_set_t *set = arg;
+
+    if (set->num == set->cap)
+    {
+        size_t cap = set->cap ? set->cap * 2 : 1024;
+        int *gpas = realloc(set->gpas, cap * sizeof(int));
+        if (gpas == NULL)
+            return ERR_DB_FILE;
+        set->gpas = gpas;
+        set->cap = cap;
+    }
+
+    set->gpas[set->num++] = s->gpa;
+    return NO_ERROR;
+}
+
+/*
+ *  aggregate_db
+ *      fd:  database file descriptor
+ *
+ *  Prints the number of students, the average, lowest and highest gpa and
+ *  a histogram of the gpas in DB_GPA_BUCKET_WIDTH wide buckets.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_DB_RECORD_CNT, M_GPA_STATS and the histogram on success
+ *            M_DB_EMPTY       the database has no students
+ *            M_ERR_DB_READ    error reading the database file
+ */
+int aggregate_db(int fd)
+{
+    db_col_t *col = db_col_find(fd);
+    db_gpa_stats_t stats;
+    gpa_set_t set = {0};
+    int widest = 1;
+
+    if (col != NULL)
+    {
+        // put_record() changes the columns under the meta lock
+        if (db_lock_meta(fd, DB_LOCK_SH) != NO_ERROR)
+        {
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        db_gpa_stats(col->gpas, col->hdr->count, &stats);
+        db_lock_meta(fd, DB_LOCK_UN);
+    }
+    else
+    {
+        if (scan_db(fd, collect_gpa, &set) != NO_ERROR)
+        {
+            free(set.gpas);
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        db_gpa_stats(set.gpas, set.num, &stats);
+        free(set.gpas);
+    }
+
+    if (stats.count == 0)
+    {
+        printf(M_DB_EMPTY);
+        return NO_ERROR;
+    }
+
+    printf(M_DB_RECORD_CNT, stats.count);
+    printf(M_GPA_STATS, (double)stats.sum / stats.count / 100.0,
+           stats.min / 100.0, stats.max / 100.0);
+
+    for (int b = 0; b < DB_GPA_BUCKETS; b++)
+        widest = stats.hist[b] > widest ? stats.hist[b] : widest;
+
+    printf(GPA_HIST_HDR_STRING, "GPA", "COUNT");
+    for (int b = 0; b < DB_GPA_BUCKETS; b++)
+    {
+        int lo = b * DB_GPA_BUCKET_WIDTH;
+        int hi = b == DB_GPA_BUCKETS - 1 ? MAX_STD_GPA : lo + DB_GPA_BUCKET_WIDTH - 1;
+        // bars are scaled so the fullest bucket is GPA_HIST_BAR_MAX long
+        int bar = (int)((long)stats.hist[b] * GPA_HIST_BAR_MAX / widest);
+
+        printf(GPA_HIST_FMT_STRING, lo / 100.0, hi / 100.0, stats.hist[b], bar, GPA_HIST_BAR);
+    }
+
+    return NO_ERROR;
+}
@@ -0,0 +1,350 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Streaming export
+ *
+ *  -p formats every student with printf(), which parses the format string
+ *  and converts a float per row and is the bottleneck of printing a big
+ *  database.  export_db() writes the live students for other programs
+ *  instead, in one of three formats:
+ *
+ *    bin   the 64 byte student_t records back to back, what a packed
+ *          database holds without its header
+ *    json  one object per line, {"id":1,"fname":"john","lname":"doe","gpa":3.45}
+ *    csv   a header line, then id,fname,lname,gpa rows, names quoted when
+ *          they need it
+ *
+ *  Rows are formatted by hand straight into EXPORT_SEGS segments of
+ *  EXPORT_SEG_LEN bytes; the gpa is the integer it is stored as with a
+ *  decimal point put in, no float is involved.  A row never straddles two
+ *  segments, and once all of them are full they go out with one writev().
+ *  The students come from scan_db(), in the order -p prints them.
+ */
+
+//"00" to "99", two digits per lookup
+static const char DIGIT_PAIRS[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+static const char *FORMAT_NAMES[] = {"bin", "json", "csv"};
+
+/*
+ *  fmt_uint
+ *      returns:  p advanced past the decimal digits of v
+ */
+static char *fmt_uint(char *p, unsigned v)
+{
+    char tmp[10];
+    char *t = tmp + sizeof(tmp);
+
+    while (v >= 100)
+    {
+        unsigned pair = (v % 100) * 2;
+
+        v /= 100;
+        t -= 2;
+        memcpy(t, &DIGIT_PAIRS[pair], 2);
+    }
+    if (v >= 10)
+    {
+        t -= 2;
+        memcpy(t, &DIGIT_PAIRS[v * 2], 2);
+    }
+    else
+    {
+        *--t = '0' + v;
+    }
+
+    size_t n = tmp + sizeof(tmp) - t;
+    memcpy(p, t, n);
+    return p + n;
+}
+
+static char *fmt_int(char *p, int v)
+{
+    if (v < 0)
+    {
+        *p++ = '-';
+        return fmt_uint(p, -(unsigned)v);
+    }
+    return fmt_uint(p, v);
+}
+
+/*
+ *  fmt_gpa
+ *      returns:  p advanced past gpa / 100.0 with two decimals, 345 is
+ *                "3.45", the same digits as "%.2f"
+ */
+static char *fmt_gpa(char *p, int gpa)
+{
+    unsigned v = gpa < 0 ? -(unsigned)gpa : (unsigned)gpa;
+
+    if (gpa < 0)
+        *p++ = '-';
+    p = fmt_uint(p, v / 100);
+    *p++ = '.';
+    memcpy(p, &DIGIT_PAIRS[(v % 100) * 2], 2);
+    return p + 2;
+}
+
+/*
+ *  fmt_json_str
+ *      returns:  p advanced past name as a JSON string, name is at most
+ *                max bytes and NUL terminated only when shorter
+ */
+static char *fmt_json_str(char *p, const char *name, size_t max)
+{
+    size_t n = strnlen(name, max);
+
+    *p++ = '"';
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned char c = name[i];
+
+        if (c == '"' || c == '\\')
+        {
+            *p++ = '\\';
+            *p++ = c;
+        }
+        else if (c < 0x20)
+        {
+            memcpy(p, "\\u00", 4);
+            p[4] = "0123456789abcdef"[c >> 4];
+            p[5] = "0123456789abcdef"[c & 0xF];
+            p += 6;
+        }
+        else
+        {
+            *p++ = c;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+/*
+ *  fmt_csv_str
+ *      Like fmt_json_str() for a CSV field, quoted only if it holds a
+ *      comma, a quote or a line break.
+ */
+static char *fmt_csv_str(char *p, const char *name, size_t max)
+{
+    size_t n = strnlen(name, max);
+    bool quote = false;
+
+    for (size_t i = 0; i < n; i++)
+        quote |= name[i] == ',' || name[i] == '"' || name[i] == '\r' || name[i] == '\n';
+
+    if (!quote)
+    {
+        memcpy(p, name, n);
+        return p + n;
+    }
+
+    *p++ = '"';
+    for (size_t i = 0; i < n; i++)
+    {
+        if (name[i] == '"')
+            *p++ = '"';
+        *p++ = name[i];
+    }
+    *p++ = '"';
+    return p;
+}
+
+/*
+ *  export_flush
+ *      Writes the filled segments with writev() and empties them.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int export_flush(db_export_t *ex)
+{
+    struct iovec iov[EXPORT_SEGS];
+    struct iovec *next = iov;
+    int cnt = 0;
+
+    for (int i = 0; i <= ex->seg && i < EXPORT_SEGS; i++)
+    {
+        if (ex->len[i] == 0)
+            continue;
+        iov[cnt].iov_base = ex->buf + (size_t)i * EXPORT_SEG_LEN;
+        iov[cnt].iov_len = ex->len[i];
+        cnt++;
+    }
+
+    while (cnt > 0)
+    {
+        ssize_t n = writev(ex->out, next, cnt);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return ERR_DB_FILE;
+        }
+
+        // a short write, skip what went out and resume mid segment
+        while (cnt > 0 && (size_t)n >= next->iov_len)
+        {
+            n -= next->iov_len;
+            next++;
+            cnt--;
+        }
+        if (cnt > 0)
+        {
+            next->iov_base = (char *)next->iov_base + n;
+            next->iov_len -= n;
+        }
+    }
+
+    memset(ex->len, 0, sizeof(ex->len));
+    ex->seg = 0;
+    return NO_ERROR;
+}
+
+/*
+ *  export_row
+ *      returns:  room for EXPORT_ROW_MAX bytes in the current segment, the
+ *                caller adds what it used to ex->len[ex->seg]; NULL if a
+ *                flush to make room failed
+ */
+static char *export_row(db_export_t *ex)
+{
+    if (EXPORT_SEG_LEN - ex->len[ex->seg] < EXPORT_ROW_MAX)
+    {
+        ex->seg++;
+        if (ex->seg == EXPORT_SEGS && export_flush(ex) != NO_ERROR)
+            return NULL;
+    }
+
+    return ex->buf + (size_t)ex->seg * EXPORT_SEG_LEN + ex->len[ex->seg];
+}
+
+static int export_record(const student_t *s, void *arg)
+{
+    db_export_t *ex = arg;
+    char *row = export_row(ex);
+    char *p = row;
+
+    if (row == NULL)
+    {
+        ex->failed = true;
+        return ERR_DB_FILE;
+    }
+
+    switch (ex->format)
+    {
+    case DB_EXPORT_BIN:
+        memcpy(p, s, STUDENT_RECORD_SIZE);
+        p += STUDENT_RECORD_SIZE;
+        break;
+
+    case DB_EXPORT_JSON:
+        memcpy(p, "{\"id\":", 6);
+        p = fmt_int(p + 6, s->id);
+        memcpy(p, ",\"fname\":", 9);
+        p = fmt_json_str(p + 9, s->fname, sizeof(s->fname));
+        memcpy(p, ",\"lname\":", 9);
+        p = fmt_json_str(p + 9, s->lname, sizeof(s->lname));
+        memcpy(p, ",\"gpa\":", 7);
+        p = fmt_gpa(p + 7, s->gpa);
+        memcpy(p, "}\n", 2);
+        p += 2;
+        break;
+
+    default:
+        p = fmt_int(p, s->id);
+        *p++ = ',';
+        p = fmt_csv_str(p, s->fname, sizeof(s->fname));
+        *p++ = ',';
+        p = fmt_csv_str(p, s->lname, sizeof(s->lname));
+        *p++ = ',';
+        p = fmt_gpa(p, s->gpa);
+        *p++ = '\n';
+        break;
+    }
+
+    ex->len[ex->seg] += p - row;
+    return NO_ERROR;
+}
+
+/*
+ *  export_format
+ *      name:  "bin", "json" or "csv"
+ *
+ *  returns:  the DB_EXPORT_* format, or -1 for an unknown name
+ */
+int export_format(const char *name)
+{
+    for (int i = 0; i < (int)(sizeof(FORMAT_NAMES) / sizeof(FORMAT_NAMES[0])); i++)
+    {
+        if (strcmp(name, FORMAT_NAMES[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ *  export_db
+ *      fd:      database file descriptor
+ *      format:  DB_EXPORT_BIN, DB_EXPORT_JSON or DB_EXPORT_CSV
+ *      out:     file descriptor the export is written to
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  the export, on out
+ *            M_ERR_DB_READ     error reading the db file
+ *            M_ERR_EXPORT      error writing the export
+ */
+int export_db(int fd, int format, int out)
+{
+    db_export_t ex = {.out = out, .format = format};
+    int rc;
+
+    ex.buf = malloc((size_t)EXPORT_SEGS * EXPORT_SEG_LEN);
+    if (ex.buf == NULL)
+    {
+        printf(M_ERR_EXPORT);
+        return ERR_DB_FILE;
+    }
+
+    // whatever printf() buffered goes out before the segments do
+    fflush(stdout);
+
+    if (format == DB_EXPORT_CSV)
+    {
+        memcpy(ex.buf, "id,fname,lname,gpa\n", 19);
+        ex.len[0] = 19;
+    }
+
+    rc = scan_db(fd, export_record, &ex);
+    if (rc == NO_ERROR && export_flush(&ex) != NO_ERROR)
+        ex.failed = true;
+    free(ex.buf);
+
+    if (ex.failed)
+    {
+        printf(M_ERR_EXPORT);
+        return ERR_DB_FILE;
+    }
+    if (rc != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
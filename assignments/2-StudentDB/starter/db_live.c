@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Live record detection
+ *
+ *  A block scan spends its inner loop deciding which of up to
+ *  SCAN_BLOCK_RECS slots hold a student, and a deleted or never written
+ *  slot is 64 zero bytes.  Instead of a memcmp() against
+ *  EMPTY_STUDENT_RECORD and a branch per slot, four records at a time are
+ *  ORed together in vector registers (two 32 byte halves with AVX2, four
+ *  16 byte quarters with SSE2) and turned into a 4 bit live mask.  A table
+ *  lookup on the mask stores the positions of the live ones, so nothing
+ *  branches on the data.  Without SSE2 it is the memcmp() loop again.
+ *
+ *  Only the extent walk of scan_db() calls it, which with the default
+ *  mmap engine and occupancy bitmap is just the bitmap rebuild: print,
+ *  export and compaction then walk the set bits, a packed file its index,
+ *  and count is a popcount.  The read()/write() engine (SDB_ENGINE=io)
+ *  and databases without a bitmap take the extent walk every time.
+ *
+ *  Which kernel runs is fixed at compile time, SSE2 on every x86-64
+ *  build, AVX2 when built with -mavx2 or -march=native.  bench/ times
+ *  them against the memcmp() loop, and sdbsc with and without them.
+ */
+
+// sdbsc is built without optimization for debugging, and unoptimized
+// intrinsics spill every vector to the stack, slower than the loop they
+// replace.  This file is small enough to debug optimized.
+#pragma GCC optimize("O2")
+
+#define LIVE_GROUP 4
+
+#if defined(__SSE2__)
+//the positions of the set bits of every 4 bit mask, and how many there are
+static const int LIVE_POS[16][4] = {
+    {0, 0, 0, 0}, {0, 0, 0, 0}, {1, 0, 0, 0}, {0, 1, 0, 0},
+    {2, 0, 0, 0}, {0, 2, 0, 0}, {1, 2, 0, 0}, {0, 1, 2, 0},
+    {3, 0, 0, 0}, {0, 3, 0, 0}, {1, 3, 0, 0}, {0, 1, 3, 0},
+    {2, 3, 0, 0}, {0, 2, 3, 0}, {1, 2, 3, 0}, {0, 1, 2, 3},
+};
+static const int LIVE_CNT[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+#endif
+
+/*
+ *  record_live
+ *      returns:  1 if any of the 64 bytes of rec is set, 0 otherwise
+ */
+static inline unsigned record_live(const student_t *rec)
+{
+    // optimized, this is eight word loads that stop at the first set one
+    return memcmp(rec, &EMPTY_STUDENT_RECORD, sizeof(*rec)) != 0;
+}
+
+/*
+ *  group_live
+ *      returns:  bit k set if recs[k] is live, for the LIVE_GROUP records
+ *                at recs
+ */
+static inline unsigned group_live(const student_t *recs)
+{
+#if defined(__AVX2__)
+    unsigned mask = 0;
+
+    for (int k = 0; k < LIVE_GROUP; k++)
+    {
+        const __m256i *p = (const __m256i *)&recs[k];
+        __m256i v = _mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1));
+
+        mask |= (unsigned)!_mm256_testz_si256(v, v) << k;
+    }
+    return mask;
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i eq[LIVE_GROUP];
+
+    // fold every record to 16 bytes and compare them as 4 ints, the
+    // results are 0 or -1 so packing them keeps them exact: one nibble
+    // of the byte mask per record, all set if the record is empty
+    for (int k = 0; k < LIVE_GROUP; k++)
+    {
+        const __m128i *p = (const __m128i *)&recs[k];
+        __m128i v = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+                                 _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+
+        eq[k] = _mm_cmpeq_epi32(v, zero);
+    }
+
+    unsigned set = ~_mm_movemask_epi8(_mm_packs_epi16(_mm_packs_epi32(eq[0], eq[1]),
+                                                      _mm_packs_epi32(eq[2], eq[3]))) & 0xFFFF;
+
+    // any bit of a nibble to its lowest bit, then bits 0, 4, 8 and 12 to
+    // 12..15 with one multiply, no two partial products overlap
+    set |= set >> 1;
+    set |= set >> 2;
+    return (((set & 0x1111) * 0x1248) >> 12) & 0xF;
+#else
+    unsigned mask = 0;
+
+    for (int k = 0; k < LIVE_GROUP; k++)
+        mask |= record_live(&recs[k]) << k;
+    return mask;
+#endif
+}
+
+/*
+ *  db_live_slots
+ *      recs:  n consecutive slots
+ *      live:  filled with the positions in recs that hold a student, in
+ *             order, has room for n
+ *
+ *  The tests of a group of LIVE_GROUP records are independent of each
+ *  other and of the output, only adding up the group's bits waits on the
+ *  previous group.
+ *
+ *  returns:  the number of positions written to live
+ */
+int db_live_slots(const student_t *recs, int n, int *live)
+{
+    int nlive = 0;
+    int i = 0;
+
+    for (; i + LIVE_GROUP <= n; i += LIVE_GROUP)
+    {
+        unsigned mask = group_live(&recs[i]);
+
+#if defined(__SSE2__)
+        // all four positions are stored, the first popcount of them are
+        // the live ones.  nlive <= i, so the store stays below i + 4 <= n.
+        __m128i pos = _mm_loadu_si128((const __m128i *)LIVE_POS[mask]);
+
+        _mm_storeu_si128((__m128i *)&live[nlive], _mm_add_epi32(pos, _mm_set1_epi32(i)));
+        nlive += LIVE_CNT[mask];
+#else
+        for (int k = 0; k < LIVE_GROUP; k++)
+        {
+            live[nlive] = i + k;
+            nlive += (mask >> k) & 1;
+        }
+#endif
+    }
+
+    for (; i < n; i++)
+    {
+        live[nlive] = i;
+        nlive += record_live(&recs[i]);
+    }
+
+    return nlive;
+}
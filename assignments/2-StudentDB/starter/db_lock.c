@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Record locks
+ *
+ *  Any number of sdbsc processes can have the database open at once.  To
+ *  keep them from clobbering each other every student id owns the
+ *  STUDENT_RECORD_SIZE bytes at id * STUDENT_RECORD_SIZE of the database
+ *  as an fcntl() byte range lock:
+ *
+ *    get_student()                  shared lock on the id
+ *    add_student(), del_student()   exclusive lock on the id, held from
+ *                                   the lookup to the write
+ *    put_record()                   exclusive lock on DB_LOCK_META while
+ *                                   the slot and the sidecars change
+ *    scans, open, bulk, compress    one lock over every id and the meta
+ *                                   range, shared to read, exclusive to
+ *                                   rebuild or load
+ *
+ *  The ranges are keys, not the bytes the record lives in: a packed
+ *  database locks the same range for an id wherever its slot is.  Locks
+ *  are always taken in that order, id then meta, and the whole range in
+ *  one request, so two processes cannot deadlock.
+ *
+ *  The locks are open file description (OFD) locks.  Classic POSIX locks
+ *  are dropped when any fd of the file is closed, OFD locks belong to the
+ *  fd from open_db() and are released with it.  Asking for a lock that fd
+ *  already holds converts it instead of blocking, so while the whole range
+ *  is held the per id and meta locks are skipped; they are covered.
+ */
+#define LOCK_OFFSET(id)     ((off_t)(id) * STUDENT_RECORD_SIZE)
+#define LOCK_ALL_LEN        LOCK_OFFSET(DB_LOCK_META + 1)
+
+static db_lock_t g_db_lock = {.fd = -1};
+
+static int lock_range(int fd, int type, off_t start, off_t len)
+{
+    struct flock fl = {0};
+    int cmd = F_OFD_SETLKW;
+
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
+
+    switch (type)
+    {
+    case DB_LOCK_SH:
+        fl.l_type = F_RDLCK;
+        break;
+    case DB_LOCK_EX:
+        fl.l_type = F_WRLCK;
+        break;
+    default:
+        fl.l_type = F_UNLCK;
+        cmd = F_OFD_SETLK;
+        break;
+    }
+
+    while (fcntl(fd, cmd, &fl) < 0)
+    {
+        if (errno != EINTR)
+            return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  lock_range_sync
+ *      lock_range(), then brings the mapping of fd up to date.  Other
+ *      processes only change the file under a conflicting lock, so once
+ *      ours is granted the size the mapping saw may be stale.
+ */
+static int lock_range_sync(int fd, int type, off_t start, off_t len)
+{
+    db_map_t *map;
+
+    if (lock_range(fd, type, start, len) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    map = db_map_find(fd);
+    if (type != DB_LOCK_UN && map != NULL && db_map_refresh(map) != NO_ERROR)
+    {
+        lock_range(fd, DB_LOCK_UN, start, len);
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+static bool lock_covered(int fd)
+{
+    return g_db_lock.fd == fd && g_db_lock.depth > 0;
+}
+
+/*
+ *  db_lock_record
+ *      fd:    database file descriptor
+ *      id:    student id
+ *      type:  DB_LOCK_SH, DB_LOCK_EX or DB_LOCK_UN to release it
+ *
+ *  Waits for the lock.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_lock_record(int fd, int id, int type)
+{
+    if (id < 0 || id > MAX_STD_ID)
+        return NO_ERROR;
+    if (lock_covered(fd))
+        return NO_ERROR;
+
+    return lock_range_sync(fd, type, LOCK_OFFSET(id), STUDENT_RECORD_SIZE);
+}
+
+/*
+ *  db_lock_meta
+ *      Like db_lock_record(), for the range that serializes updates of the
+ *      sidecars and the next free slot of a packed database.
+ */
+int db_lock_meta(int fd, int type)
+{
+    if (lock_covered(fd))
+        return NO_ERROR;
+
+    return lock_range(fd, type, LOCK_OFFSET(DB_LOCK_META), STUDENT_RECORD_SIZE);
+}
+
+/*
+ *  db_lock_all
+ *      fd:    database file descriptor
+ *      type:  DB_LOCK_SH, DB_LOCK_EX or DB_LOCK_UN to release it
+ *
+ *  Locks every id and the meta range at once.  Calls nest, only the
+ *  outermost one locks and the matching DB_LOCK_UN unlocks, so a scan
+ *  inside a bulk load or a compaction keeps the exclusive lock.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_lock_all(int fd, int type)
+{
+    if (type == DB_LOCK_UN)
+    {
+        if (!lock_covered(fd))
+            return NO_ERROR;
+        if (--g_db_lock.depth > 0)
+            return NO_ERROR;
+
+        g_db_lock.fd = -1;
+        return lock_range(fd, DB_LOCK_UN, 0, LOCK_ALL_LEN);
+    }
+
+    if (lock_covered(fd))
+    {
+        g_db_lock.depth++;
+        return NO_ERROR;
+    }
+
+    if (lock_range_sync(fd, type, 0, LOCK_ALL_LEN) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    g_db_lock.fd = fd;
+    g_db_lock.depth = 1;
+    return NO_ERROR;
+}
+
+/*
+ *  db_lock_new
+ *      Locks all of fd, a database that is being built and not open_db()'d,
+ *      so that processes that open it wait until it is complete.  Closing
+ *      fd releases the lock.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_lock_new(int fd)
+{
+    return lock_range(fd, DB_LOCK_EX, 0, LOCK_ALL_LEN);
+}
+
+/*
+ *  db_lock_close
+ *      Forgets the locks of fd, close() releases them.
+ */
+void db_lock_close(int fd)
+{
+    if (g_db_lock.fd == fd)
+    {
+        g_db_lock.fd = -1;
+        g_db_lock.depth = 0;
+    }
+}
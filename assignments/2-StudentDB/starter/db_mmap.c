@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Memory mapped storage engine
+ *
+ *  The whole database file is mapped MAP_SHARED and records are reached by
+ *  indexing a student_t array, so lookups, inserts and scans do not make any
+ *  syscalls.  The file is never grown past (id+1) * STUDENT_RECORD_SIZE, the
+ *  same size lseek()+write() would leave behind, so both engines can be used
+ *  on the same file.  Only one database is mapped per process.
+ */
+static db_map_t g_db_map = {.fd = -1};
+
+static size_t map_round(off_t len)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    return ((size_t)len + page - 1) & ~(page - 1);
+}
+
+/*
+ *  map_resize
+ *      map:  the mapping
+ *      len:  new length of the database file
+ *
+ *  Remaps the file after it changed size.  The mapping is always a whole
+ *  number of pages, so it only moves when len crosses a page boundary.
+ */
+static int map_resize(db_map_t *map, off_t len)
+{
+    size_t map_len = map_round(len);
+    void *recs;
+
+    if (map_len == map->map_len)
+    {
+        map->file_len = len;
+        return NO_ERROR;
+    }
+
+    if (map->map_len == 0)
+        recs = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+    else if (map_len == 0)
+    {
+        munmap(map->recs, map->map_len);
+        recs = NULL;
+    }
+    else
+        recs = mremap(map->recs, map->map_len, map_len, MREMAP_MAYMOVE);
+
+    if (recs == MAP_FAILED)
+        return ERR_DB_FILE;
+
+    map->recs = recs;
+    map->map_len = map_len;
+    map->file_len = len;
+    return NO_ERROR;
+}
+
+/*
+ *  db_map_open
+ *      fd:  file descriptor of an open database, opened O_RDWR
+ *
+ *  returns:  NO_ERROR     fd is now served by the mapping
+ *            ERR_DB_FILE  the file could not be mapped, the caller should
+ *                         fall back to read()/write()
+ */
+int db_map_open(int fd)
+{
+    struct stat st;
+
+    if (g_db_map.fd >= 0 || fstat(fd, &st) < 0)
+        return ERR_DB_FILE;
+
+    g_db_map.fd = fd;
+    g_db_map.recs = NULL;
+    g_db_map.map_len = 0;
+    g_db_map.file_len = 0;
+
+    if (map_resize(&g_db_map, st.st_size) != NO_ERROR)
+    {
+        g_db_map.fd = -1;
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+void db_map_close(int fd)
+{
+    if (fd < 0 || g_db_map.fd != fd)
+        return;
+
+    if (g_db_map.map_len > 0)
+        munmap(g_db_map.recs, g_db_map.map_len);
+    g_db_map.fd = -1;
+    g_db_map.recs = NULL;
+    g_db_map.map_len = 0;
+    g_db_map.file_len = 0;
+}
+
+/*
+ *  db_map_find
+ *      fd:  database file descriptor
+ *
+ *  returns:  the mapping serving fd, or NULL if fd uses read()/write()
+ */
+db_map_t *db_map_find(int fd)
+{
+    if (fd < 0 || g_db_map.fd != fd)
+        return NULL;
+
+    return &g_db_map;
+}
+
+/*
+ *  db_map_refresh
+ *      map:  the mapping
+ *
+ *  Picks up size changes made by another process (or the other engine)
+ *  since the file was mapped.  -z truncates the file in place while other
+ *  processes keep it mapped, a page past the new end would raise SIGBUS,
+ *  so the mapping follows the file down as well as up.
+ */
+int db_map_refresh(db_map_t *map)
+{
+    struct stat st;
+
+    if (fstat(map->fd, &st) < 0)
+        return ERR_DB_FILE;
+
+    if (st.st_size == map->file_len)
+        return NO_ERROR;
+
+    return map_resize(map, st.st_size);
+}
+
+/*
+ *  db_map_reserve
+ *      map:  the mapping
+ *      len:  minimum length of the database file
+ *
+ *  Extends the file with ftruncate() so that len bytes can be stored
+ *  through the mapping.  The new range is a hole, just like the gap that
+ *  writing past the end of the file leaves.
+ */
+int db_map_reserve(db_map_t *map, off_t len)
+{
+    // file_len may be stale in either direction, see db_map_refresh()
+    if (db_map_refresh(map) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (len <= map->file_len)
+        return NO_ERROR;
+
+    if (ftruncate(map->fd, len) < 0)
+        return ERR_DB_FILE;
+
+    return map_resize(map, len);
+}
+
+/*
+ *  db_map_record
+ *      map:  the mapping
+ *      id:   student id
+ *
+ *  returns:  a pointer to the slot of id, or NULL if the slot lies past
+ *            the end of the file
+ */
+student_t *db_map_record(db_map_t *map, int id)
+{
+    off_t end = ((off_t)id + 1) * STUDENT_RECORD_SIZE;
+
+    if (id < 0)
+        return NULL;
+
+    if (end > map->file_len)
+    {
+        if (db_map_refresh(map) != NO_ERROR || end > map->file_len)
+            return NULL;
+    }
+
+    return &map->recs[id];
+}
+
+/*
+ *  db_map_nrecs
+ *      map:  the mapping
+ *
+ *  returns:  the number of whole record slots in the file
+ */
+int db_map_nrecs(db_map_t *map)
+{
+    return (int)(map->file_len / STUDENT_RECORD_SIZE);
+}
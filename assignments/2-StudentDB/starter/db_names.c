@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Name index
+ *
+ *  A sorted array of (lname, fname, id) entries in a sidecar file
+ *  (dbFile + DB_NAMES_SUFFIX), so exact and prefix matches on the last name
+ *  are a binary search plus a walk over the matching entries instead of a
+ *  scan of the database.  Entries are 64 bytes, like the records, and the
+ *  names are truncated exactly the way add_student() stores them.
+ *
+ *  add/del insert and remove single entries with a memmove() of the tail,
+ *  bulk_load() merges its sorted batch in one pass from the back.  Like
+ *  every sidecar it is rebuilt from the database when it does not match.
+ */
+#define NAMES_MIN_CAP   1024
+
+static db_names_t g_db_names = {.fd = -1};
+
+static int cmp_ent(const db_name_ent_t *a, const db_name_ent_t *b)
+{
+    int rc = strncmp(a->lname, b->lname, sizeof(a->lname));
+
+    if (rc == 0)
+        rc = strncmp(a->fname, b->fname, sizeof(a->fname));
+    if (rc == 0)
+        rc = (a->id > b->id) - (a->id < b->id);
+    return rc;
+}
+
+static int cmp_ent_qsort(const void *a, const void *b)
+{
+    return cmp_ent(a, b);
+}
+
+static void make_ent(db_name_ent_t *ent, const char *lname, const char *fname, int id)
+{
+    memset(ent, 0, sizeof(*ent));
+    memcpy(ent->lname, lname, strnlen(lname, sizeof(ent->lname) - 1));
+    memcpy(ent->fname, fname, strnlen(fname, sizeof(ent->fname) - 1));
+    ent->id = id;
+}
+
+static size_t names_cap(size_t map_len)
+{
+    return (map_len - sizeof(db_side_hdr_t)) / sizeof(db_name_ent_t);
+}
+
+/*
+ *  names_remap
+ *      Maps the file again at its current size, at least len bytes.
+ */
+static int names_remap(db_names_t *names, size_t len)
+{
+    void *base;
+    size_t map_len;
+
+    if (db_side_map(names->path, len, &base, &map_len) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (names->hdr != NULL)
+        munmap(names->hdr, names->map_len);
+    names->hdr = base;
+    names->ents = (db_name_ent_t *)(names->hdr + 1);
+    names->map_len = map_len;
+    return NO_ERROR;
+}
+
+/*
+ *  names_reserve
+ *      Makes room for n entries, doubling the file as it grows.  Another
+ *      process may have grown it already, which the header's cap shows.
+ */
+static int names_reserve(db_names_t *names, size_t n)
+{
+    size_t cap = names_cap(names->map_len);
+
+    if (names->hdr->cap > cap && names_remap(names, 0) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    cap = names_cap(names->map_len);
+    if (n <= cap)
+        return NO_ERROR;
+
+    while (cap < n)
+        cap *= 2;
+    if (names_remap(names, sizeof(db_side_hdr_t) + cap * sizeof(db_name_ent_t)) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    names->hdr->cap = names_cap(names->map_len);
+    return NO_ERROR;
+}
+
+/*
+ *  lower_bound
+ *      returns:  the index of the first entry that is not less than key
+ */
+static size_t lower_bound(db_names_t *names, const db_name_ent_t *key)
+{
+    size_t lo = 0;
+    size_t hi = names->hdr->count;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (cmp_ent(&names->ents[mid], key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+typedef struct rebuild_set {
+    db_name_ent_t *ents;
+    size_t num;
+    size_t cap;
+} rebuild_set_t;
+
+static int collect_ent(const student_t *s, void *arg)
+{
+    rebuild_set_t *set = arg;
+
+    if (set->num == set->cap)
+    {
+        size_t cap = set->cap ? set->cap * 2 : NAMES_MIN_CAP;
+        db_name_ent_t *ents = realloc(set->ents, cap * sizeof(db_name_ent_t));
+        if (ents == NULL)
+            return ERR_DB_FILE;
+        set->ents = ents;
+        set->cap = cap;
+    }
+
+    make_ent(&set->ents[set->num++], s->lname, s->fname, s->id);
+    return NO_ERROR;
+}
+
+static int names_rebuild(int fd, db_names_t *names, struct stat *db_st)
+{
+    rebuild_set_t set = {0};
+    int rc;
+
+    rc = scan_db(fd, collect_ent, &set);
+    if (rc == NO_ERROR)
+    {
+        qsort(set.ents, set.num, sizeof(db_name_ent_t), cmp_ent_qsort);
+        rc = names_reserve(names, set.num);
+    }
+
+    if (rc == NO_ERROR)
+    {
+        memset(names->hdr, 0, sizeof(db_side_hdr_t));
+        if (set.num > 0)
+            memcpy(names->ents, set.ents, set.num * sizeof(db_name_ent_t));
+        names->hdr->count = set.num;
+        names->hdr->cap = names_cap(names->map_len);
+        db_side_stamp(names->hdr, DB_NAMES_MAGIC, DB_NAMES_VERSION, db_st);
+    }
+
+    free(set.ents);
+    return rc;
+}
+
+/*
+ *  db_names_open
+ *      fd:      database file descriptor
+ *      dbFile:  name of the database, used to find the index
+ *      reset:   the database was just truncated, drop every entry
+ *
+ *  returns:  NO_ERROR if fd has a name index, ERR_DB_FILE otherwise.  The
+ *            name queries fall back to a scan without one.
+ */
+int db_names_open(int fd, const char *dbFile, bool reset)
+{
+    db_names_t *names = &g_db_names;
+    struct stat db_st;
+
+    if (names->fd >= 0 || fstat(fd, &db_st) < 0)
+        return ERR_DB_FILE;
+
+    snprintf(names->path, sizeof(names->path), "%s%s", dbFile, DB_NAMES_SUFFIX);
+    names->hdr = NULL;
+    if (names_remap(names, sizeof(db_side_hdr_t) + NAMES_MIN_CAP * sizeof(db_name_ent_t)) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (reset || !db_side_valid(names->hdr, DB_NAMES_MAGIC, DB_NAMES_VERSION, &db_st) ||
+        names->hdr->count > names_cap(names->map_len))
+    {
+        if (names_rebuild(fd, names, &db_st) != NO_ERROR)
+        {
+            munmap(names->hdr, names->map_len);
+            names->hdr = NULL;
+            return ERR_DB_FILE;
+        }
+    }
+
+    names->fd = fd;
+    return NO_ERROR;
+}
+
+void db_names_close(int fd)
+{
+    if (fd < 0 || g_db_names.fd != fd)
+        return;
+
+    munmap(g_db_names.hdr, g_db_names.map_len);
+    g_db_names.fd = -1;
+    g_db_names.hdr = NULL;
+    g_db_names.ents = NULL;
+}
+
+/*
+ *  db_names_find
+ *      returns:  the name index of fd, or NULL if fd has none
+ */
+db_names_t *db_names_find(int fd)
+{
+    if (fd < 0 || g_db_names.fd != fd)
+        return NULL;
+
+    return &g_db_names;
+}
+
+int db_names_insert(db_names_t *names, const student_t *s)
+{
+    db_name_ent_t ent;
+    size_t pos;
+
+    if (names_reserve(names, names->hdr->count + 1) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    make_ent(&ent, s->lname, s->fname, s->id);
+    pos = lower_bound(names, &ent);
+    memmove(&names->ents[pos + 1], &names->ents[pos],
+            (names->hdr->count - pos) * sizeof(db_name_ent_t));
+    names->ents[pos] = ent;
+    names->hdr->count++;
+    return NO_ERROR;
+}
+
+void db_names_remove(db_names_t *names, const student_t *s)
+{
+    db_name_ent_t ent;
+    size_t pos;
+
+    if (names_reserve(names, 0) != NO_ERROR)
+        return;
+
+    make_ent(&ent, s->lname, s->fname, s->id);
+    pos = lower_bound(names, &ent);
+    if (pos == names->hdr->count || cmp_ent(&names->ents[pos], &ent) != 0)
+        return;
+
+    memmove(&names->ents[pos], &names->ents[pos + 1],
+            (names->hdr->count - pos - 1) * sizeof(db_name_ent_t));
+    names->hdr->count--;
+}
+
+/*
+ *  db_names_merge
+ *      recs:  n new students, in any order
+ *
+ *  Adds a whole batch with one backwards merge instead of n memmove()s.
+ */
+int db_names_merge(db_names_t *names, student_t **recs, int n)
+{
+    db_name_ent_t *batch;
+    size_t old;
+    size_t i;
+    size_t j;
+    size_t out;
+
+    if (n <= 0)
+        return NO_ERROR;
+
+    batch = malloc((size_t)n * sizeof(db_name_ent_t));
+    if (batch == NULL)
+        return ERR_DB_FILE;
+
+    for (int k = 0; k < n; k++)
+        make_ent(&batch[k], recs[k]->lname, recs[k]->fname, recs[k]->id);
+    qsort(batch, n, sizeof(db_name_ent_t), cmp_ent_qsort);
+
+    if (names_reserve(names, names->hdr->count + n) != NO_ERROR)
+    {
+        free(batch);
+        return ERR_DB_FILE;
+    }
+
+    old = names->hdr->count;
+    i = old;
+    j = (size_t)n;
+    out = old + n;
+    while (j > 0)
+    {
+        if (i > 0 && cmp_ent(&names->ents[i - 1], &batch[j - 1]) > 0)
+            names->ents[--out] = names->ents[--i];
+        else
+            names->ents[--out] = batch[--j];
+    }
+    names->hdr->count = old + n;
+
+    free(batch);
+    return NO_ERROR;
+}
+
+/*
+ *  db_names_lookup
+ *      lname:   last name, or its first characters when prefix is set
+ *      fname:   first name that must match exactly as well, or NULL
+ *      prefix:  match every last name that starts with lname
+ *      fn:      called with the id of every match, in name order
+ *
+ *  returns:  NO_ERROR or the value fn stopped the walk with
+ */
+int db_names_lookup(db_names_t *names, const char *lname, const char *fname, bool prefix,
+                    int (*fn)(int id, void *arg), void *arg)
+{
+    db_name_ent_t key;
+    size_t key_len;
+    int rc = NO_ERROR;
+
+    if (names_reserve(names, 0) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    make_ent(&key, lname, fname != NULL ? fname : "", 0);
+    key.id = INT_MIN;
+    key_len = strlen(key.lname);
+
+    for (size_t pos = lower_bound(names, &key); pos < names->hdr->count && rc == NO_ERROR; pos++)
+    {
+        db_name_ent_t *ent = &names->ents[pos];
+
+        if (prefix ? strncmp(ent->lname, key.lname, key_len) != 0
+                   : strncmp(ent->lname, key.lname, sizeof(key.lname)) != 0)
+            break;
+        if (fname != NULL && strncmp(ent->fname, key.fname, sizeof(key.fname)) != 0)
+        {
+            if (prefix)
+                continue;
+            break;
+        }
+
+        rc = fn(ent->id, arg);
+    }
+
+    return rc;
+}
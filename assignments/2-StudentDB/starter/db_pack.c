@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Packed layout
+ *
+ *  The default layout stores student id at offset id * STUDENT_RECORD_SIZE,
+ *  so the file is as long as the highest id.  compress_db_ex() can instead
+ *  write a packed file: slot 0 holds a db_pack_hdr_t, slots 1..n hold the
+ *  live students in id order and students added later are appended.  The
+ *  id -> slot mapping lives in an index file next to the database
+ *  (dbFile + DB_IDX_SUFFIX), an int array of MAX_STD_ID+1 entries where 0
+ *  means "not in the database".  It is mapped, so a lookup stays O(1), and
+ *  written with holes for the pages that have no students.
+ *
+ *  The index is only a cache.  Entry 0 holds the generation of the
+ *  database it was built for, and a db_side_hdr_t after the last entry
+ *  counts the writes in flight like every other sidecar does.  If the
+ *  index is missing, was built for another generation or a write died
+ *  between the record and its index entry, it is rebuilt from the
+ *  records, which all carry their own id.
+ */
+#define IDX_ENTRIES     (MAX_STD_ID + 1)
+#define IDX_HDR_OFF     (((size_t)IDX_ENTRIES * sizeof(int) + 63) & ~(size_t)63)
+#define IDX_FILE_LEN    (IDX_HDR_OFF + sizeof(db_side_hdr_t))
+
+static db_pack_t g_db_pack = {.fd = -1};
+
+void db_pack_index_path(const char *dbFile, char *path, size_t len)
+{
+    snprintf(path, len, "%s%s", dbFile, DB_IDX_SUFFIX);
+}
+
+void db_pack_init_hdr(db_pack_hdr_t *hdr)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->id = DELETED_STUDENT_ID;
+    strncpy(hdr->magic, DB_PACK_MAGIC, sizeof(hdr->magic));
+    hdr->version = DB_PACK_VERSION;
+    hdr->generation = ((unsigned int)now.tv_nsec ^ (unsigned int)now.tv_sec ^
+                       ((unsigned int)getpid() << 16)) | 1;
+}
+
+/*
+ *  db_pack_write_index
+ *      path:   index file to create or replace
+ *      idx:    IDX_ENTRIES slot numbers, idx[0] is the generation
+ *      db_st:  the database the index is for
+ *
+ *  Pages without a single student are left as holes.  The file is written
+ *  next to path, fsync'd and renamed over it, a process that still has the
+ *  old index mapped keeps reading the old file instead of faulting on a
+ *  truncated one.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_pack_write_index(const char *path, const int *idx, struct stat *db_st)
+{
+    const size_t page_ints = 4096 / sizeof(int);
+    char tmp_path[PATH_MAX];
+    db_side_hdr_t hdr;
+    int rc = NO_ERROR;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd < 0)
+        return ERR_DB_FILE;
+
+    for (size_t first = 0; first < IDX_ENTRIES && rc == NO_ERROR; first += page_ints)
+    {
+        size_t n = IDX_ENTRIES - first < page_ints ? IDX_ENTRIES - first : page_ints;
+        size_t i;
+
+        for (i = 0; i < n && idx[first + i] == 0; i++)
+            ;
+        if (i == n)
+            continue;
+
+        if (pwrite(fd, idx + first, n * sizeof(int), first * sizeof(int)) != (ssize_t)(n * sizeof(int)))
+            rc = ERR_DB_FILE;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    db_side_stamp(&hdr, DB_IDX_MAGIC, DB_IDX_VERSION, db_st);
+    if (rc == NO_ERROR && pwrite(fd, &hdr, sizeof(hdr), IDX_HDR_OFF) != sizeof(hdr))
+        rc = ERR_DB_FILE;
+
+    if (rc == NO_ERROR && (ftruncate(fd, IDX_FILE_LEN) < 0 || fsync(fd) < 0))
+        rc = ERR_DB_FILE;
+
+    close(fd);
+    if (rc == NO_ERROR && rename(tmp_path, path) < 0)
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR)
+        unlink(tmp_path);
+    return rc;
+}
+
+/*
+ *  rebuild_index
+ *      Reads every slot of the packed database fd and writes a new index
+ *      file for generation.
+ */
+static int rebuild_index(int fd, const char *path, unsigned int generation)
+{
+    struct stat db_st;
+    student_t *buff;
+    int *idx;
+    off_t slot = 1;
+    ssize_t io_size;
+    int rc = NO_ERROR;
+
+    idx = calloc(IDX_ENTRIES, sizeof(int));
+    buff = malloc((size_t)SCAN_BLOCK_RECS * STUDENT_RECORD_SIZE);
+    if (idx == NULL || buff == NULL)
+    {
+        free(idx);
+        free(buff);
+        return ERR_DB_FILE;
+    }
+
+    idx[0] = (int)generation;
+    while ((io_size = pread(fd, buff, (size_t)SCAN_BLOCK_RECS * STUDENT_RECORD_SIZE,
+                            slot * STUDENT_RECORD_SIZE)) > 0)
+    {
+        int n = io_size / STUDENT_RECORD_SIZE;
+
+        for (int i = 0; i < n; i++)
+        {
+            if (buff[i].id >= MIN_STD_ID && buff[i].id <= MAX_STD_ID)
+                idx[buff[i].id] = (int)(slot + i);
+        }
+        if (n == 0)
+            break;
+        slot += n;
+    }
+    if (io_size < 0 || fstat(fd, &db_st) < 0)
+        rc = ERR_DB_FILE;
+
+    if (rc == NO_ERROR)
+        rc = db_pack_write_index(path, idx, &db_st);
+
+    free(idx);
+    free(buff);
+    return rc;
+}
+
+/*
+ *  map_index
+ *      Maps the index at path if it is usable for generation of the
+ *      database db_st.
+ */
+static int map_index(const char *path, unsigned int generation, struct stat *db_st)
+{
+    struct stat st;
+    db_side_hdr_t *hdr;
+    int *idx;
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+
+    if (fd < 0)
+        return ERR_DB_FILE;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != IDX_FILE_LEN)
+    {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    idx = mmap(NULL, IDX_FILE_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (idx == MAP_FAILED)
+        return ERR_DB_FILE;
+
+    hdr = (db_side_hdr_t *)((char *)idx + IDX_HDR_OFF);
+    if ((unsigned int)idx[0] != generation ||
+        !db_side_valid(hdr, DB_IDX_MAGIC, DB_IDX_VERSION, db_st))
+    {
+        munmap(idx, IDX_FILE_LEN);
+        return ERR_DB_FILE;
+    }
+
+    g_db_pack.idx = idx;
+    g_db_pack.hdr = hdr;
+    return NO_ERROR;
+}
+
+/*
+ *  db_pack_open
+ *      fd:      database file descriptor
+ *      dbFile:  name of the database, used to find the index
+ *
+ *  Checks slot 0 for a packed header and, if there is one, maps the index
+ *  (rebuilding it first when it is missing, stale or was left mid update).
+ *  A database in the default layout is left alone.  The caller keeps
+ *  other processes out while the index is rebuilt.
+ *
+ *  returns:  NO_ERROR     fd is in the default layout, or packed and ready
+ *            ERR_DB_FILE  fd is packed but the index is unusable
+ */
+int db_pack_open(int fd, const char *dbFile)
+{
+    db_pack_hdr_t hdr;
+    struct stat db_st;
+    char path[PATH_MAX];
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.id != DELETED_STUDENT_ID ||
+        strncmp(hdr.magic, DB_PACK_MAGIC, sizeof(hdr.magic)) != 0)
+        return NO_ERROR;
+
+    if (hdr.version != DB_PACK_VERSION || g_db_pack.fd >= 0 || fstat(fd, &db_st) < 0)
+        return ERR_DB_FILE;
+
+    db_pack_index_path(dbFile, path, sizeof(path));
+    if (map_index(path, hdr.generation, &db_st) != NO_ERROR)
+    {
+        if (rebuild_index(fd, path, hdr.generation) != NO_ERROR ||
+            map_index(path, hdr.generation, &db_st) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    g_db_pack.fd = fd;
+    g_db_pack.generation = hdr.generation;
+    return NO_ERROR;
+}
+
+void db_pack_close(int fd)
+{
+    if (fd < 0 || g_db_pack.fd != fd)
+        return;
+
+    munmap(g_db_pack.idx, IDX_FILE_LEN);
+    g_db_pack.fd = -1;
+    g_db_pack.idx = NULL;
+    g_db_pack.hdr = NULL;
+}
+
+/*
+ *  db_pack_find
+ *      fd:  database file descriptor
+ *
+ *  returns:  the packed state of fd, or NULL if fd uses the default layout
+ */
+db_pack_t *db_pack_find(int fd)
+{
+    if (fd < 0 || g_db_pack.fd != fd)
+        return NULL;
+
+    return &g_db_pack;
+}
+
+/*
+ *  db_pack_slot
+ *      returns:  the slot holding id, 0 if id is not in the database
+ */
+int db_pack_slot(db_pack_t *pack, int id)
+{
+    if (id < MIN_STD_ID || id > MAX_STD_ID)
+        return 0;
+
+    return pack->idx[id];
+}
+
+/*
+ *  db_pack_set
+ *      Points id at slot, 0 drops it from the index.  The caller brackets
+ *      the record write and this with db_side_begin(pack->hdr) and
+ *      db_side_end(pack->hdr).
+ */
+void db_pack_set(db_pack_t *pack, int id, int slot)
+{
+    if (id >= MIN_STD_ID && id <= MAX_STD_ID)
+        pack->idx[id] = slot;
+}
+
+/*
+ *  db_pack_next_slot
+ *      returns:  the first unused slot at the end of the file, or
+ *                ERR_DB_FILE
+ */
+int db_pack_next_slot(db_pack_t *pack)
+{
+    struct stat st;
+
+    if (fstat(pack->fd, &st) < 0)
+        return ERR_DB_FILE;
+
+    return (int)((st.st_size + STUDENT_RECORD_SIZE - 1) / STUDENT_RECORD_SIZE);
+}
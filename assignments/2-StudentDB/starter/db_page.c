@@ -0,0 +1,819 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Paged database
+ *
+ *  student.db addresses a student by id * 64, so the id space is capped by
+ *  MAX_STD_ID and the names by the 64 byte student_t.  DB_PAGE_FILE is a
+ *  second store without either limit, reached with -P in front of an
+ *  option.  The file is a sequence of page_size pages:
+ *
+ *    page 0    db_page_hdr_t: magic, version, page and record size, the
+ *              name lengths of the schema, the root of the tree
+ *    page 1..  nodes of a B+-tree keyed by id, every page starts with a
+ *              db_node_hdr_t
+ *
+ *  Leaves hold the records themselves sorted by id, each one
+ *  id, gpa, fname[fname_len], lname[lname_len], and are chained in id
+ *  order for printing.  Inner nodes hold nkeys separator ids and nkeys + 1
+ *  child pages, child i has the ids below key i, child i + 1 the ids from
+ *  key i up.  A lookup reads height pages; the file only grows by the
+ *  pages that splits add, never by the size of the id space.
+ *
+ *  Deletes remove the record from its leaf and leave the tree shape alone,
+ *  an empty leaf still routes its range correctly and is refilled by later
+ *  adds.  The whole file is flock()ed, shared by readers and exclusive by
+ *  writers, an operation is a handful of page reads and writes.
+ */
+#define NODE_HDR_LEN    ((int)sizeof(db_node_hdr_t))
+#define REC_FIXED_LEN   8       //id and gpa in front of the names
+
+static db_page_t g_db_page = {.fd = -1};
+
+static int read_page(db_page_t *db, uint32_t pno, void *buf)
+{
+    ssize_t n = pread(db->fd, buf, db->hdr.page_size, (off_t)pno * db->hdr.page_size);
+
+    if (n != (ssize_t)db->hdr.page_size)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int write_page(db_page_t *db, uint32_t pno, const void *buf)
+{
+    ssize_t n = pwrite(db->fd, buf, db->hdr.page_size, (off_t)pno * db->hdr.page_size);
+
+    if (n != (ssize_t)db->hdr.page_size)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int write_hdr(db_page_t *db)
+{
+    if (pwrite(db->fd, &db->hdr, sizeof(db->hdr), 0) != (ssize_t)sizeof(db->hdr))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static db_node_hdr_t *node(char *page)
+{
+    return (db_node_hdr_t *)page;
+}
+
+static char *leaf_rec(db_page_t *db, char *page, int i)
+{
+    return page + NODE_HDR_LEN + (size_t)i * db->hdr.record_size;
+}
+
+static int32_t rec_id(const char *rec)
+{
+    int32_t id;
+
+    memcpy(&id, rec, sizeof(id));
+    return id;
+}
+
+static int32_t *inner_keys(char *page)
+{
+    return (int32_t *)(page + NODE_HDR_LEN);
+}
+
+static uint32_t *inner_children(db_page_t *db, char *page)
+{
+    return (uint32_t *)(page + NODE_HDR_LEN + db->inner_max * sizeof(int32_t));
+}
+
+static void pack_rec(db_page_t *db, char *rec, const db_page_rec_t *s)
+{
+    int32_t fixed[2] = {s->id, s->gpa};
+
+    memcpy(rec, fixed, REC_FIXED_LEN);
+    strncpy(rec + REC_FIXED_LEN, s->fname, db->hdr.fname_len);
+    strncpy(rec + REC_FIXED_LEN + db->hdr.fname_len, s->lname, db->hdr.lname_len);
+}
+
+static void unpack_rec(db_page_t *db, const char *rec, db_page_rec_t *s)
+{
+    int32_t fixed[2];
+
+    memset(s, 0, sizeof(*s));
+    memcpy(fixed, rec, REC_FIXED_LEN);
+    s->id = fixed[0];
+    s->gpa = fixed[1];
+    // a name that fills its field has no NUL on disk
+    memcpy(s->fname, rec + REC_FIXED_LEN, db->hdr.fname_len);
+    memcpy(s->lname, rec + REC_FIXED_LEN + db->hdr.fname_len, db->hdr.lname_len);
+}
+
+/*
+ *  inner_child
+ *      returns:  the index of the child of inner node page that holds id
+ */
+static int inner_child(char *page, int id)
+{
+    int32_t *keys = inner_keys(page);
+    int lo = 0;
+    int hi = node(page)->nkeys;
+
+    // first key greater than id
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        if (keys[mid] <= id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ *  leaf_find
+ *      returns:  the position of id in leaf page, or where it would be
+ *                inserted; *found tells which
+ */
+static int leaf_find(db_page_t *db, char *page, int id, bool *found)
+{
+    int lo = 0;
+    int hi = node(page)->nkeys;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        if (rec_id(leaf_rec(db, page, mid)) < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = lo < node(page)->nkeys && rec_id(leaf_rec(db, page, lo)) == id;
+    return lo;
+}
+
+/*
+ *  descend
+ *      Reads the path from the root to the leaf that holds id, level 0 is
+ *      the root.  path[level] is the page number, the page itself is at
+ *      db->path + level * page_size.
+ *
+ *  returns:  the leaf, or NULL on a read error or a corrupt tree
+ */
+static char *descend(db_page_t *db, int id, uint32_t *path)
+{
+    uint32_t pno = db->hdr.root;
+    char *page = NULL;
+
+    for (uint32_t level = 0; level < db->hdr.height; level++)
+    {
+        page = db->path + (size_t)level * db->hdr.page_size;
+        if (pno == 0 || pno >= db->hdr.npages || read_page(db, pno, page) != NO_ERROR)
+            return NULL;
+        path[level] = pno;
+
+        bool leaf = level == db->hdr.height - 1;
+        if (node(page)->type != (leaf ? DB_NODE_LEAF : DB_NODE_INNER))
+            return NULL;
+        if (!leaf)
+            pno = inner_children(db, page)[inner_child(page, id)];
+    }
+    return page;
+}
+
+static uint32_t alloc_page(db_page_t *db)
+{
+    return db->hdr.npages++;
+}
+
+/*
+ *  insert_inner
+ *      Adds separator key with child, the page right of it, to the inner
+ *      node at level, splitting it and the levels above while they are
+ *      full.  A split of the root grows the tree by a level.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int insert_inner(db_page_t *db, uint32_t *path, int level, int32_t key, uint32_t child)
+{
+    uint32_t left_pno = path[level + 1];
+
+    while (level >= 0)
+    {
+        char *page = db->path + (size_t)level * db->hdr.page_size;
+        int32_t *keys = inner_keys(page);
+        uint32_t *children = inner_children(db, page);
+        int n = node(page)->nkeys;
+        int pos = inner_child(page, key);
+
+        if (n < db->inner_max)
+        {
+            memmove(&keys[pos + 1], &keys[pos], (n - pos) * sizeof(*keys));
+            memmove(&children[pos + 2], &children[pos + 1], (n - pos) * sizeof(*children));
+            keys[pos] = key;
+            children[pos + 1] = child;
+            node(page)->nkeys++;
+            return write_page(db, path[level], page);
+        }
+
+        // full: n + 1 keys and n + 2 children, the middle key moves up
+        int32_t *tkeys = (int32_t *)db->spill;
+        uint32_t *tchildren = (uint32_t *)(tkeys + n + 1);
+
+        memcpy(tkeys, keys, pos * sizeof(*keys));
+        tkeys[pos] = key;
+        memcpy(&tkeys[pos + 1], &keys[pos], (n - pos) * sizeof(*keys));
+        memcpy(tchildren, children, (pos + 1) * sizeof(*children));
+        tchildren[pos + 1] = child;
+        memcpy(&tchildren[pos + 2], &children[pos + 1], (n - pos) * sizeof(*children));
+
+        int mid = (n + 1) / 2;
+        uint32_t right_pno = alloc_page(db);
+        char *right = db->split;
+
+        memset(right, 0, db->hdr.page_size);
+        node(right)->type = DB_NODE_INNER;
+        node(right)->nkeys = n - mid;
+        memcpy(inner_keys(right), &tkeys[mid + 1], (n - mid) * sizeof(*keys));
+        memcpy(inner_children(db, right), &tchildren[mid + 1], (n - mid + 1) * sizeof(*children));
+
+        memset(page + NODE_HDR_LEN, 0, db->hdr.page_size - NODE_HDR_LEN);
+        node(page)->nkeys = mid;
+        memcpy(keys, tkeys, mid * sizeof(*keys));
+        memcpy(children, tchildren, (mid + 1) * sizeof(*children));
+
+        if (write_page(db, right_pno, right) != NO_ERROR ||
+            write_page(db, path[level], page) != NO_ERROR)
+            return ERR_DB_FILE;
+
+        key = tkeys[mid];
+        child = right_pno;
+        left_pno = path[level];
+        level--;
+    }
+
+    // the root split, a new root points at both halves
+    uint32_t root_pno = alloc_page(db);
+    char *root = db->split;
+
+    memset(root, 0, db->hdr.page_size);
+    node(root)->type = DB_NODE_INNER;
+    node(root)->nkeys = 1;
+    inner_keys(root)[0] = key;
+    inner_children(db, root)[0] = left_pno;
+    inner_children(db, root)[1] = child;
+    if (write_page(db, root_pno, root) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    db->hdr.root = root_pno;
+    db->hdr.height++;
+    return NO_ERROR;
+}
+
+/*
+ *  db_page_get
+ *      db:  from db_page_open()
+ *      id:  student id
+ *      s:   filled with the student
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE
+ */
+int db_page_get(db_page_t *db, int id, db_page_rec_t *s)
+{
+    uint32_t path[DB_PAGE_MAX_HEIGHT];
+    char *leaf = descend(db, id, path);
+    bool found;
+    int pos;
+
+    if (leaf == NULL)
+        return ERR_DB_FILE;
+
+    pos = leaf_find(db, leaf, id, &found);
+    if (!found)
+        return SRCH_NOT_FOUND;
+
+    unpack_rec(db, leaf_rec(db, leaf, pos), s);
+    return NO_ERROR;
+}
+
+/*
+ *  db_page_insert
+ *      db:  from db_page_open()
+ *      s:   the student, names longer than the schema are cut
+ *
+ *  Splits the leaf in half when it is full and carries the split up the
+ *  tree.  New pages are written before the pages that point at them, the
+ *  header last.
+ *
+ *  returns:  NO_ERROR, ERR_DB_OP if the id exists or ERR_DB_FILE
+ */
+int db_page_insert(db_page_t *db, const db_page_rec_t *s)
+{
+    uint32_t path[DB_PAGE_MAX_HEIGHT];
+    char *leaf = descend(db, s->id, path);
+    int level = db->hdr.height - 1;
+    uint32_t rsize = db->hdr.record_size;
+    bool found;
+    int pos, n;
+
+    if (leaf == NULL)
+        return ERR_DB_FILE;
+
+    pos = leaf_find(db, leaf, s->id, &found);
+    if (found)
+        return ERR_DB_OP;
+
+    n = node(leaf)->nkeys;
+    if (n < db->leaf_max)
+    {
+        memmove(leaf_rec(db, leaf, pos + 1), leaf_rec(db, leaf, pos), (size_t)(n - pos) * rsize);
+        memset(leaf_rec(db, leaf, pos), 0, rsize);
+        pack_rec(db, leaf_rec(db, leaf, pos), s);
+        node(leaf)->nkeys++;
+        if (write_page(db, path[level], leaf) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    else
+    {
+        if (db->hdr.height >= DB_PAGE_MAX_HEIGHT || db->hdr.npages > UINT32_MAX - DB_PAGE_MAX_HEIGHT)
+            return ERR_DB_FILE;
+
+        // full: the n + 1 records in order, the upper half moves right
+        char *tmp = db->spill;
+
+        memcpy(tmp, leaf_rec(db, leaf, 0), (size_t)pos * rsize);
+        memset(tmp + (size_t)pos * rsize, 0, rsize);
+        pack_rec(db, tmp + (size_t)pos * rsize, s);
+        memcpy(tmp + (size_t)(pos + 1) * rsize, leaf_rec(db, leaf, pos), (size_t)(n - pos) * rsize);
+
+        int mid = (n + 1) / 2;
+        uint32_t right_pno = alloc_page(db);
+        char *right = db->split;
+
+        memset(right, 0, db->hdr.page_size);
+        node(right)->type = DB_NODE_LEAF;
+        node(right)->nkeys = n + 1 - mid;
+        node(right)->next = node(leaf)->next;
+        memcpy(leaf_rec(db, right, 0), tmp + (size_t)mid * rsize, (size_t)(n + 1 - mid) * rsize);
+
+        memset(leaf + NODE_HDR_LEN, 0, db->hdr.page_size - NODE_HDR_LEN);
+        node(leaf)->nkeys = mid;
+        node(leaf)->next = right_pno;
+        memcpy(leaf_rec(db, leaf, 0), tmp, (size_t)mid * rsize);
+
+        if (write_page(db, right_pno, right) != NO_ERROR ||
+            write_page(db, path[level], leaf) != NO_ERROR)
+            return ERR_DB_FILE;
+
+        if (insert_inner(db, path, level - 1, rec_id(leaf_rec(db, right, 0)), right_pno) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    db->hdr.count++;
+    return write_hdr(db);
+}
+
+/*
+ *  db_page_delete
+ *      db:  from db_page_open()
+ *      id:  student id
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE
+ */
+int db_page_delete(db_page_t *db, int id)
+{
+    uint32_t path[DB_PAGE_MAX_HEIGHT];
+    char *leaf = descend(db, id, path);
+    uint32_t rsize = db->hdr.record_size;
+    bool found;
+    int pos, n;
+
+    if (leaf == NULL)
+        return ERR_DB_FILE;
+
+    pos = leaf_find(db, leaf, id, &found);
+    if (!found)
+        return SRCH_NOT_FOUND;
+
+    n = node(leaf)->nkeys;
+    memmove(leaf_rec(db, leaf, pos), leaf_rec(db, leaf, pos + 1), (size_t)(n - pos - 1) * rsize);
+    memset(leaf_rec(db, leaf, n - 1), 0, rsize);
+    node(leaf)->nkeys--;
+    if (write_page(db, path[db->hdr.height - 1], leaf) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    db->hdr.count--;
+    return write_hdr(db);
+}
+
+/*
+ *  db_page_scan
+ *      db:   from db_page_open()
+ *      fn:   called with every student in id order, a non zero return
+ *            stops the scan and is returned
+ *      arg:  passed to fn
+ *
+ *  Walks down the leftmost edge, then along the leaf chain.
+ *
+ *  returns:  NO_ERROR, ERR_DB_FILE or what fn stopped with
+ */
+int db_page_scan(db_page_t *db, int (*fn)(const db_page_rec_t *s, void *arg), void *arg)
+{
+    uint32_t path[DB_PAGE_MAX_HEIGHT];
+    char *leaf = descend(db, INT32_MIN, path);
+    db_page_rec_t s;
+    uint32_t pno;
+    uint32_t visited = 0;
+
+    if (leaf == NULL)
+        return ERR_DB_FILE;
+
+    for (;;)
+    {
+        for (int i = 0; i < node(leaf)->nkeys; i++)
+        {
+            int rc;
+
+            unpack_rec(db, leaf_rec(db, leaf, i), &s);
+            rc = fn(&s, arg);
+            if (rc != 0)
+                return rc;
+        }
+
+        // a chain longer than the file is a loop
+        pno = node(leaf)->next;
+        if (pno == 0)
+            return NO_ERROR;
+        if (pno >= db->hdr.npages || ++visited >= db->hdr.npages)
+            return ERR_DB_FILE;
+        if (read_page(db, pno, leaf) != NO_ERROR || node(leaf)->type != DB_NODE_LEAF)
+            return ERR_DB_FILE;
+    }
+}
+
+static int set_schema(db_page_t *db, int fname_len, int lname_len, int page_size)
+{
+    uint32_t rsize = REC_FIXED_LEN + fname_len + lname_len;
+
+    // 4 byte aligned records keep the ids of a leaf aligned
+    rsize = (rsize + 3) & ~3u;
+
+    if (fname_len < 1 || fname_len > DB_PAGE_NAME_MAX || lname_len < 1 || lname_len > DB_PAGE_NAME_MAX)
+        return ERR_DB_OP;
+    if (page_size < DB_PAGE_MIN_SIZE || page_size > DB_PAGE_MAX_SIZE || (page_size & (page_size - 1)) != 0)
+        return ERR_DB_OP;
+    // a leaf split needs three records to leave two non empty halves
+    if ((page_size - NODE_HDR_LEN) / (int)rsize < 3)
+        return ERR_DB_OP;
+
+    memset(&db->hdr, 0, sizeof(db->hdr));
+    memcpy(db->hdr.magic, DB_PAGE_MAGIC, sizeof(db->hdr.magic));
+    db->hdr.version = DB_PAGE_VERSION;
+    db->hdr.page_size = page_size;
+    db->hdr.record_size = rsize;
+    db->hdr.fname_len = fname_len;
+    db->hdr.lname_len = lname_len;
+    return NO_ERROR;
+}
+
+static int check_hdr(db_page_t *db)
+{
+    db_page_hdr_t hdr = db->hdr;
+
+    if (memcmp(hdr.magic, DB_PAGE_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != DB_PAGE_VERSION)
+        return ERR_DB_FILE;
+    if (set_schema(db, hdr.fname_len, hdr.lname_len, hdr.page_size) != NO_ERROR ||
+        db->hdr.record_size != hdr.record_size)
+        return ERR_DB_FILE;
+    db->hdr = hdr;
+
+    if (hdr.height < 1 || hdr.height > DB_PAGE_MAX_HEIGHT || hdr.root == 0 || hdr.root >= hdr.npages)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  db_page_open
+ *      path:       the paged database, created if it does not exist
+ *      write:      true to lock it for db_page_insert()/db_page_delete()
+ *      reset:      true to empty it, with the schema below
+ *      fname_len:  name lengths and page size of a new or reset file
+ *      lname_len
+ *      page_size
+ *
+ *  An existing file keeps the schema in its header.  The lock is held
+ *  until db_page_close().
+ *
+ *  returns:  the open database, or NULL; *err tells ERR_DB_OP for a bad
+ *            schema from ERR_DB_FILE
+ */
+db_page_t *db_page_open(const char *path, bool write, bool reset, int fname_len, int lname_len,
+                        int page_size, int *err)
+{
+    db_page_t *db = &g_db_page;
+    struct stat st;
+    int lock = write || reset ? LOCK_EX : LOCK_SH;
+
+    *err = ERR_DB_FILE;
+    if (db->fd >= 0)
+        return NULL;
+
+    db->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (db->fd < 0)
+        return NULL;
+
+    while (flock(db->fd, lock) < 0)
+    {
+        if (errno != EINTR)
+            goto fail;
+    }
+    if (fstat(db->fd, &st) < 0)
+        goto fail;
+
+    // a reader that finds the file new has to create it
+    if (st.st_size == 0 && lock == LOCK_SH)
+    {
+        lock = LOCK_EX;
+        if (flock(db->fd, lock) < 0 || fstat(db->fd, &st) < 0)
+            goto fail;
+    }
+
+    if (reset || st.st_size == 0)
+    {
+        char *root;
+        int rc;
+
+        rc = set_schema(db, fname_len, lname_len, page_size);
+        if (rc != NO_ERROR)
+        {
+            *err = rc;
+            goto fail;
+        }
+        db->hdr.root = 1;
+        db->hdr.height = 1;
+        db->hdr.npages = 2;
+
+        root = calloc(1, db->hdr.page_size);
+        if (root == NULL)
+            goto fail;
+        node(root)->type = DB_NODE_LEAF;
+        rc = ftruncate(db->fd, 0) < 0 ? ERR_DB_FILE : write_page(db, 1, root);
+        free(root);
+        if (rc != NO_ERROR || write_hdr(db) != NO_ERROR)
+            goto fail;
+    }
+    else
+    {
+        if (pread(db->fd, &db->hdr, sizeof(db->hdr), 0) != (ssize_t)sizeof(db->hdr) ||
+            check_hdr(db) != NO_ERROR)
+            goto fail;
+    }
+
+    db->leaf_max = (db->hdr.page_size - NODE_HDR_LEN) / db->hdr.record_size;
+    db->inner_max = (db->hdr.page_size - NODE_HDR_LEN - sizeof(uint32_t)) /
+                    (sizeof(int32_t) + sizeof(uint32_t));
+    db->path = malloc((size_t)DB_PAGE_MAX_HEIGHT * db->hdr.page_size);
+    db->split = malloc(db->hdr.page_size);
+    // a full leaf plus one record, or a full inner node plus one key
+    db->spill = malloc(2 * (size_t)db->hdr.page_size);
+    if (db->path == NULL || db->split == NULL || db->spill == NULL)
+        goto fail;
+
+    return db;
+
+fail:
+    db_page_close(db);
+    return NULL;
+}
+
+/*
+ *  db_page_close
+ *      Releases the lock and the buffers of db.
+ */
+void db_page_close(db_page_t *db)
+{
+    if (db->fd >= 0)
+        close(db->fd);
+    free(db->path);
+    free(db->split);
+    free(db->spill);
+    memset(db, 0, sizeof(*db));
+    db->fd = -1;
+}
+
+static void print_page_hdr(db_page_t *db)
+{
+    printf(PAGE_PRINT_HDR_STRING, "ID", db->hdr.fname_len, "FIRST NAME", db->hdr.lname_len,
+           "LAST NAME", "GPA");
+}
+
+static void print_page_rec(db_page_t *db, const db_page_rec_t *s)
+{
+    printf(PAGE_PRINT_FMT_STRING, s->id, db->hdr.fname_len, s->fname, db->hdr.lname_len,
+           s->lname, s->gpa / 100.0);
+}
+
+static int print_one(const db_page_rec_t *s, void *arg)
+{
+    print_page_rec(arg, s);
+    return 0;
+}
+
+static int parse_page_id(const char *arg)
+{
+    char *end;
+    long id;
+
+    errno = 0;
+    id = strtol(arg, &end, 10);
+    if (errno != 0 || *end != '\0' || id < MIN_STD_ID || id > DB_PAGE_MAX_ID)
+        return -1;
+    return id;
+}
+
+/*
+ *  page_command
+ *      argc, argv:  main()'s, argv[1] is -P and argv[2] the option
+ *
+ *  Runs -a, -c, -d, -f, -p or -z on DB_PAGE_FILE, with the messages the
+ *  options print for student.db.  -z takes an optional schema:
+ *
+ *      -P -z [fname_len lname_len [page_size]]
+ *
+ *  returns:  the exit code for the shell
+ */
+int page_command(int argc, char *argv[])
+{
+    int fname_len = DB_PAGE_FNAME_LEN;
+    int lname_len = DB_PAGE_LNAME_LEN;
+    int page_size = DB_PAGE_SIZE;
+    db_page_rec_t s = {0};
+    db_page_t *db;
+    char opt;
+    int exit_code = EXIT_OK;
+    int id = 0;
+    int gpa;
+    int err;
+    int rc;
+
+    if (argc < 3 || argv[2][0] != '-' || argv[2][1] == '\0' || argv[2][2] != '\0' ||
+        strchr("acdfpz", argv[2][1]) == NULL)
+    {
+        usage(argv[0]);
+        return EXIT_FAIL_ARGS;
+    }
+    opt = argv[2][1];
+
+    switch (opt)
+    {
+    case 'a':
+        if (argc != 7)
+        {
+            usage(argv[0]);
+            return EXIT_FAIL_ARGS;
+        }
+        id = parse_page_id(argv[3]);
+        gpa = atoi(argv[6]);
+        if (id < 0 || gpa < MIN_STD_GPA || gpa > MAX_STD_GPA)
+        {
+            printf(M_ERR_STD_RNG);
+            return EXIT_FAIL_ARGS;
+        }
+        s.id = id;
+        s.gpa = gpa;
+        strncpy(s.fname, argv[4], DB_PAGE_NAME_MAX);
+        strncpy(s.lname, argv[5], DB_PAGE_NAME_MAX);
+        break;
+
+    case 'd':
+    case 'f':
+        if (argc != 4)
+        {
+            usage(argv[0]);
+            return EXIT_FAIL_ARGS;
+        }
+        id = parse_page_id(argv[3]);
+        if (id < 0)
+        {
+            printf(M_STD_NOT_FND_MSG, atoi(argv[3]));
+            return EXIT_FAIL_ARGS;
+        }
+        break;
+
+    case 'z':
+        if (argc != 3 && argc != 5 && argc != 6)
+        {
+            usage(argv[0]);
+            return EXIT_FAIL_ARGS;
+        }
+        if (argc >= 5)
+        {
+            fname_len = atoi(argv[3]);
+            lname_len = atoi(argv[4]);
+        }
+        if (argc == 6)
+            page_size = atoi(argv[5]);
+        break;
+
+    default:
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            return EXIT_FAIL_ARGS;
+        }
+        break;
+    }
+
+    db = db_page_open(DB_PAGE_FILE, opt == 'a' || opt == 'd', opt == 'z', fname_len, lname_len,
+                      page_size, &err);
+    if (db == NULL)
+    {
+        if (err == ERR_DB_OP)
+        {
+            printf(M_ERR_PAGE_SCHEMA, fname_len, lname_len, page_size);
+            return EXIT_FAIL_ARGS;
+        }
+        printf(M_ERR_DB_OPEN);
+        return EXIT_FAIL_DB;
+    }
+
+    switch (opt)
+    {
+    case 'a':
+        rc = db_page_insert(db, &s);
+        if (rc == NO_ERROR)
+            printf(M_STD_ADDED, id);
+        else if (rc == ERR_DB_OP)
+            printf(M_ERR_DB_ADD_DUP, id);
+        else
+            printf(M_ERR_DB_WRITE);
+        if (rc != NO_ERROR)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'c':
+        if (db->hdr.count == 0)
+            printf(M_DB_EMPTY);
+        else
+            printf(M_DB_RECORD_CNT, (int)db->hdr.count);
+        break;
+
+    case 'd':
+        rc = db_page_delete(db, id);
+        if (rc == NO_ERROR)
+            printf(M_STD_DEL_MSG, id);
+        else if (rc == SRCH_NOT_FOUND)
+            printf(M_STD_NOT_FND_MSG, id);
+        else
+            printf(M_ERR_DB_WRITE);
+        if (rc != NO_ERROR)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'f':
+        rc = db_page_get(db, id, &s);
+        if (rc == NO_ERROR)
+        {
+            print_page_hdr(db);
+            print_page_rec(db, &s);
+        }
+        else if (rc == SRCH_NOT_FOUND)
+            printf(M_STD_NOT_FND_MSG, id);
+        else
+            printf(M_ERR_DB_READ);
+        if (rc != NO_ERROR)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'p':
+        if (db->hdr.count == 0)
+        {
+            printf(M_DB_EMPTY);
+            break;
+        }
+        print_page_hdr(db);
+        if (db_page_scan(db, print_one, db) != NO_ERROR)
+        {
+            printf(M_ERR_DB_READ);
+            exit_code = EXIT_FAIL_DB;
+        }
+        break;
+
+    case 'z':
+        printf(M_DB_ZERO_OK);
+        break;
+    }
+
+    db_page_close(db);
+    return exit_code;
+}
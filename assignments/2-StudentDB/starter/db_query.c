@@ -0,0 +1,469 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Predicate queries
+ *
+ *  query_db() takes a conjunction of conditions such as
+ *
+ *      gpa>=350 and id between 1000 and 2000 and lname=doe*
+ *
+ *  and compiles it once into an id range, a gpa range and optional first
+ *  and last names (a trailing * matches a prefix).  gpa values are in the
+ *  -a form (350) or written as a real gpa (3.5).  The id range bounds the
+ *  part of the file that is read at all (see scan_db_range()), the blocks
+ *  that come back go through a branch free id/gpa filter, four records at
+ *  a time with SSE2, and only the survivors have their names compared.
+ */
+#define QUERY_TOKEN_MAX 64
+
+typedef enum query_tok {
+    TOK_END,
+    TOK_WORD,
+    TOK_NUMBER,
+    TOK_OP,
+} query_tok_t;
+
+typedef struct query_lexer {
+    const char *pos;
+    const char *start;          //start of the current token, for errors
+    query_tok_t kind;
+    char text[QUERY_TOKEN_MAX];
+} query_lexer_t;
+
+typedef struct query {
+    long id_lo;
+    long id_hi;
+    long gpa_lo;
+    long gpa_hi;
+    char lname[32];             //cut to the field sizes, like add_student()
+    char fname[24];
+    bool match_lname;
+    bool match_fname;
+    bool lname_prefix;
+    bool fname_prefix;
+
+    // matches, copied out of the scan blocks
+    student_t *out;
+    int num;
+    int cap;
+    bool sorted;
+} query_t;
+
+static int query_error(query_lexer_t *lx, const char *what)
+{
+    printf(M_ERR_QUERY, what, *lx->start != '\0' ? lx->start : "end of query");
+    return EXIT_FAIL_ARGS;
+}
+
+static bool is_word_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '-' || c == '*' || c == '.';
+}
+
+/*
+ *  next_token
+ *      Reads the token at lx->pos into lx->kind and lx->text.
+ */
+static int next_token(query_lexer_t *lx)
+{
+    const char *p = lx->pos;
+    size_t len = 0;
+
+    while (isspace((unsigned char)*p))
+        p++;
+    lx->start = p;
+
+    if (*p == '\0')
+    {
+        lx->kind = TOK_END;
+        lx->text[0] = '\0';
+        lx->pos = p;
+        return NO_ERROR;
+    }
+
+    if (*p == '\'' || *p == '"')
+    {
+        const char *close = strchr(p + 1, *p);
+
+        if (close == NULL)
+            return query_error(lx, "unterminated string");
+        len = close - (p + 1);
+        if (len >= QUERY_TOKEN_MAX)
+            return query_error(lx, "string too long");
+        memcpy(lx->text, p + 1, len);
+        lx->kind = TOK_WORD;
+        p = close + 1;
+    }
+    else if (*p == '<' || *p == '>' || *p == '=')
+    {
+        lx->text[len++] = *p++;
+        if (*p == '=')
+            lx->text[len++] = *p++;
+        lx->kind = TOK_OP;
+    }
+    else if (is_word_char(*p))
+    {
+        bool number = true;
+
+        for (; is_word_char(*p); p++)
+        {
+            if (len + 1 >= QUERY_TOKEN_MAX)
+                return query_error(lx, "word too long");
+            if (!isdigit((unsigned char)*p) && *p != '.')
+                number = false;
+            lx->text[len++] = *p;
+        }
+        lx->kind = number ? TOK_NUMBER : TOK_WORD;
+    }
+    else
+    {
+        return query_error(lx, "unexpected character");
+    }
+
+    lx->text[len] = '\0';
+    lx->pos = p;
+    return NO_ERROR;
+}
+
+static bool is_keyword(query_lexer_t *lx, const char *word)
+{
+    return lx->kind == TOK_WORD && strcasecmp(lx->text, word) == 0;
+}
+
+/*
+ *  parse_value
+ *      gpa:  allow a real gpa, 3.5 means 350
+ *
+ *  Reads the number at the current token and moves past it.
+ */
+static int parse_value(query_lexer_t *lx, bool gpa, long *value)
+{
+    char *end;
+
+    if (lx->kind != TOK_NUMBER)
+        return query_error(lx, "expected a number");
+
+    errno = 0;
+    if (strchr(lx->text, '.') != NULL)
+    {
+        double real = strtod(lx->text, &end);
+
+        if (!gpa)
+            return query_error(lx, "ids are whole numbers");
+        if (errno != 0 || *end != '\0' || real > INT_MAX / 100)
+            return query_error(lx, "bad number");
+        *value = (long)(real * 100 + 0.5);
+    }
+    else
+    {
+        *value = strtol(lx->text, &end, 10);
+        if (errno != 0 || *end != '\0' || *value > INT_MAX)
+            return query_error(lx, "bad number");
+    }
+
+    return next_token(lx);
+}
+
+static void narrow(long *lo, long *hi, long from, long to)
+{
+    if (from > *lo)
+        *lo = from;
+    if (to < *hi)
+        *hi = to;
+}
+
+static int parse_name(query_lexer_t *lx, char *name, size_t size, bool *match, bool *prefix)
+{
+    size_t len;
+
+    if (*match)
+        return query_error(lx, "name given twice");
+    if (lx->kind != TOK_WORD && lx->kind != TOK_NUMBER)
+        return query_error(lx, "expected a name");
+
+    len = strlen(lx->text);
+    *prefix = len > 0 && lx->text[len - 1] == '*';
+    if (*prefix)
+        lx->text[--len] = '\0';
+
+    memset(name, 0, size);
+    memcpy(name, lx->text, len < size - 1 ? len : size - 1);
+    *match = true;
+    return next_token(lx);
+}
+
+/*
+ *  parse_cond
+ *      field op value | field between value and value
+ */
+static int parse_cond(query_lexer_t *lx, query_t *q)
+{
+    long *lo;
+    long *hi;
+    long value;
+    long value2;
+    char op[3];
+    bool gpa;
+    int rc;
+
+    if (is_keyword(lx, "lname") || is_keyword(lx, "fname"))
+    {
+        bool last = is_keyword(lx, "lname");
+
+        if ((rc = next_token(lx)) != NO_ERROR)
+            return rc;
+        if (lx->kind != TOK_OP || (strcmp(lx->text, "=") != 0 && strcmp(lx->text, "==") != 0))
+            return query_error(lx, "names only compare with =");
+        if ((rc = next_token(lx)) != NO_ERROR)
+            return rc;
+
+        if (last)
+            return parse_name(lx, q->lname, sizeof(q->lname), &q->match_lname, &q->lname_prefix);
+        return parse_name(lx, q->fname, sizeof(q->fname), &q->match_fname, &q->fname_prefix);
+    }
+
+    if (is_keyword(lx, "id"))
+        gpa = false;
+    else if (is_keyword(lx, "gpa"))
+        gpa = true;
+    else
+        return query_error(lx, "expected id, gpa, lname or fname");
+
+    lo = gpa ? &q->gpa_lo : &q->id_lo;
+    hi = gpa ? &q->gpa_hi : &q->id_hi;
+    if ((rc = next_token(lx)) != NO_ERROR)
+        return rc;
+
+    if (is_keyword(lx, "between"))
+    {
+        if ((rc = next_token(lx)) != NO_ERROR ||
+            (rc = parse_value(lx, gpa, &value)) != NO_ERROR)
+            return rc;
+        if (!is_keyword(lx, "and"))
+            return query_error(lx, "expected and");
+        if ((rc = next_token(lx)) != NO_ERROR ||
+            (rc = parse_value(lx, gpa, &value2)) != NO_ERROR)
+            return rc;
+        narrow(lo, hi, value, value2);
+        return NO_ERROR;
+    }
+
+    if (lx->kind != TOK_OP)
+        return query_error(lx, "expected a comparison");
+    strcpy(op, lx->text);
+    if ((rc = next_token(lx)) != NO_ERROR ||
+        (rc = parse_value(lx, gpa, &value)) != NO_ERROR)
+        return rc;
+
+    if (strcmp(op, "<") == 0)
+        narrow(lo, hi, LONG_MIN, value - 1);
+    else if (strcmp(op, "<=") == 0)
+        narrow(lo, hi, LONG_MIN, value);
+    else if (strcmp(op, ">") == 0)
+        narrow(lo, hi, value + 1, LONG_MAX);
+    else if (strcmp(op, ">=") == 0)
+        narrow(lo, hi, value, LONG_MAX);
+    else
+        narrow(lo, hi, value, value);
+
+    return NO_ERROR;
+}
+
+/*
+ *  compile_query
+ *      text:  cond [and cond]...
+ *      q:     set to the ranges and names text allows
+ *
+ *  returns:  NO_ERROR, or EXIT_FAIL_ARGS with M_ERR_QUERY printed
+ */
+static int compile_query(const char *text, query_t *q)
+{
+    query_lexer_t lx = {.pos = text};
+    int rc;
+
+    memset(q, 0, sizeof(*q));
+    q->id_lo = MIN_STD_ID;
+    q->id_hi = MAX_STD_ID;
+    q->gpa_lo = MIN_STD_GPA;
+    q->gpa_hi = MAX_STD_GPA;
+    q->sorted = true;
+
+    if ((rc = next_token(&lx)) != NO_ERROR)
+        return rc;
+
+    for (;;)
+    {
+        if ((rc = parse_cond(&lx, q)) != NO_ERROR)
+            return rc;
+        if (lx.kind == TOK_END)
+            return NO_ERROR;
+        if (!is_keyword(&lx, "and"))
+            return query_error(&lx, "expected and");
+        if ((rc = next_token(&lx)) != NO_ERROR)
+            return rc;
+    }
+}
+
+/*
+ *  filter_block
+ *      hits:  set to the indexes of the records of recs[0..n) whose id and
+ *             gpa are in range
+ *
+ *  Empty slots have id 0, below every id range, so they drop out without
+ *  a test of their own.
+ *
+ *  returns:  the number of hits
+ */
+static int filter_block(const query_t *q, const student_t *recs, int n, int *hits)
+{
+    int id_lo = (int)q->id_lo, id_hi = (int)q->id_hi;
+    int gpa_lo = (int)q->gpa_lo, gpa_hi = (int)q->gpa_hi;
+    int nhits = 0;
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i v_id_lo = _mm_set1_epi32(id_lo);
+    const __m128i v_id_hi = _mm_set1_epi32(id_hi);
+    const __m128i v_gpa_lo = _mm_set1_epi32(gpa_lo);
+    const __m128i v_gpa_hi = _mm_set1_epi32(gpa_hi);
+
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i ids = _mm_set_epi32(recs[i + 3].id, recs[i + 2].id, recs[i + 1].id, recs[i].id);
+        __m128i gpas = _mm_set_epi32(recs[i + 3].gpa, recs[i + 2].gpa, recs[i + 1].gpa, recs[i].gpa);
+        __m128i out = _mm_or_si128(_mm_or_si128(_mm_cmplt_epi32(ids, v_id_lo),
+                                                _mm_cmpgt_epi32(ids, v_id_hi)),
+                                   _mm_or_si128(_mm_cmplt_epi32(gpas, v_gpa_lo),
+                                                _mm_cmpgt_epi32(gpas, v_gpa_hi)));
+        int mask = ~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xf;
+
+        while (mask != 0)
+        {
+            hits[nhits++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        hits[nhits] = i;
+        nhits += (recs[i].id >= id_lo) & (recs[i].id <= id_hi) &
+                 (recs[i].gpa >= gpa_lo) & (recs[i].gpa <= gpa_hi);
+    }
+
+    return nhits;
+}
+
+static bool name_matches(const char *field, const char *want, size_t size, bool prefix)
+{
+    return strncmp(field, want, prefix ? strlen(want) : size) == 0;
+}
+
+static int query_block(const student_t *recs, int n, void *arg)
+{
+    query_t *q = arg;
+    int hits[SCAN_BLOCK_RECS];
+    int nhits = filter_block(q, recs, n, hits);
+
+    for (int k = 0; k < nhits; k++)
+    {
+        const student_t *s = &recs[hits[k]];
+
+        if (q->match_lname && !name_matches(s->lname, q->lname, sizeof(q->lname), q->lname_prefix))
+            continue;
+        if (q->match_fname && !name_matches(s->fname, q->fname, sizeof(q->fname), q->fname_prefix))
+            continue;
+
+        if (q->num == q->cap)
+        {
+            int cap = q->cap ? q->cap * 2 : 256;
+            student_t *out = realloc(q->out, (size_t)cap * sizeof(student_t));
+            if (out == NULL)
+                return ERR_DB_OP;
+            q->out = out;
+            q->cap = cap;
+        }
+
+        // students appended to a packed database come after the compacted ones
+        if (q->num > 0 && q->out[q->num - 1].id > s->id)
+            q->sorted = false;
+        q->out[q->num++] = *s;
+    }
+
+    return NO_ERROR;
+}
+
+static int cmp_student_id(const void *a, const void *b)
+{
+    const student_t *sa = a;
+    const student_t *sb = b;
+
+    return (sa->id > sb->id) - (sa->id < sb->id);
+}
+
+/*
+ *  query_db
+ *      fd:    database file descriptor
+ *      text:  the predicate, see the top of this file
+ *
+ *  Prints the students matching text like print_db(), in id order.
+ *
+ *  returns:  NO_ERROR        at least one student matched
+ *            SRCH_NOT_FOUND  no student matched
+ *            EXIT_FAIL_ARGS  text is not a valid query
+ *            ERR_DB_FILE     database file I/O issue
+ *
+ *  console:  <see print_db()>   on success
+ *            M_QUERY_NO_MATCH   no student matched
+ *            M_ERR_QUERY        text is not a valid query
+ *            M_ERR_DB_READ      error reading the database file
+ */
+int query_db(int fd, const char *text)
+{
+    query_t q;
+    bool header_printed = false;
+    int rc;
+
+    rc = compile_query(text, &q);
+    if (rc != NO_ERROR)
+        return rc;
+
+    if (q.id_lo <= q.id_hi && q.gpa_lo <= q.gpa_hi)
+        rc = scan_db_range(fd, (int)q.id_lo, (int)q.id_hi, query_block, &q);
+
+    if (rc != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        free(q.out);
+        return ERR_DB_FILE;
+    }
+
+    if (!q.sorted)
+        qsort(q.out, q.num, sizeof(student_t), cmp_student_id);
+    for (int i = 0; i < q.num; i++)
+        print_record(&q.out[i], &header_printed);
+    free(q.out);
+
+    if (!header_printed)
+    {
+        printf(M_QUERY_NO_MATCH);
+        return SRCH_NOT_FOUND;
+    }
+
+    return NO_ERROR;
+}
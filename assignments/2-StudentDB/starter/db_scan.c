@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Sparse aware record scans
+ *
+ *  Records live at id * STUDENT_RECORD_SIZE, so a database holding ids 1 and
+ *  99999 is a 6.4MB file that is almost entirely hole.  scan_db() asks the
+ *  file system for the data extents with lseek(SEEK_DATA/SEEK_HOLE) and only
+ *  visits those, reading them SCAN_BLOCK_RECS records per pread() or, with
+ *  the mmap engine, straight out of the mapping.  File systems without
+ *  extent information report the whole file as one data extent, which
+ *  degrades to a plain block scan.
+ *
+ *  A packed database has no holes to skip.  It is walked through its index
+ *  instead, which keeps the id order even for students appended after the
+ *  last compaction.
+ *
+ *  With the mmap engine and an occupancy bitmap neither is needed, the set
+ *  bits name the live students and the mapping hands them out directly.
+ *  The read()/write() engine keeps using extents, which read runs of
+ *  neighbouring students with one pread() instead of one per student.
+ *
+ *  scan_db_range() exposes the extent walk itself for query filters that
+ *  want whole blocks of records, bounded to the slots of an id range.
+ *  Everything else gets only the live records of a block, picked out by
+ *  db_live_slots().
+ */
+
+static int scan_bitmap(db_map_t *map, db_pack_t *pack, db_bmp_t *bmp, db_scan_fn fn, void *arg)
+{
+    int rc = NO_ERROR;
+
+    if (db_map_refresh(map) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    for (int id = db_bmp_next(bmp, MIN_STD_ID); id >= 0 && rc == NO_ERROR;
+         id = db_bmp_next(bmp, id + 1))
+    {
+        int slot = pack != NULL ? db_pack_slot(pack, id) : id;
+        student_t *rec = slot > 0 ? db_map_record(map, slot) : NULL;
+
+        if (rec == NULL || rec->id != id)
+            continue;
+
+        rc = fn(rec, arg);
+    }
+
+    return rc;
+}
+
+/*
+ *  scan_packed
+ *      Visits the students of a packed database in id order.  Without the
+ *      mmap engine the (live * 64 byte) file is read into memory first.
+ */
+static int scan_packed(int fd, db_map_t *map, db_pack_t *pack, db_scan_fn fn, void *arg)
+{
+    student_t *recs;
+    student_t *buff = NULL;
+    off_t file_len;
+    int nrecs;
+    int rc = NO_ERROR;
+
+    if (map != NULL)
+    {
+        if (db_map_refresh(map) != NO_ERROR)
+            return ERR_DB_FILE;
+        recs = map->recs;
+        file_len = map->file_len;
+    }
+    else
+    {
+        file_len = lseek(fd, 0, SEEK_END);
+        if (file_len < 0)
+            return ERR_DB_FILE;
+
+        buff = malloc(file_len > 0 ? (size_t)file_len : 1);
+        if (buff == NULL)
+            return ERR_DB_FILE;
+
+        for (off_t done = 0; done < file_len;)
+        {
+            ssize_t io_size = pread(fd, (char *)buff + done, file_len - done, done);
+            if (io_size < 0 && errno == EINTR)
+                continue;
+            if (io_size <= 0)
+            {
+                file_len = done;
+                break;
+            }
+            done += io_size;
+        }
+        recs = buff;
+    }
+
+    nrecs = (int)(file_len / STUDENT_RECORD_SIZE);
+    for (int id = MIN_STD_ID; id <= MAX_STD_ID && rc == NO_ERROR; id++)
+    {
+        int slot = db_pack_slot(pack, id);
+
+        if (slot <= 0 || slot >= nrecs || recs[slot].id != id)
+            continue;
+
+        rc = fn(&recs[slot], arg);
+    }
+
+    free(buff);
+    return rc;
+}
+
+/*
+ *  scan_extent
+ *      Hands the slots [first, last) to fn, SCAN_BLOCK_RECS at a time.
+ */
+static int scan_extent(int fd, db_map_t *map, student_t *buff, int first, int last,
+                       db_block_fn fn, void *arg)
+{
+    int rc;
+
+    while (first < last)
+    {
+        const student_t *recs;
+        int n = last - first;
+
+        if (n > SCAN_BLOCK_RECS)
+            n = SCAN_BLOCK_RECS;
+
+        if (map != NULL)
+        {
+            recs = &map->recs[first];
+        }
+        else
+        {
+            ssize_t io_size = pread(fd, buff, (size_t)n * STUDENT_RECORD_SIZE,
+                                    (off_t)first * STUDENT_RECORD_SIZE);
+            if (io_size < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return ERR_DB_FILE;
+            }
+            // the file shrank under us, whatever is left is past the end
+            if (io_size < STUDENT_RECORD_SIZE)
+                return NO_ERROR;
+            n = io_size / STUDENT_RECORD_SIZE;
+            recs = buff;
+        }
+
+        rc = fn(recs, n, arg);
+        if (rc != NO_ERROR)
+            return rc;
+
+        first += n;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  scan_slots
+ *      Hands the data extents among the slots [first, last) to fn.
+ */
+static int scan_slots(int fd, db_map_t *map, int first, int last, db_block_fn fn, void *arg)
+{
+    student_t *buff = NULL;
+    off_t end;
+    off_t data;
+    off_t hole = (off_t)first * STUDENT_RECORD_SIZE;
+    int rc = NO_ERROR;
+
+    if (map != NULL)
+    {
+        if (db_map_refresh(map) != NO_ERROR)
+            return ERR_DB_FILE;
+        end = map->file_len;
+    }
+    else
+    {
+        end = lseek(fd, 0, SEEK_END);
+        if (end < 0)
+            return ERR_DB_FILE;
+
+        buff = malloc((size_t)SCAN_BLOCK_RECS * STUDENT_RECORD_SIZE);
+        if (buff == NULL)
+            return ERR_DB_FILE;
+    }
+
+    if (end > (off_t)last * STUDENT_RECORD_SIZE)
+        end = (off_t)last * STUDENT_RECORD_SIZE;
+
+    while (hole < end)
+    {
+        data = lseek(fd, hole, SEEK_DATA);
+        if (data < 0)
+        {
+            // ENXIO: nothing but hole up to the end of the file
+            if (errno != ENXIO)
+                rc = ERR_DB_FILE;
+            break;
+        }
+        if (data >= end)
+            break;
+
+        hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0)
+        {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        if (hole > end)
+            hole = end;
+
+        // extents are block aligned and blocks hold whole records, only a
+        // truncated record at the very end of the file is dropped
+        rc = scan_extent(fd, map, buff,
+                         (int)(data / STUDENT_RECORD_SIZE),
+                         (int)(hole / STUDENT_RECORD_SIZE),
+                         fn, arg);
+        if (rc != NO_ERROR)
+            break;
+    }
+
+    free(buff);
+    return rc;
+}
+
+typedef struct record_visit {
+    db_scan_fn fn;
+    void *arg;
+} record_visit_t;
+
+static int visit_records(const student_t *recs, int n, void *arg)
+{
+    record_visit_t *visit = arg;
+    int live[SCAN_BLOCK_RECS];
+    int nlive = db_live_slots(recs, n, live);
+    int rc;
+
+    for (int i = 0; i < nlive; i++)
+    {
+        rc = visit->fn(&recs[live[i]], visit->arg);
+        if (rc != NO_ERROR)
+            return rc;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  scan_db
+ *      fd:   database file descriptor
+ *      fn:   called for every live record, in id order
+ *      arg:  passed through to fn
+ *
+ *  Scanning stops early when fn returns anything but NO_ERROR.
+ *
+ *  returns:  NO_ERROR     every live record was visited
+ *            ERR_DB_FILE  database file I/O issue
+ *            <rc>         the value fn stopped the scan with
+ *
+ *  console:  Does not produce any console I/O
+ */
+int scan_db(int fd, db_scan_fn fn, void *arg)
+{
+    db_map_t *map = db_map_find(fd);
+    record_visit_t visit = {fn, arg};
+    int rc;
+
+    // writers wait for the scan, it sees the database as of one moment
+    if (db_lock_all(fd, DB_LOCK_SH) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (map != NULL && db_bmp_find(fd) != NULL)
+        rc = scan_bitmap(map, db_pack_find(fd), db_bmp_find(fd), fn, arg);
+    else if (db_pack_find(fd) != NULL)
+        rc = scan_packed(fd, map, db_pack_find(fd), fn, arg);
+    else
+        rc = scan_slots(fd, map, 0, INT_MAX, visit_records, &visit);
+
+    db_lock_all(fd, DB_LOCK_UN);
+    return rc;
+}
+
+/*
+ *  scan_db_range
+ *      fd:        database file descriptor
+ *      first_id:  lowest id of interest
+ *      last_id:   highest id of interest
+ *      fn:        called with blocks of up to SCAN_BLOCK_RECS slots
+ *      arg:       passed through to fn
+ *
+ *  For callers that filter whole blocks at a time.  Only the slots that
+ *  can hold ids in [first_id, last_id] are read, holes are skipped, but a
+ *  block is handed over as it is in the file: it has empty slots and, in
+ *  a packed database, students outside the range among the wanted ones.
+ *  fn has to check every record's id.
+ *
+ *  returns:  NO_ERROR     the whole range was visited
+ *            ERR_DB_FILE  database file I/O issue
+ *            <rc>         the value fn stopped the scan with
+ *
+ *  console:  Does not produce any console I/O
+ */
+int scan_db_range(int fd, int first_id, int last_id, db_block_fn fn, void *arg)
+{
+    db_pack_t *pack = db_pack_find(fd);
+    int first = first_id < MIN_STD_ID ? MIN_STD_ID : first_id;
+    int last = last_id > MAX_STD_ID ? MAX_STD_ID : last_id;
+    int rc = NO_ERROR;
+
+    if (first > last)
+        return NO_ERROR;
+    if (db_lock_all(fd, DB_LOCK_SH) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // a packed database keeps compacted students in id order, so the range
+    // is the slots between its lowest and highest slot
+    if (pack != NULL)
+    {
+        int lo = INT_MAX;
+        int hi = 0;
+
+        for (int id = first; id <= last; id++)
+        {
+            int slot = db_pack_slot(pack, id);
+
+            if (slot <= 0)
+                continue;
+            if (slot < lo)
+                lo = slot;
+            if (slot > hi)
+                hi = slot;
+        }
+        first = lo;
+        last = hi;
+    }
+
+    if (first <= last)
+        rc = scan_slots(fd, db_map_find(fd), first, last + 1, fn, arg);
+
+    db_lock_all(fd, DB_LOCK_UN);
+    return rc;
+}
@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Server mode
+ *
+ *  "sdbsc -s [socket]" keeps the database open, with its mapping and
+ *  sidecars, and answers requests on a UNIX domain socket (by default
+ *  dbFile + DB_SOCK_SUFFIX, or $SDB_SOCKET).  "sdbsc -U -a|-c|-d|-f ..."
+ *  sends the same operation to it instead of opening the database, and
+ *  prints exactly what the local operation would.
+ *
+ *  Requests and responses are fixed size db_req_t / db_resp_t structs in
+ *  host byte order, the socket never leaves the machine.  A client may
+ *  pipeline any number of requests on one connection, they are answered
+ *  in order.  The server is a single thread polling every connection, so
+ *  requests from different clients never interleave.
+ *
+ *  A compaction by another process renames a new database over the one
+ *  the server has open.  Every request first checks for that and reopens
+ *  DB_FILE, so the server never answers from the unlinked old file.
+ */
+#define SERVER_MAX_CLIENTS  64
+#define SERVER_BACKLOG      64
+
+//the database being served, fd changes when it is reopened
+typedef struct server_db {
+    int fd;
+    int open_flags;
+} server_db_t;
+
+typedef struct server_conn {
+    int fd;
+    size_t fill;                //bytes of req received so far
+    db_req_t req;
+} server_conn_t;
+
+static volatile sig_atomic_t g_server_stop;
+
+static void server_stop(int sig)
+{
+    (void)sig;
+    g_server_stop = 1;
+}
+
+/*
+ *  db_socket_path
+ *      returns:  the server socket, $SDB_SOCKET or DB_FILE + DB_SOCK_SUFFIX
+ */
+const char *db_socket_path(void)
+{
+    const char *path = getenv(DB_SOCK_ENV);
+
+    return path != NULL && *path != '\0' ? path : DB_FILE DB_SOCK_SUFFIX;
+}
+
+static int make_addr(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+        return ERR_DB_FILE;
+
+    strcpy(addr->sun_path, path);
+    return NO_ERROR;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        p += n;
+        len -= n;
+    }
+
+    return NO_ERROR;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        p += n;
+        len -= n;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  run_request
+ *      Runs one request against fd.  Only the status and the data go back,
+ *      the client prints the messages.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_OP for a request the server does not know
+ */
+static int run_request(int fd, db_req_t *req, db_resp_t *resp)
+{
+    student_t s;
+    int rc;
+
+    memset(resp, 0, sizeof(*resp));
+
+    switch (req->op)
+    {
+    case DB_REQ_GET:
+        resp->status = get_student(fd, req->id, &resp->rec);
+        break;
+
+    case DB_REQ_ADD:
+        if (validate_range(req->id, req->gpa) != NO_ERROR)
+        {
+            resp->status = ERR_DB_OP;
+            break;
+        }
+        memset(&s, 0, STUDENT_RECORD_SIZE);
+        s.id = req->id;
+        s.gpa = req->gpa;
+        strncpy(s.fname, req->fname, sizeof(s.fname) - 1);
+        strncpy(s.lname, req->lname, sizeof(s.lname) - 1);
+        resp->status = insert_student(fd, &s);
+        break;
+
+    case DB_REQ_DEL:
+        resp->status = remove_student(fd, req->id);
+        break;
+
+    case DB_REQ_COUNT:
+        rc = count_students(fd);
+        resp->status = rc < 0 ? rc : NO_ERROR;
+        resp->count = rc < 0 ? 0 : rc;
+        break;
+
+    default:
+        return ERR_DB_OP;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  handle_request
+ *      run_request() on the current database.  A write that failed because
+ *      a compaction replaced the file while it ran is retried once on the
+ *      new file.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_OP for a request the server does not know
+ */
+static int handle_request(server_db_t *db, db_req_t *req, db_resp_t *resp)
+{
+    int rc;
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        db->fd = reopen_db(db->fd, DB_FILE, db->open_flags);
+        if (db->fd < 0)
+        {
+            memset(resp, 0, sizeof(*resp));
+            resp->status = ERR_DB_FILE;
+            return NO_ERROR;
+        }
+
+        rc = run_request(db->fd, req, resp);
+        if (rc != NO_ERROR || resp->status != ERR_DB_FILE || !db_replaced(db->fd))
+            break;
+    }
+
+    return rc;
+}
+
+/*
+ *  serve_conn
+ *      Reads what conn has sent and answers every complete request.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE once the connection should be closed
+ */
+static int serve_conn(server_db_t *db, server_conn_t *conn)
+{
+    db_resp_t resp;
+
+    for (;;)
+    {
+        ssize_t n = read(conn->fd, (char *)&conn->req + conn->fill, sizeof(conn->req) - conn->fill);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return NO_ERROR;
+        if (n <= 0)
+            return ERR_DB_FILE;
+
+        conn->fill += n;
+        if (conn->fill < sizeof(conn->req))
+            continue;
+
+        conn->fill = 0;
+        if (handle_request(db, &conn->req, &resp) != NO_ERROR ||
+            write_full(conn->fd, &resp, sizeof(resp)) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+}
+
+/*
+ *  serve_db
+ *      fd:          database file descriptor, stays open while serving and
+ *                   is set to the new one if the database is reopened
+ *      open_flags:  open_db_ex() flags fd was opened with
+ *      path:        socket to listen on
+ *
+ *  Serves requests until SIGINT or SIGTERM.  A socket file left behind by
+ *  a server that is gone is replaced, one that still answers is not.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_SERVER_READY once listening
+ *            M_ERR_SERVER   the socket cannot be set up
+ */
+int serve_db(int *fd, int open_flags, const char *path)
+{
+    server_db_t db = {.fd = *fd, .open_flags = open_flags & ~DB_OPEN_TRUNC};
+    struct pollfd pfds[SERVER_MAX_CLIENTS + 1];
+    server_conn_t conns[SERVER_MAX_CLIENTS];
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    int nconns = 0;
+    int lfd;
+
+    if (make_addr(path, &addr) != NO_ERROR)
+    {
+        printf(M_ERR_SERVER, path);
+        return ERR_DB_FILE;
+    }
+
+    lfd = client_connect(path);
+    if (lfd >= 0)
+    {
+        close(lfd);
+        printf(M_ERR_SERVER, path);
+        return ERR_DB_FILE;
+    }
+    unlink(path);
+
+    lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(lfd, SERVER_BACKLOG) < 0)
+    {
+        if (lfd >= 0)
+            close(lfd);
+        printf(M_ERR_SERVER, path);
+        return ERR_DB_FILE;
+    }
+
+    // no SA_RESTART, poll() has to return to see the stop flag
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf(M_SERVER_READY, path);
+    fflush(stdout);
+
+    while (!g_server_stop)
+    {
+        // with the table full the listener is not polled, pending
+        // connections wait in the backlog instead of waking poll() forever
+        pfds[0].fd = lfd;
+        pfds[0].events = nconns < SERVER_MAX_CLIENTS ? POLLIN : 0;
+        for (int i = 0; i < nconns; i++)
+        {
+            pfds[i + 1].fd = conns[i].fd;
+            pfds[i + 1].events = POLLIN;
+        }
+
+        if (poll(pfds, nconns + 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        // walk backwards, a closed connection is replaced by the last one
+        for (int i = nconns - 1; i >= 0; i--)
+        {
+            if (pfds[i + 1].revents == 0)
+                continue;
+            if (serve_conn(&db, &conns[i]) != NO_ERROR)
+            {
+                close(conns[i].fd);
+                conns[i] = conns[--nconns];
+            }
+        }
+
+        if (pfds[0].revents & POLLIN)
+        {
+            int cfd;
+
+            while (nconns < SERVER_MAX_CLIENTS &&
+                   (cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0)
+            {
+                conns[nconns].fd = cfd;
+                conns[nconns].fill = 0;
+                nconns++;
+            }
+        }
+    }
+
+    for (int i = 0; i < nconns; i++)
+        close(conns[i].fd);
+    close(lfd);
+    unlink(path);
+    *fd = db.fd;
+    return NO_ERROR;
+}
+
+/*
+ *  client_connect
+ *      returns:  a connection to the server at path, or ERR_DB_FILE
+ */
+int client_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    int sock;
+
+    if (make_addr(path, &addr) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return ERR_DB_FILE;
+
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(sock);
+        return ERR_DB_FILE;
+    }
+
+    return sock;
+}
+
+/*
+ *  client_call
+ *      Sends req and waits for its response.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if the server went away
+ */
+static int client_call(int sock, db_req_t *req, db_resp_t *resp)
+{
+    if (write_full(sock, req, sizeof(*req)) != NO_ERROR ||
+        read_full(sock, resp, sizeof(*resp)) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  client_get_student
+ *      Like get_student(), through the server.
+ */
+int client_get_student(int sock, int id, student_t *s)
+{
+    db_req_t req = {.op = DB_REQ_GET, .id = id};
+    db_resp_t resp;
+
+    if (client_call(sock, &req, &resp) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (resp.status == NO_ERROR)
+        *s = resp.rec;
+    return resp.status;
+}
+
+/*
+ *  client_add_student
+ *      Like add_student(), through the server.
+ */
+int client_add_student(int sock, int id, char *fname, char *lname, int gpa)
+{
+    db_req_t req = {.op = DB_REQ_ADD, .id = id, .gpa = gpa};
+    db_resp_t resp;
+
+    strncpy(req.fname, fname, sizeof(req.fname) - 1);
+    strncpy(req.lname, lname, sizeof(req.lname) - 1);
+
+    if (client_call(sock, &req, &resp) != NO_ERROR)
+        resp.status = ERR_DB_FILE;
+
+    switch (resp.status)
+    {
+    case NO_ERROR:
+        printf(M_STD_ADDED, id);
+        break;
+    case ERR_DB_OP:
+        printf(M_ERR_DB_ADD_DUP, id);
+        break;
+    default:
+        printf(M_ERR_DB_WRITE);
+        resp.status = ERR_DB_FILE;
+        break;
+    }
+
+    return resp.status;
+}
+
+/*
+ *  client_del_student
+ *      Like del_student(), through the server.
+ */
+int client_del_student(int sock, int id)
+{
+    db_req_t req = {.op = DB_REQ_DEL, .id = id};
+    db_resp_t resp;
+
+    if (client_call(sock, &req, &resp) != NO_ERROR)
+        resp.status = ERR_DB_FILE;
+
+    switch (resp.status)
+    {
+    case NO_ERROR:
+        printf(M_STD_DEL_MSG, id);
+        break;
+    case SRCH_NOT_FOUND:
+        printf(M_STD_NOT_FND_MSG, id);
+        resp.status = ERR_DB_OP;
+        break;
+    default:
+        printf(M_ERR_DB_WRITE);
+        resp.status = ERR_DB_FILE;
+        break;
+    }
+
+    return resp.status;
+}
+
+/*
+ *  client_count_db_records
+ *      Like count_db_records(), through the server.
+ */
+int client_count_db_records(int sock)
+{
+    db_req_t req = {.op = DB_REQ_COUNT};
+    db_resp_t resp;
+
+    if (client_call(sock, &req, &resp) != NO_ERROR || resp.status != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (resp.count == 0)
+        printf(M_DB_EMPTY);
+    else
+        printf(M_DB_RECORD_CNT, resp.count);
+
+    return resp.count;
+}
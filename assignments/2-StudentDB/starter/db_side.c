@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Sidecar files
+ *
+ *  The bitmap, the name index and the other accelerators live in files
+ *  next to the database and start with a db_side_hdr_t.  They are caches:
+ *  the header records which database (device + inode) the contents were
+ *  built from and how many updates are in flight, and any sidecar that
+ *  does not match is rebuilt from the database by its owner.
+ */
+
+/*
+ *  db_side_map
+ *      path:  sidecar file, created if missing
+ *      len:   minimum length, the file is extended to it
+ *      base:  set to a MAP_SHARED mapping of the whole file
+ *      mlen:  set to the length of the mapping
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_side_map(const char *path, size_t len, void **base, size_t *mlen)
+{
+    struct stat st;
+    void *p;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+
+    if (fd < 0)
+        return ERR_DB_FILE;
+
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    if ((size_t)st.st_size < len)
+    {
+        if (ftruncate(fd, len) < 0)
+        {
+            close(fd);
+            return ERR_DB_FILE;
+        }
+        st.st_size = len;
+    }
+
+    p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return ERR_DB_FILE;
+
+    *base = p;
+    *mlen = st.st_size;
+    return NO_ERROR;
+}
+
+/*
+ *  db_side_valid
+ *      returns:  true if hdr was built by this magic/version for the
+ *                database db_st and no update was interrupted
+ */
+bool db_side_valid(db_side_hdr_t *hdr, const char *magic, int version, struct stat *db_st)
+{
+    return strncmp(hdr->magic, magic, sizeof(hdr->magic)) == 0 &&
+           hdr->version == version &&
+           hdr->dev == (uint64_t)db_st->st_dev &&
+           hdr->ino == (uint64_t)db_st->st_ino &&
+           __atomic_load_n(&hdr->writers, __ATOMIC_ACQUIRE) == 0;
+}
+
+/*
+ *  db_side_stamp
+ *      Marks a freshly rebuilt sidecar as describing the database db_st.
+ */
+void db_side_stamp(db_side_hdr_t *hdr, const char *magic, int version, struct stat *db_st)
+{
+    memset(hdr->magic, 0, sizeof(hdr->magic));
+    memcpy(hdr->magic, magic, strnlen(magic, sizeof(hdr->magic)));
+    hdr->version = version;
+    hdr->dev = db_st->st_dev;
+    hdr->ino = db_st->st_ino;
+    __atomic_store_n(&hdr->writers, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ *  db_side_begin / db_side_end
+ *
+ *  Bracket every database write together with the sidecar update that
+ *  goes with it.  If the process dies in between, the writer count stays
+ *  raised and the next open rebuilds the sidecar instead of trusting it.
+ */
+void db_side_begin(db_side_hdr_t *hdr)
+{
+    __atomic_add_fetch(&hdr->writers, 1, __ATOMIC_ACQ_REL);
+}
+
+void db_side_end(db_side_hdr_t *hdr)
+{
+    __atomic_sub_fetch(&hdr->writers, 1, __ATOMIC_ACQ_REL);
+}
@@ -0,0 +1,561 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+/*
+ *  Write-ahead log
+ *
+ *  Once a database has a log (dbFile + DB_WAL_SUFFIX, see "-W on") every
+ *  add, delete and bulk load first appends full images of the changed
+ *  records to it and fdatasync()s the log before the records are written
+ *  in place.  The in place writes are not synced, so a mutation costs one
+ *  sequential append plus a sync instead of a random 64 byte write that
+ *  has to reach the disk.  student.db itself is synced by a checkpoint,
+ *  which then empties the log, in a background process once the log grows
+ *  past DB_WAL_CHECKPOINT_BYTES or on request with "-W checkpoint".
+ *
+ *  Group commit: the header keeps how far the log is known to be synced.
+ *  A writer whose entries end before that mark skips its own sync, and a
+ *  bulk load logs all of its students with one write() and one sync.
+ *
+ *  Recovery: every mutation holds a shared flock() on the log and bumps
+ *  pending while it runs, a checkpoint holds it exclusively.  The log is
+ *  replayed when pending shows a writer died mid mutation or the boot id
+ *  changed, meaning the unsynced in place writes may be gone.  Entries are
+ *  full record images, so replaying ones that already landed is harmless.
+ */
+#define WAL_HDR_MAP_LEN     4096
+#define WAL_BOOT_ID_FILE    "/proc/sys/kernel/random/boot_id"
+
+static db_wal_t g_db_wal = {.fd = -1, .db_fd = -1};
+
+/*
+ *  fnv1a
+ *      returns:  the 64 bit FNV-1a hash of buf[0..len)
+ */
+static uint64_t fnv1a(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+/*
+ *  boot_hash
+ *      returns:  a hash of the boot id, 0 if it cannot be read, which makes
+ *                every open replay the log
+ */
+static uint64_t boot_hash(void)
+{
+    char id[64];
+    ssize_t len;
+    int fd = open(WAL_BOOT_ID_FILE, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return 0;
+
+    len = read(fd, id, sizeof(id));
+    close(fd);
+    if (len <= 0)
+        return 0;
+
+    return fnv1a(id, len) | 1;
+}
+
+static uint32_t ent_check(const db_wal_ent_t *ent)
+{
+    uint64_t hash = fnv1a(&ent->op, sizeof(*ent) - offsetof(db_wal_ent_t, op));
+
+    return (uint32_t)(hash ^ (hash >> 32)) | 1;
+}
+
+static void make_ent(db_wal_ent_t *ent, int id, const student_t *s)
+{
+    memset(ent, 0, sizeof(*ent));
+    ent->op = s->id == DELETED_STUDENT_ID ? DB_WAL_DEL : DB_WAL_PUT;
+    ent->id = id;
+    ent->rec = *s;
+    ent->check = ent_check(ent);
+}
+
+static bool hdr_valid(db_wal_hdr_t *hdr)
+{
+    return strncmp(hdr->magic, DB_WAL_MAGIC, sizeof(hdr->magic)) == 0 &&
+           hdr->version == DB_WAL_VERSION;
+}
+
+static void hdr_init(db_wal_hdr_t *hdr)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    strncpy(hdr->magic, DB_WAL_MAGIC, sizeof(hdr->magic));
+    hdr->version = DB_WAL_VERSION;
+    hdr->synced = sizeof(db_wal_hdr_t);
+    hdr->boot = boot_hash();
+}
+
+/*
+ *  map_hdr
+ *      Opens the log at path and maps its header, the file has to exist
+ *      unless create is set.
+ */
+static int map_hdr(db_wal_t *wal, const char *path, bool create)
+{
+    struct stat st;
+    int flags = O_RDWR | O_APPEND | O_CLOEXEC | (create ? O_CREAT : 0);
+    int fd = open(path, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+
+    if (fd < 0)
+        return ERR_DB_FILE;
+
+    if (fstat(fd, &st) < 0 ||
+        ((size_t)st.st_size < sizeof(db_wal_hdr_t) && ftruncate(fd, sizeof(db_wal_hdr_t)) < 0))
+    {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    wal->hdr = mmap(NULL, WAL_HDR_MAP_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (wal->hdr == MAP_FAILED)
+    {
+        wal->hdr = NULL;
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    wal->fd = fd;
+    snprintf(wal->path, sizeof(wal->path), "%s", path);
+    return NO_ERROR;
+}
+
+static void unmap_hdr(db_wal_t *wal)
+{
+    munmap(wal->hdr, WAL_HDR_MAP_LEN);
+    close(wal->fd);
+    wal->fd = -1;
+    wal->db_fd = -1;
+    wal->hdr = NULL;
+}
+
+/*
+ *  checkpoint_locked
+ *      wal_fd:  log file, locked exclusively by the caller
+ *
+ *  Syncs the database and empties the log.
+ */
+static int checkpoint_locked(int db_fd, int wal_fd, db_wal_hdr_t *hdr)
+{
+    db_map_t *map = db_map_find(db_fd);
+
+    if (map != NULL && map->map_len > 0 && msync(map->recs, map->map_len, MS_SYNC) < 0)
+        return ERR_DB_FILE;
+    if (fsync(db_fd) < 0)
+        return ERR_DB_FILE;
+
+    if (ftruncate(wal_fd, sizeof(db_wal_hdr_t)) < 0)
+        return ERR_DB_FILE;
+
+    // no mutation runs under the exclusive lock, a raised pending count is
+    // left over from a writer that died and was just recovered
+    __atomic_store_n(&hdr->pending, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->synced, sizeof(db_wal_hdr_t), __ATOMIC_RELEASE);
+    hdr->boot = boot_hash();
+    if (fsync(wal_fd) < 0)
+        return ERR_DB_FILE;
+
+    return NO_ERROR;
+}
+
+/*
+ *  replay
+ *      Hands every intact entry of the log to fn, in log order.  A torn
+ *      entry at the end, from a crash mid append, ends the log.
+ */
+static int replay(int wal_fd, db_wal_replay_fn fn, int db_fd)
+{
+    db_wal_ent_t ents[SCAN_BLOCK_RECS / 4];
+    off_t offset = sizeof(db_wal_hdr_t);
+    ssize_t io_size;
+
+    while ((io_size = pread(wal_fd, ents, sizeof(ents), offset)) > 0)
+    {
+        int n = io_size / sizeof(db_wal_ent_t);
+
+        for (int i = 0; i < n; i++)
+        {
+            if (ents[i].check != ent_check(&ents[i]) ||
+                (ents[i].op != DB_WAL_PUT && ents[i].op != DB_WAL_DEL))
+                return NO_ERROR;
+
+            if (fn(db_fd, ents[i].id, &ents[i].rec) != NO_ERROR)
+                return ERR_DB_FILE;
+        }
+        if (n == 0)
+            break;
+        offset += (off_t)n * sizeof(db_wal_ent_t);
+    }
+
+    return io_size < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  db_wal_open
+ *      fd:      database file descriptor
+ *      dbFile:  name of the database, used to find the log
+ *      reset:   the database was just truncated, drop every entry
+ *      fn:      applies one replayed entry to fd
+ *
+ *  Does nothing if the database has no log.  Otherwise recovers the log
+ *  if needed and makes fd log its mutations.  Called before the sidecars
+ *  are opened, they have to be rebuilt after a replay.
+ *
+ *  returns:  NO_ERROR         fd has no log, or one that needed no replay
+ *            DB_WAL_REPLAYED  the log was replayed into the database
+ *            ERR_DB_FILE      the log is unusable
+ */
+int db_wal_open(int fd, const char *dbFile, bool reset, db_wal_replay_fn fn)
+{
+    db_wal_t *wal = &g_db_wal;
+    char path[PATH_MAX];
+    struct stat st;
+    int rc = NO_ERROR;
+
+    if (wal->fd >= 0)
+        return ERR_DB_FILE;
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, DB_WAL_SUFFIX);
+    if (access(path, F_OK) != 0)
+        return NO_ERROR;
+    if (map_hdr(wal, path, false) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (flock(wal->fd, LOCK_EX) < 0 || fstat(wal->fd, &st) < 0)
+    {
+        unmap_hdr(wal);
+        return ERR_DB_FILE;
+    }
+
+    if (!hdr_valid(wal->hdr))
+    {
+        // an unusable header leaves no way to trust the entries
+        hdr_init(wal->hdr);
+        reset = true;
+    }
+
+    // a truncated database drops the log, a recovered one is synced so
+    // the log is not replayed again
+    if (reset)
+    {
+        rc = checkpoint_locked(fd, wal->fd, wal->hdr);
+    }
+    else if (st.st_size > (off_t)sizeof(db_wal_hdr_t) &&
+             (__atomic_load_n(&wal->hdr->pending, __ATOMIC_ACQUIRE) != 0 ||
+              wal->hdr->boot != boot_hash() || wal->hdr->boot == 0))
+    {
+        rc = replay(wal->fd, fn, fd);
+        if (rc == NO_ERROR && checkpoint_locked(fd, wal->fd, wal->hdr) == NO_ERROR)
+            rc = DB_WAL_REPLAYED;
+        else
+            rc = ERR_DB_FILE;
+    }
+
+    flock(wal->fd, LOCK_UN);
+    if (rc < 0)
+    {
+        unmap_hdr(wal);
+        return ERR_DB_FILE;
+    }
+
+    wal->db_fd = fd;
+    return rc;
+}
+
+void db_wal_close(int fd)
+{
+    if (fd < 0 || g_db_wal.db_fd != fd)
+        return;
+
+    unmap_hdr(&g_db_wal);
+}
+
+/*
+ *  db_wal_find
+ *      returns:  the log of fd, or NULL if fd writes in place
+ */
+db_wal_t *db_wal_find(int fd)
+{
+    if (fd < 0 || g_db_wal.db_fd != fd)
+        return NULL;
+
+    return &g_db_wal;
+}
+
+/*
+ *  db_wal_enable
+ *      Creates the log of fd, every later mutation goes through it.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_wal_enable(int fd, const char *dbFile)
+{
+    db_wal_t *wal = &g_db_wal;
+    char path[PATH_MAX];
+
+    if (wal->db_fd == fd)
+        return NO_ERROR;
+    if (wal->fd >= 0)
+        return ERR_DB_FILE;
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, DB_WAL_SUFFIX);
+    if (map_hdr(wal, path, true) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (flock(wal->fd, LOCK_EX) < 0)
+    {
+        unmap_hdr(wal);
+        return ERR_DB_FILE;
+    }
+    if (!hdr_valid(wal->hdr))
+        hdr_init(wal->hdr);
+    fsync(wal->fd);
+    flock(wal->fd, LOCK_UN);
+
+    wal->db_fd = fd;
+    return NO_ERROR;
+}
+
+/*
+ *  db_wal_disable
+ *      Checkpoints the log of fd and removes it, fd writes in place again.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_wal_disable(int fd)
+{
+    db_wal_t *wal = db_wal_find(fd);
+    int rc;
+
+    if (wal == NULL)
+        return NO_ERROR;
+
+    if (flock(wal->fd, LOCK_EX) < 0)
+        return ERR_DB_FILE;
+
+    rc = checkpoint_locked(fd, wal->fd, wal->hdr);
+    if (rc == NO_ERROR && unlink(wal->path) < 0)
+        rc = ERR_DB_FILE;
+
+    flock(wal->fd, LOCK_UN);
+    if (rc == NO_ERROR)
+        unmap_hdr(wal);
+    return rc;
+}
+
+/*
+ *  db_wal_checkpoint
+ *      Syncs the database of wal and empties the log, waiting for the
+ *      mutations in progress to finish first.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_wal_checkpoint(db_wal_t *wal)
+{
+    int rc;
+
+    if (flock(wal->fd, LOCK_EX) < 0)
+        return ERR_DB_FILE;
+
+    rc = checkpoint_locked(wal->db_fd, wal->fd, wal->hdr);
+    flock(wal->fd, LOCK_UN);
+    return rc;
+}
+
+/*
+ *  checkpoint_background
+ *      Checkpoints from a grandchild so the caller neither waits for the
+ *      sync nor has to reap it.  The grandchild locks the log through a
+ *      file description of its own, a flock() on the inherited one would
+ *      convert the lock of its parent.
+ */
+static void checkpoint_background(db_wal_t *wal)
+{
+    pid_t pid = fork();
+
+    if (pid < 0)
+        return;
+    if (pid > 0)
+    {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    if (fork() != 0)
+        _exit(0);
+
+    // let go of the caller's stdout, whoever reads it should not wait for us
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0)
+    {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+
+    int wal_fd = open(wal->path, O_RDWR | O_CLOEXEC);
+    struct stat st;
+    int rc = ERR_DB_FILE;
+
+    // another checkpoint may have emptied the log while this one waited
+    if (wal_fd >= 0 && flock(wal_fd, LOCK_EX) == 0 && fstat(wal_fd, &st) == 0)
+    {
+        rc = NO_ERROR;
+        if (st.st_size > DB_WAL_CHECKPOINT_BYTES)
+            rc = checkpoint_locked(wal->db_fd, wal_fd, wal->hdr);
+    }
+    _exit(rc == NO_ERROR ? EXIT_OK : EXIT_FAIL_DB);
+}
+
+/*
+ *  db_wal_begin / db_wal_end
+ *
+ *  Bracket a mutation: the log entries, their sync and the in place write.
+ *  A checkpoint cannot run in between.  db_wal_end() starts a background
+ *  checkpoint when the log has grown past DB_WAL_CHECKPOINT_BYTES.
+ */
+int db_wal_begin(db_wal_t *wal)
+{
+    if (flock(wal->fd, LOCK_SH) < 0)
+        return ERR_DB_FILE;
+
+    __atomic_add_fetch(&wal->hdr->pending, 1, __ATOMIC_ACQ_REL);
+    return NO_ERROR;
+}
+
+void db_wal_end(db_wal_t *wal, bool ok)
+{
+    off_t end = lseek(wal->fd, 0, SEEK_END);
+
+    // a failed mutation keeps pending raised, the next open replays the log
+    if (ok)
+        __atomic_sub_fetch(&wal->hdr->pending, 1, __ATOMIC_ACQ_REL);
+    flock(wal->fd, LOCK_UN);
+
+    if (ok && end > DB_WAL_CHECKPOINT_BYTES)
+        checkpoint_background(wal);
+}
+
+/*
+ *  wal_sync
+ *      end:  offset just past the caller's last entry
+ *
+ *  Makes sure the log is on disk up to end, unless a sync by another
+ *  writer already covered it.
+ */
+static int wal_sync(db_wal_t *wal, uint64_t end)
+{
+    uint64_t synced = __atomic_load_n(&wal->hdr->synced, __ATOMIC_ACQUIRE);
+    off_t size;
+
+    if (synced >= end)
+        return NO_ERROR;
+
+    // everything appended before the sync starts is covered by it
+    size = lseek(wal->fd, 0, SEEK_END);
+    if (size < 0 || fdatasync(wal->fd) < 0)
+        return ERR_DB_FILE;
+
+    while (synced < (uint64_t)size &&
+           !__atomic_compare_exchange_n(&wal->hdr->synced, &synced, (uint64_t)size, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        ;
+
+    return NO_ERROR;
+}
+
+/*
+ *  db_wal_log
+ *      id:  student id, selects the slot
+ *      s:   new record, EMPTY_STUDENT_RECORD for a delete
+ *
+ *  Appends one entry and syncs the log.  Must run between db_wal_begin()
+ *  and db_wal_end().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int db_wal_log(db_wal_t *wal, int id, const student_t *s)
+{
+    db_wal_ent_t ent;
+    ssize_t io_size;
+
+    make_ent(&ent, id, s);
+    do
+    {
+        io_size = write(wal->fd, &ent, sizeof(ent));
+    } while (io_size < 0 && errno == EINTR);
+
+    if (io_size != sizeof(ent))
+        return ERR_DB_FILE;
+
+    return wal_sync(wal, lseek(wal->fd, 0, SEEK_CUR));
+}
+
+/*
+ *  db_wal_log_batch
+ *      ids:   n student ids, NULL for the ids of recs
+ *      recs:  n new students, NULL to log deletes of ids
+ *
+ *  Like db_wal_log() for a whole batch, one append and one sync.
+ */
+int db_wal_log_batch(db_wal_t *wal, const int *ids, student_t **recs, int n)
+{
+    db_wal_ent_t *ents;
+    size_t want = (size_t)n * sizeof(db_wal_ent_t);
+    ssize_t io_size;
+    int rc = NO_ERROR;
+
+    if (n <= 0)
+        return NO_ERROR;
+
+    ents = malloc(want);
+    if (ents == NULL)
+        return ERR_DB_FILE;
+    for (int i = 0; i < n; i++)
+        make_ent(&ents[i], ids != NULL ? ids[i] : recs[i]->id,
+                 recs != NULL ? recs[i] : &EMPTY_STUDENT_RECORD);
+
+    // O_APPEND, so the batch never interleaves with other writers
+    do
+    {
+        io_size = write(wal->fd, ents, want);
+    } while (io_size < 0 && errno == EINTR);
+
+    if (io_size != (ssize_t)want)
+        rc = ERR_DB_FILE;
+    else
+        rc = wal_sync(wal, lseek(wal->fd, 0, SEEK_CUR));
+
+    free(ents);
+    return rc;
+}
@@ -5,11 +5,17 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
 
 // database include files
 #include "db.h"
 #include "sdbsc.h"
 
+static int replay_record(int fd, int id, const student_t *s);
+static int read_record(int fd, int id, student_t *s);
+static int read_records(int fd, const int *ids, int n, student_t *recs, int *status);
+
 /*
  *  open_db
  *      dbFile:  name of the database file
@@ -22,6 +28,25 @@
  *
  */
 int open_db(char *dbFile, bool should_truncate)
+{
+    return open_db_ex(dbFile, should_truncate ? DB_OPEN_TRUNC : 0);
+}
+
+/*
+ *  open_db_ex
+ *      dbFile:  name of the database file
+ *      flags:   DB_OPEN_TRUNC to empty the file, DB_OPEN_MMAP to serve
+ *               it from the memory mapped engine
+ *
+ *  Same as open_db(), the returned fd must be released with close_db().
+ *
+ *  returns:  File descriptor on success, or ERR_DB_FILE on failure
+ *
+ *  console:  Does not produce any console I/O on success
+ *            M_ERR_DB_OPEN on error
+ *
+ */
+int open_db_ex(char *dbFile, int open_flags)
 {
     // Set permissions: rw-rw----
     // see sys/stat.h for constants
@@ -31,9 +56,6 @@ int open_db(char *dbFile, bool should_truncate)
     // create it if it does not exist
     int flags = O_RDWR | O_CREAT;
 
-    if (should_truncate)
-        flags += O_TRUNC;
-
     // Now open file
     int fd = open(dbFile, flags, mode);
 
@@ -44,9 +66,312 @@ int open_db(char *dbFile, bool should_truncate)
         return ERR_DB_FILE;
     }
 
+    // the file is truncated and the sidecars are checked or rebuilt while
+    // no other process is in the database.  A compaction that finished
+    // while we waited renamed a new file over this one, open that instead.
+    int locked;
+    while ((locked = db_lock_all(fd, DB_LOCK_EX)) == NO_ERROR && db_replaced(fd))
+    {
+        db_lock_close(fd);
+        close(fd);
+        fd = open(dbFile, flags, mode);
+        if (fd == -1)
+        {
+            printf(M_ERR_DB_OPEN);
+            return ERR_DB_FILE;
+        }
+    }
+
+    if (locked != NO_ERROR ||
+        ((open_flags & DB_OPEN_TRUNC) && ftruncate(fd, 0) < 0) ||
+        db_pack_open(fd, dbFile) != NO_ERROR)
+    {
+        printf(M_ERR_DB_OPEN);
+        db_lock_close(fd);
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    // a file that cannot be mapped still works through read()/write()
+    if (open_flags & DB_OPEN_MMAP)
+        db_map_open(fd);
+
+    // a replayed log changed the database behind the sidecars' back
+    int wal_rc = db_wal_open(fd, dbFile, open_flags & DB_OPEN_TRUNC, replay_record);
+    if (wal_rc < 0)
+    {
+        printf(M_ERR_DB_OPEN);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+    bool rebuild = (open_flags & DB_OPEN_TRUNC) || wal_rc == DB_WAL_REPLAYED;
+
+    // likewise the occupancy bitmap, name index and columns are optional
+    // accelerators
+    db_bmp_open(fd, dbFile, rebuild);
+    db_names_open(fd, dbFile, rebuild);
+    db_col_open(fd, dbFile, rebuild);
+
+    db_lock_all(fd, DB_LOCK_UN);
     return fd;
 }
 
+/*
+ *  close_db
+ *      fd:  database file descriptor from open_db()
+ *
+ *  Unmaps the database if it was opened with DB_OPEN_MMAP and closes fd.
+ */
+void close_db(int fd)
+{
+    db_wal_close(fd);
+    db_col_close(fd);
+    db_names_close(fd);
+    db_bmp_close(fd);
+    db_pack_close(fd);
+    db_map_close(fd);
+    db_lock_close(fd);
+    close(fd);
+}
+
+/*
+ *  record_slot
+ *      fd:  database file descriptor
+ *      id:  student id
+ *
+ *  returns:  the slot that holds id.  That is id itself in the default
+ *            layout, for a packed database it comes from the index and is
+ *            0 when id is not in the database.
+ */
+static int record_slot(int fd, int id)
+{
+    db_pack_t *pack = db_pack_find(fd);
+
+    if (pack != NULL)
+        return db_pack_slot(pack, id);
+
+    return id;
+}
+
+/*
+ *  put_slot
+ *      fd:  database file descriptor
+ *      id:  student id, selects the slot
+ *      s:   record to store, EMPTY_STUDENT_RECORD to clear the slot
+ *
+ *  A packed database appends students that are not in it yet and drops
+ *  cleared ones from the index.  The index keeps its writer count raised
+ *  if the record is written but the index entry is not.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int put_slot(int fd, int id, const student_t *s)
+{
+    db_map_t *map = db_map_find(fd);
+    db_pack_t *pack = db_pack_find(fd);
+    int slot = record_slot(fd, id);
+
+    if (pack != NULL && slot == 0)
+    {
+        if (s->id == DELETED_STUDENT_ID)
+            return NO_ERROR;
+
+        slot = db_pack_next_slot(pack);
+        if (slot < 0)
+            return ERR_DB_FILE;
+    }
+
+    off_t offset = (off_t)slot * STUDENT_RECORD_SIZE;
+
+    if (pack != NULL)
+        db_side_begin(pack->hdr);
+
+    if (map != NULL)
+    {
+        if (db_map_reserve(map, offset + STUDENT_RECORD_SIZE) != NO_ERROR)
+            return ERR_DB_FILE;
+
+        map->recs[slot] = *s;
+    }
+    else if (pwrite(fd, s, STUDENT_RECORD_SIZE, offset) != STUDENT_RECORD_SIZE)
+    {
+        return ERR_DB_FILE;
+    }
+
+    if (pack != NULL)
+    {
+        db_pack_set(pack, id, s->id == DELETED_STUDENT_ID ? 0 : slot);
+        db_side_end(pack->hdr);
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  put_record
+ *      fd:  database file descriptor
+ *      id:  student id, selects the slot
+ *      s:   record to store, EMPTY_STUDENT_RECORD to clear the slot
+ *
+ *  put_slot() plus the matching occupancy bitmap, name index and column
+ *  updates, logged first if the database has a write-ahead log.  A sidecar
+ *  that could not be updated keeps its writer count raised, so it is
+ *  rebuilt on the next open.  The caller holds the record lock of id, the
+ *  sidecars are changed under the meta lock.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int put_record(int fd, int id, const student_t *s)
+{
+    db_bmp_t *bmp = db_bmp_find(fd);
+    db_names_t *names = db_names_find(fd);
+    db_col_t *col = db_col_find(fd);
+    db_wal_t *wal = db_wal_find(fd);
+    bool names_ok = true;
+    bool col_ok = true;
+    student_t old;
+    int rc;
+
+    // the name index is keyed by the names of the student being deleted
+    if (names != NULL && s->id == DELETED_STUDENT_ID &&
+        read_record(fd, id, &old) != NO_ERROR)
+        names = NULL;
+
+    if (wal != NULL)
+    {
+        if (db_wal_begin(wal) != NO_ERROR)
+            return ERR_DB_FILE;
+        if (db_wal_log(wal, id, s) != NO_ERROR)
+        {
+            db_wal_end(wal, false);
+            return ERR_DB_FILE;
+        }
+    }
+
+    if (db_lock_meta(fd, DB_LOCK_EX) != NO_ERROR)
+    {
+        if (wal != NULL)
+            db_wal_end(wal, false);
+        return ERR_DB_FILE;
+    }
+
+    if (bmp != NULL)
+        db_side_begin(bmp->hdr);
+    if (names != NULL)
+        db_side_begin(names->hdr);
+    if (col != NULL)
+        db_side_begin(col->hdr);
+
+    rc = put_slot(fd, id, s);
+
+    if (rc == NO_ERROR && bmp != NULL)
+        db_bmp_set(bmp, id, s->id != DELETED_STUDENT_ID);
+    if (rc == NO_ERROR && names != NULL)
+    {
+        if (s->id != DELETED_STUDENT_ID)
+            names_ok = db_names_insert(names, s) == NO_ERROR;
+        else
+            db_names_remove(names, &old);
+    }
+    if (rc == NO_ERROR && col != NULL)
+    {
+        if (s->id != DELETED_STUDENT_ID)
+            col_ok = db_col_add(col, id, s->gpa) == NO_ERROR;
+        else
+            db_col_remove(col, id);
+    }
+
+    if (bmp != NULL && rc == NO_ERROR)
+        db_side_end(bmp->hdr);
+    if (names != NULL && rc == NO_ERROR && names_ok)
+        db_side_end(names->hdr);
+    if (col != NULL && rc == NO_ERROR && col_ok)
+        db_side_end(col->hdr);
+    db_lock_meta(fd, DB_LOCK_UN);
+    if (wal != NULL)
+        db_wal_end(wal, rc == NO_ERROR);
+
+    return rc;
+}
+
+/*
+ *  replay_record
+ *      fd:  database file descriptor
+ *      id:  student id from a write-ahead log entry
+ *      s:   the record the entry set, EMPTY_STUDENT_RECORD for a delete
+ *
+ *  Applies one logged mutation during recovery.  The entry may have landed
+ *  already, or a later one for the same id may have, so whatever is in the
+ *  slot is replaced rather than added to.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int replay_record(int fd, int id, const student_t *s)
+{
+    student_t cur;
+    int rc = read_record(fd, id, &cur);
+
+    if (rc == ERR_DB_FILE)
+        return rc;
+    if (rc == NO_ERROR)
+    {
+        if (memcmp(&cur, s, STUDENT_RECORD_SIZE) == 0)
+            return NO_ERROR;
+        if (put_record(fd, id, &EMPTY_STUDENT_RECORD) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    if (s->id == DELETED_STUDENT_ID)
+        return NO_ERROR;
+    return put_record(fd, id, s);
+}
+
+/*
+ *  read_record
+ *      get_student() without the record lock, for callers that hold it.
+ */
+static int read_record(int fd, int id, student_t *s)
+{
+    db_map_t *map = db_map_find(fd);
+
+    if (id < 0)
+        return ERR_DB_FILE;
+
+    db_bmp_t *bmp = db_bmp_find(fd);
+    if (bmp != NULL && !db_bmp_test(bmp, id))
+        return SRCH_NOT_FOUND;
+
+    // slot 0 never holds a student, in a packed database it is the header
+    int slot = record_slot(fd, id);
+    if (slot == 0)
+        return SRCH_NOT_FOUND;
+
+    if (map != NULL)
+    {
+        student_t *rec = db_map_record(map, slot);
+        if (rec == NULL || rec->id != id)
+            return SRCH_NOT_FOUND;
+
+        *s = *rec;
+        return NO_ERROR;
+    }
+
+    off_t offset = (off_t)slot * STUDENT_RECORD_SIZE;
+    int read_result = pread(fd, s, STUDENT_RECORD_SIZE, offset);
+
+    if (read_result == -1)
+    {
+        return ERR_DB_FILE;
+    }
+
+    if (read_result < STUDENT_RECORD_SIZE || s->id != id)
+    {
+        return SRCH_NOT_FOUND;
+    }
+
+    return NO_ERROR;
+}
+
 /*
  *  get_student
  *      fd:  linux file descriptor
@@ -62,26 +387,369 @@ int open_db(char *dbFile, bool should_truncate)
  */
 int get_student(int fd, int id, student_t *s)
 {
-    int offset = id * STUDENT_RECORD_SIZE;
+    int rc;
+
+    if (id < 0)
+        return ERR_DB_FILE;
+
+    // a shared lock, so the copy never has half of a concurrent write
+    if (db_lock_record(fd, id, DB_LOCK_SH) != NO_ERROR)
+        return ERR_DB_FILE;
+    rc = read_record(fd, id, s);
+    db_lock_record(fd, id, DB_LOCK_UN);
+
+    return rc;
+}
+
+/*
+ *  read_records
+ *      fd:      database file descriptor
+ *      ids:     n student ids
+ *      recs:    filled with the student of every id that is found
+ *      status:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE for every id
+ *
+ *  read_record() for a batch, the caller holds the lock.  Ids the bitmap
+ *  or the packed index rule out cost nothing, the others are read with one
+ *  db_batch_io() instead of a pread() each.  Mapped records are copied.
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if the batch could not be run
+ */
+static int read_records(int fd, const int *ids, int n, student_t *recs, int *status)
+{
+    db_map_t *map = db_map_find(fd);
+    db_bmp_t *bmp = db_bmp_find(fd);
+    db_batch_req_t *reqs;
+    int *which;
+    int m = 0;
+    int rc;
+
+    if (map != NULL)
+    {
+        for (int i = 0; i < n; i++)
+            status[i] = read_record(fd, ids[i], &recs[i]);
+        return NO_ERROR;
+    }
 
-    if (lseek(fd, offset, SEEK_SET) == -1)
+    reqs = malloc(n * sizeof(*reqs));
+    which = malloc(n * sizeof(*which));
+    if (reqs == NULL || which == NULL)
     {
+        free(reqs);
+        free(which);
         return ERR_DB_FILE;
     }
 
-    int read_result = read(fd, s, STUDENT_RECORD_SIZE);
+    for (int i = 0; i < n; i++)
+    {
+        int slot = 0;
 
-    if (read_result == -1)
+        status[i] = SRCH_NOT_FOUND;
+        if (ids[i] >= MIN_STD_ID && ids[i] <= MAX_STD_ID && (bmp == NULL || db_bmp_test(bmp, ids[i])))
+            slot = record_slot(fd, ids[i]);
+        if (slot == 0)
+            continue;
+
+        reqs[m].buf = &recs[i];
+        reqs[m].len = STUDENT_RECORD_SIZE;
+        reqs[m].off = (off_t)slot * STUDENT_RECORD_SIZE;
+        which[m++] = i;
+    }
+
+    rc = db_batch_io(fd, false, reqs, m);
+    for (int k = 0; k < m && rc == NO_ERROR; k++)
     {
+        int i = which[k];
+
+        if (reqs[k].res < 0)
+            status[i] = ERR_DB_FILE;
+        else if (reqs[k].res == STUDENT_RECORD_SIZE && recs[i].id == ids[i])
+            status[i] = NO_ERROR;
+    }
+
+    free(reqs);
+    free(which);
+    return rc;
+}
+
+/*
+ *  get_students
+ *      fd:      database file descriptor
+ *      ids:     n student ids, in any order and possibly repeated
+ *      recs:    filled with the student of every id that is found
+ *      status:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE for every id
+ *
+ *  get_student() for a batch, under one shared lock of every id instead
+ *  of one lock per id.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE, the results are in status
+ *
+ *  console:  Does not produce any console I/O
+ */
+int get_students(int fd, const int *ids, int n, student_t *recs, int *status)
+{
+    int rc;
+
+    if (db_lock_all(fd, DB_LOCK_SH) != NO_ERROR)
         return ERR_DB_FILE;
+    rc = read_records(fd, ids, n, recs, status);
+    db_lock_all(fd, DB_LOCK_UN);
+
+    return rc;
+}
+
+/*
+ *  db_replaced
+ *      returns:  true if a compaction renamed a new database over fd's
+ *                file, what is written through fd then is lost
+ */
+bool db_replaced(int fd)
+{
+    struct stat st;
+
+    return fstat(fd, &st) == 0 && st.st_nlink == 0;
+}
+
+/*
+ *  reopen_db
+ *      fd:          database file descriptor from open_db_ex(), or < 0
+ *      dbFile:      name of the database file
+ *      open_flags:  open_db_ex() flags, without DB_OPEN_TRUNC
+ *
+ *  For processes that keep the database open across operations.  Once a
+ *  compaction has renamed a new file over fd's, fd is closed and dbFile
+ *  opened again; a failed earlier reopen is retried.
+ *
+ *  returns:  fd if it is still the database, the new fd, or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_OPEN if the database cannot be opened again
+ */
+int reopen_db(int fd, char *dbFile, int open_flags)
+{
+    if (fd >= 0 && !db_replaced(fd))
+        return fd;
+
+    if (fd >= 0)
+        close_db(fd);
+    return open_db_ex(dbFile, open_flags & ~DB_OPEN_TRUNC);
+}
+
+/*
+ *  insert_student
+ *      fd:  database file descriptor
+ *      s:   student to add, validated by the caller
+ *
+ *  The duplicate check and the write happen under one exclusive record
+ *  lock, two processes adding the same id cannot both succeed.
+ *
+ *  returns:  NO_ERROR       student added to database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      the student already exists
+ *
+ *  console:  Does not produce any console I/O
+ */
+int insert_student(int fd, const student_t *s)
+{
+    student_t existing;
+    int rc;
+
+    if (db_lock_record(fd, s->id, DB_LOCK_EX) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    rc = read_record(fd, s->id, &existing);
+    if (rc == NO_ERROR)
+        rc = ERR_DB_OP;
+    else if (rc == SRCH_NOT_FOUND)
+        rc = db_replaced(fd) ? ERR_DB_FILE : put_record(fd, s->id, s);
+
+    db_lock_record(fd, s->id, DB_LOCK_UN);
+    return rc;
+}
+
+/*
+ *  remove_student
+ *      fd:  database file descriptor
+ *      id:  student to delete
+ *
+ *  Like insert_student(), the lookup and the delete are one locked step.
+ *
+ *  returns:  NO_ERROR       student deleted from database
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND student was not in the database
+ *
+ *  console:  Does not produce any console I/O
+ */
+int remove_student(int fd, int id)
+{
+    student_t existing;
+    int rc;
+
+    if (id < 0)
+        return ERR_DB_FILE;
+    if (db_lock_record(fd, id, DB_LOCK_EX) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    rc = read_record(fd, id, &existing);
+    if (rc == NO_ERROR)
+        rc = db_replaced(fd) ? ERR_DB_FILE : put_record(fd, id, &EMPTY_STUDENT_RECORD);
+
+    db_lock_record(fd, id, DB_LOCK_UN);
+    return rc;
+}
+
+/*
+ *  remove_students
+ *      fd:      database file descriptor
+ *      ids:     n student ids, in any order and possibly repeated
+ *      status:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE for every id
+ *
+ *  remove_student() for a batch.  Under one exclusive lock of every id
+ *  the students are looked up with read_records(), the deletes are logged
+ *  with one write-ahead log append and the slots are cleared with one
+ *  db_batch_io(), then the sidecars drop the students that are gone.  An
+ *  id listed twice is deleted by its first entry and not found after.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE, the results are in status
+ *
+ *  console:  Does not produce any console I/O
+ */
+int remove_students(int fd, const int *ids, int n, int *status)
+{
+    db_map_t *map = db_map_find(fd);
+    db_pack_t *pack = db_pack_find(fd);
+    db_bmp_t *bmp = db_bmp_find(fd);
+    db_names_t *names = db_names_find(fd);
+    db_col_t *col = db_col_find(fd);
+    db_wal_t *wal = db_wal_find(fd);
+    student_t *old = malloc(n * sizeof(*old));
+    int *del = malloc(n * sizeof(*del));
+    int *del_ids = malloc(n * sizeof(*del_ids));
+    db_batch_req_t *reqs = malloc(n * sizeof(*reqs));
+    uint64_t *seen = calloc((MAX_STD_ID >> 6) + 1, sizeof(*seen));
+    bool all_ok = true;
+    int ndel = 0;
+    int rc;
+
+    if (old == NULL || del == NULL || del_ids == NULL || reqs == NULL || seen == NULL)
+    {
+        rc = ERR_DB_FILE;
+        goto out_free;
     }
+    if (db_lock_all(fd, DB_LOCK_EX) != NO_ERROR)
+    {
+        rc = ERR_DB_FILE;
+        goto out_free;
+    }
+
+    rc = read_records(fd, ids, n, old, status);
+    if (rc == NO_ERROR && db_replaced(fd))
+        rc = ERR_DB_FILE;
+    if (rc != NO_ERROR)
+        goto out;
 
-    if (read_result == 0 || memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0)
+    for (int i = 0; i < n; i++)
     {
-        return SRCH_NOT_FOUND;
+        int id = ids[i];
+
+        if (status[i] != NO_ERROR)
+            continue;
+        if ((seen[id >> 6] >> (id & 63)) & 1)
+        {
+            status[i] = SRCH_NOT_FOUND;
+            continue;
+        }
+        seen[id >> 6] |= 1ULL << (id & 63);
+        del_ids[ndel] = id;
+        del[ndel++] = i;
     }
+    if (ndel == 0)
+        goto out;
 
-    return NO_ERROR;
+    if (wal != NULL)
+    {
+        if (db_wal_begin(wal) != NO_ERROR)
+        {
+            rc = ERR_DB_FILE;
+            goto out;
+        }
+        if (db_wal_log_batch(wal, del_ids, NULL, ndel) != NO_ERROR)
+        {
+            db_wal_end(wal, false);
+            rc = ERR_DB_FILE;
+            goto out;
+        }
+    }
+
+    // the meta lock is covered by the lock of every id
+    if (pack != NULL)
+        db_side_begin(pack->hdr);
+    if (bmp != NULL)
+        db_side_begin(bmp->hdr);
+    if (names != NULL)
+        db_side_begin(names->hdr);
+    if (col != NULL)
+        db_side_begin(col->hdr);
+
+    for (int k = 0; k < ndel; k++)
+    {
+        int slot = record_slot(fd, del_ids[k]);
+
+        if (map != NULL)
+        {
+            *db_map_record(map, slot) = EMPTY_STUDENT_RECORD;
+            reqs[k].res = STUDENT_RECORD_SIZE;
+            continue;
+        }
+        // only read from, the cast is for the shared request type
+        reqs[k].buf = (void *)&EMPTY_STUDENT_RECORD;
+        reqs[k].len = STUDENT_RECORD_SIZE;
+        reqs[k].off = (off_t)slot * STUDENT_RECORD_SIZE;
+    }
+    if (map == NULL)
+        rc = db_batch_io(fd, true, reqs, ndel);
+
+    for (int k = 0; k < ndel; k++)
+    {
+        int i = del[k];
+
+        if (rc != NO_ERROR || reqs[k].res != STUDENT_RECORD_SIZE)
+        {
+            status[i] = ERR_DB_FILE;
+            all_ok = false;
+            continue;
+        }
+
+        if (pack != NULL)
+            db_pack_set(pack, ids[i], 0);
+        if (bmp != NULL)
+            db_bmp_set(bmp, ids[i], false);
+        if (names != NULL)
+            db_names_remove(names, &old[i]);
+        if (col != NULL)
+            db_col_remove(col, ids[i]);
+    }
+
+    // like put_record(), a sidecar that missed a delete is rebuilt on the
+    // next open
+    if (pack != NULL && all_ok)
+        db_side_end(pack->hdr);
+    if (bmp != NULL && all_ok)
+        db_side_end(bmp->hdr);
+    if (names != NULL && all_ok)
+        db_side_end(names->hdr);
+    if (col != NULL && all_ok)
+        db_side_end(col->hdr);
+    if (wal != NULL)
+        db_wal_end(wal, all_ok);
+
+out:
+    db_lock_all(fd, DB_LOCK_UN);
+out_free:
+    free(old);
+    free(del);
+    free(del_ids);
+    free(reqs);
+    free(seen);
+    return rc;
 }
 
 /*
@@ -96,6 +764,7 @@ int get_student(int fd, int id, student_t *s)
  *  student, check if there is another student already at that location.  A good
  *  way is to use something like memcmp() to ensure that the location for this
  *  student contains all zero byes indicating the space is empty.
+ *  insert_student() does the check and the write under one record lock.
  *
  *  returns:  NO_ERROR       student added to database
  *            ERR_DB_FILE    database file I/O issue
@@ -105,26 +774,12 @@ int get_student(int fd, int id, student_t *s)
  *
  *  console:  M_STD_ADDED       on success
  *            M_ERR_DB_ADD_DUP  student already exists
- *            M_ERR_DB_READ     error reading or seeking the database file
- *            M_ERR_DB_WRITE    error writing to db file (adding student)
+ *            M_ERR_DB_WRITE    error reading or writing the db file
  *
  */
 int add_student(int fd, int id, char *fname, char *lname, int gpa)
 {
     student_t new_student;
-    student_t existing_student;
-
-    int result = get_student(fd, id, &existing_student);
-    if (result == NO_ERROR)
-    {
-        printf(M_ERR_DB_ADD_DUP, id);
-        return ERR_DB_OP;
-    }
-    else if (result == ERR_DB_FILE)
-    {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
 
     memset(&new_student, 0, STUDENT_RECORD_SIZE);
     new_student.id = id;
@@ -132,15 +787,13 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa)
     strncpy(new_student.lname, lname, sizeof(new_student.lname) - 1);
     new_student.gpa = gpa;
 
-    int offset = id * STUDENT_RECORD_SIZE;
-
-    if (lseek(fd, offset, SEEK_SET) == -1)
+    int result = insert_student(fd, &new_student);
+    if (result == ERR_DB_OP)
     {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
+        printf(M_ERR_DB_ADD_DUP, id);
+        return ERR_DB_OP;
     }
-
-    if (write(fd, &new_student, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE)
+    else if (result != NO_ERROR)
     {
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
@@ -158,7 +811,7 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa)
  *  Removes a student to the database.  Use the get_student() function to
  *  locate the student to be deleted. If there is a student at that location
  *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at
- *  that location.
+ *  that location.  remove_student() does both under one record lock.
  *
  *  returns:  NO_ERROR       student deleted from database
  *            ERR_DB_FILE    database file I/O issue
@@ -168,44 +821,130 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa)
  *
  *  console:  M_STD_DEL_MSG      on success
  *            M_STD_NOT_FND_MSG  student not in database, cant be deleted
- *            M_ERR_DB_READ      error reading or seeking the database file
- *            M_ERR_DB_WRITE     error writing to db file (adding student)
+ *            M_ERR_DB_WRITE     error reading or writing the db file
  *
  */
 int del_student(int fd, int id)
 {
-    student_t student;
-    int result;
+    int result = remove_student(fd, id);
 
-    result = get_student(fd, id, &student);
-
-    if (result == ERR_DB_FILE)
-    {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-    else if (result == SRCH_NOT_FOUND)
+    if (result == SRCH_NOT_FOUND)
     {
         printf(M_STD_NOT_FND_MSG, id);
         return ERR_DB_OP;
     }
+    else if (result != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
 
-    int offset = id * STUDENT_RECORD_SIZE;
+    printf(M_STD_DEL_MSG, id);
+    return NO_ERROR;
+}
 
-    if (lseek(fd, offset, SEEK_SET) == -1)
+/*
+ *  find_students
+ *      fd:   database file descriptor
+ *      ids:  n student ids
+ *
+ *  Prints the students of ids in the order they are listed, looked up as
+ *  one batch by get_students().
+ *
+ *  returns:  NO_ERROR       every student was found
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      at least one student was not found
+ *
+ *  console:  the header and a row for every student found
+ *            M_STD_NOT_FND_MSG for every id that was not found
+ *            M_ERR_DB_READ     error reading the db file
+ */
+int find_students(int fd, const int *ids, int n)
+{
+    student_t *recs = malloc(n * sizeof(*recs));
+    int *status = malloc(n * sizeof(*status));
+    bool header_printed = false;
+    int rc = NO_ERROR;
+
+    if (recs == NULL || status == NULL || get_students(fd, ids, n, recs, status) != NO_ERROR)
     {
         printf(M_ERR_DB_READ);
+        free(recs);
+        free(status);
         return ERR_DB_FILE;
     }
 
-    if (write(fd, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE)
+    for (int i = 0; i < n; i++)
+    {
+        switch (status[i])
+        {
+        case NO_ERROR:
+            print_record(&recs[i], &header_printed);
+            break;
+        case SRCH_NOT_FOUND:
+            printf(M_STD_NOT_FND_MSG, ids[i]);
+            if (rc == NO_ERROR)
+                rc = ERR_DB_OP;
+            break;
+        default:
+            printf(M_ERR_DB_READ);
+            rc = ERR_DB_FILE;
+            break;
+        }
+    }
+
+    free(recs);
+    free(status);
+    return rc;
+}
+
+/*
+ *  del_students
+ *      fd:   database file descriptor
+ *      ids:  n student ids
+ *
+ *  del_student() for every id, deleted as one batch by remove_students().
+ *
+ *  returns:  NO_ERROR       every student was deleted
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      at least one student was not found
+ *
+ *  console:  M_STD_DEL_MSG or M_STD_NOT_FND_MSG for every id
+ *            M_ERR_DB_WRITE    error reading or writing the db file
+ */
+int del_students(int fd, const int *ids, int n)
+{
+    int *status = malloc(n * sizeof(*status));
+    int rc = NO_ERROR;
+
+    if (status == NULL || remove_students(fd, ids, n, status) != NO_ERROR)
     {
         printf(M_ERR_DB_WRITE);
+        free(status);
         return ERR_DB_FILE;
     }
 
-    printf(M_STD_DEL_MSG, id);
-    return NO_ERROR;
+    for (int i = 0; i < n; i++)
+    {
+        switch (status[i])
+        {
+        case NO_ERROR:
+            printf(M_STD_DEL_MSG, ids[i]);
+            break;
+        case SRCH_NOT_FOUND:
+            printf(M_STD_NOT_FND_MSG, ids[i]);
+            if (rc == NO_ERROR)
+                rc = ERR_DB_OP;
+            break;
+        default:
+            printf(M_ERR_DB_WRITE);
+            rc = ERR_DB_FILE;
+            break;
+        }
+    }
+
+    free(status);
+    return rc;
 }
 
 /*
@@ -219,6 +958,7 @@ int del_student(int fd, int id)
  *  the bytes in the record read are zeros - I would suggest using memory
  *  compare memcmp() for this. Create a counter variable and initialize it
  *  to zero, every time a non-zero record is read increment the counter.
+ *  The reading is done by scan_db(), which skips the holes in the file.
  *
  *  returns:  <number>       returns the number of records in db on success
  *            ERR_DB_FILE    database file I/O issue
@@ -232,28 +972,36 @@ int del_student(int fd, int id)
  *            M_ERR_DB_WRITE   error writing to db file (adding student)
  *
  */
-int count_db_records(int fd)
+static int count_record(const student_t *s, void *arg)
 {
-    student_t student;
+    (void)s;
+    (*(int *)arg)++;
+    return NO_ERROR;
+}
+
+/*
+ *  count_students
+ *      returns:  the number of students in the database, or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int count_students(int fd)
+{
+    db_bmp_t *bmp = db_bmp_find(fd);
     int count = 0;
-    int read_result;
 
-    if (lseek(fd, 0, SEEK_SET) == -1)
-    {
-        printf(M_ERR_DB_READ);
+    if (bmp != NULL)
+        return db_bmp_count(bmp);
+    if (scan_db(fd, count_record, &count) != NO_ERROR)
         return ERR_DB_FILE;
-    }
+    return count;
+}
 
-    // ok this sometimes takes forever, im not sure why..
-    while ((read_result = read(fd, &student, STUDENT_RECORD_SIZE)) > 0)
-    {
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0)
-        {
-            count++;
-        }
-    }
+int count_db_records(int fd)
+{
+    int count = count_students(fd);
 
-    if (read_result == -1)
+    if (count < 0)
     {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
@@ -294,7 +1042,8 @@ int count_db_records(int fd)
  *  The code above assumes you are reading student records into a local
  *  variable named student that is of type student_t. Also dont forget that
  *  the GPA in the student structure is an int, to convert it into a real
- *  gpa divide by 100.0 and store in a float variable.
+ *  gpa divide by 100.0 and store in a float variable.  Records come from
+ *  scan_db(), in id order.
  *
  *  returns:  NO_ERROR       on success
  *            ERR_DB_FILE    database file I/O issue
@@ -304,46 +1053,129 @@ int count_db_records(int fd)
  *            M_ERR_DB_READ    error reading or seeking the database file
  *
  */
+int print_record(const student_t *s, void *arg)
+{
+    bool *header_printed = arg;
+
+    if (!*header_printed)
+    {
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+        *header_printed = true;
+    }
+
+    float real_gpa = s->gpa / 100.0;
+
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, real_gpa);
+    return NO_ERROR;
+}
+
 int print_db(int fd)
 {
-    student_t student;
-    int read_result;
     bool header_printed = false;
 
-    if (lseek(fd, 0, SEEK_SET) == -1)
+    if (scan_db(fd, print_record, &header_printed) != NO_ERROR)
     {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
-    while ((read_result = read(fd, &student, STUDENT_RECORD_SIZE)) > 0)
+    if (!header_printed)
     {
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0)
-        {
-            continue;
-        }
+        printf(M_DB_EMPTY);
+    }
 
-        if (!header_printed)
-        {
-            printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
-            header_printed = true;
-        }
+    return NO_ERROR;
+}
 
-        float real_gpa = student.gpa / 100.0;
+//names are cut to the field sizes, the way add_student() stores them
+typedef struct name_query {
+    int fd;
+    char lname[32];
+    char fname[24];
+    bool match_fname;
+    bool prefix;
+    bool header_printed;
+} name_query_t;
+
+static int print_name_match(int id, void *arg)
+{
+    name_query_t *q = arg;
+    student_t student;
 
-        printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
-               student.lname, real_gpa);
-    }
+    // skip entries whose student vanished since the index was read
+    if (get_student(q->fd, id, &student) != NO_ERROR)
+        return NO_ERROR;
 
-    if (read_result == -1)
+    return print_record(&student, &q->header_printed);
+}
+
+static int filter_name_match(const student_t *s, void *arg)
+{
+    name_query_t *q = arg;
+    size_t lname_len = q->prefix ? strlen(q->lname) : sizeof(q->lname);
+
+    if (strncmp(s->lname, q->lname, lname_len) != 0)
+        return NO_ERROR;
+    if (q->match_fname && strncmp(s->fname, q->fname, sizeof(q->fname)) != 0)
+        return NO_ERROR;
+
+    return print_record(s, &q->header_printed);
+}
+
+/*
+ *  find_by_name
+ *      fd:      linux file descriptor
+ *      lname:   last name to look for
+ *      fname:   first name that has to match too, or NULL
+ *      prefix:  match every last name starting with lname instead
+ *
+ *  Prints the matching students like print_db().  The name index returns
+ *  them ordered by name without a scan; if the database has no index the
+ *  whole database is scanned and they come out in id order.
+ *
+ *  returns:  NO_ERROR       at least one student matched
+ *            SRCH_NOT_FOUND no student matched
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  <see print_db()>  on success
+ *            M_NAME_NOT_FND    no student matched
+ *            M_ERR_DB_READ     error reading the database file
+ */
+int find_by_name(int fd, char *lname, char *fname, bool prefix)
+{
+    db_names_t *names = db_names_find(fd);
+    name_query_t q = {0};
+    char display[96];
+    int rc;
+
+    q.fd = fd;
+    q.prefix = prefix;
+    q.match_fname = fname != NULL;
+    strncpy(q.lname, lname, sizeof(q.lname) - 1);
+    if (fname != NULL)
+        strncpy(q.fname, fname, sizeof(q.fname) - 1);
+
+    // the index is read under the same lock that writers change it under
+    if (db_lock_all(fd, DB_LOCK_SH) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    else if (names != NULL)
+        rc = db_names_lookup(names, lname, fname, prefix, print_name_match, &q);
+    else
+        rc = scan_db(fd, filter_name_match, &q);
+    db_lock_all(fd, DB_LOCK_UN);
+
+    if (rc != NO_ERROR)
     {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
-    if (!header_printed)
+    if (!q.header_printed)
     {
-        printf(M_DB_EMPTY);
+        snprintf(display, sizeof(display), "%s%s%s%s", fname != NULL ? fname : "",
+                 fname != NULL ? " " : "", lname, prefix ? "*" : "");
+        printf(M_NAME_NOT_FND, display);
+        return SRCH_NOT_FOUND;
     }
 
     return NO_ERROR;
@@ -421,6 +1253,9 @@ void print_student(student_t *s)
  *  compressed file after you create it, it is a good design to return the fd
  *  of the new compressed file from this function
  *
+ *  The work is done by compress_db_ex(), keeping the layout the database
+ *  already has.
+ *
  *  returns:  <number>       returns the fd of the compressed database file
  *            ERR_DB_FILE    database file I/O issue
  *
@@ -439,8 +1274,263 @@ void print_student(student_t *s)
  */
 int compress_db(int fd)
 {
-    printf(M_NOT_IMPL);
+    return compress_db_ex(fd, db_pack_find(fd) != NULL ? DB_LAYOUT_PACKED : DB_LAYOUT_SPARSE);
+}
+
+//compaction output, live records are buffered into runs of consecutive
+//slots and written SCAN_BLOCK_RECS at a time
+typedef struct compact_out {
+    int fd;
+    int layout;
+    int *idx;
+    int next_slot;
+    int buff_slot;
+    int nbuff;
+    student_t buff[SCAN_BLOCK_RECS];
+} compact_out_t;
+
+static int compact_flush(compact_out_t *out)
+{
+    size_t len = (size_t)out->nbuff * STUDENT_RECORD_SIZE;
+    off_t offset = (off_t)out->buff_slot * STUDENT_RECORD_SIZE;
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t io_size = pwrite(out->fd, (char *)out->buff + done, len - done, offset + done);
+        if (io_size < 0)
+            return ERR_DB_FILE;
+        done += io_size;
+    }
+
+    out->nbuff = 0;
+    return NO_ERROR;
+}
+
+static int compact_record(const student_t *s, void *arg)
+{
+    compact_out_t *out = arg;
+    int slot = s->id;
+
+    if (out->layout == DB_LAYOUT_PACKED)
+    {
+        if (s->id < MIN_STD_ID || s->id > MAX_STD_ID)
+            return NO_ERROR;
+        slot = out->next_slot++;
+        out->idx[s->id] = slot;
+    }
+
+    if (out->nbuff > 0 &&
+        (out->nbuff == SCAN_BLOCK_RECS || out->buff_slot + out->nbuff != slot))
+    {
+        if (compact_flush(out) != NO_ERROR)
+            return ERR_DB_OP;
+    }
+
+    if (out->nbuff == 0)
+        out->buff_slot = slot;
+    out->buff[out->nbuff++] = *s;
+    return NO_ERROR;
+}
+
+static int fsync_dir(const char *dir)
+{
+    int dfd = open(dir, O_RDONLY | O_DIRECTORY);
+    int rc = NO_ERROR;
+
+    if (dfd < 0)
+        return ERR_DB_FILE;
+    if (fsync(dfd) < 0)
+        rc = ERR_DB_FILE;
+    close(dfd);
+    return rc;
+}
+
+/*
+ *  compress_db_ex
+ *      fd:      database file descriptor, closed by this function
+ *      layout:  DB_LAYOUT_SPARSE to keep students at id * 64, or
+ *               DB_LAYOUT_PACKED to store them back to back with an index
+ *
+ *  Streams the live students into TMP_DB_FILE in runs of up to
+ *  SCAN_BLOCK_RECS records, fsyncs it and renames it over DB_FILE, so a
+ *  crash leaves either the old or the new database behind, never a mix.
+ *  The packed index is written the same way.  It is renamed after the
+ *  database and checked against the header's generation on open, so an
+ *  index from before the crash is simply rebuilt.
+ *
+ *  returns:  <number>     the fd of the compressed database
+ *            ERR_DB_FILE  database file I/O issue
+ *
+ *  console:  see compress_db()
+ */
+int compress_db_ex(int fd, int layout)
+{
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    int open_flags = db_map_find(fd) != NULL ? DB_OPEN_MMAP : 0;
+    char idx_path[PATH_MAX];
+    char tmp_idx_path[PATH_MAX];
+    db_pack_hdr_t hdr;
+    struct stat st;
+    compact_out_t *out;
+    int rc;
+
+    // the compacted file is synced anyway, start it with an empty log
+    if (db_wal_find(fd) != NULL && db_wal_checkpoint(db_wal_find(fd)) != NO_ERROR)
+    {
+        printf(M_ERR_WAL);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    // writers wait until the new file is in place, then see that theirs
+    // was replaced instead of writing into it.  So does a second
+    // compaction, which has nothing left to do.
+    if (db_lock_all(fd, DB_LOCK_EX) != NO_ERROR || db_replaced(fd))
+    {
+        printf(M_ERR_DB_READ);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    out = calloc(1, sizeof(compact_out_t));
+    if (out == NULL)
+    {
+        printf(M_ERR_DB_WRITE);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    out->layout = layout;
+    out->fd = open(TMP_DB_FILE, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (out->fd < 0)
+    {
+        printf(M_ERR_DB_OPEN);
+        free(out);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    if (layout == DB_LAYOUT_PACKED)
+    {
+        out->idx = calloc(MAX_STD_ID + 1, sizeof(int));
+        if (out->idx == NULL)
+        {
+            rc = ERR_DB_OP;
+            goto fail;
+        }
+
+        // the header goes through the same buffer as slot 0
+        db_pack_init_hdr(&hdr);
+        out->idx[0] = (int)hdr.generation;
+        memcpy(&out->buff[0], &hdr, sizeof(hdr));
+        out->nbuff = 1;
+        out->next_slot = 1;
+    }
+
+    rc = scan_db(fd, compact_record, out);
+    if (rc == NO_ERROR && out->nbuff > 0)
+        rc = compact_flush(out) == NO_ERROR ? NO_ERROR : ERR_DB_OP;
+    if (rc == NO_ERROR && fsync(out->fd) < 0)
+        rc = ERR_DB_OP;
+    if (rc != NO_ERROR)
+        goto fail;
+
+    db_pack_index_path(DB_FILE, idx_path, sizeof(idx_path));
+    db_pack_index_path(TMP_DB_FILE, tmp_idx_path, sizeof(tmp_idx_path));
+    if (layout == DB_LAYOUT_PACKED &&
+        (fstat(out->fd, &st) < 0 || db_pack_write_index(tmp_idx_path, out->idx, &st) != NO_ERROR))
+    {
+        rc = ERR_DB_OP;
+        goto fail;
+    }
+
+    // processes that open the new file wait until its index is in place
+    if (db_lock_new(out->fd) != NO_ERROR)
+    {
+        rc = ERR_DB_OP;
+        goto fail;
+    }
+
+    if (rename(TMP_DB_FILE, DB_FILE) < 0)
+    {
+        printf(M_ERR_DB_CREATE);
+        close(out->fd);
+        unlink(TMP_DB_FILE);
+        unlink(tmp_idx_path);
+        free(out->idx);
+        free(out);
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    // a stale index is ignored by the default layout and rebuilt by a
+    // packed one, so failing here does not lose data
+    if (layout == DB_LAYOUT_PACKED)
+        rename(tmp_idx_path, idx_path);
+    else
+        unlink(idx_path);
+    fsync_dir(".");
+    close(out->fd);
+    close_db(fd);
+
+    free(out->idx);
+    free(out);
+
+    fd = open_db_ex(DB_FILE, open_flags);
+    if (fd < 0)
+        return ERR_DB_FILE;
+
+    printf(M_DB_COMPRESSED_OK);
     return fd;
+
+fail:
+    printf(rc == ERR_DB_OP ? M_ERR_DB_WRITE : M_ERR_DB_READ);
+    close(out->fd);
+    unlink(TMP_DB_FILE);
+    free(out->idx);
+    free(out);
+    close_db(fd);
+    return ERR_DB_FILE;
+}
+
+/*
+ *  parse_id_list
+ *      list:  comma separated student ids, e.g. "1,20,300"
+ *      ids:   set to a malloc()ed array of the ids
+ *
+ *  returns:  the number of ids, or -1 if list is not a list of numbers
+ */
+static int parse_id_list(const char *list, int **ids)
+{
+    const char *p = list;
+    int n = 1;
+
+    for (const char *c = list; *c != '\0'; c++)
+        n += *c == ',';
+
+    *ids = malloc(n * sizeof(**ids));
+    if (*ids == NULL)
+        return -1;
+
+    for (int i = 0; i < n; i++)
+    {
+        char *end;
+        long id;
+
+        errno = 0;
+        id = strtol(p, &end, 10);
+        if (end == p || errno != 0 || id < 0 || id > INT_MAX || (*end != ',' && *end != '\0'))
+        {
+            free(*ids);
+            *ids = NULL;
+            return -1;
+        }
+        (*ids)[i] = id;
+        p = end + 1;
+    }
+
+    return n;
 }
 
 /*
@@ -483,14 +1573,28 @@ int validate_range(int id, int gpa)
  */
 void usage(char *exename)
 {
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
+    printf("usage: %s -[h|a|b|c|d|D|e|f|F|g|l|L|p|P|q|s|U|W|x|X|z] options.  Where:\n", exename);
     printf("\t-h:  prints help\n");
     printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
+    printf("\t-b file:  bulk loads students, one \"id first_name last_name gpa\" per line (- for stdin)\n");
     printf("\t-c:  counts the records in the database\n");
     printf("\t-d id:  deletes a student\n");
+    printf("\t-e bin|json|csv:  exports every student as raw records, JSON lines or CSV\n");
     printf("\t-f id:  finds and prints a student in the database\n");
+    printf("\t-F id1,id2,...:  finds and prints a batch of students\n");
+    printf("\t-D id1,id2,...:  deletes a batch of students\n");
+    printf("\t-g:  prints gpa statistics: count, average, lowest, highest and a histogram\n");
+    printf("\t-l last_name [first_name]:  finds students by name\n");
+    printf("\t-L prefix:  finds students whose last name starts with prefix\n");
     printf("\t-p:  prints all records in the student database\n");
+    printf("\t-P -a|-c|-d|-f|-p|-z ...:  runs the operation on the paged database, ids up to %d\n", DB_PAGE_MAX_ID);
+    printf("\t-P -z [fname_len lname_len [page_size]]:  recreates the paged database with that schema\n");
+    printf("\t-q query:  prints the students matching query, e.g. \"gpa>=350 and id between 1000 and 2000\"\n");
+    printf("\t-s [socket]:  serves the database on a UNIX socket until interrupted\n");
+    printf("\t-U -a|-c|-d|-f ...:  runs the operation on a running -s server\n");
+    printf("\t-W on|off|checkpoint:  turns the write-ahead log on or off, or checkpoints it\n");
     printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
+    printf("\t-X:  compress the database file into the packed layout\n");
     printf("\t-z:  zero db file (remove all records)\n");
 }
 
@@ -503,12 +1607,32 @@ int main(int argc, char *argv[])
     int exit_code; // exit code to shell
     int id;        // userid from argv[2]
     int gpa;       // gpa from argv[5]
+    int open_flags; // open_db_ex() flags, selects the storage engine
+    char *engine;
+    int srv = -1;  // server connection when -U routes the operation
+    bool client = false;
+    int *ids;      // -F and -D id lists
+    int n;
 
     // space for a student structure which we will get back from
     // some of the functions we will be writing such as get_student(),
     // and print_student().
     student_t student = {0};
 
+    // -P in front of an option runs it on the paged database instead, see
+    // db_page.c
+    if (argc >= 2 && strcmp(argv[1], "-P") == 0)
+        exit(page_command(argc, argv));
+
+    // -U in front of an option sends it to a running server instead, see
+    // db_server.c
+    if (argc >= 2 && strcmp(argv[1], "-U") == 0)
+    {
+        memmove(&argv[1], &argv[2], (argc - 1) * sizeof(char *));
+        argc--;
+        client = true;
+    }
+
     // This function must have at least one arg, and the arg must start
     // with a dash
     if ((argc < 2) || (*argv[1] != '-'))
@@ -531,10 +1655,35 @@ int main(int argc, char *argv[])
     // now lets open the file and continue if there is no error
     // note we are not truncating the file using the second
     // parameter
-    fd = open_db(DB_FILE, false);
-    if (fd < 0)
+    // the mmap engine is the default, SDB_ENGINE=io keeps every record
+    // access a read()/write() syscall
+    open_flags = DB_OPEN_MMAP;
+    engine = getenv(SDB_ENGINE_ENV);
+    if (engine != NULL && strcmp(engine, "io") == 0)
+        open_flags = 0;
+
+    if (client)
+    {
+        if (opt == '\0' || strchr("acdf", opt) == NULL)
+        {
+            usage(argv[0]);
+            exit(EXIT_FAIL_ARGS);
+        }
+        srv = client_connect(db_socket_path());
+        if (srv < 0)
+        {
+            printf(M_ERR_SERVER, db_socket_path());
+            exit(EXIT_FAIL_DB);
+        }
+        fd = -1;
+    }
+    else
     {
-        exit(EXIT_FAIL_DB);
+        fd = open_db_ex(DB_FILE, open_flags);
+        if (fd < 0)
+        {
+            exit(EXIT_FAIL_DB);
+        }
     }
 
     // set rc to the return code of the operation to ensure the program
@@ -568,18 +1717,37 @@ int main(int argc, char *argv[])
             break;
         }
 
-        rc = add_student(fd, id, argv[3], argv[4], gpa);
+        if (srv >= 0)
+            rc = client_add_student(srv, id, argv[3], argv[4], gpa);
+        else
+            rc = add_student(fd, id, argv[3], argv[4], gpa);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
 
         break;
 
+    case 'b':
+        //   arv[0] arv[1]  arv[2]
+        // prog_name     -b    file
+        //-------------------------
+        // example:  prog_name -b students.csv
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = bulk_load(fd, argv[2]);
+        if (rc != 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'c':
         //    arv[0] arv[1]
         // prog_name     -c
         //-----------------
         // example:  prog_name -c
-        rc = count_db_records(fd);
+        rc = srv >= 0 ? client_count_db_records(srv) : count_db_records(fd);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
         break;
@@ -596,12 +1764,28 @@ int main(int argc, char *argv[])
             break;
         }
         id = atoi(argv[2]);
-        rc = del_student(fd, id);
+        rc = srv >= 0 ? client_del_student(srv, id) : del_student(fd, id);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
 
         break;
 
+    case 'e':
+        //   arv[0] arv[1]         arv[2]
+        // prog_name     -e  bin|json|csv
+        //-------------------------------
+        // example:  prog_name -e json > students.json
+        if (argc != 3 || export_format(argv[2]) < 0)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = export_db(fd, export_format(argv[2]), STDOUT_FILENO);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'f':
         //    arv[0] arv[1]  arv[2]
         // prog_name     -f      id
@@ -614,7 +1798,10 @@ int main(int argc, char *argv[])
             break;
         }
         id = atoi(argv[2]);
-        rc = get_student(fd, id, &student);
+        if (srv >= 0)
+            rc = client_get_student(srv, id, &student);
+        else
+            rc = get_student(fd, id, &student);
 
         switch (rc)
         {
@@ -632,6 +1819,55 @@ int main(int argc, char *argv[])
         }
         break;
 
+    case 'F':
+    case 'D':
+        //   arv[0] arv[1]       arv[2]
+        // prog_name  -F|-D  id,id,...
+        //-------------------------------
+        // example:  prog_name -F 100,200,300
+        if (argc != 3 || (n = parse_id_list(argv[2], &ids)) < 0)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (opt == 'F')
+            rc = find_students(fd, ids, n);
+        else
+            rc = del_students(fd, ids, n);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        free(ids);
+        break;
+
+    case 'g':
+        //    arv[0] arv[1]
+        // prog_name     -g
+        //-----------------
+        // example:  prog_name -g
+        rc = aggregate_db(fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'l':
+    case 'L':
+        //    arv[0] arv[1]     arv[2]       arv[3]
+        // prog_name     -l  last_name  first_name(optional)
+        // prog_name     -L     prefix
+        //---------------------------------------------------
+        // example:  prog_name -l doe john
+        if (argc != 3 && !(opt == 'l' && argc == 4))
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = find_by_name(fd, argv[2], argc == 4 ? argv[3] : NULL, opt == 'L');
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'p':
         //    arv[0] arv[1]
         // prog_name     -p
@@ -642,6 +1878,83 @@ int main(int argc, char *argv[])
             exit_code = EXIT_FAIL_DB;
         break;
 
+    case 'q':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -q   query
+        //-------------------------
+        // example:  prog_name -q "gpa>=350 and lname=doe"
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = query_db(fd, argv[2]);
+        if (rc == EXIT_FAIL_ARGS)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 's':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -s  socket(optional)
+        //-------------------------------------
+        // example:  prog_name -s /tmp/student.sock
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = serve_db(&fd, open_flags, argc == 3 ? argv[2] : db_socket_path());
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'W':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -W  on|off|checkpoint
+        //--------------------------------------
+        // example:  prog_name -W on
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (strcmp(argv[2], "on") == 0)
+        {
+            rc = db_wal_enable(fd, DB_FILE);
+            if (rc == NO_ERROR)
+                printf(M_WAL_ON);
+        }
+        else if (strcmp(argv[2], "off") == 0)
+        {
+            rc = db_wal_disable(fd);
+            if (rc == NO_ERROR)
+                printf(M_WAL_OFF);
+        }
+        else if (strcmp(argv[2], "checkpoint") == 0)
+        {
+            // without a log every write is already in place
+            rc = db_wal_find(fd) != NULL ? db_wal_checkpoint(db_wal_find(fd)) : NO_ERROR;
+            if (rc == NO_ERROR)
+                printf(M_WAL_CHECKPOINT);
+        }
+        else
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (rc != NO_ERROR)
+        {
+            printf(M_ERR_WAL);
+            exit_code = EXIT_FAIL_DB;
+        }
+        break;
+
     case 'x':
         //    arv[0] arv[1]
         // prog_name     -x
@@ -655,6 +1968,16 @@ int main(int argc, char *argv[])
             exit_code = EXIT_FAIL_DB;
         break;
 
+    case 'X':
+        //    arv[0] arv[1]
+        // prog_name     -X
+        //-----------------
+        // example:  prog_name -X
+        fd = compress_db_ex(fd, DB_LAYOUT_PACKED);
+        if (fd < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'z':
         //    arv[0] arv[1]
         // prog_name     -x
@@ -662,8 +1985,8 @@ int main(int argc, char *argv[])
         // example:  prog_name -x
         // HINT:  close the db file, we already have fd
         //       and reopen db indicating truncate=true
-        close(fd);
-        fd = open_db(DB_FILE, true);
+        close_db(fd);
+        fd = open_db_ex(DB_FILE, open_flags | DB_OPEN_TRUNC);
         if (fd < 0)
         {
             exit_code = EXIT_FAIL_DB;
@@ -679,6 +2002,9 @@ int main(int argc, char *argv[])
 
     // dont forget to close the file before exiting, and setting the
     // proper exit code - see the header file for expected values
-    close(fd);
+    if (srv >= 0)
+        close(srv);
+    else
+        close_db(fd);
     exit(exit_code);
 }
@@ -1,19 +1,436 @@
 #ifndef __SDB_H__
 
+#include <limits.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "db.h" //get student record type
 
+//open_db_ex() flags.  DB_OPEN_MMAP serves the database from a shared
+//mapping (see db_mmap.c), if the file cannot be mapped the fd silently
+//falls back to read()/write().  SDB_ENGINE_ENV=io disables the mapping.
+#define DB_OPEN_TRUNC   0x01
+#define DB_OPEN_MMAP    0x02
+#define SDB_ENGINE_ENV  "SDB_ENGINE"
+
+//state of the memory mapped engine, recs covers file_len bytes of the
+//db file rounded up to whole pages
+typedef struct db_map {
+    int fd;
+    student_t *recs;
+    size_t map_len;
+    off_t file_len;
+} db_map_t;
+
+//packed layout (see db_pack.c), slot 0 of the database holds this header
+//instead of a student, no student has id 0 so it never collides
+#define DB_PACK_MAGIC   "sdbsc-packed"
+#define DB_PACK_VERSION 1
+#define DB_IDX_SUFFIX   ".idx"
+#define DB_IDX_MAGIC    "sdbsidx"
+#define DB_IDX_VERSION  1
+
+typedef struct db_pack_hdr {
+    int id;                     //always DELETED_STUDENT_ID
+    char magic[16];             //DB_PACK_MAGIC
+    int version;                //DB_PACK_VERSION
+    unsigned int generation;    //changes on every compaction, see the index
+    char reserved[36];
+} db_pack_hdr_t;
+
+//state of a packed database, idx maps every id to its slot
+typedef struct db_pack {
+    int fd;
+    int *idx;
+    struct db_side_hdr *hdr;    //after the slots, see db_pack.c
+    unsigned int generation;
+} db_pack_t;
+
+//header of every sidecar file next to the database, see db_side.c
+typedef struct db_side_hdr {
+    char magic[8];
+    int version;
+    int writers;                //updates in progress, see db_side_begin()
+    uint64_t dev;               //the database the sidecar was built from
+    uint64_t ino;
+    uint64_t count;             //entries, for sidecars that keep a list
+    uint64_t cap;
+    char reserved[16];
+} db_side_hdr_t;
+
+//occupancy bitmap (see db_bitmap.c), one bit per student id
+#define DB_BMP_MAGIC    "sdbsbmp"
+#define DB_BMP_VERSION  1
+#define DB_BMP_SUFFIX   ".bmp"
+
+typedef struct db_bmp {
+    int fd;
+    db_side_hdr_t *hdr;
+    uint64_t *words;
+} db_bmp_t;
+
+//name index (see db_names.c), sorted by last name, first name and id
+#define DB_NAMES_MAGIC      "sdbsnam"
+#define DB_NAMES_VERSION    1
+#define DB_NAMES_SUFFIX     ".names"
+
+typedef struct db_name_ent {
+    char lname[32];
+    char fname[24];
+    int id;
+    int reserved;
+} db_name_ent_t;
+
+typedef struct db_names {
+    int fd;
+    db_side_hdr_t *hdr;
+    db_name_ent_t *ents;
+    size_t map_len;
+    char path[PATH_MAX];
+} db_names_t;
+
+//columnar shadow (see db_col.c), the ids and gpas of every student as two
+//packed int arrays of COL_CAP entries each, plus where each id is in them
+#define DB_COL_MAGIC    "sdbscol"
+#define DB_COL_VERSION  2
+#define DB_COL_SUFFIX   ".col"
+
+typedef struct db_col {
+    int fd;
+    db_side_hdr_t *hdr;
+    int *ids;
+    int *gpas;
+    int *rows;                  //by id, position in ids + 1, 0 if absent
+} db_col_t;
+
+//aggregate_db() histogram, 0.50 wide buckets from 0.00 to 5.00
+#define DB_GPA_BUCKET_WIDTH 50
+#define DB_GPA_BUCKETS      ((MAX_STD_GPA - MIN_STD_GPA) / DB_GPA_BUCKET_WIDTH)
+
+typedef struct db_gpa_stats {
+    int count;
+    long sum;
+    int min;
+    int max;
+    int hist[DB_GPA_BUCKETS];
+} db_gpa_stats_t;
+
+//write-ahead log (see db_wal.c), header followed by db_wal_ent_t entries
+#define DB_WAL_MAGIC            "sdbswal"
+#define DB_WAL_VERSION          1
+#define DB_WAL_SUFFIX           ".wal"
+#define DB_WAL_CHECKPOINT_BYTES (1 << 20)
+#define DB_WAL_PUT              1
+#define DB_WAL_DEL              2
+#define DB_WAL_REPLAYED         1
+
+typedef struct db_wal_hdr {
+    char magic[8];
+    int version;
+    int pending;                //mutations in progress, see db_wal_begin()
+    uint64_t synced;            //the log is on disk up to here
+    uint64_t boot;              //hash of the boot id at the last checkpoint
+    char reserved[32];
+} db_wal_hdr_t;
+
+typedef struct db_wal_ent {
+    uint32_t check;             //hash of the rest, a torn entry ends the log
+    int op;                     //DB_WAL_PUT or DB_WAL_DEL
+    int id;
+    int reserved;
+    student_t rec;              //the full new record
+} db_wal_ent_t;
+
+typedef struct db_wal {
+    int fd;
+    int db_fd;
+    db_wal_hdr_t *hdr;
+    char path[PATH_MAX];
+} db_wal_t;
+
+//db_wal_open() callback, applies one logged record during recovery
+typedef int (*db_wal_replay_fn)(int fd, int id, const student_t *s);
+
+//server mode (see db_server.c), fixed size requests and responses in host
+//byte order over a UNIX domain socket
+#define DB_SOCK_SUFFIX  ".sock"
+#define DB_SOCK_ENV     "SDB_SOCKET"
+#define DB_REQ_GET      1
+#define DB_REQ_ADD      2
+#define DB_REQ_DEL      3
+#define DB_REQ_COUNT    4
+
+typedef struct db_req {
+    int op;                     //DB_REQ_*
+    int id;
+    int gpa;                    //DB_REQ_ADD
+    int reserved;
+    char fname[24];             //DB_REQ_ADD
+    char lname[32];
+} db_req_t;
+
+typedef struct db_resp {
+    int status;                 //NO_ERROR or the error code of the operation
+    int count;                  //DB_REQ_COUNT
+    student_t rec;              //DB_REQ_GET
+} db_resp_t;
+
+//record locks (see db_lock.c), fcntl() ranges of the database keyed by
+//student id, DB_LOCK_META is the range past the last id
+#define DB_LOCK_UN      0
+#define DB_LOCK_SH      1
+#define DB_LOCK_EX      2
+#define DB_LOCK_META    (MAX_STD_ID + 1)
+
+//the fd that holds the whole range and how many db_lock_all() calls deep
+typedef struct db_lock {
+    int fd;
+    int depth;
+} db_lock_t;
+
+//paged database (see db_page.c), a B+-tree of student records in
+//page_size pages behind a db_page_hdr_t in page 0.  The schema, the name
+//lengths and the page size, is chosen by -P -z and kept in the header.
+#define DB_PAGE_FILE        "student.pdb"
+#define DB_PAGE_MAGIC       "sdbspage"
+#define DB_PAGE_VERSION     1
+#define DB_PAGE_SIZE        4096
+#define DB_PAGE_MIN_SIZE    256
+#define DB_PAGE_MAX_SIZE    65536
+#define DB_PAGE_FNAME_LEN   64
+#define DB_PAGE_LNAME_LEN   64
+#define DB_PAGE_NAME_MAX    255
+#define DB_PAGE_MAX_ID      INT_MAX
+#define DB_PAGE_MAX_HEIGHT  16
+#define DB_NODE_LEAF        1
+#define DB_NODE_INNER       2
+
+typedef struct db_page_hdr {
+    char magic[8];              //DB_PAGE_MAGIC, not NUL terminated
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t record_size;       //id, gpa and both names, 4 byte aligned
+    uint32_t fname_len;
+    uint32_t lname_len;
+    uint32_t root;              //page of the root node
+    uint32_t height;            //levels of the tree, 1 while the root is a leaf
+    uint32_t npages;            //pages in the file, including this one
+    uint64_t count;             //students in the database
+    char reserved[64];
+} db_page_hdr_t;
+
+//start of every page of the tree
+typedef struct db_node_hdr {
+    uint16_t type;              //DB_NODE_LEAF or DB_NODE_INNER
+    uint16_t nkeys;             //records of a leaf, separator keys of an inner node
+    uint32_t next;              //the leaf after this one in id order, 0 at the end
+    uint32_t reserved[2];
+} db_node_hdr_t;
+
+//a student of the paged database, the names NUL terminated
+typedef struct db_page_rec {
+    int id;
+    int gpa;
+    char fname[DB_PAGE_NAME_MAX + 1];
+    char lname[DB_PAGE_NAME_MAX + 1];
+} db_page_rec_t;
+
+//an open paged database, path has room for a page per level of the tree
+typedef struct db_page {
+    int fd;
+    db_page_hdr_t hdr;
+    int leaf_max;               //records per leaf
+    int inner_max;              //separator keys per inner node
+    char *path;
+    char *split;                //the new page of a split
+    char *spill;                //a full node plus the entry that split it
+} db_page_t;
+
+//batched record I/O (see db_batch.c), one read or write of len bytes at
+//off into buf, res is the byte count or -errno once it ran
+#define SDB_BATCH_ENV           "SDB_BATCH"
+#define DB_BATCH_RING_ENTRIES   256
+#define DB_BATCH_THREADS        8
+
+typedef struct db_batch_req {
+    void *buf;
+    size_t len;
+    off_t off;
+    ssize_t res;
+} db_batch_req_t;
+
+//export_db() formats (see db_export.c), rows are formatted into
+//EXPORT_SEGS segments that are written with one writev().  EXPORT_ROW_MAX
+//bounds the longest row, a JSON row with every name byte escaped.
+#define DB_EXPORT_BIN   0
+#define DB_EXPORT_JSON  1
+#define DB_EXPORT_CSV   2
+#define EXPORT_SEG_LEN  (64 * 1024)
+#define EXPORT_SEGS     16
+#define EXPORT_ROW_MAX  512
+
+typedef struct db_export {
+    int out;                    //fd the export goes to
+    int format;
+    bool failed;                //a write to out failed
+    char *buf;                  //the segments, back to back
+    int seg;                    //the segment being filled
+    size_t len[EXPORT_SEGS];    //bytes used of every segment
+} db_export_t;
+
+//compress_db_ex() output layouts
+#define DB_LAYOUT_SPARSE 0
+#define DB_LAYOUT_PACKED 1
+
+//records read per pread() by scan_db(), 64KB
+#define SCAN_BLOCK_RECS 1024
+
+//scan_db() callback, called once per live record
+typedef int (*db_scan_fn)(const student_t *s, void *arg);
+
+//scan_db_range() callback, called with n consecutive slots of the file
+typedef int (*db_block_fn)(const student_t *recs, int n, void *arg);
+
 //prototypes for functions go below for this assignment
 int open_db(char *dbFile, bool should_truncate);
+int open_db_ex(char *dbFile, int flags);
+void close_db(int fd);
+bool db_replaced(int fd);
+int reopen_db(int fd, char *dbFile, int open_flags);
 int add_student(int fd, int id, char *fname, char *lname, int gpa);
 int get_student(int fd, int id, student_t *s);
+int put_record(int fd, int id, const student_t *s);
+int insert_student(int fd, const student_t *s);
+int remove_student(int fd, int id);
 int del_student(int fd, int id);
+int get_students(int fd, const int *ids, int n, student_t *recs, int *status);
+int remove_students(int fd, const int *ids, int n, int *status);
+int find_students(int fd, const int *ids, int n);
+int del_students(int fd, const int *ids, int n);
 int compress_db(int fd);
+int compress_db_ex(int fd, int layout);
 void print_student(student_t *s);
 int validate_range(int id, int gpa);
+int count_students(int fd);
 int count_db_records(int fd);
 int print_db(int fd);
+int print_record(const student_t *s, void *arg);
+int find_by_name(int fd, char *lname, char *fname, bool prefix);
 void usage(char *);
 
+//sparse aware scans, db_scan.c
+int scan_db(int fd, db_scan_fn fn, void *arg);
+int scan_db_range(int fd, int first_id, int last_id, db_block_fn fn, void *arg);
+
+//live record detection, db_live.c
+int db_live_slots(const student_t *recs, int n, int *live);
+
+//predicate queries, db_query.c
+int query_db(int fd, const char *text);
+
+//bulk loading, db_bulk.c
+int bulk_load(int fd, char *path);
+
+//packed layout and its id index, db_pack.c
+void db_pack_index_path(const char *dbFile, char *path, size_t len);
+void db_pack_init_hdr(db_pack_hdr_t *hdr);
+int db_pack_write_index(const char *path, const int *idx, struct stat *db_st);
+int db_pack_open(int fd, const char *dbFile);
+void db_pack_close(int fd);
+db_pack_t *db_pack_find(int fd);
+int db_pack_slot(db_pack_t *pack, int id);
+void db_pack_set(db_pack_t *pack, int id, int slot);
+int db_pack_next_slot(db_pack_t *pack);
+
+//sidecar files, db_side.c
+int db_side_map(const char *path, size_t len, void **base, size_t *mlen);
+bool db_side_valid(db_side_hdr_t *hdr, const char *magic, int version, struct stat *db_st);
+void db_side_stamp(db_side_hdr_t *hdr, const char *magic, int version, struct stat *db_st);
+void db_side_begin(db_side_hdr_t *hdr);
+void db_side_end(db_side_hdr_t *hdr);
+
+//occupancy bitmap, db_bitmap.c
+int db_bmp_open(int fd, const char *dbFile, bool reset);
+void db_bmp_close(int fd);
+db_bmp_t *db_bmp_find(int fd);
+bool db_bmp_test(db_bmp_t *bmp, int id);
+void db_bmp_set(db_bmp_t *bmp, int id, bool live);
+int db_bmp_count(db_bmp_t *bmp);
+int db_bmp_next(db_bmp_t *bmp, int from);
+
+//name index, db_names.c
+int db_names_open(int fd, const char *dbFile, bool reset);
+void db_names_close(int fd);
+db_names_t *db_names_find(int fd);
+int db_names_insert(db_names_t *names, const student_t *s);
+void db_names_remove(db_names_t *names, const student_t *s);
+int db_names_merge(db_names_t *names, student_t **recs, int n);
+int db_names_lookup(db_names_t *names, const char *lname, const char *fname, bool prefix,
+                    int (*fn)(int id, void *arg), void *arg);
+
+//columnar shadow and gpa aggregates, db_col.c
+int db_col_open(int fd, const char *dbFile, bool reset);
+void db_col_close(int fd);
+db_col_t *db_col_find(int fd);
+int db_col_add(db_col_t *col, int id, int gpa);
+void db_col_remove(db_col_t *col, int id);
+void db_gpa_stats(const int *gpas, size_t n, db_gpa_stats_t *stats);
+int aggregate_db(int fd);
+
+//write-ahead log, db_wal.c
+int db_wal_open(int fd, const char *dbFile, bool reset, db_wal_replay_fn fn);
+void db_wal_close(int fd);
+db_wal_t *db_wal_find(int fd);
+int db_wal_enable(int fd, const char *dbFile);
+int db_wal_disable(int fd);
+int db_wal_checkpoint(db_wal_t *wal);
+int db_wal_begin(db_wal_t *wal);
+void db_wal_end(db_wal_t *wal, bool ok);
+int db_wal_log(db_wal_t *wal, int id, const student_t *s);
+int db_wal_log_batch(db_wal_t *wal, const int *ids, student_t **recs, int n);
+
+//server mode and its client, db_server.c
+const char *db_socket_path(void);
+int serve_db(int *fd, int open_flags, const char *path);
+int client_connect(const char *path);
+int client_get_student(int sock, int id, student_t *s);
+int client_add_student(int sock, int id, char *fname, char *lname, int gpa);
+int client_del_student(int sock, int id);
+int client_count_db_records(int sock);
+
+//record locks, db_lock.c
+int db_lock_record(int fd, int id, int type);
+int db_lock_meta(int fd, int type);
+int db_lock_all(int fd, int type);
+int db_lock_new(int fd);
+void db_lock_close(int fd);
+
+//paged database, db_page.c
+db_page_t *db_page_open(const char *path, bool write, bool reset, int fname_len, int lname_len,
+                        int page_size, int *err);
+void db_page_close(db_page_t *db);
+int db_page_get(db_page_t *db, int id, db_page_rec_t *s);
+int db_page_insert(db_page_t *db, const db_page_rec_t *s);
+int db_page_delete(db_page_t *db, int id);
+int db_page_scan(db_page_t *db, int (*fn)(const db_page_rec_t *s, void *arg), void *arg);
+int page_command(int argc, char *argv[]);
+
+//streaming export, db_export.c
+int export_format(const char *name);
+int export_db(int fd, int format, int out);
+
+//batched record I/O, db_batch.c
+int db_batch_io(int fd, bool write, db_batch_req_t *reqs, int n);
+
+//memory mapped engine, db_mmap.c
+int db_map_open(int fd);
+void db_map_close(int fd);
+db_map_t *db_map_find(int fd);
+int db_map_refresh(db_map_t *map);
+int db_map_reserve(db_map_t *map, off_t len);
+student_t *db_map_record(db_map_t *map, int id);
+int db_map_nrecs(db_map_t *map);
+
 //error codes to be returned from individual functions
 // NO_ERROR is returned if there are no errors
 // ERR_DB_FILE is returned if there is are any issues with the database file itself
@@ -53,6 +470,20 @@ void usage(char *);
 #define M_DB_EMPTY        "Database contains no student records.\n"
 #define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
 #define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
+#define M_NAME_NOT_FND    "No students named %s were found in database.\n"
+#define M_QUERY_NO_MATCH  "No students match the query.\n"
+#define M_ERR_QUERY       "Cant run query, %s at \"%s\".\n"
+#define M_WAL_ON          "Write-ahead log enabled.\n"
+#define M_WAL_OFF         "Write-ahead log disabled.\n"
+#define M_WAL_CHECKPOINT  "Write-ahead log checkpointed into the database.\n"
+#define M_ERR_WAL         "Error using the write-ahead log, exiting!\n"
+#define M_SERVER_READY    "Serving student database on %s.\n"
+#define M_ERR_SERVER      "Cant serve or reach the student database on %s!\n"
+#define M_ERR_PAGE_SCHEMA "Cant create a paged database with %d and %d byte names in %d byte pages.\n"
+#define M_ERR_EXPORT      "Error writing the export, exiting!\n"
+#define M_GPA_STATS       "GPA average %.2f, lowest %.2f, highest %.2f.\n"
+#define M_ERR_BULK_LINE   "Skipping line %d, expected: id first_name last_name gpa (in range).\n"
+#define M_BULK_DONE       "Bulk load added %d student(s), skipped %d, in %.3f seconds (%.0f records/sec).\n"
 
 //useful format strings for print students
 //For example to print the header in the required output:
@@ -61,4 +492,14 @@ void usage(char *);
 #define  STUDENT_PRINT_HDR_STRING   "%-6s %-24s %-32s %-3s\n"
 #define  STUDENT_PRINT_FMT_STRING   "%-6d %-24.24s %-32.32s %-3.2f\n"
 
+//paged database rows, the name columns are as wide as the schema's names
+#define  PAGE_PRINT_HDR_STRING      "%-10s %-*s %-*s %-3s\n"
+#define  PAGE_PRINT_FMT_STRING      "%-10d %-*s %-*s %-3.2f\n"
+
+//gpa histogram rows of aggregate_db(), the bar is cut from GPA_HIST_BAR
+#define  GPA_HIST_HDR_STRING        "%-9s %6s\n"
+#define  GPA_HIST_FMT_STRING        "%.2f-%.2f %6d %.*s\n"
+#define  GPA_HIST_BAR               "########################################"
+#define  GPA_HIST_BAR_MAX           40
+
 #endif
\ No newline at end of file
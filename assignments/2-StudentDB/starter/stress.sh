@@ -0,0 +1,123 @@
+#! /bin/bash
+#
+# Hammers one database from several sdbsc processes at once.
+#
+#   ./stress.sh [processes] [operations] [ids] [sdbsc options]
+#
+# First every process adds the same [ids] new students in the same order,
+# exactly one add of each may succeed.  Then every process adds, deletes,
+# finds and prints random ids out of the first [ids], so they keep
+# colliding on the same records.  Student <id> is always "f<id> l<id>"
+# with a gpa derived from the id, a find that prints anything else saw a
+# torn or misplaced record.  At the end every student that was reported
+# added and not deleted has to be in the database, and the count, the full
+# print, the name index and the columns have to agree.
+#
+# Runs in a scratch directory, student.db next to sdbsc is not touched.
+# The options, e.g. -X or -W on, are run on the empty database first.
+# SDB_ENGINE is passed through, SDB_ENGINE=io stresses pread()/pwrite().
+
+procs=${1:-8}
+ops=${2:-200}
+ids=${3:-50}
+shift $(($# < 3 ? $# : 3))
+
+sdbsc=$(cd "$(dirname "$0")" && pwd)/sdbsc
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+fail() {
+    echo "stress: $*"
+    exit 1
+}
+
+student() {
+    "$sdbsc" -a "$1" "f$1" "l$1" $(($1 % 400 + 100))
+}
+
+racer() {
+    local added=0
+
+    for ((id = ids + 1; id <= 2 * ids; id++)); do
+        [ "$(student "$id")" = "Student $id added to database." ] && added=$((added + 1))
+    done
+
+    echo "$added" >"race.$1"
+}
+
+worker() {
+    local added=0 deleted=0 torn=0
+    local id out
+
+    RANDOM=$1
+    for ((i = 0; i < ops; i++)); do
+        id=$((RANDOM % ids + 1))
+        case $((RANDOM % 8)) in
+        0 | 1 | 2)
+            out=$(student "$id")
+            [ "$out" = "Student $id added to database." ] && added=$((added + 1))
+            ;;
+        3 | 4)
+            out=$("$sdbsc" -d "$id")
+            [ "$out" = "Student $id was deleted from database." ] && deleted=$((deleted + 1))
+            ;;
+        5 | 6)
+            if out=$("$sdbsc" -f "$id"); then
+                out=$(echo "$out" | tail -1 | tr -s ' ')
+                [ "$out" = "$id f$id l$id $(printf '%.2f' "$((id % 400 + 100))e-2")" ] ||
+                    torn=$((torn + 1))
+            fi
+            ;;
+        7)
+            "$sdbsc" -p >/dev/null
+            ;;
+        esac
+    done
+
+    echo "$added $deleted $torn" >"result.$1"
+}
+
+if [ $# -gt 0 ]; then
+    "$sdbsc" "$@" >/dev/null || fail "sdbsc $* failed"
+fi
+
+for ((p = 1; p <= procs; p++)); do
+    racer "$p" &
+done
+wait
+
+expected=0
+for ((p = 1; p <= procs; p++)); do
+    read -r added <"race.$p" || fail "process $p did not finish"
+    expected=$((expected + added))
+done
+[ "$expected" -eq "$ids" ] || fail "$expected adds of $ids new students succeeded"
+
+for ((p = 1; p <= procs; p++)); do
+    worker "$p" &
+done
+wait
+
+for ((p = 1; p <= procs; p++)); do
+    read -r added deleted torn <"result.$p" || fail "process $p did not finish"
+    [ "$torn" -eq 0 ] || fail "process $p read $torn torn record(s)"
+    expected=$((expected + added - deleted))
+done
+
+count=$("$sdbsc" -c | grep -o '[0-9]\+')
+[ -n "$count" ] || count=0
+[ "$count" -eq "$expected" ] || fail "$count students, $expected were added and not deleted"
+
+rows=$("$sdbsc" -p | grep -c '^[0-9]')
+[ "$rows" -eq "$count" ] || fail "-p prints $rows students, -c counts $count"
+
+rows=$("$sdbsc" -L '' | grep -c '^[0-9]')
+[ "$rows" -eq "$count" ] || fail "the name index has $rows students, -c counts $count"
+
+if [ "$count" -gt 0 ]; then
+    rows=$("$sdbsc" -g | head -1 | grep -o '[0-9]\+')
+    [ "$rows" -eq "$count" ] || fail "the columns have $rows students, -c counts $count"
+fi
+
+echo "$procs processes, $((procs * ops)) operations, $count students left."
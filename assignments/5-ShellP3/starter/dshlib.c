@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -6,6 +7,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <spawn.h>
+#include <errno.h>
 #include "dshlib.h"
 
 int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff) {
@@ -69,8 +72,76 @@ int build_cmd_list(char *cmd_line, command_list_t *clist) {
     return rc;
 }
 
+static int g_spawn_backend = -1;
+
+void set_spawn_backend(int backend) {
+    g_spawn_backend = backend;
+}
+
+int get_spawn_backend() {
+    char *env;
+
+    if (g_spawn_backend < 0) {
+        env = getenv(DSH_SPAWN_ENV);
+        if (env != NULL && strcmp(env, "posix_spawn") == 0) {
+            g_spawn_backend = DSH_SPAWN_POSIX;
+        } else {
+            g_spawn_backend = DSH_SPAWN_FORK;
+        }
+    }
+
+    return g_spawn_backend;
+}
+
+/*
+ * Starts cmd with posix_spawnp(), which glibc implements with
+ * clone(CLONE_VM|CLONE_VFORK), so the shell's page tables are never
+ * copied.  in_fd, out_fd and err_fd replace stdin, stdout and stderr
+ * unless they are -1; any other descriptor the caller holds must be
+ * close-on-exec.  Returns the pid, or -1 with errno set if the command
+ * could not be started.
+ */
+pid_t spawn_cmd(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd) {
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int rc;
+
+    rc = posix_spawn_file_actions_init(&actions);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+
+    if (in_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+    if (out_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+    if (err_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+    }
+
+    rc = posix_spawnp(&pid, cmd->argv[0], &actions, NULL, cmd->argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+    return pid;
+}
+
 int exec_cmd(cmd_buff_t *cmd) {
-    int child_pid = fork();
+    int child_pid = -1;
+
+    // commands that cannot be spawned are forked to fail the usual way
+    if (get_spawn_backend() == DSH_SPAWN_POSIX) {
+        child_pid = spawn_cmd(cmd, -1, -1, -1);
+    }
+    if (child_pid < 0) {
+        child_pid = fork();
+    }
     
     if (child_pid < 0) {
         printf("Error: Could not create process\n");
@@ -130,13 +201,22 @@ int execute_pipeline(command_list_t *clist) {
     pid_t pids[clist->num];
 
     for (int i = 0; i < clist->num - 1; i++) {
-        if (pipe(pipes[i]) == -1) {
+        if (pipe2(pipes[i], O_CLOEXEC) == -1) {
             perror("pipe");
             return ERR_EXEC_CMD;
         }
     }
 
     for (int i = 0; i < clist->num; i++) {
+        if (get_spawn_backend() == DSH_SPAWN_POSIX) {
+            pids[i] = spawn_cmd(&clist->commands[i],
+                                (i > 0) ? pipes[i - 1][0] : -1,
+                                (i < clist->num - 1) ? pipes[i][1] : -1, -1);
+            if (pids[i] > 0) {
+                continue;
+            }
+        }
+
         pids[i] = fork();
         if (pids[i] == -1) {
             perror("fork");
@@ -1,6 +1,8 @@
 #ifndef __DSHLIB_H__
     #define __DSHLIB_H__
 
+#include <sys/types.h>
+
 
 //Constants for command structure sizes
 #define EXE_MAX 64
@@ -82,6 +84,15 @@ int exec_local_cmd_loop();
 int exec_cmd(cmd_buff_t *cmd);
 int execute_pipeline(command_list_t *clist);
 
+//process launch backends, DSH_SPAWN_ENV=posix_spawn selects spawn at startup
+#define DSH_SPAWN_FORK      0
+#define DSH_SPAWN_POSIX     1
+#define DSH_SPAWN_ENV       "DSH_SPAWN"
+
+void set_spawn_backend(int backend);
+int get_spawn_backend();
+pid_t spawn_cmd(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd);
+
 
 
 
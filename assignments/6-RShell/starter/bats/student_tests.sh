@@ -36,11 +36,21 @@ EOF
 }
 
 @test "Test: Multiple pipes put together pt1" {
+    # a fixture of the starter's four sources, so that files added to the
+    # tree do not change the count
+    fixture="$BATS_TMPDIR/pipes_fixture"
+    rm -rf "$fixture"
+    mkdir -p "$fixture"
+    touch "$fixture/dsh_cli.c" "$fixture/dshlib.c" "$fixture/rsh_cli.c" "$fixture/rsh_server.c"
+    touch "$fixture/dshlib.h" "$fixture/makefile"
+
     run "./dsh" <<EOF
+cd $fixture
 ls | grep .c | wc -l
 EOF
+    rm -rf "$fixture"
     stripped_output=$(echo "$output" | tr -d '[:space:]')
-    expected_output="localmodedsh4>4dsh4>cmdloopreturned0"
+    expected_output="localmodedsh4>dsh4>4dsh4>cmdloopreturned0"
     echo "Captured stdout:"
     echo "Output: $output"
     echo "Exit Status: $status"
@@ -202,10 +212,488 @@ EOF
     [ "$status" -eq 0 ]
 }
 
-@test "Test: Cant go past 8 commands in a pipeline" {
+@test "Test: Pipelines longer than 8 commands run" {
+    run "./dsh" <<EOF
+echo command1 | cat | cat | cat | cat | cat | cat | cat | cat | cat | tr a-z A-Z
+EOF
+    [[ "$output" =~ "COMMAND1" ]]
+    [ "$status" -eq 0 ]
+}
+
+@test "Test: Commands with more than 8 arguments are not truncated" {
     run "./dsh" <<EOF
-echo command1 | echo command2 | echo command3 | echo command4 | echo command5 | echo command6 | echo command7 | echo command8 | echo command9
+echo a1 a2 a3 a4 a5 a6 a7 a8 a9 a10 a11 a12
+EOF
+    [[ "$output" =~ "a1 a2 a3 a4 a5 a6 a7 a8 a9 a10 a11 a12" ]]
+    [ "$status" -eq 0 ]
+}
+
+# Remote shell tests start their own server on a random port with the
+# environment given to start_rdsh_server; teardown stops it.
+start_rdsh_server() {
+    RDSH_PORT=$((20000 + RANDOM % 20000))
+    env "$@" ./dsh -s -i 127.0.0.1 -p "$RDSH_PORT" > /dev/null 2>&1 &
+    RDSH_SERVER_PID=$!
+
+    for i in $(seq 50); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$RDSH_PORT") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+# Waits up to $1 seconds for the server to exit on its own
+wait_rdsh_server() {
+    for i in $(seq $(($1 * 10))); do
+        if ! kill -0 "$RDSH_SERVER_PID" 2>/dev/null; then
+            wait "$RDSH_SERVER_PID" 2>/dev/null || true
+            RDSH_SERVER_PID=
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+teardown() {
+    if [ -n "$RDSH_SERVER_PID" ]; then
+        kill "$RDSH_SERVER_PID" 2>/dev/null || true
+        wait "$RDSH_SERVER_PID" 2>/dev/null || true
+    fi
+}
+
+@test "Evented server runs a pipeline" {
+    start_rdsh_server RDSH_MODE=evented
+
+    run ./dsh -c -p "$RDSH_PORT" <<EOF
+echo hello evented | tr a-z A-Z
+EOF
+    echo "Output: $output"
+    [[ "$output" =~ "HELLO EVENTED" ]]
+    [ "$status" -eq 0 ]
+}
+
+@test "Evented server answers a client while another one runs a command" {
+    start_rdsh_server RDSH_MODE=evented
+
+    printf 'sleep 3\n' | ./dsh -c -p "$RDSH_PORT" > /dev/null &
+    slow_pid=$!
+    sleep 0.5
+
+    run timeout 2 ./dsh -c -p "$RDSH_PORT" <<EOF
+echo not blocked
+EOF
+    wait "$slow_pid"
+    echo "Output: $output"
+    [[ "$output" =~ "not blocked" ]]
+    [ "$status" -eq 0 ]
+}
+
+@test "Evented server answers legacy clients" {
+    start_rdsh_server RDSH_MODE=evented
+
+    exec 3<>"/dev/tcp/127.0.0.1/$RDSH_PORT"
+    printf 'echo legacy\0' >&3
+    IFS= read -r -d $'\x04' reply <&3
+    exec 3>&-
+    echo "Reply: $reply"
+    [ "$reply" = $'legacy\n' ]
+}
+
+@test "Evented server exits on stop-server" {
+    start_rdsh_server RDSH_MODE=evented
+
+    run ./dsh -c -p "$RDSH_PORT" <<EOF
+stop-server
+EOF
+    [[ "$output" =~ "Stopping server" ]]
+    wait_rdsh_server 3
+}
+
+@test "Threaded server runs clients on the worker pool concurrently" {
+    start_rdsh_server RDSH_MODE=threaded RDSH_WORKERS=4
+
+    pids=""
+    for i in 1 2 3 4; do
+        printf 'sleep 1\necho client %s\n' "$i" | timeout 3 ./dsh -c -p "$RDSH_PORT" > "$BATS_TMPDIR/pool_$i.out" &
+        pids="$pids $!"
+    done
+    for pid in $pids; do
+        wait "$pid"
+    done
+
+    for i in 1 2 3 4; do
+        grep -q "client $i" "$BATS_TMPDIR/pool_$i.out"
+    done
+}
+
+@test "Threaded server queues clients when every worker is busy" {
+    start_rdsh_server RDSH_MODE=threaded RDSH_WORKERS=1
+
+    printf 'sleep 1\n' | ./dsh -c -p "$RDSH_PORT" > /dev/null &
+    slow_pid=$!
+    sleep 0.3
+
+    run timeout 4 ./dsh -c -p "$RDSH_PORT" <<EOF
+echo served after the first client
 EOF
-    [[ "$output" =~ "error: piping limited to 8 commands" ]]
+    wait "$slow_pid"
+    echo "Output: $output"
+    [[ "$output" =~ "served after the first client" ]]
+    [ "$status" -eq 0 ]
+}
+
+@test "Framed replies carry output containing the legacy EOF byte" {
+    start_rdsh_server RDSH_MODE=threaded
+
+    run ./dsh -c -p "$RDSH_PORT" <<EOF
+printf before\004after
+echo next command
+EOF
+    echo "Output: $output"
+    [[ "$output" == *$'before\x04after'* ]]
+    [[ "$output" =~ "next command" ]]
+    [ "$status" -eq 0 ]
+}
+
+# The client, run with the environment given, dies of SIGPIPE once head has
+# its bytes, while the server is still streaming to it
+rdsh_client_closes_mid_stream() {
+    printf 'seq 1 2000000\nseq 1 2000000\n' | env "$@" ./dsh -c -p "$RDSH_PORT" | head -c 100 > /dev/null
+    sleep 0.5
+
+    run timeout 3 ./dsh -c -p "$RDSH_PORT" <<EOF
+echo still serving
+EOF
+    echo "Output: $output"
+    [[ "$output" =~ "still serving" ]]
+    kill -0 "$RDSH_SERVER_PID"
+}
+
+@test "Single threaded server survives a client that closes mid stream" {
+    start_rdsh_server RDSH_MODE=single
+    rdsh_client_closes_mid_stream
+}
+
+@test "Threaded server survives a client that closes mid stream" {
+    start_rdsh_server RDSH_MODE=threaded
+    rdsh_client_closes_mid_stream
+}
+
+@test "Evented server survives a client that closes mid stream" {
+    start_rdsh_server RDSH_MODE=evented
+    rdsh_client_closes_mid_stream
+}
+
+@test "Pipeline stages run with the default SIGPIPE under the server" {
+    for spawn in fork posix_spawn; do
+        start_rdsh_server RDSH_MODE=threaded DSH_SPAWN=$spawn
+
+        run timeout 3 ./dsh -c -p "$RDSH_PORT" <<EOF
+yes | head -n 2
+EOF
+        echo "Output ($spawn): $output"
+        [[ "$output" =~ "y"$'\n'"y" ]]
+        [[ ! "$output" =~ "Broken pipe" ]]
+        teardown
+    done
+}
+
+# Sends cmd on fd 3 as a HELLO frame followed by a CMD frame
+send_framed_cmd() {
+    local len
+
+    len=$(printf '\\x%02x\\x%02x' $((${#1} / 256)) $((${#1} % 256)))
+    printf '\x00\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00' >&3
+    printf "\x01\x01\x00\x00\x00\x00\x00\x01\x00\x00${len}\x00\x00\x00\x00%s" "$1" >&3
+}
+
+@test "Evented server keeps serving while a framed client does not read" {
+    start_rdsh_server RDSH_MODE=evented
+
+    exec 3<>"/dev/tcp/127.0.0.1/$RDSH_PORT"
+    send_framed_cmd "seq 1 3000000"
+    sleep 0.5
+
+    run timeout 2 ./dsh -c -p "$RDSH_PORT" <<EOF
+echo second client
+EOF
+    exec 3>&-
+    echo "Output: $output"
+    [[ "$output" =~ "second client" ]]
+    [ "$status" -eq 0 ]
+}
+
+@test "Evented server keeps serving while a legacy client does not read" {
+    start_rdsh_server RDSH_MODE=evented
+
+    exec 3<>"/dev/tcp/127.0.0.1/$RDSH_PORT"
+    printf 'seq 1 3000000\0' >&3
+    sleep 0.5
+
+    run timeout 2 ./dsh -c -p "$RDSH_PORT" <<EOF
+echo second client
+EOF
+    exec 3>&-
+    echo "Output: $output"
+    [[ "$output" =~ "second client" ]]
+    [ "$status" -eq 0 ]
+}
+
+@test "Batch client prints replies in submission order" {
+    for mode in single threaded evented; do
+        start_rdsh_server RDSH_MODE=$mode
+
+        output=$(RDSH_BATCH=4 timeout 5 ./dsh -c -p "$RDSH_PORT" 2> "$BATS_TMPDIR/batch.err" <<EOF
+echo one
+sleep 1
+echo two
+seq 1 3
+ls /nonexistent
+echo three
+EOF
+)
+        echo "Output ($mode): $output"
+        [[ "$output" == *$'one\ntwo\n1\n2\n3\nls: '*$'\nthree\n'* ]]
+        grep -q "batch: 6 commands, 1 failed" "$BATS_TMPDIR/batch.err"
+        teardown
+    done
+}
+
+@test "Servers survive a batch client that closes mid stream" {
+    for mode in single threaded evented; do
+        start_rdsh_server RDSH_MODE=$mode
+        rdsh_client_closes_mid_stream RDSH_BATCH=8
+        teardown
+    done
+}
+
+@test "RDSH_EXEC=zygote starts the zygote next to the server" {
+    start_rdsh_server RDSH_MODE=threaded RDSH_EXEC=zygote
+
+    pgrep -P "$RDSH_SERVER_PID" -x dsh
+}
+
+@test "Zygote runs pipelines and reports their exit code" {
+    for mode in threaded evented; do
+        start_rdsh_server RDSH_MODE=$mode RDSH_EXEC=zygote
+
+        output=$(RDSH_BATCH=4 timeout 5 ./dsh -c -p "$RDSH_PORT" 2> "$BATS_TMPDIR/zygote.err" <<EOF
+echo hello zygote | tr a-z A-Z
+ls /nonexistent
+EOF
+)
+        echo "Output ($mode): $output"
+        [[ "$output" =~ "HELLO ZYGOTE" ]]
+        [[ "$output" =~ "/nonexistent" ]]
+        grep -q "batch: 2 commands, 1 failed" "$BATS_TMPDIR/zygote.err"
+        teardown
+    done
+}
+
+@test "Zygote runs commands in the directory the server cd'd to" {
+    mkdir -p "$BATS_TMPDIR/zygote_cwd"
+    touch "$BATS_TMPDIR/zygote_cwd/zygote_marker"
+    start_rdsh_server RDSH_MODE=threaded RDSH_EXEC=zygote
+
+    run timeout 3 ./dsh -c -p "$RDSH_PORT" <<EOF
+cd $BATS_TMPDIR/zygote_cwd
+ls
+EOF
+    rm -rf "$BATS_TMPDIR/zygote_cwd"
+    echo "Output: $output"
+    [[ "$output" =~ "zygote_marker" ]]
+    [ "$status" -eq 0 ]
+}
+
+# dsh has no < or > operators; under posix_spawn every stage's stdin,
+# stdout and stderr are set up by dup2 file actions instead of in a child
+@test "posix_spawn stages get their pipes and stderr under the server" {
+    for mode in threaded evented; do
+        start_rdsh_server RDSH_MODE=$mode DSH_SPAWN=posix_spawn
+
+        run timeout 3 ./dsh -c -p "$RDSH_PORT" <<EOF
+seq 1 5 | tac | head -n 2 | tr 5 X
+ls /nonexistent | wc -l
+EOF
+        echo "Output ($mode): $output"
+        [[ "$output" =~ "X"$'\n'"4" ]]
+        [[ "$output" =~ "cannot access '/nonexistent'" ]]
+        [[ "$output" =~ $'\n'"0"$'\n' ]]
+        [ "$status" -eq 0 ]
+        teardown
+    done
+}
+
+@test "posix_spawn reports commands that cannot be spawned without leaking the server log" {
+    start_rdsh_server RDSH_MODE=threaded DSH_SPAWN=posix_spawn
+
+    run timeout 3 ./dsh -c -p "$RDSH_PORT" <<EOF
+nosuchcmd_xyz | cat
+echo after
+EOF
+    echo "Output: $output"
+    [[ "$output" =~ "Error: 'nosuchcmd_xyz'" ]]
+    [[ "$output" =~ "after" ]]
+    [[ ! "$output" =~ "rdsh-exec" ]]
+    [ "$status" -eq 0 ]
+}
+
+@test "hash lists commands the zygote ran" {
+    for mode in threaded evented; do
+        start_rdsh_server RDSH_MODE=$mode RDSH_EXEC=zygote
+
+        run timeout 3 ./dsh -c -p "$RDSH_PORT" <<EOF
+ls -d /
+ls -d / | cat
+hash
+EOF
+        echo "Output ($mode): $output"
+        [[ "$output" =~ "hits" ]]
+        [[ "$output" =~ "2"$'\t'"/"[^$'\n']*"/ls" ]]
+        [[ "$output" =~ "1"$'\t'"/"[^$'\n']*"/cat" ]]
+        [ "$status" -eq 0 ]
+        teardown
+    done
+}
+
+@test "hash -r empties the table under the zygote" {
+    start_rdsh_server RDSH_MODE=threaded RDSH_EXEC=zygote
+
+    run timeout 3 ./dsh -c -p "$RDSH_PORT" <<EOF
+ls -d /
+hash -r
+hash
+EOF
+    echo "Output: $output"
+    [[ "$output" =~ "hash: hash table empty" ]]
+    [ "$status" -eq 0 ]
+}
+
+@test "Quoted arguments keep their spaces and pipe characters" {
+    run "./dsh" <<EOF
+echo "a | b" | tr a-z A-Z
+echo "  two  spaces  "
+EOF
+    echo "Output: $output"
+    [[ "$output" =~ "A | B" ]]
+    [[ "$output" =~ "  two  spaces  " ]]
+    [ "$status" -eq 0 ]
+}
+
+@test "Empty pipeline stages are a parse error" {
+    run "./dsh" <<EOF
+echo a |  | cat
+echo still parsing
+EOF
+    echo "Output: $output"
+    [[ "$output" =~ "Error parsing command" ]]
+    [[ "$output" =~ "still parsing" ]]
+    [ "$status" -eq 0 ]
+}
+
+@test "Command lines longer than SH_CMD_MAX are parsed whole" {
+    long=$(head -c 20000 /dev/zero | tr '\0' x)
+
+    run "./dsh" <<EOF
+echo $long | wc -c
+EOF
+    echo "Output: $output"
+    [[ "$output" =~ "20001" ]]
+    [ "$status" -eq 0 ]
+}
+
+@test "Server parses every request of a connection into the same list" {
+    long=$(head -c 20000 /dev/zero | tr '\0' x)
+
+    for mode in single threaded evented; do
+        start_rdsh_server RDSH_MODE=$mode
+
+        run timeout 3 ./dsh -c -p "$RDSH_PORT" <<EOF
+echo a1 a2 a3 a4 a5 a6 "a | 7"
+echo x
+echo a |  | cat
+echo $long | wc -c
+echo "q | r" | tr a-z A-Z
+EOF
+        echo "Output ($mode): $output"
+        [[ "$output" =~ "a1 a2 a3 a4 a5 a6 a | 7" ]]
+        [[ "$output" =~ "dsh4> x"$'\n' ]]
+        [[ "$output" =~ "Error parsing command" ]]
+        [[ "$output" =~ "20001" ]]
+        [[ "$output" =~ "Q | R" ]]
+        [ "$status" -eq 0 ]
+        teardown
+    done
+}
+
+@test "Server runs commands past the old argument and stage limits" {
+    args=$(seq -s ' ' 1 40)
+    stages=$(printf ' | cat%.0s' $(seq 20))
+
+    for env in RDSH_MODE=single RDSH_MODE=threaded RDSH_MODE=evented "RDSH_MODE=threaded RDSH_EXEC=zygote"; do
+        start_rdsh_server $env
+
+        run timeout 5 ./dsh -c -p "$RDSH_PORT" <<EOF
+echo $args
+echo many stages $stages | tr a-z A-Z
+echo $args $stages | wc -w
+EOF
+        echo "Output ($env): $output"
+        [[ "$output" =~ "$args" ]]
+        [[ "$output" =~ "MANY STAGES" ]]
+        [[ "$output" =~ "dsh4> 40"$'\n' ]]
+        [ "$status" -eq 0 ]
+        teardown
+    done
+}
+
+@test "Evented server starts no stage of a pipeline that exits" {
+    start_rdsh_server RDSH_MODE=evented
+
+    printf 'sleep 31 | exit\n' | timeout 3 ./dsh -c -p "$RDSH_PORT" > /dev/null &
+    exit_pid=$!
+    sleep 0.3
+
+    run timeout 2 ./dsh -c -p "$RDSH_PORT" <<EOF
+echo not blocked
+EOF
+    wait "$exit_pid" || true
+    echo "Output: $output"
+    [[ "$output" =~ "not blocked" ]]
+    ! pgrep -fx "sleep 31"
+}
+
+@test "A stage that fails to exec does not repeat buffered output" {
+    run "./dsh" <<EOF
+ls -d /
+hash | nosuchcmd_xyz
+EOF
+    echo "Output: $output"
+    [ "$(grep -c "hits" <<< "$output")" -eq 1 ]
+    [ "$status" -eq 0 ]
+}
+
+@test "hash drops a cached path once the command has moved" {
+    dir1="$BATS_TMPDIR/hash_dir1"
+    dir2="$BATS_TMPDIR/hash_dir2"
+    rm -rf "$dir1" "$dir2"
+    mkdir -p "$dir1" "$dir2"
+    printf '#!/bin/sh\necho moved command ran\n' > "$dir1/hash_moved_cmd"
+    chmod +x "$dir1/hash_moved_cmd"
+
+    PATH="$dir1:$dir2:$PATH" run "./dsh" <<EOF
+hash_moved_cmd
+mv $dir1/hash_moved_cmd $dir2/hash_moved_cmd
+hash_moved_cmd
+hash
+EOF
+    rm -rf "$dir1" "$dir2"
+    echo "Output: $output"
+    [ "$(grep -c "moved command ran" <<< "$output")" -eq 2 ]
+    [[ "$output" =~ "$dir2/hash_moved_cmd" ]]
+    [[ ! "$output" =~ "$dir1/hash_moved_cmd" ]]
     [ "$status" -eq 0 ]
 }
@@ -111,6 +111,16 @@ run_test "Long output handling" \
     "echo 'cat /etc/passwd | head -20' | ./dsh -c -p $PORT" \
     "root"
 
+# 13. Output containing the legacy EOF byte (0x04) must not end the reply
+run_test "Output containing 0x04" \
+    "echo -e 'printf a\\004b\necho after' | ./dsh -c -p $PORT" \
+    "$(printf 'a\004b')dsh4> after"
+
+# 14. hash builtin remembers resolved commands
+run_test "hash builtin" \
+    "echo -e 'ls /\nhash' | ./dsh -c -p $PORT" \
+    "/ls"
+
 # Cleanup
 kill $SERVER_PID 2>/dev/null
 wait $SERVER_PID 2>/dev/null
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "dshlib.h"
+
+/*
+ * Spawn latency of execute_pipeline() for 1 to CMD_MAX stage pipelines of
+ * `true`, with the fork and posix_spawn backends.  -m pads the process
+ * with resident heap, which is what makes fork() expensive.
+ *
+ *   usage: spawn_bench [-m heap_mb] [-n runs]
+ */
+
+static double time_pipeline(int backend, char *cmd, int runs) {
+    command_list_t clist = {0};
+    struct timespec start, end;
+    char cmd_copy[SH_CMD_MAX];
+
+    set_spawn_backend(backend);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < runs; i++) {
+        strcpy(cmd_copy, cmd);
+        if (build_cmd_list(cmd_copy, &clist) != OK) {
+            fprintf(stderr, "cannot parse '%s'\n", cmd);
+            exit(1);
+        }
+        execute_pipeline(&clist);
+        free_cmd_list(&clist);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close_cmd_list(&clist);
+
+    return ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / runs;
+}
+
+int main(int argc, char *argv[]) {
+    size_t heap_mb = 0;
+    int runs = 200;
+    char cmd[SH_CMD_MAX] = "true";
+    char *heap = NULL;
+    double fork_us, spawn_us;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:n:")) != -1) {
+        switch (opt) {
+        case 'm': heap_mb = strtoul(optarg, NULL, 10); break;
+        case 'n': runs = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-m heap_mb] [-n runs]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (heap_mb > 0) {
+        heap = malloc(heap_mb << 20);
+        if (heap == NULL) {
+            perror("malloc");
+            return 1;
+        }
+        madvise(heap, heap_mb << 20, MADV_NOHUGEPAGE);
+        memset(heap, 1, heap_mb << 20);
+    }
+
+    printf("%zu MB resident, %d runs, usec per pipeline\n", heap_mb, runs);
+    printf("stages      fork     spawn   speedup\n");
+    for (int stages = 1; stages <= CMD_MAX; stages++) {
+        if (stages > 1) {
+            strcat(cmd, " | true");
+        }
+        fork_us = time_pipeline(DSH_SPAWN_FORK, cmd, runs);
+        spawn_us = time_pipeline(DSH_SPAWN_POSIX, cmd, runs);
+        printf("%6d  %8.1f  %8.1f  %7.2fx\n", stages, fork_us, spawn_us, fork_us / spawn_us);
+    }
+
+    free(heap);
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * Compares commands/second of the fork and zygote exec backends.  The
+ * benchmark first makes itself look like a busy server (resident heap and
+ * idle threads) because that is what makes fork() from the server slow.
+ *
+ *   usage: zygote_bench [-m heap_mb] [-t threads] [-n runs] [-c "cmd"]
+ */
+
+static pthread_mutex_t g_idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_idle_cond = PTHREAD_COND_INITIALIZER;
+static int g_idle_done = 0;
+
+static void *idle_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_idle_mutex);
+    while (!g_idle_done) {
+        pthread_cond_wait(&g_idle_cond, &g_idle_mutex);
+    }
+    pthread_mutex_unlock(&g_idle_mutex);
+    return NULL;
+}
+
+static double run_backend(int backend, char *cmd, int runs, int out_fd) {
+    command_list_t clist = {0};
+    struct timespec start, end;
+    char *cmd_copy;
+
+    set_exec_backend(backend);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < runs; i++) {
+        cmd_copy = strdup(cmd);
+        if (cmd_copy == NULL || build_cmd_list(cmd_copy, &clist) != OK) {
+            fprintf(stderr, "cannot parse '%s'\n", cmd);
+            exit(1);
+        }
+        rsh_execute_pipeline(out_fd, &clist);
+        free_cmd_list(&clist);
+        free(cmd_copy);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close_cmd_list(&clist);
+
+    return runs / ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+    size_t heap_mb = 1024;
+    int threads = 16;
+    int runs = 500;
+    char *cmd = "true";
+    pthread_t *tids;
+    char *heap;
+    int out_fd;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:t:n:c:")) != -1) {
+        switch (opt) {
+        case 'm': heap_mb = strtoul(optarg, NULL, 10); break;
+        case 't': threads = atoi(optarg); break;
+        case 'n': runs = atoi(optarg); break;
+        case 'c': cmd = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-m heap_mb] [-t threads] [-n runs] [-c cmd]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // like start_server(), start the zygote while the process is still small
+    if (rsh_zygote_start() != OK) {
+        return 1;
+    }
+
+    heap = malloc(heap_mb << 20);
+    if (heap == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    // 4K pages, as a long-running server heap would mostly be
+    madvise(heap, heap_mb << 20, MADV_NOHUGEPAGE);
+    memset(heap, 1, heap_mb << 20);
+
+    tids = calloc(threads, sizeof(pthread_t));
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, idle_thread, NULL);
+    }
+
+    out_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    printf("'%s', %zu MB resident, %d threads, %d runs\n", cmd, heap_mb, threads, runs);
+    printf("  fork:   %8.0f cmds/sec\n", run_backend(RDSH_EXEC_FORK, cmd, runs, out_fd));
+    printf("  zygote: %8.0f cmds/sec\n", run_backend(RDSH_EXEC_ZYGOTE, cmd, runs, out_fd));
+
+    pthread_mutex_lock(&g_idle_mutex);
+    g_idle_done = 1;
+    pthread_cond_broadcast(&g_idle_cond);
+    pthread_mutex_unlock(&g_idle_mutex);
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    rsh_zygote_stop();
+    close(out_fd);
+    free(tids);
+    free(heap);
+    return 0;
+}
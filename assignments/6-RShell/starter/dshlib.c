@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -6,21 +7,26 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <spawn.h>
+#include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
 
 #include "dshlib.h"
 
 int alloc_cmd_buff(cmd_buff_t *cmd_buff) {
+    memset(cmd_buff, 0, sizeof(cmd_buff_t));
+
     cmd_buff->_cmd_buffer = (char *)malloc(SH_CMD_MAX);
     if (cmd_buff->_cmd_buffer == NULL) {
         return ERR_MEMORY;
     }
     
     memset(cmd_buff->_cmd_buffer, 0, SH_CMD_MAX);
-    cmd_buff->argc = 0;
-    
-    for (int i = 0; i < CMD_ARGV_MAX; i++) {
-        cmd_buff->argv[i] = NULL;
-    }
+    cmd_buff->argv = cmd_buff->_argv_inline;
     
     return OK;
 }
@@ -30,6 +36,11 @@ int free_cmd_buff(cmd_buff_t *cmd_buff) {
         free(cmd_buff->_cmd_buffer);
         cmd_buff->_cmd_buffer = NULL;
     }
+    if (cmd_buff->_argv_cap > 0) {
+        free(cmd_buff->argv);
+        cmd_buff->_argv_cap = 0;
+    }
+    cmd_buff->argv = cmd_buff->_argv_inline;
     
     return OK;
 }
@@ -40,107 +51,310 @@ int clear_cmd_buff(cmd_buff_t *cmd_buff) {
     }
     
     cmd_buff->argc = 0;
-    for (int i = 0; i < CMD_ARGV_MAX; i++) {
-        cmd_buff->argv[i] = NULL;
+    if (cmd_buff->_argv_cap == 0) {
+        cmd_buff->argv = cmd_buff->_argv_inline;
     }
+    cmd_buff->argv[0] = NULL;
     
     return OK;
 }
 
-int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff) {
-    char *token;
-    int i = 0;
-    
-    if (cmd_line == NULL || cmd_buff == NULL) {
+/*
+ * Makes room for argc arguments plus the terminating NULL.  Up to
+ * CMD_ARGV_MAX slots live inside the cmd_buff_t; beyond that argv moves to
+ * the heap and keeps its size for later commands.
+ */
+int reserve_cmd_argv(cmd_buff_t *cmd, int argc) {
+    int cap = (cmd->_argv_cap > 0) ? cmd->_argv_cap : CMD_ARGV_MAX;
+    char **argv;
+
+    if (cmd->_argv_cap == 0) {
+        // the struct may have been moved since argv was last set
+        cmd->argv = cmd->_argv_inline;
+    }
+    if (argc + 1 <= cap) {
+        return OK;
+    }
+
+    while (cap < argc + 1) {
+        cap *= 2;
+    }
+
+    if (cmd->_argv_cap == 0) {
+        argv = malloc(sizeof(char *) * cap);
+        if (argv != NULL) {
+            memcpy(argv, cmd->_argv_inline, sizeof(cmd->_argv_inline));
+        }
+    } else {
+        argv = realloc(cmd->argv, sizeof(char *) * cap);
+    }
+    if (argv == NULL) {
         return ERR_MEMORY;
     }
-    
-    strncpy(cmd_buff->_cmd_buffer, cmd_line, SH_CMD_MAX - 1);
-    cmd_buff->_cmd_buffer[SH_CMD_MAX - 1] = '\0';
-    
-    token = strtok(cmd_buff->_cmd_buffer, " \t\n");
-    while (token != NULL && i < CMD_ARGV_MAX - 1) {
-        cmd_buff->argv[i++] = token;
-        token = strtok(NULL, " \t\n");
+
+    cmd->argv = argv;
+    cmd->_argv_cap = cap;
+    return OK;
+}
+
+/*
+ * Makes room for num stages (and their pids).  The first CMD_MAX live
+ * inside the command_list_t, so a zeroed list needs no setup.
+ */
+int reserve_cmd_list(command_list_t *clist, int num) {
+    cmd_buff_t *commands;
+    pid_t *pids;
+    int cap;
+
+    if (clist->commands == NULL) {
+        clist->commands = clist->_commands_inline;
+        clist->pids = clist->_pids_inline;
+        clist->_cap = CMD_MAX;
     }
-    
-    cmd_buff->argv[i] = NULL;
-    cmd_buff->argc = i;
-    
+    if (num <= clist->_cap) {
+        return OK;
+    }
+
+    cap = clist->_cap;
+    while (cap < num) {
+        cap *= 2;
+    }
+
+    if (clist->commands == clist->_commands_inline) {
+        commands = malloc(sizeof(cmd_buff_t) * cap);
+        pids = malloc(sizeof(pid_t) * cap);
+        if (commands == NULL || pids == NULL) {
+            free(commands);
+            free(pids);
+            return ERR_MEMORY;
+        }
+        memcpy(commands, clist->_commands_inline, sizeof(clist->_commands_inline));
+        memcpy(pids, clist->_pids_inline, sizeof(clist->_pids_inline));
+    } else {
+        commands = realloc(clist->commands, sizeof(cmd_buff_t) * cap);
+        if (commands == NULL) {
+            return ERR_MEMORY;
+        }
+        clist->commands = commands;
+        pids = realloc(clist->pids, sizeof(pid_t) * cap);
+        if (pids == NULL) {
+            return ERR_MEMORY;
+        }
+    }
+
+    memset(commands + clist->_cap, 0, sizeof(cmd_buff_t) * (cap - clist->_cap));
+    for (int i = 0; i < clist->_cap; i++) {
+        if (commands[i]._argv_cap == 0) {
+            commands[i].argv = commands[i]._argv_inline;
+        }
+    }
+
+    clist->commands = commands;
+    clist->pids = pids;
+    clist->_cap = cap;
+    return OK;
+}
+
+/*
+ * Command parsing
+ *
+ * A command line is tokenized in one pass straight into the command list's
+ * arena: every token is copied there (without its quotes) followed by a
+ * NUL, and argv points at the copies.  Nothing is allocated once the arena
+ * has grown to the longest line seen, free_cmd_list() only rewinds it and
+ * close_cmd_list() gives it back.  No static state is involved, so
+ * threads can parse concurrently into their own lists.
+ */
+
+/*
+ * Copies the next pipeline stage from *line to *dst and points cmd->argv
+ * at the tokens.  Whitespace separates tokens except inside double quotes.
+ * Leaves *line after the '|' that ended the stage (or at the end of the
+ * line) and *dst after the last terminator written, which never takes more
+ * room than the input consumed plus one byte.
+ */
+static int parse_stage(const char **line, char **dst, cmd_buff_t *cmd) {
+    const char *p = *line;
+    char *out = *dst;
+    int in_token = 0;
+    int in_quote = 0;
+
+    cmd->argc = 0;
+    reserve_cmd_argv(cmd, 0);
+
+    for (; *p != '\0'; p++) {
+        if (!in_quote && (*p == PIPE_CHAR || isspace((unsigned char)*p))) {
+            if (in_token) {
+                *out++ = '\0';
+                in_token = 0;
+            }
+            if (*p == PIPE_CHAR) {
+                p++;
+                break;
+            }
+            continue;
+        }
+
+        if (!in_token) {
+            if (reserve_cmd_argv(cmd, cmd->argc + 1) != OK) {
+                return ERR_MEMORY;
+            }
+            cmd->argv[cmd->argc++] = out;
+            in_token = 1;
+        }
+
+        if (*p == '"') {
+            in_quote = !in_quote;
+        } else {
+            *out++ = *p;
+        }
+    }
+
+    if (in_token) {
+        *out++ = '\0';
+    }
+    cmd->argv[cmd->argc] = NULL;
+
+    *line = p;
+    *dst = out;
+    return OK;
+}
+
+static int cmd_arena_reserve(cmd_arena_t *arena, size_t size) {
+    size_t new_size;
+    char *base;
+
+    if (size <= arena->size) {
+        return OK;
+    }
+
+    new_size = (arena->size > 0) ? arena->size : CMD_ARENA_MIN;
+    while (new_size < size) {
+        new_size *= 2;
+    }
+
+    base = realloc(arena->base, new_size);
+    if (base == NULL) {
+        return ERR_MEMORY;
+    }
+
+    arena->base = base;
+    arena->size = new_size;
     return OK;
 }
 
+/*
+ * Parses a single command (no pipes) into the buffer set up by
+ * alloc_cmd_buff(), growing it for lines longer than SH_CMD_MAX.
+ */
+int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff) {
+    const char *p = cmd_line;
+    size_t len;
+    char *dst;
+
+    if (cmd_line == NULL || cmd_buff == NULL || cmd_buff->_cmd_buffer == NULL) {
+        return ERR_MEMORY;
+    }
+
+    len = strlen(cmd_line);
+    if (len >= SH_CMD_MAX) {
+        dst = realloc(cmd_buff->_cmd_buffer, len + 1);
+        if (dst == NULL) {
+            return ERR_MEMORY;
+        }
+        cmd_buff->_cmd_buffer = dst;
+    }
+
+    dst = cmd_buff->_cmd_buffer;
+    return parse_stage(&p, &dst, cmd_buff);
+}
+
 int close_cmd_buff(cmd_buff_t *cmd_buff) {
     return free_cmd_buff(cmd_buff);
 }
 
+/*
+ * clist must have been zeroed before its first use and may be reused for
+ * any number of lines; the argv strings stay valid until the next call or
+ * close_cmd_list().
+ */
 int build_cmd_list(char *cmd_line, command_list_t *clist) {
-    char *cmd_start;
-    char *pipe_loc;
-    char cmd_segment[SH_CMD_MAX];
-    int cmd_idx = 0;
-    
+    const char *p = cmd_line;
+    cmd_buff_t *cmd;
+    char *dst;
+    int rc;
+
     if (cmd_line == NULL || clist == NULL) {
         return ERR_MEMORY;
     }
-    
-    cmd_start = cmd_line;
-    while (*cmd_start && isspace(*cmd_start)) {
-        cmd_start++;
+
+    clist->num = 0;
+
+    while (*p && isspace((unsigned char)*p)) {
+        p++;
     }
-    
-    if (*cmd_start == '\0') {
+    if (*p == '\0') {
         return WARN_NO_CMDS;
     }
-    
-    clist->num = 0;
-    
-    while (*cmd_start != '\0') {
-        pipe_loc = strchr(cmd_start, PIPE_CHAR);
-        
-        if (pipe_loc == NULL) {
-            strncpy(cmd_segment, cmd_start, SH_CMD_MAX - 1);
-            cmd_segment[SH_CMD_MAX - 1] = '\0';
-            cmd_start += strlen(cmd_start);
-        } else {
-            int segment_len = pipe_loc - cmd_start;
-            if (segment_len >= SH_CMD_MAX) {
-                segment_len = SH_CMD_MAX - 1;
-            }
-            
-            strncpy(cmd_segment, cmd_start, segment_len);
-            cmd_segment[segment_len] = '\0';
-            cmd_start = pipe_loc + 1;
-            
-            while (*cmd_start && isspace(*cmd_start)) {
-                cmd_start++;
-            }
+
+    if (cmd_arena_reserve(&clist->arena, strlen(p) + 1) != OK) {
+        return ERR_MEMORY;
+    }
+    dst = clist->arena.base;
+
+    while (*p != '\0') {
+        if (reserve_cmd_list(clist, clist->num + 1) != OK) {
+            return ERR_MEMORY;
         }
-        
-        if (cmd_idx >= CMD_MAX) {
-            return ERR_TOO_MANY_COMMANDS;
+
+        cmd = &clist->commands[clist->num];
+        cmd->_cmd_buffer = dst;
+        rc = parse_stage(&p, &dst, cmd);
+        if (rc != OK) {
+            return rc;
+        }
+        if (cmd->argc == 0) {
+            return ERR_CMD_ARGS_BAD;
+        }
+        clist->num++;
+
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
         }
-        
-        alloc_cmd_buff(&clist->commands[cmd_idx]);
-        build_cmd_buff(cmd_segment, &clist->commands[cmd_idx]);
-        
-        cmd_idx++;
     }
-    
-    clist->num = cmd_idx;
-    
+
     return OK;
 }
 
+/*
+ * Forgets the parsed commands but keeps the arena for the next line.
+ */
 int free_cmd_list(command_list_t *cmd_lst) {
     if (cmd_lst == NULL) {
         return ERR_MEMORY;
     }
-    
-    for (int i = 0; i < cmd_lst->num; i++) {
-        free_cmd_buff(&cmd_lst->commands[i]);
+
+    cmd_lst->num = 0;
+    return OK;
+}
+
+int close_cmd_list(command_list_t *cmd_lst) {
+    if (cmd_lst == NULL) {
+        return ERR_MEMORY;
     }
-    
+
+    for (int i = 0; cmd_lst->commands != NULL && i < cmd_lst->_cap; i++) {
+        if (cmd_lst->commands[i]._argv_cap > 0) {
+            free(cmd_lst->commands[i].argv);
+        }
+    }
+    if (cmd_lst->commands != cmd_lst->_commands_inline) {
+        free(cmd_lst->commands);
+        free(cmd_lst->pids);
+    }
+    free(cmd_lst->arena.base);
+
+    memset(cmd_lst, 0, sizeof(command_list_t));
     return OK;
 }
 
@@ -155,6 +369,8 @@ Built_In_Cmds match_command(const char *input) {
         return BI_CMD_DRAGON;
     else if (strcmp(input, "cd") == 0)
         return BI_CMD_CD;
+    else if (strcmp(input, "hash") == 0)
+        return BI_CMD_HASH;
     
     return BI_NOT_BI;
 }
@@ -179,6 +395,13 @@ Built_In_Cmds exec_built_in_cmd(cmd_buff_t *cmd) {
                 perror("cd");
             }
             return BI_EXECUTED;
+        case BI_CMD_HASH: {
+            char out[HASH_OUT_MAX];
+
+            hash_builtin(cmd, out, sizeof(out));
+            printf("%s", out);
+            return BI_EXECUTED;
+        }
         case BI_CMD_EXIT:
             return BI_CMD_EXIT;
         default:
@@ -186,67 +409,457 @@ Built_In_Cmds exec_built_in_cmd(cmd_buff_t *cmd) {
     }
 }
 
-int execute_pipeline(command_list_t *clist) {
-    int pipes[CMD_MAX - 1][2];
-    pid_t pids[CMD_MAX];
-    int status[CMD_MAX];
-    int exit_code = 0;
-    Built_In_Cmds bi_cmd;
+/*
+ * PATH lookup cache
+ *
+ * execvp() walks $PATH with one failing execve() per directory for every
+ * stage.  Instead the parent resolves argv[0] once, remembers the absolute
+ * path, and the child execve()s it directly.  The table is shared by the
+ * threads of the remote server, so it sits behind a rwlock; hit counters
+ * are atomic so lookups only need the read lock.
+ *
+ * Entries are dropped when $PATH changes and by hash -r.  A hit is checked
+ * with access() before it is handed out; one that has gone away is dropped
+ * and looked up again, so a stale entry costs one access() once rather
+ * than a failed execve() and a PATH walk in the child on every run.
+ */
+struct hash_entry {
+    char *name;
+    char *path;
+    atomic_uint hits;
+    struct hash_entry *next;
+};
 
-    for (int i = 0; i < clist->num - 1; i++) {
-        if (pipe(pipes[i]) == -1) {
-            perror("pipe");
-            return ERR_EXEC_CMD;
+static struct hash_entry *g_hash_table[HASH_BUCKETS];
+static char *g_hash_path_env = NULL;
+static pthread_rwlock_t g_hash_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static unsigned int hash_bucket(const char *name) {
+    unsigned int h = 5381;
+
+    while (*name != '\0') {
+        h = h * 33 + (unsigned char)*name++;
+    }
+    return h % HASH_BUCKETS;
+}
+
+// caller holds the write lock
+static void hash_clear_locked() {
+    struct hash_entry *entry;
+
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        while (g_hash_table[i] != NULL) {
+            entry = g_hash_table[i];
+            g_hash_table[i] = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+        }
+    }
+}
+
+static int hash_path_changed(const char *path_env) {
+    if (g_hash_path_env == NULL || path_env == NULL) {
+        return g_hash_path_env != path_env;
+    }
+    return strcmp(g_hash_path_env, path_env) != 0;
+}
+
+/*
+ * Walks $PATH the way execvp() would and returns the first executable
+ * regular file, without touching the table.
+ */
+static int hash_search_path(const char *name, const char *path_env, char *path, size_t path_sz) {
+    const char *dir = (path_env != NULL) ? path_env : "/bin:/usr/bin";
+    const char *end;
+    struct stat st;
+    size_t dir_len;
+
+    while (1) {
+        end = strchr(dir, ':');
+        dir_len = (end != NULL) ? (size_t)(end - dir) : strlen(dir);
+
+        // an empty PATH element means the current directory
+        if (dir_len == 0) {
+            snprintf(path, path_sz, "%s", name);
+        } else {
+            snprintf(path, path_sz, "%.*s/%s", (int)dir_len, dir, name);
+        }
+
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0) {
+            return OK;
+        }
+
+        if (end == NULL) {
+            break;
+        }
+        dir = end + 1;
+    }
+
+    return ERR_EXEC_CMD;
+}
+
+/*
+ * Fills path with the absolute location of name.  Names containing a '/'
+ * are used as given.  Returns ERR_EXEC_CMD when name is not on $PATH.
+ */
+int hash_resolve(const char *name, char *path, size_t path_sz) {
+    const char *path_env;
+    struct hash_entry *entry = NULL;
+    unsigned int bucket;
+
+    if (strchr(name, '/') != NULL) {
+        snprintf(path, path_sz, "%s", name);
+        return OK;
+    }
+
+    path_env = getenv("PATH");
+    bucket = hash_bucket(name);
+
+    pthread_rwlock_rdlock(&g_hash_lock);
+    if (!hash_path_changed(path_env)) {
+        for (entry = g_hash_table[bucket]; entry != NULL; entry = entry->next) {
+            if (strcmp(entry->name, name) == 0) {
+                atomic_fetch_add_explicit(&entry->hits, 1, memory_order_relaxed);
+                snprintf(path, path_sz, "%s", entry->path);
+                break;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&g_hash_lock);
+
+    if (entry != NULL) {
+        if (access(path, X_OK) == 0) {
+            return OK;
+        }
+        // moved or removed since it was cached
+        hash_forget(name);
+    }
+
+    if (hash_search_path(name, path_env, path, path_sz) != OK) {
+        return ERR_EXEC_CMD;
+    }
+
+    hash_remember(name, path);
+    return OK;
+}
+
+/*
+ * Records path as the location of name and counts a hit, as a lookup that
+ * missed the table would.  Used by hash_resolve() and by processes that
+ * are handed paths resolved elsewhere (the remote server's zygote).
+ */
+void hash_remember(const char *name, const char *path) {
+    const char *path_env = getenv("PATH");
+    struct hash_entry *entry;
+    unsigned int bucket = hash_bucket(name);
+
+    pthread_rwlock_wrlock(&g_hash_lock);
+    if (hash_path_changed(path_env)) {
+        hash_clear_locked();
+        free(g_hash_path_env);
+        g_hash_path_env = (path_env != NULL) ? strdup(path_env) : NULL;
+    }
+
+    // another thread may have added it while we were searching
+    for (entry = g_hash_table[bucket]; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            break;
+        }
+    }
+    if (entry == NULL) {
+        entry = malloc(sizeof(struct hash_entry));
+        if (entry != NULL) {
+            entry->name = strdup(name);
+            entry->path = strdup(path);
+            if (entry->name == NULL || entry->path == NULL) {
+                free(entry->name);
+                free(entry->path);
+                free(entry);
+                entry = NULL;
+            }
+        }
+        if (entry != NULL) {
+            atomic_init(&entry->hits, 0);
+            entry->next = g_hash_table[bucket];
+            g_hash_table[bucket] = entry;
+        }
+    }
+    if (entry != NULL) {
+        atomic_fetch_add_explicit(&entry->hits, 1, memory_order_relaxed);
+    }
+    pthread_rwlock_unlock(&g_hash_lock);
+}
+
+void hash_forget(const char *name) {
+    struct hash_entry **pp;
+    struct hash_entry *entry;
+
+    pthread_rwlock_wrlock(&g_hash_lock);
+    for (pp = &g_hash_table[hash_bucket(name)]; *pp != NULL; pp = &(*pp)->next) {
+        if (strcmp((*pp)->name, name) == 0) {
+            entry = *pp;
+            *pp = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&g_hash_lock);
+}
+
+void hash_clear() {
+    pthread_rwlock_wrlock(&g_hash_lock);
+    hash_clear_locked();
+    pthread_rwlock_unlock(&g_hash_lock);
+}
+
+/*
+ * The hash builtin, modelled on the bash one:
+ *
+ *      hash            list remembered commands and their hit counts
+ *      hash -r         forget everything
+ *      hash name...    look up and remember each name
+ *
+ * Output goes to out so the remote server can send it to its client.
+ * Returns the exit status.
+ */
+int hash_builtin(cmd_buff_t *cmd, char *out, size_t out_sz) {
+    char path[PATH_MAX];
+    struct hash_entry *entry;
+    size_t len = 0;
+    int rc = 0;
+
+    out[0] = '\0';
+
+    if (cmd->argc == 2 && strcmp(cmd->argv[1], "-r") == 0) {
+        hash_clear();
+        return 0;
+    }
+
+    if (cmd->argc > 1) {
+        for (int i = 1; i < cmd->argc && len < out_sz; i++) {
+            if (hash_resolve(cmd->argv[i], path, sizeof(path)) != OK) {
+                len += snprintf(out + len, out_sz - len, "hash: %s: not found\n", cmd->argv[i]);
+                rc = 1;
+            }
+        }
+        return rc;
+    }
+
+    pthread_rwlock_rdlock(&g_hash_lock);
+    if (hash_path_changed(getenv("PATH"))) {
+        pthread_rwlock_unlock(&g_hash_lock);
+        hash_clear();
+        pthread_rwlock_rdlock(&g_hash_lock);
+    }
+    for (int i = 0; i < HASH_BUCKETS && len < out_sz; i++) {
+        for (entry = g_hash_table[i]; entry != NULL && len < out_sz; entry = entry->next) {
+            if (len == 0) {
+                len += snprintf(out, out_sz, "hits\tcommand\n");
+            }
+            if (len < out_sz) {
+                len += snprintf(out + len, out_sz - len, "%4u\t%s\n",
+                                atomic_load_explicit(&entry->hits, memory_order_relaxed),
+                                entry->path);
+            }
+        }
+    }
+    pthread_rwlock_unlock(&g_hash_lock);
+
+    if (len == 0) {
+        snprintf(out, out_sz, "hash: hash table empty\n");
+    }
+    return 0;
+}
+
+/*
+ * Child side of a stage: execve() the path resolved by the parent, or do
+ * a regular execvp() when there is none or it has gone stale.  Only
+ * returns on failure, with errno set.
+ */
+void exec_resolved(cmd_buff_t *cmd, const char *path) {
+    if (path != NULL && path[0] != '\0') {
+        execve(path, cmd->argv, environ);
+        if (errno != ENOENT) {
+            return;
+        }
+    }
+    execvp(cmd->argv[0], cmd->argv);
+}
+
+static int g_spawn_backend = -1;
+
+void set_spawn_backend(int backend) {
+    g_spawn_backend = backend;
+}
+
+int get_spawn_backend() {
+    char *env;
+
+    if (g_spawn_backend < 0) {
+        env = getenv(DSH_SPAWN_ENV);
+        if (env != NULL && strcmp(env, "posix_spawn") == 0) {
+            g_spawn_backend = DSH_SPAWN_POSIX;
+        } else {
+            g_spawn_backend = DSH_SPAWN_FORK;
+        }
+    }
+
+    return g_spawn_backend;
+}
+
+/*
+ * Starts cmd with posix_spawn(), which glibc implements with
+ * clone(CLONE_VM|CLONE_VFORK), so the parent's page tables are never
+ * copied.  argv[0] is looked up through the PATH cache.  in_fd, out_fd
+ * and err_fd replace stdin, stdout and stderr unless they are -1; any
+ * other descriptor the caller holds must be close-on-exec.  Returns the
+ * pid, or -1 with errno set if the command could not be started.
+ */
+pid_t spawn_cmd(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t sigdef;
+    char path[PATH_MAX];
+    pid_t pid;
+    int rc;
+
+    rc = posix_spawn_file_actions_init(&actions);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+
+    // the remote server ignores SIGPIPE, the command gets the default back
+    posix_spawnattr_init(&attr);
+    sigemptyset(&sigdef);
+    sigaddset(&sigdef, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigdef);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+    if (in_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+    if (out_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+    if (err_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+    }
+
+    if (hash_resolve(cmd->argv[0], path, sizeof(path)) != OK) {
+        rc = ENOENT;
+    } else {
+        rc = posix_spawn(&pid, path, &actions, &attr, cmd->argv, environ);
+        if (rc == ENOENT && strchr(cmd->argv[0], '/') == NULL) {
+            // removed between hash_resolve()'s check and the spawn
+            hash_forget(cmd->argv[0]);
+            if (hash_resolve(cmd->argv[0], path, sizeof(path)) == OK) {
+                rc = posix_spawn(&pid, path, &actions, &attr, cmd->argv, environ);
+            }
         }
     }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
 
-    for (int i = 0; i < clist->num; i++) {
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+    return pid;
+}
+
+/*
+ * Pipes are made one stage at a time, so only two are ever open no matter
+ * how long the pipeline is.  They are close-on-exec; each stage only gets
+ * the ends dup2()ed onto its stdin and stdout.
+ */
+int execute_pipeline(command_list_t *clist) {
+    pid_t *pids = clist->pids;
+    int pipe_fds[2];
+    int prev_read = -1;
+    char path[PATH_MAX];
+    int status;
+    int started = 0;
+    int exit_code = 0;
+    Built_In_Cmds bi_cmd;
+
+    for (int i = 0; i < clist->num; i++, started++) {
         bi_cmd = exec_built_in_cmd(&clist->commands[i]);
-        
+
         if (bi_cmd == BI_CMD_EXIT) {
-            return EXIT_SC;
-        } else if (bi_cmd == BI_EXECUTED) {
-            pids[i] = -1;
-            continue;
+            exit_code = EXIT_SC;
+            break;
         }
 
-        pids[i] = fork();
-        
-        if (pids[i] < 0) {
-            perror("fork");
-            return ERR_EXEC_CMD;
-        } else if (pids[i] == 0) {
-            if (i > 0) {
-                dup2(pipes[i-1][0], STDIN_FILENO);
-            }
-            
-            if (i < clist->num - 1) {
-                dup2(pipes[i][1], STDOUT_FILENO);
+        pipe_fds[0] = -1;
+        pipe_fds[1] = -1;
+        if (i < clist->num - 1 && pipe2(pipe_fds, O_CLOEXEC) == -1) {
+            perror("pipe");
+            exit_code = ERR_EXEC_CMD;
+            break;
+        }
+
+        pids[i] = -1;
+        if (bi_cmd != BI_EXECUTED) {
+            // a command that cannot be spawned goes through fork() so that it
+            // fails with the usual message and exit status
+            if (get_spawn_backend() == DSH_SPAWN_POSIX) {
+                pids[i] = spawn_cmd(&clist->commands[i], prev_read, pipe_fds[1], -1);
             }
-            
-            for (int j = 0; j < clist->num - 1; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
+
+            if (pids[i] < 0) {
+                if (hash_resolve(clist->commands[i].argv[0], path, sizeof(path)) != OK) {
+                    path[0] = '\0';
+                }
+
+                pids[i] = fork();
+                if (pids[i] == 0) {
+                    if (prev_read >= 0) {
+                        dup2(prev_read, STDIN_FILENO);
+                    }
+                    if (pipe_fds[1] >= 0) {
+                        dup2(pipe_fds[1], STDOUT_FILENO);
+                    }
+
+                    exec_resolved(&clist->commands[i], path);
+
+                    perror("execvp");
+                    // _exit: the prompt still buffered in this copy of
+                    // stdout must not be written a second time
+                    _exit(EXIT_FAILURE);
+                } else if (pids[i] < 0) {
+                    perror("fork");
+                    exit_code = ERR_EXEC_CMD;
+                }
             }
-            
-            execvp(clist->commands[i].argv[0], clist->commands[i].argv);
-            
-            perror("execvp");
-            exit(EXIT_FAILURE);
+        }
+
+        if (prev_read >= 0) {
+            close(prev_read);
+        }
+        if (pipe_fds[1] >= 0) {
+            close(pipe_fds[1]);
+        }
+        prev_read = pipe_fds[0];
+
+        if (exit_code == ERR_EXEC_CMD) {
+            break;
         }
     }
 
-    for (int i = 0; i < clist->num - 1; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+    if (prev_read >= 0) {
+        close(prev_read);
     }
     
-    for (int i = 0; i < clist->num; i++) {
+    for (int i = 0; i < started; i++) {
         if (pids[i] > 0) {
-            waitpid(pids[i], &status[i], 0);
+            waitpid(pids[i], &status, 0);
             
             if (i == clist->num - 1) {
-                exit_code = WEXITSTATUS(status[i]);
+                exit_code = WEXITSTATUS(status);
             }
         }
     }
@@ -255,15 +868,16 @@ int execute_pipeline(command_list_t *clist) {
 }
 
 int exec_local_cmd_loop() {
-    char cmd_buff[SH_CMD_MAX];
-    command_list_t cmd_list;
+    char *cmd_buff = NULL;
+    size_t cmd_buff_sz = 0;
+    command_list_t cmd_list = {0};
     int rc;
     
     while (1) {
         printf("%s", SH_PROMPT);
         fflush(stdout);
         
-        if (fgets(cmd_buff, SH_CMD_MAX, stdin) == NULL) {
+        if (getline(&cmd_buff, &cmd_buff_sz, stdin) < 0) {
             printf("\n");
             break;
         }
@@ -283,9 +897,6 @@ int exec_local_cmd_loop() {
         if (rc == WARN_NO_CMDS) {
             printf("%s", CMD_WARN_NO_CMD);
             continue;
-        } else if (rc == ERR_TOO_MANY_COMMANDS) {
-            printf(CMD_ERR_PIPE_LIMIT, CMD_MAX);
-            continue;
         } else if (rc != OK) {
             printf("Error parsing command: %d\n", rc);
             continue;
@@ -301,5 +912,7 @@ int exec_local_cmd_loop() {
         free_cmd_list(&cmd_list);
     }
     
+    close_cmd_list(&cmd_list);
+    free(cmd_buff);
     return OK;
 }
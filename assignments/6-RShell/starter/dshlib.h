@@ -1,13 +1,17 @@
 #ifndef __DSHLIB_H__
     #define __DSHLIB_H__
 
+#include <sys/types.h>
 
-//Constants for command structure sizes
+
+//Constants for command structure sizes.  CMD_MAX and CMD_ARGV_MAX are the
+//stages and argv slots kept inline; longer pipelines and argument lists
+//spill to the heap.
 #define EXE_MAX 64
 #define ARG_MAX 256
 #define CMD_MAX 8
 #define CMD_ARGV_MAX (CMD_MAX + 1)
-// Longest command that can be read from the shell
+// Initial size of a standalone cmd_buff_t buffer, grown for longer lines
 #define SH_CMD_MAX EXE_MAX + ARG_MAX
 
 typedef struct command
@@ -19,8 +23,10 @@ typedef struct command
 typedef struct cmd_buff
 {
     int  argc;
-    char *argv[CMD_ARGV_MAX];
+    char **argv;                        // _argv_inline unless _argv_cap > 0
     char *_cmd_buffer;
+    int  _argv_cap;                     // slots of a heap argv, 0 when inline
+    char *_argv_inline[CMD_ARGV_MAX];
 } cmd_buff_t;
 
 /* WIP - Move to next assignment 
@@ -33,9 +39,23 @@ typedef struct command{
 }command_t;
 */
 
+// Backing store for the argv strings of a parsed command list
+#define CMD_ARENA_MIN 512
+
+typedef struct cmd_arena
+{
+    char   *base;
+    size_t  size;
+} cmd_arena_t;
+
 typedef struct command_list{
     int num;
-    cmd_buff_t commands[CMD_MAX];
+    cmd_buff_t *commands;               // _commands_inline until it outgrows it
+    pid_t *pids;                        // per stage, set when a pipeline starts
+    int _cap;
+    cmd_buff_t _commands_inline[CMD_MAX];
+    pid_t _pids_inline[CMD_MAX];
+    cmd_arena_t arena;
 }command_list_t;
 
 //Special character #defines
@@ -65,12 +85,17 @@ int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff);
 int close_cmd_buff(cmd_buff_t *cmd_buff);
 int build_cmd_list(char *cmd_line, command_list_t *clist);
 int free_cmd_list(command_list_t *cmd_lst);
+int close_cmd_list(command_list_t *cmd_lst);
+int reserve_cmd_list(command_list_t *clist, int num);
+int reserve_cmd_argv(cmd_buff_t *cmd, int argc);
+void print_dragon();
 
 //built in command stuff
 typedef enum {
     BI_CMD_EXIT,
     BI_CMD_DRAGON,
     BI_CMD_CD,
+    BI_CMD_HASH,
     BI_CMD_STOP_SVR,
     BI_CMD_RC,
     BI_NOT_BI,
@@ -84,6 +109,26 @@ int exec_local_cmd_loop();
 int exec_cmd(cmd_buff_t *cmd);
 int execute_pipeline(command_list_t *clist);
 
+//process launch backends, DSH_SPAWN_ENV=posix_spawn selects spawn at startup
+#define DSH_SPAWN_FORK      0
+#define DSH_SPAWN_POSIX     1
+#define DSH_SPAWN_ENV       "DSH_SPAWN"
+
+void set_spawn_backend(int backend);
+int get_spawn_backend();
+pid_t spawn_cmd(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd);
+
+//PATH lookup cache, see the hash builtin
+#define HASH_BUCKETS        64
+#define HASH_OUT_MAX        4096
+
+int hash_resolve(const char *name, char *path, size_t path_sz);
+void hash_remember(const char *name, const char *path);
+void hash_forget(const char *name);
+void hash_clear();
+int hash_builtin(cmd_buff_t *cmd, char *out, size_t out_sz);
+void exec_resolved(cmd_buff_t *cmd, const char *path);
+
 
 
 
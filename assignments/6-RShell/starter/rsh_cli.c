@@ -6,17 +6,99 @@
 #include <unistd.h>
 #include <sys/un.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 
 #include "dshlib.h"
 #include "rshlib.h"
 
+/*
+ * Reads framed replies for one command until its END frame arrives,
+ * copying DATA payloads to stdout.  The command's exit code is stored in
+ * *cmd_rc.
+ */
+static int recv_framed_reply(int cli_socket, char *rsp_buff, int *cmd_rc) {
+    rdsh_frame_hdr_t hdr;
+    uint32_t remaining;
+    uint32_t chunk;
+
+    while (1) {
+        if (rdsh_recv_frame_hdr(cli_socket, &hdr) != OK) {
+            printf("%s", RCMD_SERVER_EXITED);
+            return ERR_RDSH_COMMUNICATION;
+        }
+
+        if (hdr.type == RDSH_FT_END) {
+            *cmd_rc = hdr.rc;
+            return OK;
+        } else if (hdr.type != RDSH_FT_DATA) {
+            printf("%s", CMD_ERR_RDSH_COMM);
+            return ERR_RDSH_COMMUNICATION;
+        }
+
+        remaining = hdr.len;
+        while (remaining > 0) {
+            chunk = (remaining > RDSH_COMM_BUFF_SZ) ? RDSH_COMM_BUFF_SZ : remaining;
+            if (rdsh_recv_all(cli_socket, rsp_buff, chunk) != OK) {
+                printf("%s", RCMD_SERVER_EXITED);
+                return ERR_RDSH_COMMUNICATION;
+            }
+            fwrite(rsp_buff, 1, chunk, stdout);
+            remaining -= chunk;
+        }
+    }
+}
+
+static int recv_legacy_reply(int cli_socket, char *rsp_buff) {
+    ssize_t io_size;
+    int is_eof;
+
+    while (1) {
+        memset(rsp_buff, 0, RDSH_COMM_BUFF_SZ);
+        io_size = recv(cli_socket, rsp_buff, RDSH_COMM_BUFF_SZ - 1, 0);
+        
+        if (io_size < 0) {
+            perror("recv");
+            return ERR_RDSH_COMMUNICATION;
+        }
+        
+        if (io_size == 0) {
+            printf("%s", RCMD_SERVER_EXITED);
+            return ERR_RDSH_COMMUNICATION;
+        }
+        
+        is_eof = (rsp_buff[io_size - 1] == RDSH_EOF_CHAR);
+        
+        if (is_eof) {
+            printf("%.*s", (int)io_size - 1, rsp_buff);
+        } else {
+            printf("%.*s", (int)io_size, rsp_buff);
+        }
+        
+        if (is_eof) {
+            return OK;
+        }
+    }
+}
+
 int exec_remote_cmd_loop(char *address, int port)
 {
     char *cmd_buff;
     char *rsp_buff;
     int cli_socket = -1;
     ssize_t io_size;
-    int is_eof;
+    uint32_t req_id = 0;
+    int cmd_rc = 0;
+    int proto;
+    int rc;
+
+    // RDSH_BATCH_ENV pipelines stdin instead of prompting, like DSH_SPAWN_ENV
+    // it needs no command line flag
+    if (getenv(RDSH_BATCH_ENV) != NULL) {
+        return exec_remote_batch(address, port, NULL, atoi(getenv(RDSH_BATCH_ENV)));
+    }
     
     cmd_buff = malloc(RDSH_COMM_BUFF_SZ);
     rsp_buff = malloc(RDSH_COMM_BUFF_SZ);
@@ -31,6 +113,11 @@ int exec_remote_cmd_loop(char *address, int port)
         return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_CLIENT);
     }
 
+    proto = rdsh_negotiate(cli_socket);
+    if (proto < 0) {
+        return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
+    }
+
     while (1) {
         printf("%s", SH_PROMPT);
         fflush(stdout);
@@ -46,38 +133,25 @@ int exec_remote_cmd_loop(char *address, int port)
             continue;
         }
         
-        io_size = send(cli_socket, cmd_buff, strlen(cmd_buff) + 1, 0);
-        if (io_size < 0) {
-            perror("send");
-            return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
-        }
-        
-        while (1) {
-            memset(rsp_buff, 0, RDSH_COMM_BUFF_SZ);
-            io_size = recv(cli_socket, rsp_buff, RDSH_COMM_BUFF_SZ - 1, 0);
-            
+        if (proto == RDSH_PROTO_LEGACY) {
+            io_size = send(cli_socket, cmd_buff, strlen(cmd_buff) + 1, MSG_NOSIGNAL);
             if (io_size < 0) {
-                perror("recv");
+                perror("send");
                 return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
             }
-            
-            if (io_size == 0) {
-                printf("%s", RCMD_SERVER_EXITED);
-                return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
-            }
-            
-            is_eof = (rsp_buff[io_size - 1] == RDSH_EOF_CHAR);
-            
-            if (is_eof) {
-                printf("%.*s", (int)io_size - 1, rsp_buff);
-            } else {
-                printf("%.*s", (int)io_size, rsp_buff);
-            }
-            
-            if (is_eof) {
-                break;
+            rc = recv_legacy_reply(cli_socket, rsp_buff);
+        } else {
+            rc = rdsh_send_frame(cli_socket, RDSH_FT_CMD, ++req_id, 0,
+                                 cmd_buff, strlen(cmd_buff));
+            if (rc == OK) {
+                rc = recv_framed_reply(cli_socket, rsp_buff, &cmd_rc);
             }
         }
+        fflush(stdout);
+
+        if (rc != OK) {
+            return client_cleanup(cli_socket, cmd_buff, rsp_buff, ERR_RDSH_COMMUNICATION);
+        }
         
         if (strcmp(cmd_buff, "exit") == 0 || strcmp(cmd_buff, "stop-server") == 0) {
             break;
@@ -87,6 +161,296 @@ int exec_remote_cmd_loop(char *address, int port)
     return client_cleanup(cli_socket, cmd_buff, rsp_buff, OK);
 }
 
+/*
+ * Batch mode
+ *
+ * Commands are read from a file (or stdin) and sent ahead of their replies,
+ * keeping up to window requests in flight.  Replies are matched to the
+ * oldest outstanding request id, which is how the server answers them, so
+ * output is printed in submission order.  Sends are non-blocking so the
+ * client never stops draining replies while the server is busy writing.
+ */
+struct batch_state {
+    FILE *in;
+    int eof;
+    int stopping;
+    char *send_buff;
+    size_t send_len;
+    size_t send_off;
+    uint32_t *ids;
+    int window;
+    int head;
+    int in_flight;
+    uint32_t next_id;
+    int sent;
+    int done;
+    int failed;
+};
+
+/*
+ * Frames the next non-empty command from the input into send_buff.
+ * Returns 1 if a command was queued, 0 at end of input.
+ */
+static int batch_next_cmd(struct batch_state *bs, char *cmd_buff) {
+    rdsh_frame_hdr_t hdr;
+    size_t len;
+
+    while (!bs->eof && !bs->stopping) {
+        if (fgets(cmd_buff, RDSH_FRAME_MAX_PAYLOAD, bs->in) == NULL) {
+            bs->eof = 1;
+            break;
+        }
+
+        cmd_buff[strcspn(cmd_buff, "\n")] = '\0';
+        len = strlen(cmd_buff);
+        if (len == 0) {
+            continue;
+        }
+
+        if (strcmp(cmd_buff, "exit") == 0 || strcmp(cmd_buff, "stop-server") == 0) {
+            bs->stopping = 1;
+        }
+
+        hdr.type = RDSH_FT_CMD;
+        hdr.version = RDSH_PROTO_VERSION;
+        hdr.flags = 0;
+        hdr.req_id = ++bs->next_id;
+        hdr.len = len;
+        hdr.rc = 0;
+        rdsh_encode_hdr(&hdr, (unsigned char *)bs->send_buff);
+        memcpy(bs->send_buff + RDSH_FRAME_HDR_SZ, cmd_buff, len);
+        bs->send_len = RDSH_FRAME_HDR_SZ + len;
+        bs->send_off = 0;
+
+        bs->ids[(bs->head + bs->in_flight) % bs->window] = hdr.req_id;
+        bs->in_flight++;
+        bs->sent++;
+        return 1;
+    }
+
+    return 0;
+}
+
+static int batch_send_some(int cli_socket, struct batch_state *bs) {
+    ssize_t io_size;
+
+    io_size = send(cli_socket, bs->send_buff + bs->send_off,
+                   bs->send_len - bs->send_off, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (io_size < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return OK;
+        }
+        perror("send");
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    bs->send_off += io_size;
+    if (bs->send_off == bs->send_len) {
+        bs->send_len = 0;
+        bs->send_off = 0;
+    }
+    return OK;
+}
+
+/*
+ * Reads one reply frame and routes it to the oldest in-flight request.
+ */
+static int batch_recv_frame(int cli_socket, struct batch_state *bs, char *rsp_buff) {
+    rdsh_frame_hdr_t hdr;
+    uint32_t remaining;
+    uint32_t chunk;
+
+    if (rdsh_recv_frame_hdr(cli_socket, &hdr) != OK) {
+        printf("%s", RCMD_SERVER_EXITED);
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    if (bs->in_flight == 0 || hdr.req_id != bs->ids[bs->head] ||
+        (hdr.type != RDSH_FT_DATA && hdr.type != RDSH_FT_END)) {
+        printf("%s", CMD_ERR_RDSH_COMM);
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    if (hdr.type == RDSH_FT_END) {
+        if (hdr.rc != 0) {
+            bs->failed++;
+        }
+        bs->done++;
+        bs->head = (bs->head + 1) % bs->window;
+        bs->in_flight--;
+        return OK;
+    }
+
+    remaining = hdr.len;
+    while (remaining > 0) {
+        chunk = (remaining > RDSH_COMM_BUFF_SZ) ? RDSH_COMM_BUFF_SZ : remaining;
+        if (rdsh_recv_all(cli_socket, rsp_buff, chunk) != OK) {
+            printf("%s", RCMD_SERVER_EXITED);
+            return ERR_RDSH_COMMUNICATION;
+        }
+        fwrite(rsp_buff, 1, chunk, stdout);
+        remaining -= chunk;
+    }
+
+    return OK;
+}
+
+/*
+ * Runs every command in batch_file ("-" or NULL for stdin) on the server
+ * with up to window commands in flight, then reports throughput on stderr.
+ * Servers that only speak the legacy protocol get one command at a time.
+ */
+int exec_remote_batch(char *address, int port, char *batch_file, int window)
+{
+    struct batch_state bs;
+    struct pollfd pfd;
+    struct timespec start, end;
+    char *cmd_buff = NULL;
+    char *rsp_buff = NULL;
+    int cli_socket = -1;
+    int proto;
+    int rc = OK;
+
+    memset(&bs, 0, sizeof(bs));
+    bs.window = (window > 0) ? window : RDSH_BATCH_DEF_WINDOW;
+    bs.in = stdin;
+    if (batch_file != NULL && strcmp(batch_file, "-") != 0) {
+        bs.in = fopen(batch_file, "r");
+        if (bs.in == NULL) {
+            perror(batch_file);
+            return ERR_RDSH_CLIENT;
+        }
+    }
+
+    cmd_buff = malloc(RDSH_COMM_BUFF_SZ);
+    rsp_buff = malloc(RDSH_COMM_BUFF_SZ);
+    bs.send_buff = malloc(RDSH_COMM_BUFF_SZ);
+    bs.ids = calloc(bs.window, sizeof(uint32_t));
+    if (cmd_buff == NULL || rsp_buff == NULL || bs.send_buff == NULL || bs.ids == NULL) {
+        rc = ERR_MEMORY;
+        goto done;
+    }
+
+    cli_socket = start_client(address, port);
+    if (cli_socket < 0) {
+        perror("start client");
+        rc = ERR_RDSH_CLIENT;
+        goto done;
+    }
+
+    proto = rdsh_negotiate(cli_socket);
+    if (proto < 0) {
+        rc = ERR_RDSH_COMMUNICATION;
+        goto done;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (proto == RDSH_PROTO_LEGACY) {
+        while (fgets(cmd_buff, RDSH_COMM_BUFF_SZ, bs.in) != NULL) {
+            cmd_buff[strcspn(cmd_buff, "\n")] = '\0';
+            if (strlen(cmd_buff) == 0) {
+                continue;
+            }
+            if (rdsh_send_all(cli_socket, cmd_buff, strlen(cmd_buff) + 1) != OK ||
+                recv_legacy_reply(cli_socket, rsp_buff) != OK) {
+                rc = ERR_RDSH_COMMUNICATION;
+                break;
+            }
+            bs.sent++;
+            bs.done++;
+            if (strcmp(cmd_buff, "exit") == 0 || strcmp(cmd_buff, "stop-server") == 0) {
+                break;
+            }
+        }
+    } else {
+        while (1) {
+            if (bs.send_len == 0 && bs.in_flight < bs.window) {
+                batch_next_cmd(&bs, cmd_buff);
+            }
+            if (bs.send_len == 0 && bs.in_flight == 0) {
+                break;
+            }
+
+            pfd.fd = cli_socket;
+            pfd.events = (bs.in_flight > 0) ? POLLIN : 0;
+            if (bs.send_len > 0) {
+                pfd.events |= POLLOUT;
+            }
+            pfd.revents = 0;
+
+            if (poll(&pfd, 1, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("poll");
+                rc = ERR_RDSH_COMMUNICATION;
+                break;
+            }
+
+            if (pfd.revents & POLLOUT) {
+                rc = batch_send_some(cli_socket, &bs);
+                if (rc != OK) {
+                    break;
+                }
+            }
+            if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+                rc = batch_recv_frame(cli_socket, &bs, rsp_buff);
+                if (rc != OK) {
+                    break;
+                }
+            }
+        }
+    }
+
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, RCMD_MSG_BATCH_STATS, bs.done, bs.failed,
+            (secs > 0) ? bs.done / secs : 0.0);
+
+done:
+    if (bs.in != NULL && bs.in != stdin) {
+        fclose(bs.in);
+    }
+    free(bs.send_buff);
+    free(bs.ids);
+    return client_cleanup(cli_socket, cmd_buff, rsp_buff, rc);
+}
+
+/*
+ * Offers the framed protocol to the server.  Returns the protocol version
+ * to use, RDSH_PROTO_LEGACY if the server only speaks NUL/EOF delimited
+ * messages, or ERR_RDSH_COMMUNICATION.
+ */
+int rdsh_negotiate(int cli_socket) {
+    unsigned char wire[RDSH_FRAME_HDR_SZ];
+    rdsh_frame_hdr_t hdr;
+
+    if (rdsh_send_frame(cli_socket, RDSH_FT_HELLO, 0, 0, NULL, 0) != OK) {
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    if (rdsh_recv_all(cli_socket, wire, 1) != OK) {
+        printf("%s", RCMD_SERVER_EXITED);
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    // a legacy server treats the hello as an empty command
+    if (wire[0] == (unsigned char)RDSH_EOF_CHAR) {
+        return RDSH_PROTO_LEGACY;
+    }
+
+    if (wire[0] != RDSH_FT_HELLO ||
+        rdsh_recv_all(cli_socket, wire + 1, RDSH_FRAME_HDR_SZ - 1) != OK) {
+        printf("%s", CMD_ERR_RDSH_COMM);
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    rdsh_decode_hdr(wire, &hdr);
+    return hdr.version;
+}
+
 int start_client(char *server_ip, int port) {
     struct sockaddr_in addr;
     int cli_socket;
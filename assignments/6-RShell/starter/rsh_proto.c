@@ -0,0 +1,160 @@
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * Framed rdsh protocol helpers shared by the client and the server.  Frame
+ * headers travel in network byte order; everything above this file sees
+ * them in host order.
+ */
+
+int rdsh_send_all(int sock, const void *buff, size_t len) {
+    const char *p = buff;
+    ssize_t sent_len;
+
+    while (len > 0) {
+        sent_len = send(sock, p, len, MSG_NOSIGNAL);
+        if (sent_len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("send");
+            return ERR_RDSH_COMMUNICATION;
+        }
+        p += sent_len;
+        len -= sent_len;
+    }
+
+    return OK;
+}
+
+/*
+ * Reads exactly len bytes.  Returns OK, or ERR_RDSH_COMMUNICATION when the
+ * peer closed the connection or the read failed.
+ */
+int rdsh_recv_all(int sock, void *buff, size_t len) {
+    char *p = buff;
+    ssize_t io_size;
+
+    while (len > 0) {
+        io_size = recv(sock, p, len, 0);
+        if (io_size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("recv");
+            return ERR_RDSH_COMMUNICATION;
+        }
+        if (io_size == 0) {
+            return ERR_RDSH_COMMUNICATION;
+        }
+        p += io_size;
+        len -= io_size;
+    }
+
+    return OK;
+}
+
+void rdsh_encode_hdr(const rdsh_frame_hdr_t *hdr, unsigned char *wire) {
+    uint16_t flags = htons(hdr->flags);
+    uint32_t req_id = htonl(hdr->req_id);
+    uint32_t len = htonl(hdr->len);
+    uint32_t rc = htonl((uint32_t)hdr->rc);
+
+    wire[0] = hdr->type;
+    wire[1] = hdr->version;
+    memcpy(wire + 2, &flags, 2);
+    memcpy(wire + 4, &req_id, 4);
+    memcpy(wire + 8, &len, 4);
+    memcpy(wire + 12, &rc, 4);
+}
+
+void rdsh_decode_hdr(const unsigned char *wire, rdsh_frame_hdr_t *hdr) {
+    uint16_t flags;
+    uint32_t req_id;
+    uint32_t len;
+    uint32_t rc;
+
+    memcpy(&flags, wire + 2, 2);
+    memcpy(&req_id, wire + 4, 4);
+    memcpy(&len, wire + 8, 4);
+    memcpy(&rc, wire + 12, 4);
+
+    hdr->type = wire[0];
+    hdr->version = wire[1];
+    hdr->flags = ntohs(flags);
+    hdr->req_id = ntohl(req_id);
+    hdr->len = ntohl(len);
+    hdr->rc = (int32_t)ntohl(rc);
+}
+
+/*
+ * Sends a header and its payload with a single sendmsg() where possible.
+ */
+int rdsh_send_frame(int sock, uint8_t type, uint32_t req_id, int32_t rc,
+                    const void *payload, uint32_t len) {
+    unsigned char wire[RDSH_FRAME_HDR_SZ];
+    rdsh_frame_hdr_t hdr;
+    struct iovec iov[2];
+    struct msghdr msg;
+    size_t total = RDSH_FRAME_HDR_SZ + len;
+    ssize_t sent_len;
+
+    hdr.type = type;
+    hdr.version = RDSH_PROTO_VERSION;
+    hdr.flags = 0;
+    hdr.req_id = req_id;
+    hdr.len = len;
+    hdr.rc = rc;
+    rdsh_encode_hdr(&hdr, wire);
+
+    iov[0].iov_base = wire;
+    iov[0].iov_len = RDSH_FRAME_HDR_SZ;
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (len > 0) ? 2 : 1;
+
+    do {
+        sent_len = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (sent_len < 0 && errno == EINTR);
+
+    if (sent_len < 0) {
+        perror("sendmsg");
+        return ERR_RDSH_COMMUNICATION;
+    }
+    if ((size_t)sent_len == total) {
+        return OK;
+    }
+
+    // short send, finish the remainder byte-wise
+    if ((size_t)sent_len < RDSH_FRAME_HDR_SZ) {
+        if (rdsh_send_all(sock, wire + sent_len, RDSH_FRAME_HDR_SZ - sent_len) != OK) {
+            return ERR_RDSH_COMMUNICATION;
+        }
+        sent_len = RDSH_FRAME_HDR_SZ;
+    }
+    return rdsh_send_all(sock, (const char *)payload + (sent_len - RDSH_FRAME_HDR_SZ),
+                         total - sent_len);
+}
+
+int rdsh_recv_frame_hdr(int sock, rdsh_frame_hdr_t *hdr) {
+    unsigned char wire[RDSH_FRAME_HDR_SZ];
+
+    if (rdsh_recv_all(sock, wire, RDSH_FRAME_HDR_SZ) != OK) {
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    rdsh_decode_hdr(wire, hdr);
+    return OK;
+}
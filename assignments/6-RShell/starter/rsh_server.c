@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <arpa/inet.h>
@@ -11,16 +12,49 @@
 #include <pthread.h>
 #include <signal.h>
 #include <ctype.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <semaphore.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <limits.h>
 
 #include "dshlib.h"
 #include "rshlib.h"
 
 static int g_threaded_server = 0;
+static int g_evented_server = 0;
 static int g_server_running = 1;
 static pthread_mutex_t g_server_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int g_pool_workers = RDSH_POOL_DEF_WORKERS;
+static int g_overflow_policy = RDSH_OVERFLOW_REJECT;
+static int g_exec_backend = RDSH_EXEC_FORK;
 
-struct thread_arg {
-    int client_socket;
+/*
+ * Bounded lock-free MPMC ring of accepted client sockets (Vyukov's
+ * sequence-numbered cells).  The acceptor produces and the pool workers
+ * consume; the two semaphores only park threads while the ring is empty
+ * or full and never guard the ring itself.
+ */
+struct rsh_queue_cell {
+    atomic_size_t seq;
+    int cli_socket;
+};
+
+struct rsh_pool {
+    struct rsh_queue_cell cells[RDSH_POOL_QUEUE_SZ];
+    alignas(64) atomic_size_t head;
+    alignas(64) atomic_size_t tail;
+    sem_t items;
+    sem_t space;
+    int num_workers;
+    atomic_int next_id;
+    pthread_t *workers;
+    atomic_int *active;     // socket each worker is serving, -1 when idle
 };
 
 void handle_signal(int sig) {
@@ -35,6 +69,191 @@ void set_threaded_server(int val) {
     g_threaded_server = val;
 }
 
+void set_worker_pool_size(int workers) {
+    g_pool_workers = (workers < 0) ? RDSH_POOL_DEF_WORKERS : workers;
+}
+
+void set_overflow_policy(int policy) {
+    g_overflow_policy = policy;
+}
+
+void set_exec_backend(int backend) {
+    g_exec_backend = backend;
+}
+
+static int rsh_queue_push(struct rsh_pool *pool, int cli_socket) {
+    struct rsh_queue_cell *cell;
+    size_t pos = atomic_load_explicit(&pool->tail, memory_order_relaxed);
+    intptr_t diff;
+
+    while (1) {
+        cell = &pool->cells[pos & (RDSH_POOL_QUEUE_SZ - 1)];
+        diff = (intptr_t)atomic_load_explicit(&cell->seq, memory_order_acquire) - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&pool->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&pool->tail, memory_order_relaxed);
+        }
+    }
+
+    cell->cli_socket = cli_socket;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+static int rsh_queue_pop(struct rsh_pool *pool, int *cli_socket) {
+    struct rsh_queue_cell *cell;
+    size_t pos = atomic_load_explicit(&pool->head, memory_order_relaxed);
+    intptr_t diff;
+
+    while (1) {
+        cell = &pool->cells[pos & (RDSH_POOL_QUEUE_SZ - 1)];
+        diff = (intptr_t)atomic_load_explicit(&cell->seq, memory_order_acquire) - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&pool->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&pool->head, memory_order_relaxed);
+        }
+    }
+
+    *cli_socket = cell->cli_socket;
+    atomic_store_explicit(&cell->seq, pos + RDSH_POOL_QUEUE_SZ, memory_order_release);
+    return 0;
+}
+
+static int rsh_server_stopping() {
+    int stopping;
+
+    pthread_mutex_lock(&g_server_mutex);
+    stopping = !g_server_running;
+    pthread_mutex_unlock(&g_server_mutex);
+
+    return stopping;
+}
+
+static int rsh_pool_start(struct rsh_pool *pool) {
+    pthread_attr_t attr;
+    long workers = g_pool_workers;
+
+    if (workers == 0) {
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (workers < 1) {
+            workers = 1;
+        }
+    }
+
+    for (size_t i = 0; i < RDSH_POOL_QUEUE_SZ; i++) {
+        atomic_init(&pool->cells[i].seq, i);
+    }
+    atomic_init(&pool->head, 0);
+    atomic_init(&pool->tail, 0);
+    atomic_init(&pool->next_id, 0);
+    sem_init(&pool->items, 0, 0);
+    sem_init(&pool->space, 0, RDSH_POOL_QUEUE_SZ);
+
+    pool->num_workers = 0;
+    pool->workers = calloc(workers, sizeof(pthread_t));
+    pool->active = calloc(workers, sizeof(atomic_int));
+    if (pool->workers == NULL || pool->active == NULL) {
+        free(pool->workers);
+        free(pool->active);
+        return ERR_RDSH_SERVER;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, RDSH_POOL_STACK_SZ);
+
+    for (long i = 0; i < workers; i++) {
+        atomic_init(&pool->active[i], -1);
+        if (pthread_create(&pool->workers[i], &attr, handle_client, pool) != 0) {
+            perror("pthread_create");
+            break;
+        }
+        pool->num_workers++;
+    }
+
+    pthread_attr_destroy(&attr);
+
+    if (pool->num_workers == 0) {
+        free(pool->workers);
+        free(pool->active);
+        return ERR_RDSH_SERVER;
+    }
+
+    printf("Started %d worker threads\n", pool->num_workers);
+    return OK;
+}
+
+/*
+ * Hands an accepted socket to the pool.  When the ring is full the
+ * connection is either turned away with an rdsh-error message or the
+ * acceptor waits for a free slot, leaving later clients in the listen
+ * backlog.
+ */
+static void rsh_pool_submit(struct rsh_pool *pool, int cli_socket) {
+    struct timespec deadline;
+
+    while (sem_trywait(&pool->space) != 0) {
+        if (g_overflow_policy == RDSH_OVERFLOW_REJECT) {
+            printf("Worker pool saturated, rejecting client\n");
+            send_message_string(cli_socket, CMD_ERR_RDSH_BUSY);
+            close(cli_socket);
+            return;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        if (sem_timedwait(&pool->space, &deadline) == 0) {
+            break;
+        }
+        if (rsh_server_stopping()) {
+            close(cli_socket);
+            return;
+        }
+    }
+
+    rsh_queue_push(pool, cli_socket);
+    sem_post(&pool->items);
+}
+
+static void rsh_pool_stop(struct rsh_pool *pool) {
+    int cli_socket;
+
+    // kick workers out of recv() on clients that are still connected
+    for (int i = 0; i < pool->num_workers; i++) {
+        cli_socket = atomic_load(&pool->active[i]);
+        if (cli_socket >= 0) {
+            shutdown(cli_socket, SHUT_RDWR);
+        }
+    }
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        while (sem_wait(&pool->space) != 0) {
+        }
+        rsh_queue_push(pool, -1);
+        sem_post(&pool->items);
+    }
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    sem_destroy(&pool->items);
+    sem_destroy(&pool->space);
+    free(pool->workers);
+    free(pool->active);
+}
+
 void *handle_client(void *arg);
 int exec_client_requests(int cli_socket);
 int send_message_string(int cli_socket, char *buff);
@@ -43,14 +262,57 @@ int rsh_execute_pipeline(int cli_sock, command_list_t *clist);
 Built_In_Cmds rsh_built_in_cmd(cmd_buff_t *cmd);
 Built_In_Cmds rsh_match_command(const char *input);
 
-int start_server(char *ifaces, int port, int is_threaded) {
+/*
+ * RDSH_MODE_ENV overrides the mode start_server() was called with, the way
+ * DSH_SPAWN_ENV picks the spawn backend, so the evented server can be
+ * selected without a command line flag.
+ */
+static int rsh_env_mode(int mode) {
+    char *env = getenv(RDSH_MODE_ENV);
+
+    if (env == NULL) {
+        return mode;
+    } else if (strcmp(env, "single") == 0) {
+        return RDSH_MODE_SINGLE;
+    } else if (strcmp(env, "threaded") == 0) {
+        return RDSH_MODE_THREADED;
+    } else if (strcmp(env, "evented") == 0) {
+        return RDSH_MODE_EVENTED;
+    }
+
+    return mode;
+}
+
+int start_server(char *ifaces, int port, int mode) {
     int svr_socket;
     int rc;
 
+    mode = rsh_env_mode(mode);
+    if (getenv(RDSH_WORKERS_ENV) != NULL) {
+        set_worker_pool_size(atoi(getenv(RDSH_WORKERS_ENV)));
+    }
+    if (getenv(RDSH_EXEC_ENV) != NULL) {
+        set_exec_backend(strcmp(getenv(RDSH_EXEC_ENV), "zygote") == 0 ?
+                         RDSH_EXEC_ZYGOTE : RDSH_EXEC_FORK);
+    }
+
     signal(SIGTERM, handle_signal);
     signal(SIGINT, handle_signal);
+
+    // resolve DSH_SPAWN_ENV before worker threads can race on it
+    get_spawn_backend();
+
+    if (g_exec_backend == RDSH_EXEC_ZYGOTE && rsh_zygote_start() != OK) {
+        fprintf(stderr, "zygote unavailable, forking from the server\n");
+    }
+
+    // a client that disconnects mid reply must only fail that connection's
+    // sends (EPIPE), not kill the server.  Set after the zygote has forked;
+    // stages put SIGPIPE back to its default before they exec.
+    signal(SIGPIPE, SIG_IGN);
     
-    set_threaded_server(is_threaded);
+    set_threaded_server(mode == RDSH_MODE_THREADED);
+    g_evented_server = (mode == RDSH_MODE_EVENTED);
     
     pthread_mutex_lock(&g_server_mutex);
     g_server_running = 1;
@@ -59,12 +321,18 @@ int start_server(char *ifaces, int port, int is_threaded) {
     svr_socket = boot_server(ifaces, port);
     if (svr_socket < 0) {
         int err_code = svr_socket;
+        rsh_zygote_stop();
         return err_code;
     }
 
-    rc = process_cli_requests(svr_socket);
+    if (g_evented_server) {
+        rc = process_cli_requests_evented(svr_socket);
+    } else {
+        rc = process_cli_requests(svr_socket);
+    }
 
     stop_server(svr_socket);
+    rsh_zygote_stop();
 
     return rc;
 }
@@ -124,14 +392,14 @@ int process_cli_requests(int svr_socket) {
     int rc = OK;
     struct sockaddr_in client_addr;
     socklen_t addr_len = sizeof(client_addr);
-    pthread_t tid;
-    struct thread_arg *thread_arg;
-    pthread_attr_t attr;
+    struct rsh_pool pool;
     int server_should_stop = 0;
     
     if (g_threaded_server) {
-        pthread_attr_init(&attr);
-        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        rc = rsh_pool_start(&pool);
+        if (rc != OK) {
+            return rc;
+        }
     }
 
     while (1) {
@@ -159,7 +427,8 @@ int process_cli_requests(int svr_socket) {
                 continue;
             }
             perror("select");
-            return ERR_RDSH_COMMUNICATION;
+            rc = ERR_RDSH_COMMUNICATION;
+            break;
         } else if (select_result == 0) {
             continue;
         }
@@ -170,7 +439,8 @@ int process_cli_requests(int svr_socket) {
                 continue;
             }
             perror("accept");
-            return ERR_RDSH_COMMUNICATION;
+            rc = ERR_RDSH_COMMUNICATION;
+            break;
         }
 
         char client_ip[INET_ADDRSTRLEN];
@@ -178,21 +448,7 @@ int process_cli_requests(int svr_socket) {
         printf("Client connected from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
 
         if (g_threaded_server) {
-            thread_arg = malloc(sizeof(struct thread_arg));
-            if (!thread_arg) {
-                close(cli_socket);
-                perror("malloc");
-                continue;
-            }
-            
-            thread_arg->client_socket = cli_socket;
-            
-            if (pthread_create(&tid, &attr, handle_client, thread_arg) != 0) {
-                perror("pthread_create");
-                free(thread_arg);
-                close(cli_socket);
-                continue;
-            }
+            rsh_pool_submit(&pool, cli_socket);
         } else {
             rc = exec_client_requests(cli_socket);
             close(cli_socket);
@@ -205,251 +461,1539 @@ int process_cli_requests(int svr_socket) {
     }
 
     if (g_threaded_server) {
-        pthread_attr_destroy(&attr);
+        pthread_mutex_lock(&g_server_mutex);
+        g_server_running = 0;
+        pthread_mutex_unlock(&g_server_mutex);
+        rsh_pool_stop(&pool);
     }
 
     return rc;
 }
 
+/*
+ * Pool worker: serves one client connection at a time, pulled off the
+ * accept queue, until it dequeues the -1 shutdown sentinel.
+ */
 void *handle_client(void *arg) {
-    struct thread_arg *thread_arg = (struct thread_arg *)arg;
-    int cli_socket = thread_arg->client_socket;
+    struct rsh_pool *pool = (struct rsh_pool *)arg;
+    int id = atomic_fetch_add(&pool->next_id, 1);
+    int cli_socket;
     int rc;
     
-    free(thread_arg);
-    
     char thread_name[16];
-    snprintf(thread_name, sizeof(thread_name), "client-%d", cli_socket);
+    snprintf(thread_name, sizeof(thread_name), "rsh-worker-%d", id);
     #ifdef _GNU_SOURCE
     pthread_setname_np(pthread_self(), thread_name);
     #endif
     
-    rc = exec_client_requests(cli_socket);
-    close(cli_socket);
-    
-    if (rc == OK_EXIT) {
-        printf("%s", RCMD_MSG_SVR_STOP_REQ);
-        
-        pthread_mutex_lock(&g_server_mutex);
-        g_server_running = 0;
-        pthread_mutex_unlock(&g_server_mutex);
-        
-        kill(getpid(), SIGTERM);
-    }
-    
-    return NULL;
-}
-
-int exec_client_requests(int cli_socket) {
-    int io_size;
-    command_list_t cmd_list;
-    int rc;
-    int cmd_rc;
-    char *io_buff;
-    char temp_buff[RDSH_COMM_BUFF_SZ];
-    int total_recv = 0;
-    int is_complete = 0;
-
-    io_buff = malloc(RDSH_COMM_BUFF_SZ);
-    if (io_buff == NULL) {
-        return ERR_RDSH_SERVER;
-    }
-
     while (1) {
-        memset(io_buff, 0, RDSH_COMM_BUFF_SZ);
-        memset(&cmd_list, 0, sizeof(command_list_t));
-        total_recv = 0;
-        is_complete = 0;
-        
-        while (!is_complete && total_recv < RDSH_COMM_BUFF_SZ - 1) {
-            memset(temp_buff, 0, RDSH_COMM_BUFF_SZ);
-            io_size = recv(cli_socket, temp_buff, RDSH_COMM_BUFF_SZ - 1 - total_recv, 0);
-            
-            if (io_size < 0) {
-                perror("recv");
-                free(io_buff);
-                return ERR_RDSH_COMMUNICATION;
-            }
-            
-            if (io_size == 0) {
-                printf("Client disconnected unexpectedly\n");
-                free(io_buff);
-                return OK;
-            }
-            
-            memcpy(io_buff + total_recv, temp_buff, io_size);
-            total_recv += io_size;
-            
-            for (int i = 0; i < io_size; i++) {
-                if (temp_buff[i] == '\0') {
-                    is_complete = 1;
-                    break;
-                }
-            }
-        }
-        
-        if (!is_complete) {
-            printf("Error: Command too long or missing null terminator\n");
-            send_message_string(cli_socket, "Error: Command too long or missing null terminator\n");
+        if (sem_wait(&pool->items) != 0) {
             continue;
         }
-        
-        printf(RCMD_MSG_SVR_EXEC_REQ, io_buff);
-        
-        int end = total_recv - 1;
-        while (end > 0 && isspace(io_buff[end-1])) {
-            io_buff[--end] = '\0';
-        }
-        
-        if (strlen(io_buff) == 0) {
-            send_message_eof(cli_socket);
+        if (rsh_queue_pop(pool, &cli_socket) != 0) {
             continue;
         }
-        
-        if (strcmp(io_buff, "exit") == 0) {
-            printf("%s", RCMD_MSG_CLIENT_EXITED);
-            send_message_string(cli_socket, "Goodbye!\n");
-            free(io_buff);
-            return OK;
-        } else if (strcmp(io_buff, "stop-server") == 0) {
-            send_message_string(cli_socket, "Stopping server...\n");
-            free(io_buff);
-            return OK_EXIT;
+        sem_post(&pool->space);
+
+        if (cli_socket < 0) {
+            break;
         }
-        
-        cmd_buff_t temp_cmd;
-        if (alloc_cmd_buff(&temp_cmd) != OK) {
-            send_message_string(cli_socket, "Error: Failed to allocate memory for command\n");
-            continue;
+
+        atomic_store(&pool->active[id], cli_socket);
+        if (rsh_server_stopping()) {
+            rc = OK;
+        } else {
+            rc = exec_client_requests(cli_socket);
         }
+        atomic_store(&pool->active[id], -1);
+        close(cli_socket);
         
-        build_cmd_buff(io_buff, &temp_cmd);
-        Built_In_Cmds bi_cmd_type = rsh_built_in_cmd(&temp_cmd);
-        
-        if (bi_cmd_type == BI_CMD_EXIT) {
-            if (strcmp(temp_cmd.argv[0], "stop-server") == 0) {
-                free_cmd_buff(&temp_cmd);
-                send_message_string(cli_socket, "Stopping server...\n");
-                free(io_buff);
-                return OK_EXIT;
-            }
+        if (rc == OK_EXIT) {
+            printf("%s", RCMD_MSG_SVR_STOP_REQ);
             
-            free_cmd_buff(&temp_cmd);
-            printf("%s", RCMD_MSG_CLIENT_EXITED);
-            send_message_string(cli_socket, "Goodbye!\n");
-            free(io_buff);
-            return OK;
-        } else if (bi_cmd_type == BI_EXECUTED) {
-            if (strcmp(temp_cmd.argv[0], "cd") == 0) {
-                if (temp_cmd.argc < 2) {
-                    send_message_string(cli_socket, "cd: missing argument\n");
-                } else if (chdir(temp_cmd.argv[1]) != 0) {
-                    char error_msg[256];
-                    snprintf(error_msg, sizeof(error_msg), "cd: %s: %s\n", 
-                             temp_cmd.argv[1], strerror(errno));
-                    send_message_string(cli_socket, error_msg);
-                } else {
-                    send_message_eof(cli_socket);
-                }
-            } else if (strcmp(temp_cmd.argv[0], "dragon") == 0) {
-                int pipefd[2];
-                if (pipe(pipefd) == -1) {
-                    perror("pipe");
-                    send_message_string(cli_socket, "Error creating pipe for dragon command\n");
-                    free_cmd_buff(&temp_cmd);
-                    continue;
-                }
-                
-                int saved_stdout = dup(STDOUT_FILENO);
-                dup2(pipefd[1], STDOUT_FILENO);
-                
-                print_dragon();
-                fflush(stdout);
-                
-                dup2(saved_stdout, STDOUT_FILENO);
-                close(saved_stdout);
-                close(pipefd[1]);
-                
-                char dragon_output[4096];
-                ssize_t bytes_read = read(pipefd[0], dragon_output, sizeof(dragon_output) - 1);
-                close(pipefd[0]);
-                
-                if (bytes_read > 0) {
-                    dragon_output[bytes_read] = '\0';
-                    send(cli_socket, dragon_output, bytes_read, 0);
-                }
-                
-                send_message_eof(cli_socket);
-            } else {
-                send_message_eof(cli_socket);
-            }
+            pthread_mutex_lock(&g_server_mutex);
+            g_server_running = 0;
+            pthread_mutex_unlock(&g_server_mutex);
             
-            free_cmd_buff(&temp_cmd);
-            continue;
-        }
-        
-        free_cmd_buff(&temp_cmd);
-        
-        rc = build_cmd_list(io_buff, &cmd_list);
-        
-        if (rc == WARN_NO_CMDS) {
-            send_message_string(cli_socket, CMD_WARN_NO_CMD);
-            continue;
-        } else if (rc == ERR_TOO_MANY_COMMANDS) {
-            char error_msg[100];
-            snprintf(error_msg, sizeof(error_msg), CMD_ERR_PIPE_LIMIT, CMD_MAX);
-            send_message_string(cli_socket, error_msg);
-            continue;
-        } else if (rc != OK) {
-            char error_msg[100];
-            snprintf(error_msg, sizeof(error_msg), "Error parsing command: %d\n", rc);
-            send_message_string(cli_socket, error_msg);
-            continue;
+            kill(getpid(), SIGTERM);
         }
-        
-        cmd_rc = rsh_execute_pipeline(cli_socket, &cmd_list);
-        printf(RCMD_MSG_SVR_RC_CMD, cmd_rc);
-        
-        if (cmd_rc == EXIT_SC) {
-            free_cmd_list(&cmd_list);
-            free(io_buff);
-            return OK;
-        } else if (cmd_rc == STOP_SERVER_SC) {
-            free_cmd_list(&cmd_list);
-            free(io_buff);
+    }
+    
+    return NULL;
+}
+
+/*
+ * Request handling shared by every server mode
+ *
+ * rsh_prepare_request() answers everything that does not need a pipeline
+ * (blank lines, exit, stop-server, built-ins and parse errors) and
+ * otherwise leaves a parsed command list for the caller, which either runs
+ * it to completion (rsh_exec_request) or hands it to the reactor.
+ */
+#define RSH_REQ_PIPELINE        1
+
+static int rsh_prepare_request(rdsh_conn_t *conn, char *cmd, command_list_t *clist) {
+    Built_In_Cmds bi_cmd_type;
+    char error_msg[100];
+    int rc;
+
+    printf(RCMD_MSG_SVR_EXEC_REQ, cmd);
+    conn->bytes_out = 0;
+
+    int end = strlen(cmd);
+    while (end > 0 && isspace(cmd[end-1])) {
+        cmd[--end] = '\0';
+    }
+
+    if (strlen(cmd) == 0) {
+        rdsh_reply_end(conn, 0);
+        return OK;
+    }
+
+    if (strcmp(cmd, "exit") == 0) {
+        printf("%s", RCMD_MSG_CLIENT_EXITED);
+        rdsh_reply(conn, "Goodbye!\n", 0);
+        return EXIT_SC;
+    } else if (strcmp(cmd, "stop-server") == 0) {
+        rdsh_reply(conn, "Stopping server...\n", 0);
+        return OK_EXIT;
+    }
+
+    rc = build_cmd_list(cmd, clist);
+
+    if (rc == WARN_NO_CMDS) {
+        rdsh_reply(conn, CMD_WARN_NO_CMD, rc);
+        return OK;
+    } else if (rc != OK) {
+        snprintf(error_msg, sizeof(error_msg), "Error parsing command: %d\n", rc);
+        rdsh_reply(conn, error_msg, rc);
+        return OK;
+    }
+
+    bi_cmd_type = rsh_built_in_cmd(&clist->commands[0]);
+
+    if (bi_cmd_type == BI_CMD_EXIT) {
+        if (strcmp(clist->commands[0].argv[0], "stop-server") == 0) {
+            free_cmd_list(clist);
+            rdsh_reply(conn, "Stopping server...\n", 0);
             return OK_EXIT;
         }
-        
-        send_message_eof(cli_socket);
-        
-        free_cmd_list(&cmd_list);
+
+        free_cmd_list(clist);
+        printf("%s", RCMD_MSG_CLIENT_EXITED);
+        rdsh_reply(conn, "Goodbye!\n", 0);
+        return EXIT_SC;
+    } else if (bi_cmd_type == BI_EXECUTED && clist->num == 1) {
+        rsh_exec_builtin(conn, &clist->commands[0]);
+        free_cmd_list(clist);
+        return OK;
     }
 
-    free(io_buff);
-    return OK;
+    return RSH_REQ_PIPELINE;
 }
 
-int send_message_eof(int cli_socket) {
-    int bytes_sent;
-    
-    bytes_sent = send(cli_socket, &RDSH_EOF_CHAR, 1, 0);
-    
-    if (bytes_sent != 1) {
-        perror("send EOF");
-        return ERR_RDSH_COMMUNICATION;
+/*
+ * Starts clist through the configured exec backend.  With the zygote,
+ * *reply_fd receives the descriptor the exit code arrives on and pids is
+ * left untouched; otherwise *reply_fd is -1 and the stages are our own
+ * children.  Pipelines containing exit or stop-server always run here so
+ * that the server sees those requests.
+ */
+static int rsh_launch_pipeline(int out_fd, command_list_t *clist, pid_t *pids, int *reply_fd) {
+    int use_zygote = (g_exec_backend == RDSH_EXEC_ZYGOTE);
+
+    for (int i = 0; use_zygote && i < clist->num; i++) {
+        if (rsh_built_in_cmd(&clist->commands[i]) == BI_CMD_EXIT) {
+            use_zygote = 0;
+        }
     }
-    
-    return OK;
+
+    *reply_fd = use_zygote ? rsh_zygote_launch(out_fd, clist) : -1;
+    if (*reply_fd >= 0) {
+        return OK;
+    }
+
+    return rsh_start_pipeline(out_fd, clist, pids);
 }
 
-int send_message_string(int cli_socket, char *buff) {
-    int send_len = strlen(buff);
-    int sent_len;
+static int rsh_reap_pipeline(command_list_t *clist, pid_t *pids, int reply_fd) {
+    if (reply_fd >= 0) {
+        return rsh_zygote_collect(reply_fd);
+    }
+    return rsh_wait_pipeline(clist, pids);
+}
+
+/*
+ * Framed connections cannot hand the socket to the children, the output
+ * has to be wrapped in DATA frames.  The last stage (and every stage's
+ * stderr) writes into a pipe that is relayed to the client.
+ */
+static int rsh_execute_pipeline_framed(rdsh_conn_t *conn, command_list_t *clist) {
+    pid_t *pids = clist->pids;
+    int out_pipe[2];
+    int reply_fd;
+    int rc;
+
+    if (pipe2(out_pipe, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return ERR_EXEC_CMD;
+    }
+    fcntl(out_pipe[0], F_SETPIPE_SZ, RDSH_RELAY_PIPE_SZ);
+
+    rc = rsh_launch_pipeline(out_pipe[1], clist, pids, &reply_fd);
+    close(out_pipe[1]);
+
+    if (rc == OK) {
+        // if the client went away the pipe is not drained; closing it before
+        // the reap lets the stages run into EPIPE instead of blocking on it
+        rsh_relay_output(conn, out_pipe[0]);
+        close(out_pipe[0]);
+        return rsh_reap_pipeline(clist, pids, reply_fd);
+    }
+
+    close(out_pipe[0]);
+    return rc;
+}
+
+/*
+ * Runs one command line for conn and sends the complete reply.  Returns OK
+ * to read the next command, EXIT_SC when the client is leaving and OK_EXIT
+ * when the server has been asked to stop.
+ */
+int rsh_exec_request(rdsh_conn_t *conn, char *cmd_line) {
+    command_list_t *cmd_list = &conn->cmd_list;
+    int cmd_rc;
+    int rc;
+
+    rc = rsh_prepare_request(conn, cmd_line, cmd_list);
+    if (rc != RSH_REQ_PIPELINE) {
+        return rc;
+    }
+
+    if (conn->proto == RDSH_PROTO_LEGACY) {
+        cmd_rc = rsh_execute_pipeline(conn->sock, cmd_list);
+    } else {
+        cmd_rc = rsh_execute_pipeline_framed(conn, cmd_list);
+    }
+    printf(RCMD_MSG_SVR_RC_CMD, cmd_rc);
+    if (conn->proto != RDSH_PROTO_LEGACY) {
+        printf(RCMD_MSG_SVR_BYTES_OUT, conn->bytes_out);
+    }
+    free_cmd_list(cmd_list);
+
+    if (cmd_rc == EXIT_SC) {
+        return EXIT_SC;
+    } else if (cmd_rc == STOP_SERVER_SC) {
+        return OK_EXIT;
+    }
+
+    rdsh_reply_end(conn, cmd_rc);
+    return OK;
+}
+
+/*
+ * Moves exactly len bytes that are known to be sitting in out_fd to the
+ * client socket with splice(), so the payload never passes through user
+ * space.  Falls back to read()/send() if the kernel refuses to splice.
+ */
+static int rsh_splice_payload(rdsh_conn_t *conn, int out_fd, size_t len) {
+    char buff[RDSH_RELAY_CHUNK_SZ];
+    ssize_t moved;
+
+    while (len > 0) {
+        moved = splice(out_fd, NULL, conn->sock, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (moved > 0) {
+            len -= moved;
+            conn->bytes_out += moved;
+            continue;
+        }
+        if (moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if (moved < 0 && errno != EINVAL && errno != ENOSYS) {
+            perror("splice");
+            return ERR_RDSH_COMMUNICATION;
+        }
+
+        moved = read(out_fd, buff, (len < sizeof(buff)) ? len : sizeof(buff));
+        if (moved <= 0 || rdsh_send_all(conn->sock, buff, moved) != OK) {
+            return ERR_RDSH_COMMUNICATION;
+        }
+        len -= moved;
+        conn->bytes_out += moved;
+    }
+
+    return OK;
+}
+
+/*
+ * Relays a pipeline's output pipe to the client as DATA frames.  Each
+ * frame covers whatever the pipe currently holds (FIONREAD), so the header
+ * can be written before the payload is spliced straight from the pipe into
+ * the socket.  Blocks until the pipe hits EOF; the evented server relays
+ * with rsh_evt_relay() instead.  Returns 0 at EOF and
+ * ERR_RDSH_COMMUNICATION on failure.
+ */
+int rsh_relay_output(rdsh_conn_t *conn, int out_fd) {
+    unsigned char wire[RDSH_FRAME_HDR_SZ];
+    rdsh_frame_hdr_t hdr;
+    struct pollfd pfd;
+    ssize_t sent;
+    int avail;
+    int rc;
+
+    hdr.type = RDSH_FT_DATA;
+    hdr.version = RDSH_PROTO_VERSION;
+    hdr.flags = 0;
+    hdr.rc = 0;
+
+    while (1) {
+        pfd.fd = out_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        rc = poll(&pfd, 1, -1);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return ERR_RDSH_COMMUNICATION;
+        }
+
+        if (ioctl(out_fd, FIONREAD, &avail) < 0) {
+            perror("ioctl");
+            return ERR_RDSH_COMMUNICATION;
+        }
+
+        if (avail == 0) {
+            if (pfd.revents & (POLLHUP | POLLERR)) {
+                return 0;
+            }
+            continue;
+        }
+
+        hdr.req_id = conn->req_id;
+        hdr.len = avail;
+        rdsh_encode_hdr(&hdr, wire);
+        sent = send(conn->sock, wire, RDSH_FRAME_HDR_SZ, MSG_MORE | MSG_NOSIGNAL);
+        if (sent < 0 && errno != EINTR) {
+            perror("send");
+            return ERR_RDSH_COMMUNICATION;
+        }
+        if (sent < RDSH_FRAME_HDR_SZ) {
+            sent = (sent < 0) ? 0 : sent;
+            if (rdsh_send_all(conn->sock, wire + sent, RDSH_FRAME_HDR_SZ - sent) != OK) {
+                return ERR_RDSH_COMMUNICATION;
+            }
+        }
+
+        if (rsh_splice_payload(conn, out_fd, avail) != OK) {
+            return ERR_RDSH_COMMUNICATION;
+        }
+    }
+}
+
+/*
+ * Makes room for len more bytes at the end of an evented connection's
+ * output queue and returns where they go, or NULL if out of memory.
+ */
+static char *rdsh_conn_reserve(rdsh_conn_t *conn, size_t len) {
+    size_t cap = (conn->out_cap > 0) ? conn->out_cap : RDSH_RELAY_CHUNK_SZ;
+    char *buff;
+
+    while (cap < conn->out_len + len) {
+        cap *= 2;
+    }
+    if (cap != conn->out_cap) {
+        buff = realloc(conn->out_buff, cap);
+        if (buff == NULL) {
+            return NULL;
+        }
+        conn->out_buff = buff;
+        conn->out_cap = cap;
+    }
+
+    return conn->out_buff + conn->out_len;
+}
+
+/*
+ * Every reply leaves through these two.  Blocking connections send right
+ * away; evented ones only append to their output queue, which the reactor
+ * writes out as the socket takes it.
+ */
+static int rdsh_conn_write(rdsh_conn_t *conn, const void *buff, size_t len) {
+    char *dst;
+
+    if (!conn->queued) {
+        return rdsh_send_all(conn->sock, buff, len);
+    }
+
+    dst = rdsh_conn_reserve(conn, len);
+    if (dst == NULL) {
+        return ERR_RDSH_COMMUNICATION;
+    }
+    memcpy(dst, buff, len);
+    conn->out_len += len;
+    return OK;
+}
+
+/*
+ * A NULL payload queues just the header, for a payload that is spliced
+ * after it.
+ */
+static int rdsh_conn_frame(rdsh_conn_t *conn, uint8_t type, uint32_t req_id, int32_t rc,
+                           const void *payload, uint32_t len) {
+    size_t queued_len = RDSH_FRAME_HDR_SZ + ((payload != NULL) ? len : 0);
+    rdsh_frame_hdr_t hdr;
+    char *dst;
+
+    if (!conn->queued) {
+        return rdsh_send_frame(conn->sock, type, req_id, rc, payload, len);
+    }
+
+    dst = rdsh_conn_reserve(conn, queued_len);
+    if (dst == NULL) {
+        return ERR_RDSH_COMMUNICATION;
+    }
+    hdr.type = type;
+    hdr.version = RDSH_PROTO_VERSION;
+    hdr.flags = 0;
+    hdr.req_id = req_id;
+    hdr.len = len;
+    hdr.rc = rc;
+    rdsh_encode_hdr(&hdr, (unsigned char *)dst);
+    if (payload != NULL) {
+        memcpy(dst + RDSH_FRAME_HDR_SZ, payload, len);
+    }
+    conn->out_len += queued_len;
+    return OK;
+}
+
+int rdsh_reply_data(rdsh_conn_t *conn, const char *buff, size_t len) {
+    conn->bytes_out += len;
+    if (conn->proto == RDSH_PROTO_LEGACY) {
+        return rdsh_conn_write(conn, buff, len);
+    }
+
+    while (len > 0) {
+        uint32_t chunk = (len > RDSH_FRAME_MAX_PAYLOAD) ? RDSH_FRAME_MAX_PAYLOAD : len;
+        if (rdsh_conn_frame(conn, RDSH_FT_DATA, conn->req_id, 0, buff, chunk) != OK) {
+            return ERR_RDSH_COMMUNICATION;
+        }
+        buff += chunk;
+        len -= chunk;
+    }
+
+    return OK;
+}
+
+int rdsh_reply_end(rdsh_conn_t *conn, int rc) {
+    if (conn->proto == RDSH_PROTO_LEGACY) {
+        return rdsh_conn_write(conn, &RDSH_EOF_CHAR, 1);
+    }
+
+    return rdsh_conn_frame(conn, RDSH_FT_END, conn->req_id, rc, NULL, 0);
+}
+
+/*
+ * Sends a complete reply made of a single message.
+ */
+int rdsh_reply(rdsh_conn_t *conn, char *buff, int rc) {
+    if (conn->proto == RDSH_PROTO_LEGACY) {
+        if (rdsh_conn_write(conn, buff, strlen(buff)) != OK) {
+            return ERR_RDSH_COMMUNICATION;
+        }
+        return rdsh_reply_end(conn, rc);
+    }
+
+    if (rdsh_reply_data(conn, buff, strlen(buff)) != OK) {
+        return ERR_RDSH_COMMUNICATION;
+    }
+    return rdsh_reply_end(conn, rc);
+}
+
+/*
+ * Answers the client's HELLO frame, whose header has already been read.
+ * The connection runs at the lower of the two protocol versions.
+ */
+static int rsh_accept_hello(rdsh_conn_t *conn, rdsh_frame_hdr_t *hello) {
+    conn->proto = (hello->version < RDSH_PROTO_VERSION) ? hello->version : RDSH_PROTO_VERSION;
+    if (conn->proto == RDSH_PROTO_LEGACY) {
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    return rdsh_conn_frame(conn, RDSH_FT_HELLO, 0, 0, NULL, 0);
+}
+
+/*
+ * Evented server (RDSH_MODE_EVENTED)
+ *
+ * A single edge-triggered epoll reactor owns the listen socket, every client
+ * socket and one pidfd per running pipeline stage.  Commands are read with
+ * MSG_DONTWAIT into a per-connection buffer and dispatched once complete
+ * (NUL terminator for legacy clients, full frame for framed ones).
+ * Pipelines are forked without waiting; the connection is marked busy until
+ * all of its children have been reaped through their pidfds and their
+ * output pipe has drained, at which point the reply is finished and any
+ * commands the client queued up meanwhile are dispatched.
+ *
+ * Client sockets are non-blocking, so a client that stops reading can only
+ * stall itself.  Children never get the socket, not even a legacy client's:
+ * every pipeline writes into a pipe that the reactor relays (raw for legacy
+ * clients, as DATA frames for framed ones).  Replies the handlers send are
+ * queued on the connection (rdsh_conn_t.queued).  When the socket fills up
+ * the queue, and the part of a DATA frame still in the pipe (splice_left),
+ * wait for EPOLLOUT; until then the pipe is not read, which in turn blocks
+ * the children once it is full, and no further commands are dispatched.
+ */
+enum {
+    RSH_EVT_LISTEN,
+    RSH_EVT_CLIENT,
+    RSH_EVT_CHILD,
+    RSH_EVT_OUTPUT,
+};
+
+struct rsh_conn;
+
+struct rsh_evt {
+    int kind;
+    int fd;
+    pid_t pid;
+    int is_last;
+    struct rsh_conn *conn;
+    struct rsh_evt *next;   // children without a pidfd, see g_evt_polled
+};
+
+struct rsh_conn {
+    struct rsh_evt evt;
+    struct rsh_evt out_evt;
+    rdsh_conn_t rconn;
+    int negotiated;
+    char *buff;
+    int len;
+    int busy;
+    int running;
+    int last_rc;
+    int closing;
+    size_t splice_left;     // payload of the current frame still in the pipe
+    int want_out;           // EPOLLOUT armed, the socket is full
+    struct rsh_conn *next;
+};
+
+// Children that could not get a pidfd.  The reactor reaps them with
+// WNOHANG after every pass, and ticks every RDSH_EVT_POLL_MS while any are
+// left, instead of blocking in waitpid().
+static struct rsh_evt *g_evt_polled = NULL;
+
+static int rsh_pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void rsh_evt_close(int epfd, struct rsh_conn *conn) {
+    if (conn->evt.fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn->evt.fd, NULL);
+        close(conn->evt.fd);
+        conn->evt.fd = -1;
+        conn->rconn.sock = -1;
+    }
+    conn->closing = 1;
+}
+
+static void rsh_evt_close_output(int epfd, struct rsh_conn *conn) {
+    if (conn->out_evt.fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn->out_evt.fd, NULL);
+        close(conn->out_evt.fd);
+        conn->out_evt.fd = -1;
+    }
+    conn->splice_left = 0;
+}
+
+static void rsh_evt_want_out(int epfd, struct rsh_conn *conn, int on) {
+    struct epoll_event ev;
+
+    if (conn->want_out == on || conn->evt.fd < 0) {
+        return;
+    }
+
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (on ? EPOLLOUT : 0);
+    ev.data.ptr = &conn->evt;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, conn->evt.fd, &ev) < 0) {
+        perror("epoll_ctl");
+        return;
+    }
+    conn->want_out = on;
+}
+
+/*
+ * Writes as much of the output queue as the socket takes.  Returns OK once
+ * the queue is empty, 1 if the socket is full (EPOLLOUT is armed to carry
+ * on) and ERR_RDSH_COMMUNICATION if the client is gone.
+ */
+static int rsh_evt_flush(int epfd, struct rsh_conn *conn) {
+    rdsh_conn_t *rconn = &conn->rconn;
+    int flags = MSG_NOSIGNAL | (conn->splice_left > 0 ? MSG_MORE : 0);
+    ssize_t sent;
+
+    while (rconn->out_off < rconn->out_len) {
+        sent = send(conn->evt.fd, rconn->out_buff + rconn->out_off,
+                    rconn->out_len - rconn->out_off, flags);
+        if (sent >= 0) {
+            rconn->out_off += sent;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            rsh_evt_want_out(epfd, conn, 1);
+            return 1;
+        }
+        perror("send");
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    rconn->out_len = 0;
+    rconn->out_off = 0;
+    return OK;
+}
+
+static void rsh_evt_finish_cmd(struct rsh_conn *conn) {
+    printf(RCMD_MSG_SVR_RC_CMD, conn->last_rc);
+    if (conn->rconn.proto != RDSH_PROTO_LEGACY) {
+        printf(RCMD_MSG_SVR_BYTES_OUT, conn->rconn.bytes_out);
+    }
+    if (conn->evt.fd >= 0) {
+        rdsh_reply_end(&conn->rconn, conn->last_rc);
+    }
+    free_cmd_list(&conn->rconn.cmd_list);
+    conn->busy = 0;
+}
+
+/*
+ * Reads everything currently available on the socket.  Returns OK when the
+ * socket is drained or the buffer is full, ERR_RDSH_COMMUNICATION when the
+ * client went away.
+ */
+static int rsh_evt_fill(struct rsh_conn *conn) {
+    ssize_t io_size;
+
+    while (conn->len < RDSH_COMM_BUFF_SZ) {
+        io_size = recv(conn->evt.fd, conn->buff + conn->len,
+                       RDSH_COMM_BUFF_SZ - conn->len, MSG_DONTWAIT);
+        if (io_size > 0) {
+            conn->len += io_size;
+            continue;
+        }
+        if (io_size == 0) {
+            return ERR_RDSH_COMMUNICATION;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return OK;
+        }
+        perror("recv");
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    return OK;
+}
+
+static int rsh_evt_watch_child(int epfd, struct rsh_conn *conn, pid_t pid, int is_last) {
+    struct rsh_evt *child;
+    struct epoll_event ev;
+    int status;
+
+    child = malloc(sizeof(struct rsh_evt));
+    if (child == NULL) {
+        // untracked it would never be reaped, and waiting for it here
+        // would stall every other connection
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        if (is_last) {
+            conn->last_rc = ERR_EXEC_CMD;
+        }
+        return OK;
+    }
+
+    child->kind = RSH_EVT_CHILD;
+    child->pid = pid;
+    child->is_last = is_last;
+    child->conn = conn;
+    child->next = NULL;
+    conn->running++;
+
+    child->fd = rsh_pidfd_open(pid);
+    if (child->fd >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = child;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, child->fd, &ev) == 0) {
+            return OK;
+        }
+        perror("epoll_ctl");
+        close(child->fd);
+        child->fd = -1;
+    }
+
+    // no pidfd support, rsh_evt_poll_children() reaps it
+    child->next = g_evt_polled;
+    g_evt_polled = child;
+    return OK;
+}
+
+/*
+ * Zygote launches are tracked by their reply pipe instead of pidfds; the
+ * reply pipe becomes readable once the whole pipeline has exited.
+ */
+static int rsh_evt_watch_reply(int epfd, struct rsh_conn *conn, int reply_fd) {
+    struct rsh_evt *child;
+    struct epoll_event ev;
+
+    child = malloc(sizeof(struct rsh_evt));
+    if (child == NULL) {
+        conn->last_rc = rsh_zygote_collect(reply_fd);
+        return OK;
+    }
+
+    child->kind = RSH_EVT_CHILD;
+    child->fd = reply_fd;
+    child->pid = -1;
+    child->is_last = 1;
+    child->conn = conn;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = child;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, reply_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        free(child);
+        conn->last_rc = rsh_zygote_collect(reply_fd);
+        return OK;
+    }
+
+    conn->running++;
+    return OK;
+}
+
+/*
+ * Creates the pipe a pipeline's output is relayed from and registers its
+ * read end with the reactor.  Returns the write end for the children, or
+ * -1.
+ */
+static int rsh_evt_open_output(int epfd, struct rsh_conn *conn) {
+    struct epoll_event ev;
+    int out_pipe[2];
+
+    if (pipe2(out_pipe, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    fcntl(out_pipe[0], F_SETPIPE_SZ, RDSH_RELAY_PIPE_SZ);
+    fcntl(out_pipe[0], F_SETFL, fcntl(out_pipe[0], F_GETFL) | O_NONBLOCK);
+
+    conn->out_evt.kind = RSH_EVT_OUTPUT;
+    conn->out_evt.fd = out_pipe[0];
+    conn->out_evt.conn = conn;
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &conn->out_evt;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, out_pipe[0], &ev) < 0) {
+        perror("epoll_ctl");
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        conn->out_evt.fd = -1;
+        return -1;
+    }
+
+    return out_pipe[1];
+}
+
+/*
+ * Runs one command for conn.  Returns OK to keep going, EXIT_SC when the
+ * client should be disconnected and OK_EXIT when the server has been asked
+ * to stop.
+ */
+static int rsh_evt_exec_cmd(int epfd, struct rsh_conn *conn, char *cmd) {
+    pid_t *pids;
+    int out_fd;
+    int reply_fd;
+    int rc;
+
+    rc = rsh_prepare_request(&conn->rconn, cmd, &conn->rconn.cmd_list);
+    if (rc != RSH_REQ_PIPELINE) {
+        return rc;
+    }
+
+    out_fd = rsh_evt_open_output(epfd, conn);
+    if (out_fd < 0) {
+        free_cmd_list(&conn->rconn.cmd_list);
+        rdsh_reply(&conn->rconn, CMD_ERR_RDSH_EXEC, ERR_RDSH_CMD_EXEC);
+        return OK;
+    }
+
+    pids = conn->rconn.cmd_list.pids;
+    rc = rsh_launch_pipeline(out_fd, &conn->rconn.cmd_list, pids, &reply_fd);
+    close(out_fd);
+
+    if (rc != OK) {
+        rsh_evt_close_output(epfd, conn);
+        free_cmd_list(&conn->rconn.cmd_list);
+        if (rc == EXIT_SC) {
+            return EXIT_SC;
+        } else if (rc == STOP_SERVER_SC) {
+            return OK_EXIT;
+        }
+        rdsh_reply(&conn->rconn, CMD_ERR_RDSH_EXEC, ERR_RDSH_CMD_EXEC);
+        return OK;
+    }
+
+    conn->busy = 1;
+    conn->running = 0;
+    conn->last_rc = 0;
+    if (reply_fd >= 0) {
+        rsh_evt_watch_reply(epfd, conn, reply_fd);
+    }
+    for (int i = 0; reply_fd < 0 && i < conn->rconn.cmd_list.num; i++) {
+        if (pids[i] > 0) {
+            rsh_evt_watch_child(epfd, conn, pids[i], i == conn->rconn.cmd_list.num - 1);
+        }
+    }
+
+    if (conn->running == 0 && conn->out_evt.fd < 0) {
+        rsh_evt_finish_cmd(conn);
+    }
+
+    return OK;
+}
+
+/*
+ * Pulls the next complete command out of the connection buffer into cmd.
+ * Returns 1 when a command was extracted, 0 when more bytes are needed and
+ * ERR_RDSH_COMMUNICATION on a protocol error.
+ */
+static int rsh_evt_next_cmd(struct rsh_conn *conn, char *cmd) {
+    rdsh_frame_hdr_t hdr;
+    char *nul;
+    int used;
+
+    if (!conn->negotiated) {
+        if (conn->len < 1) {
+            return 0;
+        }
+        if (conn->buff[0] == RDSH_FT_HELLO) {
+            if (conn->len < RDSH_FRAME_HDR_SZ) {
+                return 0;
+            }
+            rdsh_decode_hdr((unsigned char *)conn->buff, &hdr);
+            if (hdr.len != 0 || rsh_accept_hello(&conn->rconn, &hdr) != OK) {
+                return ERR_RDSH_COMMUNICATION;
+            }
+            conn->len -= RDSH_FRAME_HDR_SZ;
+            memmove(conn->buff, conn->buff + RDSH_FRAME_HDR_SZ, conn->len);
+        }
+        conn->negotiated = 1;
+    }
+
+    if (conn->rconn.proto == RDSH_PROTO_LEGACY) {
+        nul = memchr(conn->buff, '\0', conn->len);
+        if (nul == NULL) {
+            if (conn->len == RDSH_COMM_BUFF_SZ) {
+                printf("Error: Command too long or missing null terminator\n");
+                rdsh_reply(&conn->rconn, "Error: Command too long or missing null terminator\n", 0);
+                conn->len = 0;
+            }
+            return 0;
+        }
+        used = nul - conn->buff + 1;
+        memcpy(cmd, conn->buff, used);
+    } else {
+        if (conn->len < RDSH_FRAME_HDR_SZ) {
+            return 0;
+        }
+        rdsh_decode_hdr((unsigned char *)conn->buff, &hdr);
+        if (hdr.type != RDSH_FT_CMD || hdr.len >= RDSH_FRAME_MAX_PAYLOAD) {
+            return ERR_RDSH_COMMUNICATION;
+        }
+        used = RDSH_FRAME_HDR_SZ + hdr.len;
+        if (conn->len < used) {
+            return 0;
+        }
+        memcpy(cmd, conn->buff + RDSH_FRAME_HDR_SZ, hdr.len);
+        cmd[hdr.len] = '\0';
+        conn->rconn.req_id = hdr.req_id;
+    }
+
+    conn->len -= used;
+    memmove(conn->buff, conn->buff + used, conn->len);
+    return 1;
+}
+
+/*
+ * Dispatches buffered commands until the connection becomes busy, the
+ * buffer runs out of complete commands, or the client/server is done.
+ */
+static int rsh_evt_dispatch(int epfd, struct rsh_conn *conn) {
+    char cmd[RDSH_COMM_BUFF_SZ];
+    int rc;
+
+    while (!conn->busy && conn->evt.fd >= 0) {
+        // earlier replies go out first, later commands wait while they can't
+        rc = rsh_evt_flush(epfd, conn);
+        if (rc != OK) {
+            return (rc > 0) ? OK : EXIT_SC;
+        }
+
+        rc = rsh_evt_next_cmd(conn, cmd);
+        if (rc == 0) {
+            // out of commands, send what the last one (or HELLO) left
+            return (rsh_evt_flush(epfd, conn) < 0) ? EXIT_SC : OK;
+        } else if (rc < 0) {
+            return EXIT_SC;
+        }
+
+        rc = rsh_evt_exec_cmd(epfd, conn, cmd);
+        if (rc != OK) {
+            return rc;
+        }
+    }
+
+    return OK;
+}
+
+/*
+ * Alternates reading and dispatching until the socket would block or the
+ * connection is waiting on a pipeline or its own replies with a full
+ * buffer.
+ */
+static int rsh_evt_service(int epfd, struct rsh_conn *conn) {
+    int rc;
+
+    while (conn->evt.fd >= 0) {
+        if (rsh_evt_fill(conn) != OK) {
+            printf("%s", RCMD_MSG_CLIENT_EXITED);
+            rsh_evt_close(epfd, conn);
+            return OK;
+        }
+
+        rc = rsh_evt_dispatch(epfd, conn);
+        if (rc == EXIT_SC || rc == OK_EXIT) {
+            // the goodbye is sent if the socket takes it right away
+            rsh_evt_flush(epfd, conn);
+            rsh_evt_close(epfd, conn);
+            return (rc == OK_EXIT) ? OK_EXIT : OK;
+        }
+
+        if (conn->busy || conn->want_out || conn->len < RDSH_COMM_BUFF_SZ) {
+            break;
+        }
+    }
+
+    return OK;
+}
+
+static int rsh_evt_accept(int epfd, int svr_socket, struct rsh_conn **conns) {
+    struct sockaddr_in client_addr;
+    socklen_t addr_len;
+    struct epoll_event ev;
+    struct rsh_conn *conn;
+    int cli_socket;
+
+    while (1) {
+        addr_len = sizeof(client_addr);
+        cli_socket = accept4(svr_socket, (struct sockaddr *)&client_addr,
+                             &addr_len, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (cli_socket < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return OK;
+            }
+            perror("accept");
+            return OK;
+        }
+
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+        printf("Client connected from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
+
+        conn = calloc(1, sizeof(struct rsh_conn));
+        if (conn != NULL) {
+            conn->buff = malloc(RDSH_COMM_BUFF_SZ);
+        }
+        if (conn == NULL || conn->buff == NULL) {
+            perror("malloc");
+            free(conn);
+            close(cli_socket);
+            continue;
+        }
+
+        conn->evt.kind = RSH_EVT_CLIENT;
+        conn->evt.fd = cli_socket;
+        conn->evt.conn = conn;
+        conn->out_evt.fd = -1;
+        conn->rconn.sock = cli_socket;
+        conn->rconn.proto = RDSH_PROTO_LEGACY;
+        conn->rconn.queued = 1;
+
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = &conn->evt;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, cli_socket, &ev) < 0) {
+            perror("epoll_ctl");
+            close(cli_socket);
+            free(conn->buff);
+            free(conn);
+            continue;
+        }
+
+        conn->next = *conns;
+        *conns = conn;
+    }
+}
+
+/*
+ * Called once a child has been reaped or the output pipe has drained;
+ * completes the reply when both have happened.
+ */
+static int rsh_evt_maybe_finish(int epfd, struct rsh_conn *conn) {
+    if (conn->running > 0 || conn->out_evt.fd >= 0) {
+        return OK;
+    }
+
+    rsh_evt_finish_cmd(conn);
+    if (conn->evt.fd >= 0) {
+        return rsh_evt_service(epfd, conn);
+    }
+    return OK;
+}
+
+static int rsh_evt_reap(int epfd, struct rsh_evt *child) {
+    struct rsh_conn *conn = child->conn;
+    int status;
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, child->fd, NULL);
+
+    if (child->pid < 0) {
+        conn->last_rc = rsh_zygote_collect(child->fd);
+    } else {
+        close(child->fd);
+        if (waitpid(child->pid, &status, 0) == child->pid && child->is_last) {
+            conn->last_rc = WEXITSTATUS(status);
+        }
+    }
+    free(child);
+
+    conn->running--;
+    return rsh_evt_maybe_finish(epfd, conn);
+}
+
+/*
+ * Reaps whichever children on g_evt_polled have exited.  Finishing a
+ * command may start the connection's next one, which can add to the list
+ * while it is walked; new entries go in at the head, ahead of pp.
+ */
+static int rsh_evt_poll_children(int epfd) {
+    struct rsh_evt **pp = &g_evt_polled;
+    struct rsh_evt *child;
+    struct rsh_conn *conn;
+    int status;
+    int rc = OK;
+
+    while (*pp != NULL && rc != OK_EXIT) {
+        child = *pp;
+        status = 0;
+        if (waitpid(child->pid, &status, WNOHANG) == 0) {
+            pp = &child->next;
+            continue;
+        }
+
+        *pp = child->next;
+        conn = child->conn;
+        if (child->is_last) {
+            conn->last_rc = WEXITSTATUS(status);
+        }
+        free(child);
+
+        conn->running--;
+        rc = rsh_evt_maybe_finish(epfd, conn);
+    }
+
+    return rc;
+}
+
+/*
+ * Moves up to splice_left bytes from the output pipe to the socket, like
+ * rsh_splice_payload() but without blocking.  Returns OK when the frame is
+ * done, 1 if the socket is full and ERR_RDSH_COMMUNICATION on failure.  If
+ * the kernel refuses to splice, one chunk is read into the output queue
+ * instead and OK returned, so that the caller flushes it.
+ */
+static int rsh_evt_splice(int epfd, struct rsh_conn *conn) {
+    rdsh_conn_t *rconn = &conn->rconn;
+    size_t chunk;
+    ssize_t moved;
+    char *dst;
+
+    while (conn->splice_left > 0) {
+        moved = splice(conn->out_evt.fd, NULL, conn->evt.fd, NULL, conn->splice_left,
+                       SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+        if (moved > 0) {
+            conn->splice_left -= moved;
+            rconn->bytes_out += moved;
+            continue;
+        }
+        if (moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if (moved < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            rsh_evt_want_out(epfd, conn, 1);
+            return 1;
+        }
+        if (moved < 0 && errno != EINVAL && errno != ENOSYS) {
+            perror("splice");
+            return ERR_RDSH_COMMUNICATION;
+        }
+
+        chunk = (conn->splice_left < RDSH_RELAY_CHUNK_SZ) ? conn->splice_left : RDSH_RELAY_CHUNK_SZ;
+        dst = rdsh_conn_reserve(rconn, chunk);
+        moved = (dst != NULL) ? read(conn->out_evt.fd, dst, chunk) : -1;
+        if (moved <= 0) {
+            return ERR_RDSH_COMMUNICATION;
+        }
+        rconn->out_len += moved;
+        conn->splice_left -= moved;
+        rconn->bytes_out += moved;
+        return OK;
+    }
+
+    return OK;
+}
+
+/*
+ * Relays the output pipe to the client until the pipe is empty or the
+ * socket is full.  Framed clients get one DATA frame per FIONREAD worth of
+ * output, its header queued and the payload spliced after it; legacy
+ * clients get the bytes as they are.  Returns 0 once the pipe is at EOF
+ * and everything has gone out, 1 while more is to come or the socket is
+ * full, and ERR_RDSH_COMMUNICATION if the client is gone.
+ */
+static int rsh_evt_relay(int epfd, struct rsh_conn *conn) {
+    rdsh_conn_t *rconn = &conn->rconn;
+    struct pollfd pfd;
+    int avail;
+    int rc;
+
+    while (1) {
+        rc = rsh_evt_flush(epfd, conn);
+        if (rc == OK) {
+            rc = rsh_evt_splice(epfd, conn);
+        }
+        if (rc != OK) {
+            return rc;
+        }
+        if (conn->splice_left > 0 || rconn->out_len > 0) {
+            continue;
+        }
+
+        pfd.fd = conn->out_evt.fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) < 0 || ioctl(pfd.fd, FIONREAD, &avail) < 0) {
+            perror("relay");
+            return ERR_RDSH_COMMUNICATION;
+        }
+
+        if (avail == 0) {
+            return (pfd.revents & (POLLHUP | POLLERR)) ? 0 : 1;
+        }
+
+        if (rconn->proto != RDSH_PROTO_LEGACY &&
+            rdsh_conn_frame(rconn, RDSH_FT_DATA, rconn->req_id, 0, NULL, avail) != OK) {
+            return ERR_RDSH_COMMUNICATION;
+        }
+        conn->splice_left = avail;
+    }
+}
+
+static int rsh_evt_output(int epfd, struct rsh_conn *conn) {
+    int rc;
+
+    if (conn->evt.fd < 0) {
+        // client is gone, just let the children run into EPIPE
+        rsh_evt_close_output(epfd, conn);
+        return rsh_evt_maybe_finish(epfd, conn);
+    }
+    if (conn->want_out) {
+        // the socket is full, EPOLLOUT resumes the relay
+        return OK;
+    }
+
+    rc = rsh_evt_relay(epfd, conn);
+    if (rc == 1) {
+        return OK;
+    } else if (rc < 0) {
+        // the client is gone (EPIPE/ECONNRESET), drop only this connection
+        printf("%s", RCMD_MSG_CLIENT_EXITED);
+        rsh_evt_close(epfd, conn);
+    }
+
+    rsh_evt_close_output(epfd, conn);
+    return rsh_evt_maybe_finish(epfd, conn);
+}
+
+/*
+ * EPOLLOUT: the socket has room again for whatever was waiting, the relay
+ * or queued replies and the commands held back behind them.
+ */
+static int rsh_evt_writable(int epfd, struct rsh_conn *conn) {
+    if (conn->evt.fd < 0) {
+        return OK;
+    }
+    rsh_evt_want_out(epfd, conn, 0);
+
+    if (conn->out_evt.fd >= 0) {
+        return rsh_evt_output(epfd, conn);
+    }
+    return rsh_evt_service(epfd, conn);
+}
+
+static void rsh_evt_free_closed(struct rsh_conn **conns) {
+    struct rsh_conn **pp = conns;
+    struct rsh_conn *conn;
+
+    while (*pp != NULL) {
+        conn = *pp;
+        if (conn->closing && conn->running == 0 && conn->out_evt.fd < 0) {
+            *pp = conn->next;
+            close_cmd_list(&conn->rconn.cmd_list);
+            free(conn->rconn.out_buff);
+            free(conn->buff);
+            free(conn);
+        } else {
+            pp = &conn->next;
+        }
+    }
+}
+
+int process_cli_requests_evented(int svr_socket) {
+    struct epoll_event events[RDSH_EPOLL_MAX_EVENTS];
+    struct rsh_evt listen_evt;
+    struct epoll_event ev;
+    struct rsh_conn *conns = NULL;
+    struct rsh_conn *conn;
+    struct rsh_evt *evt;
+    int server_should_stop = 0;
+    int epfd;
+    int nfds;
+    int rc = OK;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    fcntl(svr_socket, F_SETFL, fcntl(svr_socket, F_GETFL) | O_NONBLOCK);
+
+    listen_evt.kind = RSH_EVT_LISTEN;
+    listen_evt.fd = svr_socket;
+    listen_evt.conn = NULL;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &listen_evt;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, svr_socket, &ev) < 0) {
+        perror("epoll_ctl");
+        close(epfd);
+        return ERR_RDSH_COMMUNICATION;
+    }
+
+    while (rc != OK_EXIT) {
+        pthread_mutex_lock(&g_server_mutex);
+        server_should_stop = !g_server_running;
+        pthread_mutex_unlock(&g_server_mutex);
+
+        if (server_should_stop) {
+            printf("Server shutdown requested\n");
+            break;
+        }
+
+        nfds = epoll_wait(epfd, events, RDSH_EPOLL_MAX_EVENTS,
+                          (g_evt_polled != NULL) ? RDSH_EVT_POLL_MS : 1000);
+        if (nfds < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            rc = ERR_RDSH_COMMUNICATION;
+            break;
+        }
+
+        for (int i = 0; i < nfds && rc != OK_EXIT; i++) {
+            evt = events[i].data.ptr;
+
+            switch (evt->kind) {
+            case RSH_EVT_LISTEN:
+                rsh_evt_accept(epfd, svr_socket, &conns);
+                break;
+            case RSH_EVT_CLIENT:
+                rc = OK;
+                if (events[i].events & EPOLLOUT) {
+                    rc = rsh_evt_writable(epfd, evt->conn);
+                }
+                if (rc == OK && (events[i].events & ~EPOLLOUT)) {
+                    rc = rsh_evt_service(epfd, evt->conn);
+                }
+                break;
+            case RSH_EVT_CHILD:
+                rc = rsh_evt_reap(epfd, evt);
+                break;
+            case RSH_EVT_OUTPUT:
+                if (evt->fd >= 0) {
+                    rc = rsh_evt_output(epfd, evt->conn);
+                }
+                break;
+            }
+        }
+
+        if (rc != OK_EXIT && g_evt_polled != NULL) {
+            rc = rsh_evt_poll_children(epfd);
+        }
+
+        // connections are freed after the batch so that stale events
+        // later in the same batch never see a dangling pointer
+        rsh_evt_free_closed(&conns);
+    }
+
+    if (rc == OK_EXIT) {
+        printf("%s", RCMD_MSG_SVR_STOP_REQ);
+    }
+
+    while (g_evt_polled != NULL) {
+        struct rsh_evt *child = g_evt_polled;
+
+        g_evt_polled = child->next;
+        free(child);
+    }
+
+    while (conns != NULL) {
+        conn = conns;
+        conns = conn->next;
+        if (conn->evt.fd >= 0) {
+            close(conn->evt.fd);
+        }
+        if (conn->out_evt.fd >= 0) {
+            close(conn->out_evt.fd);
+        }
+        close_cmd_list(&conn->rconn.cmd_list);
+        free(conn->rconn.out_buff);
+        free(conn->buff);
+        free(conn);
+    }
+
+    close(epfd);
+    return rc;
+}
+
+/*
+ * Serves one client until it disconnects.  The first byte decides the
+ * protocol: a HELLO frame switches the connection to framed messages,
+ * anything else is a legacy NUL terminated command.
+ */
+static int rsh_serve_client(rdsh_conn_t *conn) {
+    int cli_socket = conn->sock;
+    rdsh_frame_hdr_t hdr;
+    unsigned char first;
+    int io_size;
+    int rc;
+    char *io_buff;
+    char temp_buff[RDSH_COMM_BUFF_SZ];
+    int total_recv = 0;
+    int is_complete = 0;
+
+    io_size = recv(cli_socket, &first, 1, MSG_PEEK);
+    if (io_size <= 0) {
+        printf("Client disconnected unexpectedly\n");
+        return OK;
+    }
+
+    io_buff = malloc(RDSH_COMM_BUFF_SZ);
+    if (io_buff == NULL) {
+        return ERR_RDSH_SERVER;
+    }
+
+    if (first == RDSH_FT_HELLO) {
+        if (rdsh_recv_frame_hdr(cli_socket, &hdr) != OK || hdr.len != 0 ||
+            rsh_accept_hello(conn, &hdr) != OK) {
+            free(io_buff);
+            return ERR_RDSH_COMMUNICATION;
+        }
+
+        while (1) {
+            if (rdsh_recv_frame_hdr(cli_socket, &hdr) != OK) {
+                printf("%s", RCMD_MSG_CLIENT_EXITED);
+                free(io_buff);
+                return OK;
+            }
+
+            if (hdr.type != RDSH_FT_CMD || hdr.len >= RDSH_FRAME_MAX_PAYLOAD) {
+                printf("Error: unexpected frame type %d, length %u\n", hdr.type, hdr.len);
+                free(io_buff);
+                return ERR_RDSH_COMMUNICATION;
+            }
+
+            if (rdsh_recv_all(cli_socket, io_buff, hdr.len) != OK) {
+                free(io_buff);
+                return ERR_RDSH_COMMUNICATION;
+            }
+            io_buff[hdr.len] = '\0';
+            conn->req_id = hdr.req_id;
+
+            rc = rsh_exec_request(conn, io_buff);
+            if (rc == EXIT_SC) {
+                free(io_buff);
+                return OK;
+            } else if (rc == OK_EXIT) {
+                free(io_buff);
+                return OK_EXIT;
+            }
+        }
+    }
+
+    while (1) {
+        memset(io_buff, 0, RDSH_COMM_BUFF_SZ);
+        total_recv = 0;
+        is_complete = 0;
+
+        while (!is_complete && total_recv < RDSH_COMM_BUFF_SZ - 1) {
+            memset(temp_buff, 0, RDSH_COMM_BUFF_SZ);
+            io_size = recv(cli_socket, temp_buff, RDSH_COMM_BUFF_SZ - 1 - total_recv, 0);
+
+            if (io_size < 0) {
+                perror("recv");
+                free(io_buff);
+                return ERR_RDSH_COMMUNICATION;
+            }
+
+            if (io_size == 0) {
+                printf("Client disconnected unexpectedly\n");
+                free(io_buff);
+                return OK;
+            }
+
+            memcpy(io_buff + total_recv, temp_buff, io_size);
+            total_recv += io_size;
+
+            for (int i = 0; i < io_size; i++) {
+                if (temp_buff[i] == '\0') {
+                    is_complete = 1;
+                    break;
+                }
+            }
+        }
+
+        if (!is_complete) {
+            printf("Error: Command too long or missing null terminator\n");
+            send_message_string(cli_socket, "Error: Command too long or missing null terminator\n");
+            continue;
+        }
+
+        rc = rsh_exec_request(conn, io_buff);
+        if (rc == EXIT_SC) {
+            free(io_buff);
+            return OK;
+        } else if (rc == OK_EXIT) {
+            free(io_buff);
+            return OK_EXIT;
+        }
+    }
+
+    free(io_buff);
+    return OK;
+}
+
+int exec_client_requests(int cli_socket) {
+    rdsh_conn_t conn;
+    int rc;
+
+    memset(&conn, 0, sizeof(conn));
+    conn.sock = cli_socket;
+    conn.proto = RDSH_PROTO_LEGACY;
+
+    rc = rsh_serve_client(&conn);
+
+    close_cmd_list(&conn.cmd_list);
+    return rc;
+}
+
+int rsh_exec_builtin(rdsh_conn_t *conn, cmd_buff_t *cmd) {
+    if (strcmp(cmd->argv[0], "cd") == 0) {
+        if (cmd->argc < 2) {
+            return rdsh_reply(conn, "cd: missing argument\n", 1);
+        } else if (chdir(cmd->argv[1]) != 0) {
+            char error_msg[256];
+            snprintf(error_msg, sizeof(error_msg), "cd: %s: %s\n",
+                     cmd->argv[1], strerror(errno));
+            return rdsh_reply(conn, error_msg, 1);
+        }
+        return rdsh_reply_end(conn, 0);
+    } else if (strcmp(cmd->argv[0], "hash") == 0) {
+        char hash_out[HASH_OUT_MAX];
+        int rc = hash_builtin(cmd, hash_out, sizeof(hash_out));
+        return rdsh_reply(conn, hash_out, rc);
+    } else if (strcmp(cmd->argv[0], "dragon") == 0) {
+        int pipefd[2];
+        if (pipe(pipefd) == -1) {
+            perror("pipe");
+            return rdsh_reply(conn, "Error creating pipe for dragon command\n", ERR_EXEC_CMD);
+        }
+
+        int saved_stdout = dup(STDOUT_FILENO);
+        dup2(pipefd[1], STDOUT_FILENO);
+
+        print_dragon();
+        fflush(stdout);
+
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        close(pipefd[1]);
+
+        char dragon_output[4096];
+        ssize_t bytes_read = read(pipefd[0], dragon_output, sizeof(dragon_output) - 1);
+        close(pipefd[0]);
+
+        if (bytes_read > 0) {
+            rdsh_reply_data(conn, dragon_output, bytes_read);
+        }
+    }
+
+    return rdsh_reply_end(conn, 0);
+}
+
+int send_message_eof(int cli_socket) {
+    int bytes_sent;
+    
+    bytes_sent = send(cli_socket, &RDSH_EOF_CHAR, 1, MSG_NOSIGNAL);
+    
+    if (bytes_sent != 1) {
+        perror("send EOF");
+        return ERR_RDSH_COMMUNICATION;
+    }
+    
+    return OK;
+}
+
+int send_message_string(int cli_socket, char *buff) {
+    int send_len = strlen(buff);
+    int sent_len;
     int remaining = send_len;
     int offset = 0;
     
     while (remaining > 0) {
-        sent_len = send(cli_socket, buff + offset, remaining, 0);
+        sent_len = send(cli_socket, buff + offset, remaining, MSG_NOSIGNAL);
         
         if (sent_len < 0) {
             perror("send");
@@ -470,6 +2014,8 @@ Built_In_Cmds rsh_match_command(const char *input) {
         return BI_CMD_DRAGON;
     if (strcmp(input, "cd") == 0)
         return BI_CMD_CD;
+    if (strcmp(input, "hash") == 0)
+        return BI_CMD_HASH;
     if (strcmp(input, "stop-server") == 0)
         return BI_CMD_EXIT;
     return BI_NOT_BI;
@@ -493,6 +2039,7 @@ Built_In_Cmds rsh_built_in_cmd(cmd_buff_t *cmd) {
         }
         return BI_CMD_EXIT;
     case BI_CMD_CD:
+    case BI_CMD_HASH:
         return BI_EXECUTED;
     default:
         return BI_NOT_BI;
@@ -500,100 +2047,149 @@ Built_In_Cmds rsh_built_in_cmd(cmd_buff_t *cmd) {
 }
 
 int rsh_execute_pipeline(int cli_sock, command_list_t *clist) {
-    int pipes[CMD_MAX - 1][2];
-    pid_t pids[CMD_MAX];
-    int pids_st[CMD_MAX];
-    Built_In_Cmds bi_cmd;
-    int exit_code = 0;
+    pid_t *pids = clist->pids;
+    int reply_fd;
+    int rc;
 
     if (clist->num == 0) {
         return 0;
     }
-    
-    for (int i = 0; i < clist->num - 1; i++) {
-        if (pipe(pipes[i]) == -1) {
-            perror("pipe");
-            return ERR_EXEC_CMD;
-        }
+
+    rc = rsh_launch_pipeline(cli_sock, clist, pids, &reply_fd);
+    if (rc != OK) {
+        return rc;
     }
 
-    for (int i = 0; i < clist->num; i++) {
-        bi_cmd = rsh_built_in_cmd(&clist->commands[i]);
-        
-        if (bi_cmd == BI_CMD_EXIT) {
+    return rsh_reap_pipeline(clist, pids, reply_fd);
+}
+
+/*
+ * Starts every stage of clist (fork() or spawn_cmd(), per the spawn
+ * backend) with the last stdout and every stderr wired to out_fd (the
+ * client socket, or the relay pipe for framed clients) and returns without
+ * waiting, so the evented server can reap the children from its reactor.
+ * pids (normally clist->pids) gets one entry per stage, -1 for built-ins.
+ *
+ * Pipes are created one stage at a time, so a long pipeline never holds
+ * more than two open, and close-on-exec so that pipelines forked
+ * concurrently by other workers never inherit them and hold them open.
+ */
+int rsh_start_pipeline(int out_fd, command_list_t *clist, pid_t *pids) {
+    int pipe_fds[2];
+    int prev_read = -1;
+    int stage_out;
+    char path[PATH_MAX];
+    Built_In_Cmds bi_cmd;
+    int rc = OK;
+    int i;
+
+    // exit and stop-server end the request before any stage is started,
+    // so there is never a running stage to wait for on the way out
+    for (i = 0; i < clist->num; i++) {
+        if (rsh_built_in_cmd(&clist->commands[i]) == BI_CMD_EXIT) {
             if (strcmp(clist->commands[i].argv[0], "stop-server") == 0) {
-                for (int j = 0; j < clist->num - 1; j++) {
-                    close(pipes[j][0]);
-                    close(pipes[j][1]);
-                }
                 return STOP_SERVER_SC;
             }
-            
-            for (int j = 0; j < clist->num - 1; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
-            }
             return EXIT_SC;
-        } else if (bi_cmd == BI_EXECUTED) {
-            pids[i] = -1;
-            pids_st[i] = 0;
-            continue;
         }
+    }
 
-        pids[i] = fork();
-        
-        if (pids[i] < 0) {
-            perror("fork");
-            
-            for (int j = 0; j < clist->num - 1; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
-            }
-            
-            return ERR_EXEC_CMD;
-        } else if (pids[i] == 0) {
-            if (i > 0) {
-                dup2(pipes[i-1][0], STDIN_FILENO);
-            }
-            
-            if (i < clist->num - 1) {
-                dup2(pipes[i][1], STDOUT_FILENO);
-            } else {
-                dup2(cli_sock, STDOUT_FILENO);
+    for (i = 0; i < clist->num; i++) {
+        bi_cmd = rsh_built_in_cmd(&clist->commands[i]);
+
+        pipe_fds[0] = -1;
+        pipe_fds[1] = -1;
+        if (i < clist->num - 1 && pipe2(pipe_fds, O_CLOEXEC) == -1) {
+            perror("pipe");
+            rc = ERR_EXEC_CMD;
+            break;
+        }
+        stage_out = (i < clist->num - 1) ? pipe_fds[1] : out_fd;
+
+        pids[i] = -1;
+        if (bi_cmd != BI_EXECUTED) {
+            // as in execute_pipeline(), commands that fail to spawn fall back
+            // to fork() to report the error from the child
+            if (get_spawn_backend() == DSH_SPAWN_POSIX) {
+                pids[i] = spawn_cmd(&clist->commands[i], prev_read, stage_out, out_fd);
             }
-            
-            dup2(cli_sock, STDERR_FILENO);
-            
-            for (int j = 0; j < clist->num - 1; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
+
+            if (pids[i] < 0) {
+                if (hash_resolve(clist->commands[i].argv[0], path, sizeof(path)) != OK) {
+                    path[0] = '\0';
+                }
+
+                pids[i] = fork();
+                if (pids[i] == 0) {
+                    signal(SIGPIPE, SIG_DFL);
+                    if (prev_read >= 0) {
+                        dup2(prev_read, STDIN_FILENO);
+                    }
+                    dup2(stage_out, STDOUT_FILENO);
+                    dup2(out_fd, STDERR_FILENO);
+
+                    exec_resolved(&clist->commands[i], path);
+
+                    char error_msg[256];
+                    snprintf(error_msg, sizeof(error_msg), "Error: '%s': %s\n", 
+                             clist->commands[i].argv[0], strerror(errno));
+                    write(STDERR_FILENO, error_msg, strlen(error_msg));
+
+                    // _exit: the server's unflushed stdout must not reach
+                    // the client through the copy of it this child holds
+                    _exit(EXIT_FAILURE);
+                } else if (pids[i] < 0) {
+                    perror("fork");
+                    rc = ERR_EXEC_CMD;
+                }
             }
-            
-            execvp(clist->commands[i].argv[0], clist->commands[i].argv);
-            
-            char error_msg[256];
-            snprintf(error_msg, sizeof(error_msg), "Error: '%s': %s\n", 
-                     clist->commands[i].argv[0], strerror(errno));
-            write(STDERR_FILENO, error_msg, strlen(error_msg));
-            
-            exit(EXIT_FAILURE);
         }
+
+        if (prev_read >= 0) {
+            close(prev_read);
+        }
+        if (pipe_fds[1] >= 0) {
+            close(pipe_fds[1]);
+        }
+        prev_read = pipe_fds[0];
+
+        if (rc != OK) {
+            break;
+        }
+    }
+
+    if (prev_read >= 0) {
+        close(prev_read);
     }
 
-    for (int i = 0; i < clist->num - 1; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+    if (rc != OK) {
+        // the caller will not wait for a pipeline that did not start, so
+        // kill and reap the stages that did; killed first so that the
+        // evented server is never held up by a long running stage
+        for (int j = 0; j < i; j++) {
+            if (pids[j] > 0) {
+                kill(pids[j], SIGKILL);
+                waitpid(pids[j], NULL, 0);
+            }
+        }
     }
 
-    for (int i = s0; i < clist->num; i++) {
+    return rc;
+}
+
+int rsh_wait_pipeline(command_list_t *clist, pid_t *pids) {
+    int status;
+    int exit_code = 0;
+
+    for (int i = 0; i < clist->num; i++) {
         if (pids[i] > 0) {
-            waitpid(pids[i], &pids_st[i], 0);
+            waitpid(pids[i], &status, 0);
             
             if (i == clist->num - 1) {
-                exit_code = WEXITSTATUS(pids_st[i]);
+                exit_code = WEXITSTATUS(status);
             }
         }
     }
     
     return exit_code;
-}
\ No newline at end of file
+}
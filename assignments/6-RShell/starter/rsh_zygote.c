@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "dshlib.h"
+#include "rshlib.h"
+
+/*
+ * Zygote exec backend (RDSH_EXEC_ZYGOTE)
+ *
+ * Forking the server for every pipeline stage gets slower as the server
+ * grows threads and resident memory, because fork() has to copy all of its
+ * page tables.  The zygote is forked once by start_server(), before any
+ * worker thread or client socket exists, and stays small.  For each request
+ * the server sends it the argv of every stage over a SOCK_SEQPACKET socket,
+ * together with three descriptors (SCM_RIGHTS):
+ *
+ *      [0] out_fd    stdout of the last stage, stderr of every stage
+ *      [1] reply_fd  write end of a pipe the exit code is reported on
+ *      [2] cwd_fd    the server's working directory (cd is a server builtin)
+ *
+ * The zygote forks a short-lived launcher per request, which runs the
+ * pipeline with rsh_start_pipeline()/rsh_wait_pipeline() and writes the
+ * exit code to reply_fd.  SEQPACKET keeps every request one atomic message,
+ * so worker threads can submit concurrently without a lock.
+ *
+ * A launcher's PATH cache dies with it, so commands are looked up in the
+ * server's cache (where the hash builtin reads it) and the launcher is
+ * handed the result, which it remembers before starting the stages.
+ *
+ * Request layout: uint32 num, uint32 argc[num], then for every stage the
+ * resolved path of argv[0] ("" if none) and its arguments, each as a NUL
+ * terminated string.
+ */
+#define RSH_ZYG_FD_OUT          0
+#define RSH_ZYG_FD_REPLY        1
+#define RSH_ZYG_FD_CWD          2
+#define RSH_ZYG_NFDS            3
+
+static int g_zygote_sock = -1;
+static pid_t g_zygote_pid = -1;
+
+static int rsh_zygote_encode(command_list_t *clist, char *msg, size_t *msg_len) {
+    uint32_t *hdr = (uint32_t *)msg;
+    size_t off = sizeof(uint32_t) * (1 + clist->num);
+    size_t arg_len;
+    char path[PATH_MAX];
+
+    if (off > RDSH_ZYGOTE_MSG_SZ) {
+        return ERR_CMD_OR_ARGS_TOO_BIG;
+    }
+
+    hdr[0] = clist->num;
+    for (int i = 0; i < clist->num; i++) {
+        hdr[1 + i] = clist->commands[i].argc;
+
+        path[0] = '\0';
+        if (rsh_match_command(clist->commands[i].argv[0]) == BI_NOT_BI &&
+            hash_resolve(clist->commands[i].argv[0], path, sizeof(path)) != OK) {
+            path[0] = '\0';
+        }
+        arg_len = strlen(path) + 1;
+        if (off + arg_len > RDSH_ZYGOTE_MSG_SZ) {
+            return ERR_CMD_OR_ARGS_TOO_BIG;
+        }
+        memcpy(msg + off, path, arg_len);
+        off += arg_len;
+
+        for (int j = 0; j < clist->commands[i].argc; j++) {
+            arg_len = strlen(clist->commands[i].argv[j]) + 1;
+            if (off + arg_len > RDSH_ZYGOTE_MSG_SZ) {
+                return ERR_CMD_OR_ARGS_TOO_BIG;
+            }
+            memcpy(msg + off, clist->commands[i].argv[j], arg_len);
+            off += arg_len;
+        }
+    }
+
+    *msg_len = off;
+    return OK;
+}
+
+/*
+ * Rebuilds a command list whose argv point into msg and remembers the
+ * paths the server resolved.  Only used inside the launcher, which exits
+ * right after, so the list is never closed.
+ */
+static int rsh_zygote_decode(char *msg, size_t msg_len, command_list_t *clist) {
+    uint32_t *hdr = (uint32_t *)msg;
+    size_t off;
+    char *arg_end;
+
+    if (msg_len < sizeof(uint32_t) || hdr[0] == 0 ||
+        hdr[0] > msg_len / sizeof(uint32_t) - 1) {
+        return ERR_CMD_ARGS_BAD;
+    }
+
+    memset(clist, 0, sizeof(command_list_t));
+    if (reserve_cmd_list(clist, hdr[0]) != OK) {
+        return ERR_MEMORY;
+    }
+    clist->num = hdr[0];
+    off = sizeof(uint32_t) * (1 + clist->num);
+
+    for (int i = 0; i < clist->num; i++) {
+        cmd_buff_t *cmd = &clist->commands[i];
+        char *path;
+
+        if (hdr[1 + i] == 0 || hdr[1 + i] > msg_len ||
+            reserve_cmd_argv(cmd, hdr[1 + i]) != OK) {
+            return ERR_CMD_ARGS_BAD;
+        }
+        cmd->argc = hdr[1 + i];
+
+        arg_end = memchr(msg + off, '\0', msg_len - off);
+        if (arg_end == NULL) {
+            return ERR_CMD_ARGS_BAD;
+        }
+        path = msg + off;
+        off = (arg_end - msg) + 1;
+
+        for (int j = 0; j < cmd->argc; j++) {
+            arg_end = memchr(msg + off, '\0', msg_len - off);
+            if (arg_end == NULL) {
+                return ERR_CMD_ARGS_BAD;
+            }
+            cmd->argv[j] = msg + off;
+            off = (arg_end - msg) + 1;
+        }
+        cmd->argv[cmd->argc] = NULL;
+
+        if (path[0] != '\0' && strchr(cmd->argv[0], '/') == NULL) {
+            hash_remember(cmd->argv[0], path);
+        }
+    }
+
+    return OK;
+}
+
+static void rsh_zygote_launcher(char *msg, size_t msg_len, int *fds) {
+    command_list_t clist;
+    int rc;
+
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    rc = rsh_zygote_decode(msg, msg_len, &clist);
+    if (rc == OK && fchdir(fds[RSH_ZYG_FD_CWD]) < 0) {
+        rc = ERR_EXEC_CMD;
+    }
+    if (rc == OK) {
+        rc = rsh_start_pipeline(fds[RSH_ZYG_FD_OUT], &clist, clist.pids);
+        close(fds[RSH_ZYG_FD_OUT]);
+        if (rc == OK) {
+            rc = rsh_wait_pipeline(&clist, clist.pids);
+        }
+    }
+
+    write(fds[RSH_ZYG_FD_REPLY], &rc, sizeof(rc));
+    _exit(0);
+}
+
+static void rsh_zygote_main(int sock) {
+    char *msg;
+    char cbuf[CMSG_SPACE(sizeof(int) * RSH_ZYG_NFDS)];
+    struct msghdr mh;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    int fds[RSH_ZYG_NFDS];
+    int nfds;
+    ssize_t msg_len;
+
+    // launchers are never waited for; SIGINT is the server's to handle, the
+    // zygote exits once the server closes its end of the socket
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_DFL);
+
+    msg = malloc(RDSH_ZYGOTE_MSG_SZ);
+    if (msg == NULL) {
+        _exit(1);
+    }
+
+    while (1) {
+        iov.iov_base = msg;
+        iov.iov_len = RDSH_ZYGOTE_MSG_SZ;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = cbuf;
+        mh.msg_controllen = sizeof(cbuf);
+
+        msg_len = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+        if (msg_len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (msg_len <= 0) {
+            break;
+        }
+
+        nfds = 0;
+        cmsg = CMSG_FIRSTHDR(&mh);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nfds);
+        }
+
+        // a malformed request is dropped, closing reply_fd tells the server
+        if (nfds == RSH_ZYG_NFDS && !(mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+            if (fork() == 0) {
+                close(sock);
+                rsh_zygote_launcher(msg, msg_len, fds);
+            }
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+    }
+
+    free(msg);
+    _exit(0);
+}
+
+/*
+ * Forks the zygote.  Must be called before the server creates threads or
+ * sockets so that the zygote inherits as little as possible.
+ */
+int rsh_zygote_start() {
+    int sv[2];
+
+    if (g_zygote_sock >= 0) {
+        return OK;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        perror("socketpair");
+        return ERR_RDSH_SERVER;
+    }
+
+    fflush(stdout);
+    g_zygote_pid = fork();
+    if (g_zygote_pid < 0) {
+        perror("fork");
+        close(sv[0]);
+        close(sv[1]);
+        return ERR_RDSH_SERVER;
+    } else if (g_zygote_pid == 0) {
+        close(sv[0]);
+        rsh_zygote_main(sv[1]);
+    }
+
+    close(sv[1]);
+    g_zygote_sock = sv[0];
+    return OK;
+}
+
+void rsh_zygote_stop() {
+    if (g_zygote_sock < 0) {
+        return;
+    }
+
+    close(g_zygote_sock);
+    g_zygote_sock = -1;
+    waitpid(g_zygote_pid, NULL, 0);
+    g_zygote_pid = -1;
+}
+
+/*
+ * Hands clist to the zygote.  Returns the read end of the reply pipe, to be
+ * passed to rsh_zygote_collect() once the caller is done with out_fd, or
+ * -1 if the zygote is unavailable and the caller should fork itself.
+ */
+int rsh_zygote_launch(int out_fd, command_list_t *clist) {
+    char *msg;
+    char cbuf[CMSG_SPACE(sizeof(int) * RSH_ZYG_NFDS)];
+    struct msghdr mh;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    int fds[RSH_ZYG_NFDS];
+    int reply_pipe[2];
+    size_t msg_len;
+    ssize_t sent_len;
+
+    if (g_zygote_sock < 0) {
+        return -1;
+    }
+
+    msg = malloc(RDSH_ZYGOTE_MSG_SZ);
+    if (msg == NULL) {
+        return -1;
+    }
+    if (rsh_zygote_encode(clist, msg, &msg_len) != OK) {
+        free(msg);
+        return -1;
+    }
+
+    if (pipe2(reply_pipe, O_CLOEXEC) < 0) {
+        perror("pipe");
+        free(msg);
+        return -1;
+    }
+
+    fds[RSH_ZYG_FD_OUT] = out_fd;
+    fds[RSH_ZYG_FD_REPLY] = reply_pipe[1];
+    fds[RSH_ZYG_FD_CWD] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fds[RSH_ZYG_FD_CWD] < 0) {
+        perror("open cwd");
+        close(reply_pipe[0]);
+        close(reply_pipe[1]);
+        free(msg);
+        return -1;
+    }
+
+    iov.iov_base = msg;
+    iov.iov_len = msg_len;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    do {
+        sent_len = sendmsg(g_zygote_sock, &mh, MSG_NOSIGNAL);
+    } while (sent_len < 0 && errno == EINTR);
+
+    close(reply_pipe[1]);
+    close(fds[RSH_ZYG_FD_CWD]);
+    free(msg);
+
+    if (sent_len < 0) {
+        perror("zygote");
+        close(reply_pipe[0]);
+        return -1;
+    }
+
+    return reply_pipe[0];
+}
+
+/*
+ * Waits for the launcher's exit code and closes reply_fd.
+ */
+int rsh_zygote_collect(int reply_fd) {
+    ssize_t io_size;
+    int rc;
+
+    do {
+        io_size = read(reply_fd, &rc, sizeof(rc));
+    } while (io_size < 0 && errno == EINTR);
+
+    close(reply_fd);
+
+    if (io_size != sizeof(rc)) {
+        return ERR_EXEC_CMD;
+    }
+    return rc;
+}
@@ -1,6 +1,9 @@
 #ifndef __RSH_LIB_H__
     #define __RSH_LIB_H__
 
+#include <sys/types.h>
+#include <stdint.h>
+
 #include "dshlib.h"
 
 #define RDSH_DEF_PORT           1234
@@ -10,8 +13,79 @@
 #define RDSH_COMM_BUFF_SZ       (1024*64)
 #define STOP_SERVER_SC          200
 
+// Server modes accepted by start_server().  RDSH_MODE_EVENTED runs a single
+// edge-triggered epoll reactor that multiplexes every client socket.
+#define RDSH_MODE_SINGLE        0
+#define RDSH_MODE_THREADED      1
+#define RDSH_MODE_EVENTED       2
+#define RDSH_MODE_ENV           "RDSH_MODE"     // single, threaded or evented
+#define RDSH_EPOLL_MAX_EVENTS   64
+#define RDSH_EVT_POLL_MS        10      // reap interval for children without a pidfd
+#define RDSH_RELAY_CHUNK_SZ     (1024*16)
+#define RDSH_RELAY_PIPE_SZ      (1024*1024)
+
+// Threaded server worker pool.  0 workers means one per online core; the
+// accept queue size must be a power of two.
+#define RDSH_POOL_DEF_WORKERS   0
+#define RDSH_POOL_QUEUE_SZ      256
+#define RDSH_POOL_STACK_SZ      (512*1024)
+#define RDSH_WORKERS_ENV        "RDSH_WORKERS"  // overrides set_worker_pool_size()
+
+// What the acceptor does when the worker pool's accept queue is full
+#define RDSH_OVERFLOW_REJECT    0
+#define RDSH_OVERFLOW_QUEUE     1
+
+// How the server launches pipelines.  RDSH_EXEC_ZYGOTE forks from a small
+// helper process started with the server instead of from the server itself.
+#define RDSH_EXEC_FORK          0
+#define RDSH_EXEC_ZYGOTE        1
+#define RDSH_EXEC_ENV           "RDSH_EXEC"     // fork or zygote
+#define RDSH_ZYGOTE_MSG_SZ      RDSH_COMM_BUFF_SZ
+
 static const char RDSH_EOF_CHAR = 0x04;
 
+// Framed rdsh protocol.  Every message is a 16 byte header (network byte
+// order) followed by len payload bytes.  The client opens with a HELLO
+// frame; its leading 0x00 type byte looks like an empty command to a legacy
+// server, which answers with a bare RDSH_EOF_CHAR so the client can fall
+// back to NUL/EOF delimited messages.
+#define RDSH_PROTO_LEGACY       0
+#define RDSH_PROTO_VERSION      1
+#define RDSH_FRAME_HDR_SZ       16
+#define RDSH_FRAME_MAX_PAYLOAD  (RDSH_COMM_BUFF_SZ - RDSH_FRAME_HDR_SZ)
+
+#define RDSH_FT_HELLO           0x00    // both ways, version in header
+#define RDSH_FT_CMD             0x01    // client -> server, command line
+#define RDSH_FT_DATA            0x02    // server -> client, command output
+#define RDSH_FT_END             0x03    // server -> client, rc in header
+
+// Requests a batch client keeps in flight before waiting for replies
+#define RDSH_BATCH_DEF_WINDOW   64
+#define RDSH_BATCH_ENV          "RDSH_BATCH"    // window, client runs stdin as a batch
+
+typedef struct rdsh_frame_hdr {
+    uint8_t  type;
+    uint8_t  version;
+    uint16_t flags;
+    uint32_t req_id;
+    uint32_t len;
+    int32_t  rc;
+} rdsh_frame_hdr_t;
+
+// One client connection as seen by the request handlers
+typedef struct rdsh_conn {
+    int      sock;
+    int      proto;         // RDSH_PROTO_LEGACY or the negotiated version
+    uint32_t req_id;        // request being answered (framed only)
+    unsigned long long bytes_out;   // output relayed for the current request
+    command_list_t cmd_list;        // current request, arena reused per request
+    int      queued;        // evented: replies go to out_buff, not the socket
+    char    *out_buff;      // bytes the non-blocking socket has not taken yet
+    size_t   out_len;
+    size_t   out_off;
+    size_t   out_cap;
+} rdsh_conn_t;
+
 #define ERR_RDSH_COMMUNICATION  -50
 #define ERR_RDSH_SERVER         -51
 #define ERR_RDSH_CLIENT         -52
@@ -21,19 +95,32 @@ static const char RDSH_EOF_CHAR = 0x04;
 #define CMD_ERR_RDSH_COMM   "rdsh-error: communications error\n"
 #define CMD_ERR_RDSH_EXEC   "rdsh-error: command execution error\n"
 #define CMD_ERR_RDSH_ITRNL  "rdsh-error: internal server error - %d\n"
+#define CMD_ERR_RDSH_BUSY   "rdsh-error: server busy, try again later\n"
 #define CMD_ERR_RDSH_SEND   "rdsh-error: partial send.  Sent %d, expected to send %d\n"
 #define RCMD_SERVER_EXITED  "server appeared to terminate - exiting\n"
+#define RCMD_MSG_BATCH_STATS    "batch: %d commands, %d failed, %.0f cmds/sec\n"
 
 #define RCMD_MSG_CLIENT_EXITED  "client exited: getting next connection...\n"
 #define RCMD_MSG_SVR_STOP_REQ   "client requested server to stop, stopping...\n"
 #define RCMD_MSG_SVR_EXEC_REQ   "rdsh-exec:  %s\n"
 #define RCMD_MSG_SVR_RC_CMD     "rdsh-exec:  rc = %d\n"
+#define RCMD_MSG_SVR_BYTES_OUT  "rdsh-exec:  relayed %llu bytes\n"
 
 int start_client(char *address, int port);
 int client_cleanup(int cli_socket, char *cmd_buff, char *rsp_buff, int rc);
 int exec_remote_cmd_loop(char *address, int port);
+int exec_remote_batch(char *address, int port, char *batch_file, int window);
+int rdsh_negotiate(int cli_socket);
+
+int rdsh_send_all(int sock, const void *buff, size_t len);
+int rdsh_recv_all(int sock, void *buff, size_t len);
+void rdsh_encode_hdr(const rdsh_frame_hdr_t *hdr, unsigned char *wire);
+void rdsh_decode_hdr(const unsigned char *wire, rdsh_frame_hdr_t *hdr);
+int rdsh_send_frame(int sock, uint8_t type, uint32_t req_id, int32_t rc,
+                    const void *payload, uint32_t len);
+int rdsh_recv_frame_hdr(int sock, rdsh_frame_hdr_t *hdr);
 
-int start_server(char *ifaces, int port, int is_threaded);
+int start_server(char *ifaces, int port, int mode);
 int boot_server(char *ifaces, int port);
 int stop_server(int svr_socket);
 int send_message_eof(int cli_socket);
@@ -41,11 +128,28 @@ int send_message_string(int cli_socket, char *buff);
 int process_cli_requests(int svr_socket);
 int exec_client_requests(int cli_socket);
 int rsh_execute_pipeline(int socket_fd, command_list_t *clist);
+int rsh_start_pipeline(int out_fd, command_list_t *clist, pid_t *pids);
+int rsh_wait_pipeline(command_list_t *clist, pid_t *pids);
+int rsh_exec_builtin(rdsh_conn_t *conn, cmd_buff_t *cmd);
+int rsh_exec_request(rdsh_conn_t *conn, char *cmd_line);
+int rsh_relay_output(rdsh_conn_t *conn, int out_fd);
+int rdsh_reply(rdsh_conn_t *conn, char *buff, int rc);
+int rdsh_reply_data(rdsh_conn_t *conn, const char *buff, size_t len);
+int rdsh_reply_end(rdsh_conn_t *conn, int rc);
+int process_cli_requests_evented(int svr_socket);
 
 Built_In_Cmds rsh_match_command(const char *input);
 Built_In_Cmds rsh_built_in_cmd(cmd_buff_t *cmd);
 
 void set_threaded_server(int val);
+void set_worker_pool_size(int workers);
+void set_overflow_policy(int policy);
+void set_exec_backend(int backend);
+
+int rsh_zygote_start();
+void rsh_zygote_stop();
+int rsh_zygote_launch(int out_fd, command_list_t *clist);
+int rsh_zygote_collect(int reply_fd);
 int exec_client_thread(int main_socket, int cli_socket);
 void *handle_client(void *arg);
 